@@ -7,9 +7,8 @@ using System.Runtime.InteropServices;
 using System.Threading;
 using System.Xml;
 using Microsoft.Win32;
-using System.Diagnostics;
 using System.Security;
-using System.Text.RegularExpressions;
+using System.Text;
 
 namespace WinSCP
 {
@@ -70,6 +69,7 @@ namespace WinSCP
         public int DebugLogLevel { get { CheckNotDisposed(); return Logger.LogLevel; } set { CheckNotDisposed(); Logger.LogLevel = value; } }
         public string SessionLogPath { get { return _sessionLogPath; } set { CheckNotOpened(); _sessionLogPath = value; } }
         public string XmlLogPath { get { return _xmlLogPath; } set { CheckNotOpened(); _xmlLogPath = value; } }
+        public bool XmlLogPreserve { get; set; }
         #if DEBUG
         public bool GuardProcessWithJob { get { return GuardProcessWithJobInternal; } set { GuardProcessWithJobInternal = value; } }
         public bool TestHandlesClosed { get { return TestHandlesClosedInternal; } set { TestHandlesClosedInternal = value; } }
@@ -120,7 +120,6 @@ namespace WinSCP
                 _eventsEvent = new AutoResetEvent(false);
                 _disposed = false;
                 _defaultConfiguration = true;
-                _logUnique = 0;
                 _guardProcessWithJob = true;
                 RawConfiguration = new Dictionary<string, string>();
             }
@@ -206,15 +205,13 @@ namespace WinSCP
                     SessionOptionsToOpenCommand(sessionOptions, out command, out log);
                     WriteCommand(command, log);
 
-                    string logExplanation =
-                        string.Format(CultureInfo.CurrentCulture,
-                            "(response log file {0} was not created). This could indicate lack of write permissions to the log folder or problems starting WinSCP itself.",
-                            XmlLogPath);
+                    const string logExplanation =
+                        "(no response log was received). This could indicate problems starting WinSCP itself.";
 
-                    // Wait until the log file gets created or WinSCP terminates (in case of fatal error)
-                    do
+                    // Wait until WinSCP starts streaming the log or terminates (in case of fatal error)
+                    while (!_process.ActionLog.WaitForData(50))
                     {
-                        if (_process.HasExited && !File.Exists(XmlLogPath))
+                        if (_process.HasExited)
                         {
                             string[] output = new string[Output.Count];
                             Output.CopyTo(output, 0);
@@ -232,16 +229,13 @@ namespace WinSCP
                                     exitCode, string.Join(Environment.NewLine, output), logExplanation));
                         }
 
-                        Thread.Sleep(50);
-
                         CheckForTimeout(
                             string.Format(CultureInfo.CurrentCulture,
                                 "WinSCP has not responded in time {0}",
                                 logExplanation));
+                    }
 
-                    } while (!File.Exists(XmlLogPath));
-
-                    _logReader = new SessionLogReader(this);
+                    _logReader = new SessionLogReader(this, _process.ActionLog);
 
                     _logReader.WaitForNonEmptyElement("session", LogReadFlags.ThrowFailures);
 
@@ -358,103 +352,162 @@ namespace WinSCP
             }
         }
 
-        private IEnumerable<RemoteFileInfo> DoEnumerateRemoteFiles(string path, Regex regex, EnumerationOptions options)
+        public IEnumerable<RemoteFileInfo> EnumerateRemoteFiles(string path, string mask, EnumerationOptions options)
         {
-            bool allDirectories = ((options & EnumerationOptions.AllDirectories) == EnumerationOptions.AllDirectories);
-            bool matchDirectories = ((options & EnumerationOptions.MatchDirectories) == EnumerationOptions.MatchDirectories);
-            bool enumerateDirectories = ((options & EnumerationOptions.EnumerateDirectories) == EnumerationOptions.EnumerateDirectories);
-
-            if (enumerateDirectories && !allDirectories)
+            using (Logger.CreateCallstackAndLock())
             {
-                throw new ArgumentException("Cannot use enumeration option EnumerateDirectories without AllDirectories");
+                CheckOpened();
+
+                bool allDirectories = ((options & EnumerationOptions.AllDirectories) == EnumerationOptions.AllDirectories);
+                bool matchDirectories = ((options & EnumerationOptions.MatchDirectories) == EnumerationOptions.MatchDirectories);
+                bool enumerateDirectories = ((options & EnumerationOptions.EnumerateDirectories) == EnumerationOptions.EnumerateDirectories);
+
+                if (enumerateDirectories && !allDirectories)
+                {
+                    throw new ArgumentException("Cannot use enumeration option EnumerateDirectories without AllDirectories");
+                }
+
+                if (enumerateDirectories && matchDirectories)
+                {
+                    throw new ArgumentException("Cannot combine enumeration option EnumerateDirectories with MatchDirectories");
+                }
+
+                string directories;
+                if (enumerateDirectories)
+                {
+                    directories = "all";
+                }
+                else if (matchDirectories)
+                {
+                    directories = "match";
+                }
+                else
+                {
+                    directories = "none";
+                }
+
+                List<string> switches = new List<string>();
+                if (allDirectories)
+                {
+                    switches.Add(FormatSwitch("recursive"));
+                }
+                if (!string.IsNullOrEmpty(mask))
+                {
+                    switches.Add(FormatSwitch("filemask", WildcardToFileMask(mask)));
+                }
+                switches.Add(FormatSwitch("directories", directories));
+
+                string command =
+                    string.Format(CultureInfo.InvariantCulture, "ls {0} -- \"{1}\"",
+                        string.Join(" ", switches.ToArray()), Tools.ArgumentEscape(IncludeTrailingSlash(path)));
+
+                return DoEnumerateRemoteFiles(command);
             }
+        }
 
-            if (enumerateDirectories && matchDirectories)
+        private IEnumerable<RemoteFileInfo> DoEnumerateRemoteFiles(string command)
+        {
+            // The whole tree is listed by a single command, with the mask matched by WinSCP.
+            // This method exits between the directories, so the Session object is not guarded
+            // during the whole enumeration. Should another command be issued in the meantime,
+            // the rest of the listing is read to memory first (see WriteCommand).
+            RemoteFileListingReader listingReader;
+            using (Logger.CreateCallstackAndLock())
             {
-                throw new ArgumentException("Cannot combine enumeration option EnumerateDirectories with MatchDirectories");
-            }
+                CheckOpened();
 
-            // Need to use guarded method for the listing, see a comment in EnumerateRemoteFiles
-            RemoteDirectoryInfo directoryInfo = ListDirectory(path);
+                WriteCommand(command);
+
+                listingReader = new RemoteFileListingReader(this, _reader.WaitForGroupAndCreateLogReader());
+                _listingReader = listingReader;
+            }
 
-            foreach (RemoteFileInfo fileInfo in directoryInfo.Files)
+            try
             {
-                if (!fileInfo.IsThisDirectory && !fileInfo.IsParentDirectory)
+                IList<RemoteFileInfo> files;
+                while ((files = ReadRemoteFiles(listingReader)) != null)
                 {
-                    bool matches = regex.IsMatch(fileInfo.Name);
-
-                    bool enumerate;
-                    if (!fileInfo.IsDirectory)
-                    {
-                        enumerate = matches;
-                    }
-                    else
-                    {
-                        if (enumerateDirectories)
-                        {
-                            enumerate = true;
-                        }
-                        else if (matchDirectories)
-                        {
-                            enumerate = matches;
-                        }
-                        else
-                        {
-                            enumerate = false;
-                        }
-                    }
-
-                    if (enumerate)
+                    foreach (RemoteFileInfo fileInfo in files)
                     {
                         yield return fileInfo;
                     }
-
-
-                    if (fileInfo.IsDirectory && allDirectories)
+                }
+            }
+            finally
+            {
+                using (Logger.CreateCallstackAndLock())
+                {
+                    if (_listingReader == listingReader)
                     {
-                        foreach (RemoteFileInfo fileInfo2 in DoEnumerateRemoteFiles(CombinePaths(path, fileInfo.Name), regex, options))
-                        {
-                            yield return fileInfo2;
-                        }
+                        _listingReader = null;
                     }
+                    listingReader.Dispose();
                 }
             }
         }
 
-        public IEnumerable<RemoteFileInfo> EnumerateRemoteFiles(string path, string mask, EnumerationOptions options)
+        // The mask of EnumerateRemoteFiles is a simple wildcard, where only * and ? are special.
+        // Escape everything else that has a meaning in WinSCP file mask syntax.
+        private static string WildcardToFileMask(string mask)
         {
-            // Note that this method exits as soon as DoEnumerateRemoteFiles is entered,
-            // so the Session object is not guarded during the whole enumeration.
-            // Though it should not matter as it uses only guarded methods (ListDirectory)
-            // for the actual work on the session
-            using (Logger.CreateCallstackAndLock())
+            // *.* has to match even filename without dot
+            if (mask == "*.*")
             {
-                CheckOpened();
+                return "*";
+            }
 
-                Regex regex = MaskToRegex(mask);
+            StringBuilder result = new StringBuilder();
+            for (int index = 0; index < mask.Length; index++)
+            {
+                char c = mask[index];
+                switch (c)
+                {
+                    case '[':
+                        result.Append("[[]");
+                        break;
+
+                    // mask delimiters and size/time constraints are escaped by doubling
+                    case ';':
+                    case ',':
+                    case '|':
+                    case '<':
+                    case '>':
+                        result.Append(c, 2);
+                        break;
 
-                return DoEnumerateRemoteFiles(path, regex, options);
+                    // Path delimiters cannot be escaped,
+                    // a slash cannot be part of a file name anyway
+                    case '/':
+                    case '\\':
+                        result.Append('?');
+                        break;
+
+                    // masks are trimmed
+                    case ' ':
+                        if ((index == 0) || (index == mask.Length - 1))
+                        {
+                            result.Append("[ ]");
+                        }
+                        else
+                        {
+                            result.Append(c);
+                        }
+                        break;
+
+                    default:
+                        result.Append(c);
+                        break;
+                }
             }
+            return result.ToString();
         }
 
-        private static Regex MaskToRegex(string mask)
+        private IList<RemoteFileInfo> ReadRemoteFiles(RemoteFileListingReader listingReader)
         {
-            if (string.IsNullOrEmpty(mask) ||
-                // *.* has to match even filename without dot
-                (mask == "*.*"))
+            using (Logger.CreateCallstackAndLock())
             {
-                mask = "*";
+                return listingReader.Read();
             }
-
-            return
-                new Regex(
-                    '^' +
-                    mask
-                        .Replace(".", "[.]")
-                        .Replace("*", ".*")
-                        .Replace("?", ".") +
-                    '$',
-                    RegexOptions.IgnoreCase);
         }
 
         public TransferOperationResult PutFiles(string localPath, string remotePath, bool remove = false, TransferOptions options = null)
@@ -645,6 +698,11 @@ namespace WinSCP
                     throw new ArgumentException("Only Time criteria is allowed in synchronization mode Both");
                 }
 
+                if (options.ParallelConnections > 1)
+                {
+                    throw new ArgumentException("Parallel connections are not supported with synchronization");
+                }
+
                 string modeName;
                 switch (mode)
                 {
@@ -852,6 +910,36 @@ namespace WinSCP
             }
         }
 
+        // Metrics of the session as a JSON document, see the "stats" scripting command
+        public string GetSessionMetrics()
+        {
+            using (Logger.CreateCallstackAndLock())
+            {
+                CheckOpened();
+
+                WriteCommand("stats");
+
+                string metrics = null;
+
+                using (ElementLogReader groupReader = _reader.WaitForGroupAndCreateLogReader())
+                using (ElementLogReader statsReader = groupReader.WaitForNonEmptyElementAndCreateLogReader("stats", LogReadFlags.ThrowFailures))
+                {
+                    while (statsReader.Read(0))
+                    {
+                        string value;
+                        if (statsReader.GetEmptyElementValue("metrics", out value))
+                        {
+                            metrics = value;
+                        }
+                    }
+
+                    groupReader.ReadToEnd(LogReadFlags.ThrowFailures);
+                }
+
+                return metrics;
+            }
+        }
+
         public void CreateDirectory(string path)
         {
             using (Logger.CreateCallstackAndLock())
@@ -1066,7 +1154,7 @@ namespace WinSCP
             }
         }
 
-        private static string IncludeTrailingSlash(string path)
+        internal static string IncludeTrailingSlash(string path)
         {
             if (!string.IsNullOrEmpty(path) && !path.EndsWith("/", StringComparison.Ordinal))
             {
@@ -1116,7 +1204,7 @@ namespace WinSCP
                 }
 
                 // Cleanup log file
-                if ((XmlLogPath != null) && File.Exists(XmlLogPath))
+                if (!XmlLogPreserve && (XmlLogPath != null) && File.Exists(XmlLogPath))
                 {
                     Logger.WriteLine("Deleting XML log file [{0}]", XmlLogPath);
                     try
@@ -1135,8 +1223,6 @@ namespace WinSCP
                     {
                         Logger.WriteLine("XML log cleanup UnauthorizedAccessException: {0}", e);
                     }
-
-                    _xmlLogPath = null;
                 }
             }
         }
@@ -1148,6 +1234,13 @@ namespace WinSCP
 
         private void WriteCommand(string command, string log)
         {
+            if (_listingReader != null)
+            {
+                RemoteFileListingReader listingReader = _listingReader;
+                _listingReader = null;
+                listingReader.Drain();
+            }
+
             Logger.WriteLine("Command: [{0}]", log);
             _process.ExecuteCommand(command);
             GotOutput();
@@ -1562,14 +1655,7 @@ namespace WinSCP
             DateTime start = DateTime.Now;
             while (_eventsEvent.WaitOne(interval, false))
             {
-                lock (_events)
-                {
-                    foreach (Action action in _events)
-                    {
-                        action();
-                    }
-                    _events.Clear();
-                }
+                DispatchPendingEvents();
 
                 interval -= (int) (DateTime.Now - start).TotalMilliseconds;
                 if (interval < 0)
@@ -1580,6 +1666,46 @@ namespace WinSCP
             }
         }
 
+        // Like DispatchEvents, but returns as soon as the dataEvent gets signaled
+        internal bool WaitForDataAndDispatchEvents(WaitHandle dataEvent, int interval)
+        {
+            WaitHandle[] handles = new WaitHandle[] { dataEvent, _eventsEvent };
+            DateTime start = DateTime.Now;
+            bool result = false;
+            while (!result && (interval >= 0))
+            {
+                int index = WaitHandle.WaitAny(handles, interval, false);
+                if (index == WaitHandle.WaitTimeout)
+                {
+                    break;
+                }
+                else if (index == 0)
+                {
+                    result = true;
+                }
+                else
+                {
+                    DispatchPendingEvents();
+
+                    interval -= (int) (DateTime.Now - start).TotalMilliseconds;
+                    start = DateTime.Now;
+                }
+            }
+            return result;
+        }
+
+        private void DispatchPendingEvents()
+        {
+            lock (_events)
+            {
+                foreach (Action action in _events)
+                {
+                    action();
+                }
+                _events.Clear();
+            }
+        }
+
         private IDisposable RegisterOperationResult(OperationResultBase operationResult)
         {
             _operationResults.Add(operationResult);
@@ -1641,6 +1767,8 @@ namespace WinSCP
         {
             using (Logger.CreateCallstack())
             {
+                // The log is streamed over the console connection,
+                // the file is created only when explicitly configured
                 if (!string.IsNullOrEmpty(_xmlLogPath))
                 {
                     bool exists = File.Exists(_xmlLogPath);
@@ -1650,26 +1778,6 @@ namespace WinSCP
                         throw new SessionLocalException(this, string.Format(CultureInfo.CurrentCulture, "Configured temporary file {0} already exists", _xmlLogPath));
                     }
                 }
-                else
-                {
-                    string path = Path.GetTempPath();
-                    Logger.WriteLine("Temporary folder: {0}", path);
-                    string process = Process.GetCurrentProcess().Id.ToString("X4", CultureInfo.InvariantCulture);
-                    string instance = GetHashCode().ToString("X8", CultureInfo.InvariantCulture);
-                    string filename;
-                    bool exists;
-                    do
-                    {
-                        string uniqueStr = (_logUnique > 0 ? "." + _logUnique.ToString(CultureInfo.InvariantCulture) : string.Empty);
-                        ++_logUnique;
-                        filename = Path.Combine(path, "wscp" + process + "." + instance + uniqueStr + ".tmp");
-                        exists = File.Exists(filename);
-                        Logger.WriteLine("Temporary file [{0}] - Exists [{1}]", filename, exists);
-                    }
-                    while (exists);
-
-                    _xmlLogPath = filename;
-                }
             }
         }
 
@@ -1942,6 +2050,7 @@ namespace WinSCP
         private DateTime _lastOutput;
         private ElementLogReader _reader;
         private SessionLogReader _logReader;
+        private RemoteFileListingReader _listingReader;
         private readonly IList<OperationResultBase> _operationResults;
         private delegate void Action();
         private readonly IList<Action> _events;
@@ -1955,7 +2064,6 @@ namespace WinSCP
         private TimeSpan _reconnectTime;
         private string _sessionLogPath;
         private bool _aborted;
-        private int _logUnique;
         private string _xmlLogPath;
         private FileTransferProgressEventHandler _fileTransferProgress;
         private int _progressHandling;
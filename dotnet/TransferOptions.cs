@@ -35,6 +35,7 @@ namespace WinSCP
         public TransferResumeSupport ResumeSupport { get; private set; }
         public int SpeedLimit { get; set; }
         public OverwriteMode OverwriteMode { get; set; }
+        public int ParallelConnections { get; set; }
 
         public TransferOptions()
         {
@@ -91,6 +92,11 @@ namespace WinSCP
                 switches.Add(Session.FormatSwitch("speed", SpeedLimit.ToString(CultureInfo.InvariantCulture)));
             }
 
+            if (ParallelConnections > 1)
+            {
+                switches.Add(Session.FormatSwitch("parallel", ParallelConnections.ToString(CultureInfo.InvariantCulture)));
+            }
+
             switch (OverwriteMode)
             {
                 case OverwriteMode.Overwrite:
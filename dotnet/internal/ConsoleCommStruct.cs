@@ -4,14 +4,17 @@ using Microsoft.Win32.SafeHandles;
 
 namespace WinSCP
 {
-    public enum ConsoleEvent { None, Print, Input, Choice, Title, Init, Progress }
+    public enum ConsoleEvent { None, Print, Input, Choice, Title, Init, Progress, ActionLog }
 
     [StructLayout(LayoutKind.Sequential)]
     internal class ConsoleInitEventStruct
     {
         public uint InputType;
         public uint OutputType;
-        public bool WantsProgress;
+        [MarshalAs(UnmanagedType.I1)]
+        public bool WantsProgress; // since version 6
+        [MarshalAs(UnmanagedType.I1)]
+        public bool WantsActionLog; // since version 7
     }
 
     [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Unicode)]
@@ -77,6 +80,14 @@ namespace WinSCP
         public uint CPS;
     }
 
+    // Since version 7
+    [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Unicode)]
+    internal class ConsoleActionLogEventStruct
+    {
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 10240)]
+        public string Data;
+    }
+
     [StructLayout(LayoutKind.Sequential)]
     internal class ConsoleCommHeader
     {
@@ -89,7 +100,7 @@ namespace WinSCP
 
     internal class ConsoleCommStruct : IDisposable
     {
-        public const int CurrentVersion = 0x0006;
+        public const int CurrentVersion = 0x0007;
 
         public ConsoleCommStruct(Session session, SafeFileHandle fileMapping)
         {
@@ -118,7 +129,7 @@ namespace WinSCP
 
                 if (_payload != null)
                 {
-                    if ((Event != ConsoleEvent.Print) && (Event != ConsoleEvent.Title))
+                    if ((Event != ConsoleEvent.Print) && (Event != ConsoleEvent.Title) && (Event != ConsoleEvent.ActionLog))
                     {
                         Marshal.StructureToPtr(_payload, _payloadPtr, false);
                     }
@@ -156,6 +167,8 @@ namespace WinSCP
 
         public ConsoleProgressEventStruct ProgressEvent { get { return UnmarshalPayload<ConsoleProgressEventStruct>(ConsoleEvent.Progress); } }
 
+        public ConsoleActionLogEventStruct ActionLogEvent { get { return UnmarshalPayload<ConsoleActionLogEventStruct>(ConsoleEvent.ActionLog); } }
+
         private T UnmarshalPayload<T>(ConsoleEvent e)
         {
             CheckNotDisposed();
@@ -188,7 +201,8 @@ namespace WinSCP
                 Type[] types =
                     new[] {
                         typeof(ConsolePrintEventStruct), typeof(ConsoleInitEventStruct), typeof(ConsoleInputEventStruct),
-                        typeof(ConsoleChoiceEventStruct), typeof(ConsoleTitleEventStruct), typeof(ConsoleProgressEventStruct) };
+                        typeof(ConsoleChoiceEventStruct), typeof(ConsoleTitleEventStruct), typeof(ConsoleProgressEventStruct),
+                        typeof(ConsoleActionLogEventStruct) };
 
                 int maxSize = 0;
                 foreach (Type type in types)
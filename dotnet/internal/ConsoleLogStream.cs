@@ -0,0 +1,142 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Text;
+using System.Threading;
+
+namespace WinSCP
+{
+    // XML log as streamed by WinSCP over the console connection.
+    // Written to by the console event thread, read from by the XmlReader of the session.
+    internal class ConsoleLogStream : Stream
+    {
+        public ConsoleLogStream(Session session)
+        {
+            _session = session;
+            _chunks = new Queue<byte[]>();
+            _dataEvent = new ManualResetEvent(false);
+        }
+
+        public void Append(string data)
+        {
+            byte[] bytes = Encoding.UTF8.GetBytes(data);
+            lock (_lock)
+            {
+                _chunks.Enqueue(bytes);
+                _dataEvent.Set();
+            }
+        }
+
+        // No more data will come, as WinSCP has exited
+        public void Complete()
+        {
+            lock (_lock)
+            {
+                _completed = true;
+                _dataEvent.Set();
+            }
+        }
+
+        public bool WaitForData(int timeout)
+        {
+            _dataEvent.WaitOne(timeout, false);
+            lock (_lock)
+            {
+                return (_chunks.Count > 0);
+            }
+        }
+
+        public override int Read(byte[] buffer, int offset, int count)
+        {
+            int result = 0;
+            bool completed = false;
+
+            // We always want to return something, unless WinSCP is gone.
+            while ((result == 0) && !completed)
+            {
+                lock (_lock)
+                {
+                    while ((result < count) && (_chunks.Count > 0))
+                    {
+                        byte[] chunk = _chunks.Peek();
+                        int len = Math.Min(count - result, chunk.Length - _chunkOffset);
+                        Array.Copy(chunk, _chunkOffset, buffer, offset + result, len);
+                        result += len;
+                        _chunkOffset += len;
+                        if (_chunkOffset == chunk.Length)
+                        {
+                            _chunks.Dequeue();
+                            _chunkOffset = 0;
+                        }
+                    }
+
+                    completed = _completed;
+                    if ((_chunks.Count == 0) && !completed)
+                    {
+                        _dataEvent.Reset();
+                    }
+                }
+
+                if ((result == 0) && !completed)
+                {
+                    _session.Logger.WriteLineLevel(1, "Waiting for log data and dispatching events");
+                    _session.WaitForDataAndDispatchEvents(_dataEvent, WaitInterval);
+                    _session.CheckForTimeout();
+                }
+            }
+
+            return result;
+        }
+
+        protected override void Dispose(bool disposing)
+        {
+            if (disposing && (_dataEvent != null))
+            {
+                _dataEvent.Close();
+                _dataEvent = null;
+            }
+            base.Dispose(disposing);
+        }
+
+        public override bool CanRead { get { return true; } }
+        public override bool CanSeek { get { return false; } }
+        public override bool CanWrite { get { return false; } }
+
+        public override long Length { get { throw new NotSupportedException(); } }
+
+        public override long Position
+        {
+            get { throw new NotSupportedException(); }
+            set { throw new NotSupportedException(); }
+        }
+
+        public override void Flush()
+        {
+        }
+
+        public override long Seek(long offset, SeekOrigin origin)
+        {
+            throw new NotSupportedException();
+        }
+
+        public override void SetLength(long value)
+        {
+            throw new NotSupportedException();
+        }
+
+        public override void Write(byte[] buffer, int offset, int count)
+        {
+            throw new NotSupportedException();
+        }
+
+        // Only a safety net against missed wake-ups, the data event wakes us up immediately
+        private const int WaitInterval = 500;
+
+        private readonly Session _session;
+        private readonly object _lock = new object();
+        private readonly Queue<byte[]> _chunks;
+        private int _chunkOffset;
+        private bool _completed;
+        private ManualResetEvent _dataEvent;
+    }
+}
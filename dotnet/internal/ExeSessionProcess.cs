@@ -19,12 +19,14 @@ namespace WinSCP
 
         public bool HasExited { get { return _process.HasExited; } }
         public int ExitCode { get { return _process.ExitCode; } }
+        public ConsoleLogStream ActionLog { get { return _actionLog; } }
 
         public ExeSessionProcess(Session session)
         {
             _session = session;
             _logger = session.Logger;
             _incompleteLine = string.Empty;
+            _actionLog = new ConsoleLogStream(session);
 
             using (_logger.CreateCallstack())
             {
@@ -64,7 +66,12 @@ namespace WinSCP
                     logSwitch = string.Format(CultureInfo.InvariantCulture, "/log=\"{0}\" ", LogPathEscape(_session.SessionLogPath));
                 }
 
-                string xmlLogSwitch = string.Format(CultureInfo.InvariantCulture, "/xmllog=\"{0}\" ", LogPathEscape(_session.XmlLogPath));
+                // The log is streamed over the console connection, the file is optional
+                string xmlLogSwitch = null;
+                if (!string.IsNullOrEmpty(_session.XmlLogPath))
+                {
+                    xmlLogSwitch = string.Format(CultureInfo.InvariantCulture, "/xmllog=\"{0}\" ", LogPathEscape(_session.XmlLogPath));
+                }
 
                 string assemblyVersionStr =
                     (assemblyVersion == null) ? "unk" :
@@ -243,6 +250,10 @@ namespace WinSCP
                         ProcessEvent();
                     }
                 }
+
+                // WinSCP waits for the response to each log event,
+                // so once it exits, we have the complete log
+                _actionLog.Complete();
             }
         }
 
@@ -278,6 +289,10 @@ namespace WinSCP
                             ProcessProgressEvent(commStruct.ProgressEvent);
                             break;
 
+                        case ConsoleEvent.ActionLog:
+                            ProcessActionLogEvent(commStruct.ActionLogEvent);
+                            break;
+
                         default:
                             throw new NotImplementedException();
                     }
@@ -389,7 +404,17 @@ namespace WinSCP
                 e.InputType = 3; // pipe
                 e.OutputType = 3; // pipe
                 e.WantsProgress = _session.WantsProgress;
+                e.WantsActionLog = true;
+            }
+        }
+
+        private void ProcessActionLogEvent(ConsoleActionLogEventStruct e)
+        {
+            if (_logger.LogLevel >= 1)
+            {
+                _logger.WriteLine("Action log: [{0}]", e.Data);
             }
+            _actionLog.Append(e.Data);
         }
 
         private void ProcessProgressEvent(ConsoleProgressEventStruct e)
@@ -727,6 +752,11 @@ namespace WinSCP
                         _job.Dispose();
                         _job = null;
                     }
+                    if (_actionLog != null)
+                    {
+                        _actionLog.Dispose();
+                        _actionLog = null;
+                    }
                 }
             }
         }
@@ -863,5 +893,6 @@ namespace WinSCP
         private readonly List<string> _input = new List<string>();
         private AutoResetEvent _inputEvent = new AutoResetEvent(false);
         private Job _job;
+        private ConsoleLogStream _actionLog;
     }
 }
@@ -0,0 +1,152 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.Xml;
+
+namespace WinSCP
+{
+    // Reads the compact recursive listing produced by "ls -recursive",
+    // one <ls> element (directory) at a time.
+    internal class RemoteFileListingReader : IDisposable
+    {
+        public RemoteFileListingReader(Session session, ElementLogReader groupReader)
+        {
+            _session = session;
+            _groupReader = groupReader;
+            _directories = new Queue<IList<RemoteFileInfo>>();
+        }
+
+        // Returns files of the next directory or null, when there are no more
+        public IList<RemoteFileInfo> Read()
+        {
+            IList<RemoteFileInfo> result;
+            if (_directories.Count > 0)
+            {
+                result = _directories.Dequeue();
+            }
+            else if (_exception != null)
+            {
+                Exception e = _exception;
+                _exception = null;
+                throw e;
+            }
+            else if (_groupReader == null)
+            {
+                result = null;
+            }
+            else
+            {
+                result = DoRead();
+            }
+            return result;
+        }
+
+        // Reads the rest of the listing to memory, to release the log for another command
+        public void Drain()
+        {
+            using (_session.Logger.CreateCallstack())
+            {
+                try
+                {
+                    IList<RemoteFileInfo> files;
+                    while ((_groupReader != null) && ((files = DoRead()) != null))
+                    {
+                        _directories.Enqueue(files);
+                    }
+                }
+                catch (Exception e)
+                {
+                    // rethrown, once the enumeration gets to it
+                    _session.Logger.WriteLine("Postponing exception");
+                    _exception = e;
+                }
+            }
+        }
+
+        public void Dispose()
+        {
+            CloseGroup();
+        }
+
+        private IList<RemoteFileInfo> DoRead()
+        {
+            try
+            {
+                List<RemoteFileInfo> result = null;
+                if (_groupReader.TryWaitForNonEmptyElement("ls", LogReadFlags.ThrowFailures))
+                {
+                    using (ElementLogReader lsReader = _groupReader.CreateLogReader())
+                    {
+                        string destination = null;
+                        if (lsReader.TryWaitForEmptyElement("destination", 0))
+                        {
+                            lsReader.GetEmptyElementValue("destination", out destination);
+                        }
+                        if ((destination != null) && lsReader.TryWaitForNonEmptyElement("files", 0))
+                        {
+                            destination = Session.IncludeTrailingSlash(destination);
+                            result = new List<RemoteFileInfo>();
+
+                            using (ElementLogReader filesReader = lsReader.CreateLogReader())
+                            {
+                                while (filesReader.TryWaitForEmptyElement("file", 0))
+                                {
+                                    result.Add(ReadFile(filesReader, destination));
+                                }
+                            }
+                        }
+                        else
+                        {
+                            // "files" not found, keep reading, we expect "failure",
+                            // see Session.ListDirectory
+                            _groupReader.ReadToEnd(LogReadFlags.ThrowFailures);
+                            throw SessionLocalException.CreateElementNotFound(_session, "files");
+                        }
+                    }
+                }
+                else
+                {
+                    CloseGroup();
+                }
+                return result;
+            }
+            catch (Exception)
+            {
+                CloseGroup();
+                throw;
+            }
+        }
+
+        private static RemoteFileInfo ReadFile(CustomLogReader fileReader, string destination)
+        {
+            RemoteFileInfo fileInfo = new RemoteFileInfo();
+            fileInfo.Name = fileReader.GetAttribute("name");
+            fileInfo.FullName = destination + fileInfo.Name;
+            fileInfo.FileType = fileReader.GetAttribute("type")[0];
+            string value = fileReader.GetAttribute("size");
+            if (value != null)
+            {
+                fileInfo.Length = long.Parse(value, CultureInfo.InvariantCulture);
+            }
+            fileInfo.LastWriteTime = XmlConvert.ToDateTime(fileReader.GetAttribute("modification"), XmlDateTimeSerializationMode.Local);
+            fileInfo.FilePermissions = FilePermissions.CreateReadOnlyFromText(fileReader.GetAttribute("permissions"));
+            fileInfo.Owner = fileReader.GetAttribute("owner");
+            fileInfo.Group = fileReader.GetAttribute("group");
+            return fileInfo;
+        }
+
+        private void CloseGroup()
+        {
+            if (_groupReader != null)
+            {
+                _groupReader.Dispose();
+                _groupReader = null;
+            }
+        }
+
+        private readonly Session _session;
+        private ElementLogReader _groupReader;
+        private readonly Queue<IList<RemoteFileInfo>> _directories;
+        private Exception _exception;
+    }
+}
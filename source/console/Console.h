@@ -12,8 +12,8 @@ struct TConsoleCommStruct
 {
   enum TVersion
   {
-    CurrentVersion =          0x0006,
-    CurrentVersionConfirmed = 0x0106
+    CurrentVersion =          0x0007,
+    CurrentVersionConfirmed = 0x0107
   };
 
   struct TInitEvent
@@ -21,6 +21,7 @@ struct TConsoleCommStruct
     unsigned int InputType;
     unsigned int OutputType;
     bool WantsProgress; // since version 6
+    bool WantsActionLog; // since version 7
   };
 
   struct TPrintEvent
@@ -65,9 +66,15 @@ struct TConsoleCommStruct
     unsigned int CPS;
   };
 
+  // Since version 7
+  struct TActionLogEvent
+  {
+    wchar_t Data[10240];
+  };
+
   size_t Size;
   int Version;
-  enum { NONE, PRINT, INPUT, CHOICE, TITLE, INIT, PROGRESS } Event;
+  enum { NONE, PRINT, INPUT, CHOICE, TITLE, INIT, PROGRESS, ACTIONLOG } Event;
 
   union
   {
@@ -77,6 +84,7 @@ struct TConsoleCommStruct
     TTitleEvent TitleEvent;
     TInitEvent InitEvent;
     TProgressEvent ProgressEvent;
+    TActionLogEvent ActionLogEvent;
   };
 };
 //---------------------------------------------------------------------------
@@ -724,6 +724,7 @@ inline void ProcessInitEvent(TConsoleCommStruct::TInitEvent& Event)
   Event.OutputType = OutputType;
   // default anyway
   Event.WantsProgress = false;
+  Event.WantsActionLog = false;
 }
 //---------------------------------------------------------------------------
 void ProcessEvent(HANDLE ResponseEvent, HANDLE FileMapping)
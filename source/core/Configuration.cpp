@@ -37,6 +37,8 @@ const UnicodeString TlsFingerprintType(L"tls");
 __fastcall TConfiguration::TConfiguration()
 {
   FCriticalSection = new TCriticalSection();
+  FHostKeysSection = new TCriticalSection();
+  FHostKeysLoaded = false;
   FUpdating = 0;
   FStorage = stDetect;
   FDontSave = false;
@@ -44,6 +46,7 @@ __fastcall TConfiguration::TConfiguration()
   FUsage = new TUsage(this);
   FDefaultCollectUsage = false;
   FScripting = false;
+  FOnActionsLog = NULL;
 
   UnicodeString RandomSeedPath;
   if (!GetEnvironmentVariable(L"APPDATA").IsEmpty())
@@ -60,6 +63,7 @@ __fastcall TConfiguration::TConfiguration()
   }
 
   FDefaultRandomSeedFile = IncludeTrailingBackslash(RandomSeedPath) + L"winscp.rnd";
+  FDefaultChecksumCacheFile = IncludeTrailingBackslash(RandomSeedPath) + L"winscp.chk";
 }
 //---------------------------------------------------------------------------
 void __fastcall TConfiguration::Default()
@@ -86,6 +90,7 @@ void __fastcall TConfiguration::Default()
   }
 
   RandomSeedFile = FDefaultRandomSeedFile;
+  FChecksumCacheFile = FDefaultChecksumCacheFile;
   PuttyRegistryStorageKey = OriginalPuttyRegistryStorageKey;
   FConfirmOverwriting = true;
   FConfirmResume = true;
@@ -100,6 +105,11 @@ void __fastcall TConfiguration::Default()
   FShowFtpWelcomeMessage = false;
   FExternalIpAddress = L"";
   FTryFtpWhenSshFails = true;
+  FLocalIOBuffers = 8;
+  FLocalIOSequentialScan = false;
+  FLocalIOPreallocate = false;
+  FFtpTransferBufferSize = 256 * 1024;
+  FFtpReceiveBuffer = 4 * 1024 * 1024;
   CollectUsage = FDefaultCollectUsage;
 
   FLogging = false;
@@ -127,6 +137,7 @@ __fastcall TConfiguration::~TConfiguration()
   DebugAssert(!FUpdating);
   if (FApplicationInfo) FreeFileInfo(FApplicationInfo);
   delete FCriticalSection;
+  delete FHostKeysSection;
   delete FUsage;
 }
 //---------------------------------------------------------------------------
@@ -197,6 +208,7 @@ UnicodeString __fastcall TConfiguration::PropertyToKey(const UnicodeString & Pro
 #define REGCONFIG(CANCREATE) \
   BLOCK(L"Interface", CANCREATE, \
     KEY(String,   RandomSeedFile); \
+    KEY(String,   ChecksumCacheFile); \
     KEY(String,   PuttyRegistryStorageKey); \
     KEY(Bool,     ConfirmOverwriting); \
     KEY(Bool,     ConfirmResume); \
@@ -211,6 +223,11 @@ UnicodeString __fastcall TConfiguration::PropertyToKey(const UnicodeString & Pro
     KEY(Bool,     ShowFtpWelcomeMessage); \
     KEY(String,   ExternalIpAddress); \
     KEY(Bool,     TryFtpWhenSshFails); \
+    KEY(Integer,  LocalIOBuffers); \
+    KEY(Bool,     LocalIOSequentialScan); \
+    KEY(Bool,     LocalIOPreallocate); \
+    KEY(Integer,  FtpTransferBufferSize); \
+    KEY(Integer,  FtpReceiveBuffer); \
     KEY(Bool,     CollectUsage); \
   ); \
   BLOCK(L"Logging", CANCREATE, \
@@ -253,6 +270,8 @@ void __fastcall TConfiguration::DoSave(bool All, bool Explicit)
 {
   if (FDontSave) return;
 
+  FlushHostKeys();
+
   THierarchicalStorage * AStorage = CreateConfigStorage();
   try
   {
@@ -301,6 +320,9 @@ void __fastcall TConfiguration::Export(const UnicodeString & FileName)
     ExportStorage->AccessMode = smReadWrite;
     ExportStorage->Explicit = true;
 
+    // include host keys not written back yet
+    FlushHostKeys();
+
     Storage = CreateConfigStorage();
     Storage->AccessMode = smRead;
 
@@ -333,7 +355,9 @@ void __fastcall TConfiguration::Import(const UnicodeString & FileName)
     Storage->AccessMode = smReadWrite;
     Storage->Explicit = true;
 
+    FlushHostKeys();
     CopyData(ImportStorage, Storage);
+    InvalidateHostKeys();
 
     Default();
     LoadFrom(ImportStorage);
@@ -612,6 +636,128 @@ UnicodeString __fastcall TConfiguration::LastFingerprint(const UnicodeString & S
   return Result;
 }
 //---------------------------------------------------------------------------
+// PuTTY looks up the host keys on every connection (see PuttyIntf.cpp).
+// With an INI file, opening the storage means parsing the whole file,
+// so the keys are loaded once and new keys are written back in batches.
+static UnicodeString __fastcall HostKeyIndex(const UnicodeString & Name)
+{
+  // as with the registry and INI file, the names are case-insensitive
+  return LowerCase(Name);
+}
+//---------------------------------------------------------------------------
+void __fastcall TConfiguration::LoadHostKeys()
+{
+  if (!FHostKeysLoaded)
+  {
+    FHostKeys.clear();
+
+    std::unique_ptr<THierarchicalStorage> Storage(CreateConfigStorage());
+    Storage->AccessMode = smRead;
+    if (Storage->OpenSubKey(SshHostKeysSubKey, false))
+    {
+      std::unique_ptr<TStrings> Names(new TStringList());
+      Storage->GetValueNames(Names.get());
+      for (int Index = 0; Index < Names->Count; Index++)
+      {
+        UnicodeString Name = Names->Strings[Index];
+        FHostKeys[HostKeyIndex(Name)] = Storage->ReadStringRaw(Name, L"");
+      }
+    }
+
+    FHostKeysLoaded = true;
+  }
+}
+//---------------------------------------------------------------------------
+bool __fastcall TConfiguration::ReadHostKey(const UnicodeString & Name, UnicodeString & Key)
+{
+  TGuard Guard(FHostKeysSection);
+  LoadHostKeys();
+
+  THostKeys::const_iterator I = FHostKeys.find(HostKeyIndex(Name));
+  bool Result = (I != FHostKeys.end());
+  if (Result)
+  {
+    Key = I->second;
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TConfiguration::WriteHostKey(const UnicodeString & Name, const UnicodeString & Key)
+{
+  TGuard Guard(FHostKeysSection);
+  LoadHostKeys();
+
+  FHostKeys[HostKeyIndex(Name)] = Key;
+  if (FPendingHostKeys.empty())
+  {
+    FPendingHostKeysSince = Now();
+  }
+  FPendingHostKeys[Name] = Key;
+
+  // do not let too many keys wait for the configuration to be saved
+  const unsigned int MaxPendingHostKeys = 64;
+  if ((FPendingHostKeys.size() >= MaxPendingHostKeys) || HostKeysOverdue())
+  {
+    DoFlushHostKeys();
+  }
+}
+//---------------------------------------------------------------------------
+bool __fastcall TConfiguration::HostKeysOverdue()
+{
+  // Other processes (e.g. one per .NET assembly session) see the keys
+  // only once written, and a crash would lose them
+  const TDateTime MaxPendingHostKeysAge(0, 0, 5, 0);
+  return
+    !FPendingHostKeys.empty() &&
+    (Now() - FPendingHostKeysSince >= MaxPendingHostKeysAge);
+}
+//---------------------------------------------------------------------------
+void __fastcall TConfiguration::FlushOverdueHostKeys()
+{
+  TGuard Guard(FHostKeysSection);
+  if (HostKeysOverdue())
+  {
+    DoFlushHostKeys();
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TConfiguration::FlushHostKeys()
+{
+  TGuard Guard(FHostKeysSection);
+  DoFlushHostKeys();
+}
+//---------------------------------------------------------------------------
+void __fastcall TConfiguration::DoFlushHostKeys()
+{
+  if (!FPendingHostKeys.empty())
+  {
+    {
+      std::unique_ptr<THierarchicalStorage> Storage(CreateConfigStorage());
+      Storage->AccessMode = smReadWrite;
+      if (Storage->OpenSubKey(SshHostKeysSubKey, true))
+      {
+        THostKeys::const_iterator I = FPendingHostKeys.begin();
+        while (I != FPendingHostKeys.end())
+        {
+          Storage->WriteStringRaw(I->first, I->second);
+          I++;
+        }
+      }
+    }
+
+    // only once the storage is really written (INI file is on destruction)
+    FPendingHostKeys.clear();
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TConfiguration::InvalidateHostKeys()
+{
+  TGuard Guard(FHostKeysSection);
+  FHostKeys.clear();
+  FPendingHostKeys.clear();
+  FHostKeysLoaded = false;
+}
+//---------------------------------------------------------------------------
 void __fastcall TConfiguration::Changed()
 {
   if (FUpdating == 0)
@@ -683,6 +829,7 @@ void __fastcall TConfiguration::CleanupHostKeys()
   try
   {
     CleanupRegistry(SshHostKeysSubKey);
+    InvalidateHostKeys();
   }
   catch (Exception &E)
   {
@@ -1156,6 +1303,8 @@ void __fastcall TConfiguration::SetStorage(TStorage value)
 
       try
       {
+        FlushHostKeys();
+
         SourceStorage = CreateConfigStorage();
         SourceStorage->AccessMode = smRead;
 
@@ -1178,6 +1327,8 @@ void __fastcall TConfiguration::SetStorage(TStorage value)
       // save all and explicit,
       // this also removes an INI file, when switching to registry storage
       DoSave(true, true);
+
+      InvalidateHostKeys();
     }
     catch (...)
     {
@@ -1288,6 +1439,17 @@ UnicodeString __fastcall TConfiguration::GetRandomSeedFileName()
   return StripPathQuotes(ExpandEnvironmentVariables(FRandomSeedFile)).Trim();
 }
 //---------------------------------------------------------------------
+void __fastcall TConfiguration::SetChecksumCacheFile(UnicodeString value)
+{
+  // empty value disables persisting the cache
+  SET_CONFIG_PROPERTY(ChecksumCacheFile);
+}
+//---------------------------------------------------------------------
+UnicodeString __fastcall TConfiguration::GetChecksumCacheFileName()
+{
+  return ExpandEnvironmentVariables(FChecksumCacheFile).Trim();
+}
+//---------------------------------------------------------------------
 void __fastcall TConfiguration::SetExternalIpAddress(UnicodeString value)
 {
   SET_CONFIG_PROPERTY(ExternalIpAddress);
@@ -1298,6 +1460,31 @@ void __fastcall TConfiguration::SetTryFtpWhenSshFails(bool value)
   SET_CONFIG_PROPERTY(TryFtpWhenSshFails);
 }
 //---------------------------------------------------------------------
+void __fastcall TConfiguration::SetLocalIOBuffers(int value)
+{
+  SET_CONFIG_PROPERTY(LocalIOBuffers);
+}
+//---------------------------------------------------------------------
+void __fastcall TConfiguration::SetLocalIOSequentialScan(bool value)
+{
+  SET_CONFIG_PROPERTY(LocalIOSequentialScan);
+}
+//---------------------------------------------------------------------
+void __fastcall TConfiguration::SetLocalIOPreallocate(bool value)
+{
+  SET_CONFIG_PROPERTY(LocalIOPreallocate);
+}
+//---------------------------------------------------------------------
+void __fastcall TConfiguration::SetFtpTransferBufferSize(int value)
+{
+  SET_CONFIG_PROPERTY(FtpTransferBufferSize);
+}
+//---------------------------------------------------------------------
+void __fastcall TConfiguration::SetFtpReceiveBuffer(int value)
+{
+  SET_CONFIG_PROPERTY(FtpReceiveBuffer);
+}
+//---------------------------------------------------------------------
 void __fastcall TConfiguration::SetPuttyRegistryStorageKey(UnicodeString value)
 {
   SET_CONFIG_PROPERTY(PuttyRegistryStorageKey);
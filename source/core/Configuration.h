@@ -3,6 +3,7 @@
 #define ConfigurationH
 
 #include <set>
+#include <map>
 #include "RemoteFiles.h"
 #include "FileBuffer.h"
 #include "HierarchicalStorage.h"
@@ -17,6 +18,7 @@ extern const wchar_t * AutoSwitchNames;
 extern const wchar_t * NotAutoSwitchNames;
 enum TAutoSwitch { asOn, asOff, asAuto };
 enum TAssemblyLanguage { alCSharp, alVBNET, alPowerShell };
+typedef void __fastcall (__closure * TActionsLogEvent)(const UnicodeString & Data);
 //---------------------------------------------------------------------------
 class TStoredSessionList;
 //---------------------------------------------------------------------------
@@ -45,6 +47,7 @@ private:
   bool FPermanentLogActions;
   UnicodeString FActionsLogFileName;
   UnicodeString FPermanentActionsLogFileName;
+  TActionsLogEvent FOnActionsLog;
   bool FConfirmOverwriting;
   bool FConfirmResume;
   bool FAutoReadDirectoryAfterOp;
@@ -62,15 +65,29 @@ private:
   bool FShowFtpWelcomeMessage;
   UnicodeString FDefaultRandomSeedFile;
   UnicodeString FRandomSeedFile;
+  UnicodeString FDefaultChecksumCacheFile;
+  UnicodeString FChecksumCacheFile;
   UnicodeString FPuttyRegistryStorageKey;
   UnicodeString FExternalIpAddress;
   bool FTryFtpWhenSshFails;
+  int FLocalIOBuffers;
+  bool FLocalIOSequentialScan;
+  bool FLocalIOPreallocate;
+  int FFtpTransferBufferSize;
+  int FFtpReceiveBuffer;
   bool FScripting;
 
   bool FDisablePasswordStoring;
   bool FForceBanners;
   bool FDisableAcceptingHostKeys;
   bool FDefaultCollectUsage;
+  // SSH host keys, loaded from the storage once and shared by all sessions
+  typedef std::map<UnicodeString, UnicodeString> THostKeys;
+  TCriticalSection * FHostKeysSection;
+  bool FHostKeysLoaded;
+  THostKeys FHostKeys;
+  THostKeys FPendingHostKeys;
+  TDateTime FPendingHostKeysSince;
 
   UnicodeString __fastcall GetOSVersionStr();
   TVSFixedFileInfo *__fastcall GetFixedApplicationInfo();
@@ -83,8 +100,13 @@ private:
   UnicodeString __fastcall GetFileVersion(TVSFixedFileInfo * Info);
   UnicodeString __fastcall GetStoredSessionsSubKey();
   UnicodeString __fastcall GetPuttySessionsKey();
+  void __fastcall LoadHostKeys();
+  void __fastcall DoFlushHostKeys();
+  bool __fastcall HostKeysOverdue();
   void __fastcall SetRandomSeedFile(UnicodeString value);
   UnicodeString __fastcall GetRandomSeedFileName();
+  void __fastcall SetChecksumCacheFile(UnicodeString value);
+  UnicodeString __fastcall GetChecksumCacheFileName();
   void __fastcall SetPuttyRegistryStorageKey(UnicodeString value);
   UnicodeString __fastcall GetSshHostKeysSubKey();
   UnicodeString __fastcall GetRootKeyStr();
@@ -125,6 +147,11 @@ private:
   void __fastcall UpdateActualLogProtocol();
   void __fastcall SetExternalIpAddress(UnicodeString value);
   void __fastcall SetTryFtpWhenSshFails(bool value);
+  void __fastcall SetLocalIOBuffers(int value);
+  void __fastcall SetLocalIOSequentialScan(bool value);
+  void __fastcall SetLocalIOPreallocate(bool value);
+  void __fastcall SetFtpTransferBufferSize(int value);
+  void __fastcall SetFtpReceiveBuffer(int value);
   bool __fastcall GetCollectUsage();
   void __fastcall SetCollectUsage(bool value);
   bool __fastcall GetIsUnofficial();
@@ -201,6 +228,11 @@ public:
   void __fastcall NeverShowBanner(const UnicodeString SessionKey, const UnicodeString & Banner);
   void __fastcall RememberLastFingerprint(const UnicodeString & SiteKey, const UnicodeString & FingerprintType, const UnicodeString & Fingerprint);
   UnicodeString __fastcall LastFingerprint(const UnicodeString & SiteKey, const UnicodeString & FingerprintType);
+  bool __fastcall ReadHostKey(const UnicodeString & Name, UnicodeString & Key);
+  void __fastcall WriteHostKey(const UnicodeString & Name, const UnicodeString & Key);
+  void __fastcall FlushHostKeys();
+  void __fastcall FlushOverdueHostKeys();
+  void __fastcall InvalidateHostKeys();
   THierarchicalStorage * CreateConfigStorage();
   virtual THierarchicalStorage * CreateScpStorage(bool & SessionList);
   void __fastcall TemporaryLogging(const UnicodeString ALogFileName);
@@ -226,6 +258,8 @@ public:
   __property UnicodeString PuttySessionsKey  = { read=GetPuttySessionsKey };
   __property UnicodeString RandomSeedFile  = { read=FRandomSeedFile, write=SetRandomSeedFile };
   __property UnicodeString RandomSeedFileName  = { read=GetRandomSeedFileName };
+  __property UnicodeString ChecksumCacheFile  = { read=FChecksumCacheFile, write=SetChecksumCacheFile };
+  __property UnicodeString ChecksumCacheFileName  = { read=GetChecksumCacheFileName };
   __property UnicodeString SshHostKeysSubKey  = { read=GetSshHostKeysSubKey };
   __property UnicodeString RootKeyStr  = { read=GetRootKeyStr };
   __property UnicodeString ConfigurationSubKey  = { read=GetConfigurationSubKey };
@@ -247,6 +281,8 @@ public:
   __property int ActualLogProtocol  = { read=FActualLogProtocol };
   __property bool LogActions  = { read=FLogActions, write=SetLogActions };
   __property UnicodeString ActionsLogFileName  = { read=FActionsLogFileName, write=SetActionsLogFileName };
+  // When set, XML log records are delivered to the handler (in addition to the file, if any)
+  __property TActionsLogEvent OnActionsLog = { read = FOnActionsLog, write = FOnActionsLog };
   __property int LogWindowLines  = { read=FLogWindowLines, write=SetLogWindowLines };
   __property bool LogWindowComplete  = { read=GetLogWindowComplete, write=SetLogWindowComplete };
   __property UnicodeString DefaultLogFileName  = { read=GetDefaultLogFileName };
@@ -266,6 +302,11 @@ public:
   __property bool ShowFtpWelcomeMessage = { read = FShowFtpWelcomeMessage, write = SetShowFtpWelcomeMessage };
   __property UnicodeString ExternalIpAddress = { read = FExternalIpAddress, write = SetExternalIpAddress };
   __property bool TryFtpWhenSshFails = { read = FTryFtpWhenSshFails, write = SetTryFtpWhenSshFails };
+  __property int LocalIOBuffers = { read = FLocalIOBuffers, write = SetLocalIOBuffers };
+  __property bool LocalIOSequentialScan = { read = FLocalIOSequentialScan, write = SetLocalIOSequentialScan };
+  __property bool LocalIOPreallocate = { read = FLocalIOPreallocate, write = SetLocalIOPreallocate };
+  __property int FtpTransferBufferSize = { read = FFtpTransferBufferSize, write = SetFtpTransferBufferSize };
+  __property int FtpReceiveBuffer = { read = FFtpReceiveBuffer, write = SetFtpReceiveBuffer };
 
   __property UnicodeString TimeFormat = { read = GetTimeFormat };
   __property TStorage Storage  = { read=GetStorage, write=SetStorage };
@@ -111,7 +111,9 @@ void CoreLoad()
   {
     if (SessionsStorage->OpenSubKey(Configuration->StoredSessionsSubKey, false))
     {
-      StoredSessions->Load(SessionsStorage.get());
+      // Only the names are read here, the sites are loaded as needed,
+      // see Execute() in WinMain.cpp
+      StoredSessions->Load(SessionsStorage.get(), false, false, true);
     }
   }
   catch (Exception & E)
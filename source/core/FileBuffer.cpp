@@ -4,6 +4,8 @@
 
 #include "Common.h"
 #include "FileBuffer.h"
+#include "Queue.h"
+#include <deque>
 //---------------------------------------------------------------------------
 #pragma package(smart_init)
 //---------------------------------------------------------------------------
@@ -281,3 +283,486 @@ int __fastcall TSafeHandleStream::Write(const System::DynamicArray<System::Byte>
   }
   return Result;
 }
+//---------------------------------------------------------------------------
+// TLocalFileIOThread
+//---------------------------------------------------------------------------
+const int LocalIOBlockSize = 64 * 1024;
+//---------------------------------------------------------------------------
+class TLocalFileIOThread : public TSignalThread
+{
+public:
+  __fastcall TLocalFileIOThread();
+  virtual __fastcall ~TLocalFileIOThread();
+
+  void __fastcall Attach(HANDLE Handle, bool Write, int Buffers);
+  void __fastcall Detach();
+  int __fastcall Read(void * Buffer, int Count);
+  void __fastcall Write(const void * Buffer, int Count);
+  void __fastcall Flush();
+  void __fastcall Preallocate(__int64 Size);
+
+protected:
+  virtual void __fastcall ProcessEvent();
+
+private:
+  HANDLE FHandle;
+  bool FWrite;
+  unsigned int FBuffers;
+  TCriticalSection * FSection;
+  // held while the thread works with the file
+  TCriticalSection * FProcessSection;
+  HANDLE FDoneEvent;
+  std::deque<RawByteString> FBlocks;
+  // consumed part of the first block (read-ahead only)
+  int FOffset;
+  int FAvailable;
+  int FWanted;
+  DWORD FError;
+  bool FEof;
+  bool FPreallocated;
+  bool FDetaching;
+
+  void __fastcall WaitForThread();
+  void __fastcall CheckError();
+  void __fastcall ReadAhead();
+  void __fastcall WriteBehind();
+  void __fastcall Reset();
+};
+//---------------------------------------------------------------------------
+__fastcall TLocalFileIOThread::TLocalFileIOThread() :
+  TSignalThread(false),
+  FHandle(NULL), FWrite(false), FBuffers(1),
+  FOffset(0), FAvailable(0), FWanted(0), FError(0), FEof(false), FPreallocated(false),
+  FDetaching(false)
+{
+  FSection = new TCriticalSection();
+  FProcessSection = new TCriticalSection();
+  FDoneEvent = CreateEvent(NULL, false, false, NULL);
+  DebugAssert(FDoneEvent != NULL);
+  Start();
+}
+//---------------------------------------------------------------------------
+__fastcall TLocalFileIOThread::~TLocalFileIOThread()
+{
+  // the thread has to stop before we release the buffers it works with
+  Close();
+
+  Reset();
+
+  CloseHandle(FDoneEvent);
+  delete FProcessSection;
+  delete FSection;
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalFileIOThread::Reset()
+{
+  // Transfer was not completed, do not leave the file preallocated
+  // beyond what was actually written
+  if (FPreallocated)
+  {
+    SetEndOfFile(FHandle);
+  }
+
+  FHandle = NULL;
+  FBlocks.clear();
+  FOffset = 0;
+  FAvailable = 0;
+  FWanted = 0;
+  FError = 0;
+  FEof = false;
+  FPreallocated = false;
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalFileIOThread::Attach(HANDLE Handle, bool Write, int Buffers)
+{
+  TGuard ProcessGuard(FProcessSection);
+  TGuard Guard(FSection);
+  DebugAssert(FHandle == NULL);
+  FHandle = Handle;
+  FWrite = Write;
+  FBuffers = std::max(Buffers, 1);
+  FDetaching = false;
+  ResetEvent(FDoneEvent);
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalFileIOThread::Detach()
+{
+  {
+    TGuard Guard(FSection);
+    // makes the thread leave the file asap
+    FDetaching = true;
+  }
+  // waits for the thread to stop working with the file,
+  // as the caller closes the handle once we return
+  TGuard ProcessGuard(FProcessSection);
+  TGuard Guard(FSection);
+  Reset();
+  FDetaching = false;
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalFileIOThread::WaitForThread()
+{
+  TriggerEvent();
+  WaitForSingleObject(FDoneEvent, INFINITE);
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalFileIOThread::CheckError()
+{
+  // to be called with FSection locked;
+  // the error is reported only once, the thread retries when triggered again
+  if (FError != 0)
+  {
+    DWORD Error = FError;
+    FError = 0;
+    RaiseLastOSError(Error);
+  }
+}
+//---------------------------------------------------------------------------
+int __fastcall TLocalFileIOThread::Read(void * Buffer, int Count)
+{
+  DebugAssert(!FWrite);
+
+  bool Ready;
+  do
+  {
+    {
+      TGuard Guard(FSection);
+      Ready = (FAvailable >= Count) || FEof;
+      if (!Ready)
+      {
+        // error is reported only when it prevents us from returning
+        // what was asked for, so that no data is lost on retry
+        CheckError();
+        FWanted = Count;
+      }
+    }
+
+    if (!Ready)
+    {
+      WaitForThread();
+    }
+  }
+  while (!Ready);
+
+  int Result = 0;
+  {
+    TGuard Guard(FSection);
+    char * Ptr = static_cast<char *>(Buffer);
+    while ((Result < Count) && !FBlocks.empty())
+    {
+      RawByteString & Block = FBlocks.front();
+      int Len = std::min(Count - Result, Block.Length() - FOffset);
+      memcpy(Ptr + Result, Block.c_str() + FOffset, Len);
+      Result += Len;
+      FOffset += Len;
+      FAvailable -= Len;
+      if (FOffset == Block.Length())
+      {
+        FBlocks.pop_front();
+        FOffset = 0;
+      }
+    }
+    FWanted = 0;
+  }
+
+  // refill the buffers we have consumed
+  TriggerEvent();
+
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalFileIOThread::Write(const void * Buffer, int Count)
+{
+  DebugAssert(FWrite);
+
+  bool Ready;
+  do
+  {
+    {
+      TGuard Guard(FSection);
+      CheckError();
+      Ready = (FBlocks.size() < FBuffers);
+      if (Ready)
+      {
+        FBlocks.push_back(RawByteString(static_cast<const char *>(Buffer), Count));
+      }
+    }
+
+    if (!Ready)
+    {
+      WaitForThread();
+    }
+  }
+  while (!Ready);
+
+  TriggerEvent();
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalFileIOThread::Flush()
+{
+  if (FWrite)
+  {
+    bool Done;
+    do
+    {
+      {
+        TGuard Guard(FSection);
+        CheckError();
+        Done = FBlocks.empty();
+      }
+
+      if (!Done)
+      {
+        WaitForThread();
+      }
+    }
+    while (!Done);
+
+    if (FPreallocated)
+    {
+      // cut the file where the data actually ended
+      if (!SetEndOfFile(FHandle))
+      {
+        RaiseLastOSError();
+      }
+      FPreallocated = false;
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalFileIOThread::Preallocate(__int64 Size)
+{
+  DebugAssert(FWrite);
+  DebugAssert(FBlocks.empty());
+
+  LARGE_INTEGER Zero;
+  Zero.QuadPart = 0;
+  LARGE_INTEGER Start;
+  if (SetFilePointerEx(FHandle, Zero, &Start, FILE_CURRENT))
+  {
+    LARGE_INTEGER End;
+    End.QuadPart = Start.QuadPart + Size;
+    // Failing to preallocate is not an error,
+    // the file will just grow as it is written
+    if (SetFilePointerEx(FHandle, End, NULL, FILE_BEGIN))
+    {
+      FPreallocated = (SetEndOfFile(FHandle) != FALSE);
+      if (!SetFilePointerEx(FHandle, Start, NULL, FILE_BEGIN))
+      {
+        RaiseLastOSError();
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalFileIOThread::ProcessEvent()
+{
+  TGuard Guard(FProcessSection);
+  if (FWrite)
+  {
+    WriteBehind();
+  }
+  else
+  {
+    ReadAhead();
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalFileIOThread::ReadAhead()
+{
+  bool Continue = true;
+  while (Continue && !FTerminated)
+  {
+    {
+      TGuard Guard(FSection);
+      Continue =
+        (FHandle != NULL) && !FDetaching && !FEof && (FError == 0) &&
+        ((FBlocks.size() < FBuffers) || (FAvailable < FWanted));
+    }
+
+    if (Continue)
+    {
+      RawByteString Block;
+      Block.SetLength(LocalIOBlockSize);
+      DWORD Read = 0;
+      DWORD Error = 0;
+      if (!ReadFile(FHandle, Block.c_str(), Block.Length(), &Read, NULL))
+      {
+        Error = GetLastError();
+        if (Error == 0)
+        {
+          Error = ERROR_READ_FAULT;
+        }
+      }
+
+      {
+        TGuard Guard(FSection);
+        if (Error != 0)
+        {
+          FError = Error;
+          Continue = false;
+        }
+        else if (Read == 0)
+        {
+          FEof = true;
+          Continue = false;
+        }
+        else
+        {
+          Block.SetLength(Read);
+          FBlocks.push_back(Block);
+          FAvailable += Read;
+        }
+      }
+
+      SetEvent(FDoneEvent);
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalFileIOThread::WriteBehind()
+{
+  bool Continue = true;
+  while (Continue && !FTerminated)
+  {
+    RawByteString Block;
+    {
+      TGuard Guard(FSection);
+      Continue = (FHandle != NULL) && !FDetaching && !FBlocks.empty() && (FError == 0);
+      if (Continue)
+      {
+        Block = FBlocks.front();
+      }
+    }
+
+    if (Continue)
+    {
+      DWORD Written = 0;
+      DWORD Error = 0;
+      if (!WriteFile(FHandle, Block.c_str(), Block.Length(), &Written, NULL))
+      {
+        Error = GetLastError();
+        if (Error == 0)
+        {
+          Error = ERROR_WRITE_FAULT;
+        }
+      }
+      else if (Written < static_cast<DWORD>(Block.Length()))
+      {
+        Error = ERROR_HANDLE_DISK_FULL;
+      }
+
+      {
+        TGuard Guard(FSection);
+        if (Error != 0)
+        {
+          // keep the rest of the block, it is written again once the caller
+          // has been told about the error and decided to retry;
+          // the file pointer is already past the written part
+          if (Written > 0)
+          {
+            FBlocks.front().Delete(1, Written);
+          }
+          FError = Error;
+          Continue = false;
+        }
+        else
+        {
+          FBlocks.pop_front();
+        }
+      }
+
+      SetEvent(FDoneEvent);
+    }
+  }
+}
+//---------------------------------------------------------------------------
+// TAsynchronousHandleStream
+//---------------------------------------------------------------------------
+__fastcall TAsynchronousHandleStream::TAsynchronousHandleStream(
+    int AHandle, bool AWrite, int ABuffers, TLocalFileIOWorker * Worker) :
+  TSafeHandleStream(AHandle)
+{
+  if ((Worker != NULL) && !Worker->FInUse)
+  {
+    if (Worker->FThread == NULL)
+    {
+      Worker->FThread = new TLocalFileIOThread();
+    }
+    Worker->FInUse = true;
+    FWorker = Worker;
+    FThread = Worker->FThread;
+  }
+  else
+  {
+    FWorker = NULL;
+    FThread = new TLocalFileIOThread();
+  }
+  FThread->Attach(reinterpret_cast<HANDLE>(AHandle), AWrite, ABuffers);
+}
+//---------------------------------------------------------------------------
+__fastcall TAsynchronousHandleStream::~TAsynchronousHandleStream()
+{
+  if (FWorker != NULL)
+  {
+    FThread->Detach();
+    FWorker->FInUse = false;
+  }
+  else
+  {
+    delete FThread;
+  }
+}
+//---------------------------------------------------------------------------
+int __fastcall TAsynchronousHandleStream::Read(void * Buffer, int Count)
+{
+  return FThread->Read(Buffer, Count);
+}
+//---------------------------------------------------------------------------
+int __fastcall TAsynchronousHandleStream::Write(const void * Buffer, int Count)
+{
+  FThread->Write(Buffer, Count);
+  return Count;
+}
+//---------------------------------------------------------------------------
+int __fastcall TAsynchronousHandleStream::Read(System::DynamicArray<System::Byte> Buffer, int Offset, int Count)
+{
+  return Read(&Buffer[Offset], Count);
+}
+//---------------------------------------------------------------------------
+int __fastcall TAsynchronousHandleStream::Write(const System::DynamicArray<System::Byte> Buffer, int Offset, int Count)
+{
+  return Write(&Buffer[Offset], Count);
+}
+//---------------------------------------------------------------------------
+void __fastcall TAsynchronousHandleStream::Flush()
+{
+  FThread->Flush();
+}
+//---------------------------------------------------------------------------
+void __fastcall TAsynchronousHandleStream::Preallocate(__int64 Size)
+{
+  FThread->Preallocate(Size);
+}
+//---------------------------------------------------------------------------
+// TLocalFileIOWorker
+//---------------------------------------------------------------------------
+__fastcall TLocalFileIOWorker::TLocalFileIOWorker() :
+  FThread(NULL), FInUse(false)
+{
+}
+//---------------------------------------------------------------------------
+__fastcall TLocalFileIOWorker::~TLocalFileIOWorker()
+{
+  DebugAssert(!FInUse);
+  delete FThread;
+}
+//---------------------------------------------------------------------------
+void __fastcall FlushStream(TStream * Stream)
+{
+  TAsynchronousHandleStream * AsynchronousStream = dynamic_cast<TAsynchronousHandleStream *>(Stream);
+  if (AsynchronousStream != NULL)
+  {
+    AsynchronousStream->Flush();
+  }
+}
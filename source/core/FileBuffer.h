@@ -49,6 +49,44 @@ public:
   virtual int __fastcall Write(const System::DynamicArray<System::Byte> Buffer, int Offset, int Count);
 };
 //---------------------------------------------------------------------------
+class TLocalFileIOThread;
+//---------------------------------------------------------------------------
+// Keeps the thread of TAsynchronousHandleStream for the next stream,
+// so that a transfer of many small files does not start a thread for each.
+// Serves one stream at a time, streams opened meanwhile get their own thread.
+class TLocalFileIOWorker
+{
+friend class TAsynchronousHandleStream;
+public:
+  __fastcall TLocalFileIOWorker();
+  __fastcall ~TLocalFileIOWorker();
+
+private:
+  TLocalFileIOThread * FThread;
+  bool FInUse;
+};
+//---------------------------------------------------------------------------
+// Reads ahead or writes behind on a separate thread, so that the caller
+// does not wait for the disk. Supports sequential access only.
+class TAsynchronousHandleStream : public TSafeHandleStream
+{
+public:
+  __fastcall TAsynchronousHandleStream(int AHandle, bool AWrite, int ABuffers,
+    TLocalFileIOWorker * Worker = NULL);
+  virtual __fastcall ~TAsynchronousHandleStream();
+  virtual int __fastcall Read(void * Buffer, int Count);
+  virtual int __fastcall Write(const void * Buffer, int Count);
+  virtual int __fastcall Read(System::DynamicArray<System::Byte> Buffer, int Offset, int Count);
+  virtual int __fastcall Write(const System::DynamicArray<System::Byte> Buffer, int Offset, int Count);
+  void __fastcall Flush();
+  void __fastcall Preallocate(__int64 Size);
+
+private:
+  TLocalFileIOThread * FThread;
+  TLocalFileIOWorker * FWorker;
+};
+//---------------------------------------------------------------------------
+void __fastcall FlushStream(TStream * Stream);
 char * __fastcall EOLToStr(TEOLType EOLType);
 //---------------------------------------------------------------------------
 #endif
@@ -459,6 +459,11 @@ TDateTime __fastcall TFileOperationProgressType::TimeElapsed()
   return Now() - StartTime;
 }
 //---------------------------------------------------------------------------
+TDateTime __fastcall TFileOperationProgressType::FileTimeElapsed()
+{
+  return Now() - FFileStartTime;
+}
+//---------------------------------------------------------------------------
 unsigned int __fastcall TFileOperationProgressType::CPS()
 {
   unsigned int Result;
@@ -120,6 +120,7 @@ public:
   // whole operation
   TDateTime __fastcall TimeElapsed();
   // only current file
+  TDateTime __fastcall FileTimeElapsed();
   TDateTime __fastcall TimeExpected();
   TDateTime __fastcall TotalTimeExpected();
   TDateTime __fastcall TotalTimeLeft();
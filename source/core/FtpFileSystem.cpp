@@ -16,9 +16,12 @@
 #include "TextsFileZilla.h"
 #include "HelpCore.h"
 #include "Security.h"
+#include "Queue.h"
 #include <StrUtils.hpp>
 #include <DateUtils.hpp>
 #include <openssl/x509_vfy.h>
+#include <vector>
+#include <algorithm>
 //---------------------------------------------------------------------------
 #pragma package(smart_init)
 //---------------------------------------------------------------------------
@@ -232,6 +235,424 @@ private:
   bool FIgnoreFileList;
 };
 //---------------------------------------------------------------------------
+// Segments smaller than this are not worth an extra connection
+const __int64 SegmentedDownloadMinSegment = 4 * 1024 * 1024;
+const int SegmentedDownloadSegmentsPerConnection = 4;
+const unsigned int SegmentedDownloadMeasureInterval = 2000;
+//---------------------------------------------------------------------------
+class TFTPSegmentedDownload
+{
+public:
+  TFTPSegmentedDownload(TFTPFileSystem * MainFileSystem,
+    const UnicodeString & LocalFile, const UnicodeString & RemoteFile,
+    const UnicodeString & RemotePath, __int64 Size, int MaxConnections);
+  ~TFTPSegmentedDownload();
+
+  bool __fastcall Next(void * Owner, int & Index, __int64 & Start, __int64 & Length);
+  void __fastcall Progress(void * Owner, int Index, __int64 Bytes);
+  void __fastcall Done(void * Owner, int Index, bool Success);
+  void __fastcall Cancel();
+  void __fastcall Close();
+  bool __fastcall WantsConnection();
+  void __fastcall ConnectionOpened();
+  void __fastcall ConnectionClosed(bool Opened, bool Failed);
+  void __fastcall AddThread(TSimpleThread * Thread);
+  void __fastcall WaitForChange(unsigned int Timeout);
+  __int64 __fastcall GetTransferred();
+  __int64 __fastcall GetCompletePrefix();
+  bool __fastcall IsComplete();
+  bool __fastcall IsBusy();
+
+  TFTPFileSystem * const MainFileSystem;
+  const UnicodeString LocalFile;
+  const UnicodeString RemoteFile;
+  const UnicodeString RemotePath;
+  const __int64 Size;
+  __property bool Cancelled = { read = FCancelled };
+  __property int Connections = { read = FConnections };
+
+private:
+  struct TSegment
+  {
+    __int64 Start;
+    __int64 Position;
+    __int64 End;
+    __int64 RangeStart;
+    void * Owner;
+  };
+
+  TCriticalSection * FSection;
+  HANDLE FEvent;
+  std::vector<TSegment> FSegments;
+  std::vector<TSimpleThread *> FThreads;
+  bool FCancelled;
+  int FMaxConnections;
+  int FConnections;
+  int FStarting;
+  bool FGrowing;
+  unsigned int FMeasureStart;
+  __int64 FMeasureTransferred;
+  double FLastRate;
+
+  __int64 __fastcall DoGetTransferred();
+  bool __fastcall HasPending();
+};
+//---------------------------------------------------------------------------
+TFTPSegmentedDownload::TFTPSegmentedDownload(TFTPFileSystem * AMainFileSystem,
+    const UnicodeString & ALocalFile, const UnicodeString & ARemoteFile,
+    const UnicodeString & ARemotePath, __int64 ASize, int MaxConnections) :
+  MainFileSystem(AMainFileSystem),
+  LocalFile(ALocalFile),
+  RemoteFile(ARemoteFile),
+  RemotePath(ARemotePath),
+  Size(ASize),
+  FCancelled(false),
+  FMaxConnections(MaxConnections),
+  FConnections(1),
+  FStarting(0),
+  FGrowing(true),
+  FMeasureTransferred(0),
+  FLastRate(0)
+{
+  FSection = new TCriticalSection();
+  FEvent = CreateEvent(NULL, false, false, NULL);
+  FMeasureStart = GetTickCount();
+
+  // More segments than connections, so that connections added later
+  // and connections finishing early still find some work
+  __int64 Count = std::min(Size / SegmentedDownloadMinSegment,
+    static_cast<__int64>(MaxConnections * SegmentedDownloadSegmentsPerConnection));
+  Count = std::max(Count, static_cast<__int64>(1));
+  __int64 SegmentSize = Size / Count;
+  for (int Index = 0; Index < Count; Index++)
+  {
+    TSegment Segment;
+    Segment.Start = Index * SegmentSize;
+    Segment.Position = Segment.Start;
+    Segment.End = (Index < Count - 1) ? (Segment.Start + SegmentSize) : Size;
+    Segment.RangeStart = Segment.Start;
+    Segment.Owner = NULL;
+    FSegments.push_back(Segment);
+  }
+}
+//---------------------------------------------------------------------------
+TFTPSegmentedDownload::~TFTPSegmentedDownload()
+{
+  Close();
+  CloseHandle(FEvent);
+  delete FSection;
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPSegmentedDownload::Close()
+{
+  Cancel();
+  // waits for the threads to finish
+  for (size_t Index = 0; Index < FThreads.size(); Index++)
+  {
+    delete FThreads[Index];
+  }
+  FThreads.clear();
+}
+//---------------------------------------------------------------------------
+bool __fastcall TFTPSegmentedDownload::Next(void * Owner, int & Index, __int64 & Start, __int64 & Length)
+{
+  TGuard Guard(FSection);
+  bool Result = false;
+  if (!FCancelled)
+  {
+    for (size_t I = 0; !Result && (I < FSegments.size()); I++)
+    {
+      TSegment & Segment = FSegments[I];
+      if ((Segment.Owner == NULL) && (Segment.Position < Segment.End))
+      {
+        // When a segment is retried, only its part not downloaded yet is requested
+        Segment.Owner = Owner;
+        Segment.RangeStart = Segment.Position;
+        Index = I;
+        Start = Segment.RangeStart;
+        Length = Segment.End - Segment.RangeStart;
+        Result = true;
+      }
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPSegmentedDownload::Progress(void * Owner, int Index, __int64 Bytes)
+{
+  TGuard Guard(FSection);
+  TSegment & Segment = FSegments[Index];
+  // ignore late progress of a connection that has given up the segment already
+  if (Segment.Owner == Owner)
+  {
+    Segment.Position = std::min(Segment.RangeStart + Bytes, Segment.End);
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPSegmentedDownload::Done(void * Owner, int Index, bool Success)
+{
+  {
+    TGuard Guard(FSection);
+    TSegment & Segment = FSegments[Index];
+    DebugAssert(Segment.Owner == Owner);
+    if (Success)
+    {
+      Segment.Position = Segment.End;
+    }
+    Segment.Owner = NULL;
+  }
+  SetEvent(FEvent);
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPSegmentedDownload::Cancel()
+{
+  TGuard Guard(FSection);
+  FCancelled = true;
+}
+//---------------------------------------------------------------------------
+bool __fastcall TFTPSegmentedDownload::HasPending()
+{
+  bool Result = false;
+  for (size_t Index = 0; !Result && (Index < FSegments.size()); Index++)
+  {
+    Result = (FSegments[Index].Owner == NULL) && (FSegments[Index].Position < FSegments[Index].End);
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+bool __fastcall TFTPSegmentedDownload::WantsConnection()
+{
+  TGuard Guard(FSection);
+  bool Result = false;
+  if (FGrowing && !FCancelled && (FStarting == 0) &&
+      (FConnections < FMaxConnections) && HasPending())
+  {
+    unsigned int Ticks = GetTickCount();
+    if (Ticks - FMeasureStart >= SegmentedDownloadMeasureInterval)
+    {
+      __int64 Transferred = DoGetTransferred();
+      double Rate = double(Transferred - FMeasureTransferred) / (Ticks - FMeasureStart);
+      // Stop adding connections, once the last one added
+      // has not improved the overall throughput noticeably
+      if ((FConnections > 1) && (Rate < FLastRate * 1.1))
+      {
+        FGrowing = false;
+      }
+      else
+      {
+        FStarting++;
+        Result = true;
+      }
+      FLastRate = Rate;
+      FMeasureStart = Ticks;
+      FMeasureTransferred = Transferred;
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPSegmentedDownload::ConnectionOpened()
+{
+  TGuard Guard(FSection);
+  DebugAssert(FStarting > 0);
+  FStarting--;
+  FConnections++;
+  // measure the throughput with the new connection from now on
+  FMeasureStart = GetTickCount();
+  FMeasureTransferred = DoGetTransferred();
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPSegmentedDownload::ConnectionClosed(bool Opened, bool Failed)
+{
+  {
+    TGuard Guard(FSection);
+    if (Opened)
+    {
+      FConnections--;
+    }
+    else
+    {
+      FStarting--;
+    }
+    if (Failed)
+    {
+      FGrowing = false;
+    }
+  }
+  SetEvent(FEvent);
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPSegmentedDownload::AddThread(TSimpleThread * Thread)
+{
+  FThreads.push_back(Thread);
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPSegmentedDownload::WaitForChange(unsigned int Timeout)
+{
+  WaitForSingleObject(FEvent, Timeout);
+}
+//---------------------------------------------------------------------------
+__int64 __fastcall TFTPSegmentedDownload::DoGetTransferred()
+{
+  __int64 Result = 0;
+  for (size_t Index = 0; Index < FSegments.size(); Index++)
+  {
+    Result += FSegments[Index].Position - FSegments[Index].Start;
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+__int64 __fastcall TFTPSegmentedDownload::GetTransferred()
+{
+  TGuard Guard(FSection);
+  return DoGetTransferred();
+}
+//---------------------------------------------------------------------------
+__int64 __fastcall TFTPSegmentedDownload::GetCompletePrefix()
+{
+  TGuard Guard(FSection);
+  __int64 Result = Size;
+  for (size_t Index = 0; (Result == Size) && (Index < FSegments.size()); Index++)
+  {
+    if (FSegments[Index].Position < FSegments[Index].End)
+    {
+      Result = FSegments[Index].Position;
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+bool __fastcall TFTPSegmentedDownload::IsComplete()
+{
+  return (GetCompletePrefix() == Size);
+}
+//---------------------------------------------------------------------------
+bool __fastcall TFTPSegmentedDownload::IsBusy()
+{
+  TGuard Guard(FSection);
+  bool Result = false;
+  for (size_t Index = 0; !Result && (Index < FSegments.size()); Index++)
+  {
+    Result = (FSegments[Index].Owner != NULL);
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+// Connection of a segmented download, opened on a worker thread.
+// It gets the credentials and the accepted certificate of the main connection up front.
+// Anything else that would need the user makes the connection fail.
+class TFTPSegmentTerminal : public TSecondaryTerminal
+{
+public:
+  __fastcall TFTPSegmentTerminal(TTerminal * MainTerminal, TSessionData * SessionData,
+    TFTPSegmentedDownload * Download, const UnicodeString & Name);
+
+  TFTPSegmentedDownload * const Download;
+
+protected:
+  virtual TTerminal * __fastcall GetPasswordSource();
+
+private:
+  void __fastcall TerminalQueryUser(TObject * Sender,
+    const UnicodeString Query, TStrings * MoreMessages, unsigned int Answers,
+    const TQueryParams * Params, unsigned int & Answer, TQueryType Type, void * Arg);
+  void __fastcall TerminalPromptUser(TTerminal * Terminal, TPromptKind Kind,
+    UnicodeString Name, UnicodeString Instructions,
+    TStrings * Prompts, TStrings * Results, bool & Result, void * Arg);
+};
+//---------------------------------------------------------------------------
+__fastcall TFTPSegmentTerminal::TFTPSegmentTerminal(TTerminal * MainTerminal,
+    TSessionData * SessionData, TFTPSegmentedDownload * ADownload, const UnicodeString & Name) :
+  TSecondaryTerminal(MainTerminal, SessionData, MainTerminal->Configuration, Name),
+  Download(ADownload)
+{
+  AutoReadDirectory = false;
+  OnQueryUser = TerminalQueryUser;
+  OnPromptUser = TerminalPromptUser;
+}
+//---------------------------------------------------------------------------
+TTerminal * __fastcall TFTPSegmentTerminal::GetPasswordSource()
+{
+  // the main terminal is not to be accessed from the worker thread,
+  // its password is in the session data already
+  return this;
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPSegmentTerminal::TerminalQueryUser(TObject * /*Sender*/,
+  const UnicodeString /*Query*/, TStrings * /*MoreMessages*/, unsigned int Answers,
+  const TQueryParams * /*Params*/, unsigned int & Answer, TQueryType /*Type*/, void * /*Arg*/)
+{
+  // the query is logged by TTerminal::QueryUser already
+  Answer = AbortAnswer(Answers);
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPSegmentTerminal::TerminalPromptUser(TTerminal * /*Terminal*/,
+  TPromptKind /*Kind*/, UnicodeString Name, UnicodeString /*Instructions*/,
+  TStrings * /*Prompts*/, TStrings * /*Results*/, bool & Result, void * /*Arg*/)
+{
+  LogEvent(FORMAT(L"Cannot prompt for \"%s\" on segmented download connection.", (Name)));
+  Result = false;
+}
+//---------------------------------------------------------------------------
+class TFTPSegmentThread : public TSimpleThread
+{
+public:
+  __fastcall TFTPSegmentThread(TTerminal * MainTerminal, TSessionData * SessionData,
+    TFTPSegmentedDownload * Download, int Index);
+  virtual __fastcall ~TFTPSegmentThread();
+
+  virtual void __fastcall Terminate();
+
+protected:
+  virtual void __fastcall Execute();
+
+private:
+  TFTPSegmentTerminal * FTerminal;
+  TFTPSegmentedDownload * FDownload;
+};
+//---------------------------------------------------------------------------
+__fastcall TFTPSegmentThread::TFTPSegmentThread(TTerminal * MainTerminal,
+    TSessionData * SessionData, TFTPSegmentedDownload * Download, int Index) :
+  TSimpleThread(),
+  FDownload(Download)
+{
+  FTerminal = new TFTPSegmentTerminal(MainTerminal, SessionData, Download,
+    FORMAT(L"Segment %d", (Index)));
+}
+//---------------------------------------------------------------------------
+__fastcall TFTPSegmentThread::~TFTPSegmentThread()
+{
+  Close();
+  delete FTerminal;
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPSegmentThread::Terminate()
+{
+  // The download is cancelled already.
+  // A connection still being opened notices that in WaitForMessages,
+  // a transfer in its progress callback.
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPSegmentThread::Execute()
+{
+  bool Opened = false;
+  bool Failed = false;
+  try
+  {
+    FTerminal->Open();
+    Opened = true;
+    FDownload->ConnectionOpened();
+    TFTPFileSystem::DownloadSegments(FTerminal, FDownload);
+  }
+  catch(Exception & E)
+  {
+    // the segment, if any, is left for other connections
+    FTerminal->LogEvent(FORMAT(L"Segmented download connection failed: %s", (E.Message)));
+    Failed = true;
+  }
+  FDownload->ConnectionClosed(Opened, Failed);
+}
+//---------------------------------------------------------------------------
 __fastcall TFTPFileSystem::TFTPFileSystem(TTerminal * ATerminal):
   TCustomFileSystem(ATerminal),
   FFileZillaIntf(NULL),
@@ -256,7 +677,10 @@ __fastcall TFTPFileSystem::TFTPFileSystem(TTerminal * ATerminal):
   FFileSystemInfoValid(false),
   FDoListAll(false),
   FServerCapabilities(NULL),
-  FReadCurrentDirectory(false)
+  FReadCurrentDirectory(false),
+  FSegmentedDownload(NULL),
+  FSegmentIndex(-1),
+  FPipelinedResponses(NULL)
 {
   ResetReply();
 
@@ -1021,8 +1445,8 @@ bool __fastcall TFTPFileSystem::LoadFilesProperties(TStrings * /*FileList*/)
   return false;
 }
 //---------------------------------------------------------------------------
-UnicodeString __fastcall TFTPFileSystem::DoCalculateFileChecksum(
-  bool UsingHashCommand, const UnicodeString & Alg, TRemoteFile * File)
+UnicodeString __fastcall TFTPFileSystem::GetChecksumCommandName(
+  bool UsingHashCommand, const UnicodeString & Alg)
 {
   // Overview of server supporting various hash commands is at:
   // https://tools.ietf.org/html/draft-ietf-ftpext2-hash-03#appendix-B
@@ -1047,6 +1471,12 @@ UnicodeString __fastcall TFTPFileSystem::DoCalculateFileChecksum(
     }
   }
 
+  return CommandName;
+}
+//---------------------------------------------------------------------------
+UnicodeString __fastcall TFTPFileSystem::GetChecksumCommand(
+  const UnicodeString & CommandName, TRemoteFile * File)
+{
   UnicodeString FileName = File->FullFileName;
   // FTP way is not to quote.
   // But as Serv-U, GlobalSCAPE and possibly others allow
@@ -1071,10 +1501,12 @@ UnicodeString __fastcall TFTPFileSystem::DoCalculateFileChecksum(
     FileName = FORMAT(L"\"%s\"", (FileName));
   }
 
-  UnicodeString Command = FORMAT(L"%s %s", (CommandName, FileName));
-  SendCommand(Command);
-  UnicodeString ResponseText = GotReply(WaitForCommandReply(), REPLY_2XX_CODE | REPLY_SINGLE_LINE);
-
+  return FORMAT(L"%s %s", (CommandName, FileName));
+}
+//---------------------------------------------------------------------------
+UnicodeString __fastcall TFTPFileSystem::ParseChecksumResponse(
+  bool UsingHashCommand, const UnicodeString & CommandName, UnicodeString ResponseText)
+{
   UnicodeString Hash;
   if (UsingHashCommand)
   {
@@ -1128,12 +1560,108 @@ UnicodeString __fastcall TFTPFileSystem::DoCalculateFileChecksum(
   return LowerCase(Hash);
 }
 //---------------------------------------------------------------------------
+bool __fastcall TFTPFileSystem::DoCalculateFilesChecksumPipelined(bool UsingHashCommand,
+  const UnicodeString & Alg, TStrings * FileList, int Start, int Count, TStrings * Checksums,
+  TCalculatedChecksumEvent OnCalculatedChecksum,
+  TFileOperationProgressType * OperationProgress)
+{
+  UnicodeString CommandName = GetChecksumCommandName(UsingHashCommand, Alg);
+
+  // Commands separated by a new line are sent at once by FZ,
+  // so that we do not wait for a round trip for every file
+  UnicodeString Commands;
+  for (int Index = Start; Index < Start + Count; Index++)
+  {
+    TRemoteFile * File = (TRemoteFile *)FileList->Objects[Index];
+    AddToList(Commands, GetChecksumCommand(CommandName, File), L"\n");
+  }
+
+  OperationProgress->SetFile(((TRemoteFile *)FileList->Objects[Start])->FileName);
+
+  std::unique_ptr<TStrings> Responses(new TStringList());
+  unsigned int Reply;
+  FPipelinedResponses = Responses.get();
+  try
+  {
+    SendCommand(Commands);
+    Reply = WaitForCommandReply();
+  }
+  __finally
+  {
+    FPipelinedResponses = NULL;
+  }
+
+  // Failures of individual commands are reported for respective files below
+  if ((Reply != TFileZillaIntf::REPLY_OK) && (Reply != TFileZillaIntf::REPLY_ERROR))
+  {
+    GotReply(Reply, REPLY_2XX_CODE);
+  }
+  DebugAssert(Responses->Count == Count);
+
+  bool Result = true;
+  int Index = 0;
+  while (Result && (Index < Count))
+  {
+    TRemoteFile * File = (TRemoteFile *)FileList->Objects[Start + Index];
+    DebugAssert(File != NULL);
+
+    TChecksumSessionAction Action(FTerminal->ActionLog);
+    try
+    {
+      OperationProgress->SetFile(File->FileName);
+      Action.FileName(FTerminal->AbsolutePath(File->FullFileName, true));
+
+      UnicodeString ResponseText;
+      int Code = 0;
+      if (Index < Responses->Count)
+      {
+        ResponseText = Responses->Strings[Index];
+        Code = reinterpret_cast<int>(Responses->Objects[Index]);
+      }
+
+      // Accepting any 2xx single-line response, see ParseChecksumResponse
+      if (((Code / 100) != 2) || (ResponseText.Pos(L"\n") > 0))
+      {
+        throw Exception(FMTLOAD(FTP_RESPONSE_ERROR, (CommandName, ResponseText)));
+      }
+
+      UnicodeString Checksum = ParseChecksumResponse(UsingHashCommand, CommandName, ResponseText);
+
+      if (OnCalculatedChecksum != NULL)
+      {
+        OnCalculatedChecksum(File->FileName, Alg, Checksum);
+      }
+      Action.Checksum(Alg, Checksum);
+      if (Checksums != NULL)
+      {
+        Checksums->Add(Checksum);
+      }
+    }
+    catch (Exception & E)
+    {
+      FTerminal->RollbackAction(Action, OperationProgress, &E);
+
+      // Error formatting expanded from inline to avoid strange exceptions
+      UnicodeString Error =
+        FMTLOAD(CHECKSUM_ERROR,
+          (File != NULL ? File->FullFileName : UnicodeString(L"")));
+      FTerminal->CommandError(&E, Error);
+      // TODO: retries? resume?
+      Result = false;
+    }
+    Index++;
+  }
+
+  return Result;
+}
+//---------------------------------------------------------------------------
 void __fastcall TFTPFileSystem::DoCalculateFilesChecksum(bool UsingHashCommand,
   const UnicodeString & Alg, TStrings * FileList, TStrings * Checksums,
   TCalculatedChecksumEvent OnCalculatedChecksum,
   TFileOperationProgressType * OperationProgress, bool FirstLevel)
 {
   TOnceDoneOperation OnceDoneOperation; // not used
+  static int CalculateFilesChecksumPipelineLen = 16;
 
   int Index = 0;
   while ((Index < FileList->Count) && !OperationProgress->Cancel)
@@ -1185,42 +1713,29 @@ void __fastcall TFTPFileSystem::DoCalculateFilesChecksum(bool UsingHashCommand,
           }
         }
       }
+      Index++;
     }
     else
     {
-      TChecksumSessionAction Action(FTerminal->ActionLog);
-      try
+      // Calculate checksums of consecutive files in a pipeline
+      int Count = 0;
+      while ((Index + Count < FileList->Count) && (Count < CalculateFilesChecksumPipelineLen) &&
+             !((TRemoteFile *)FileList->Objects[Index + Count])->IsDirectory)
       {
-        OperationProgress->SetFile(File->FileName);
-        Action.FileName(FTerminal->AbsolutePath(File->FullFileName, true));
-
-        UnicodeString Checksum = DoCalculateFileChecksum(UsingHashCommand, Alg, File);
-
-        if (OnCalculatedChecksum != NULL)
-        {
-          OnCalculatedChecksum(File->FileName, Alg, Checksum);
-        }
-        Action.Checksum(Alg, Checksum);
-        if (Checksums != NULL)
-        {
-          Checksums->Add(Checksum);
-        }
+        Count++;
       }
-      catch (Exception & E)
-      {
-        FTerminal->RollbackAction(Action, OperationProgress, &E);
 
-        // Error formatting expanded from inline to avoid strange exceptions
-        UnicodeString Error =
-          FMTLOAD(CHECKSUM_ERROR,
-            (File != NULL ? File->FullFileName : UnicodeString(L"")));
-        FTerminal->CommandError(&E, Error);
+      if (!DoCalculateFilesChecksumPipelined(UsingHashCommand, Alg, FileList, Index, Count,
+             Checksums, OnCalculatedChecksum, OperationProgress))
+      {
         // Abort loop.
-        // TODO: retries? resume?
         Index = FileList->Count;
       }
+      else
+      {
+        Index += Count;
+      }
     }
-    Index++;
   }
 }
 //---------------------------------------------------------------------------
@@ -1468,7 +1983,32 @@ void __fastcall TFTPFileSystem::FileTransferProgress(__int64 TransferSize,
 {
   TGuard Guard(FTransferStatusCriticalSection);
 
-  DoFileTransferProgress(TransferSize, Bytes);
+  if (FSegmentedDownload != NULL)
+  {
+    SegmentTransferProgress(Bytes);
+  }
+  else
+  {
+    DoFileTransferProgress(TransferSize, Bytes);
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPFileSystem::SegmentTransferProgress(__int64 Bytes)
+{
+  FSegmentedDownload->Progress(this, FSegmentIndex, Bytes);
+
+  // only the main connection has the operation progress
+  if (FSegmentedDownload->MainFileSystem == this)
+  {
+    SegmentedDownloadProgress(FSegmentedDownload);
+  }
+
+  if (FSegmentedDownload->Cancelled)
+  {
+    FFileTransferCancelled = true;
+    FFileTransferAbort = ftaCancel;
+    FFileZillaIntf->Cancel();
+  }
 }
 //---------------------------------------------------------------------------
 void __fastcall TFTPFileSystem::FileTransfer(const UnicodeString & FileName,
@@ -1506,6 +2046,186 @@ void __fastcall TFTPFileSystem::FileTransfer(const UnicodeString & FileName,
   }
 }
 //---------------------------------------------------------------------------
+bool __fastcall TFTPFileSystem::CanDownloadSegmented(__int64 Size,
+  TFileOperationProgressType * OperationProgress)
+{
+  // Speed limit is applied per connection
+  return
+    (FTerminal->SessionData->FtpDownloadSegments > 1) &&
+    !OperationProgress->AsciiTransfer &&
+    (OperationProgress->CPSLimit == 0) &&
+    (Size >= 2 * SegmentedDownloadMinSegment);
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPFileSystem::DownloadSegmented(const UnicodeString & FileName,
+  const UnicodeString & LocalFile, const UnicodeString & RemoteFile,
+  const UnicodeString & RemotePath, __int64 Size, TFileTransferData & UserData,
+  TFileOperationProgressType * OperationProgress)
+{
+  int MaxConnections = FTerminal->SessionData->FtpDownloadSegments;
+  FTerminal->LogEvent(FORMAT(L"Downloading \"%s\" in segments over up to %d connections.", (FileName, MaxConnections)));
+
+  // Allocate the file in its full size, so that the segments can be written in any order
+  HANDLE Handle;
+  if (!FTerminal->CreateLocalFile(LocalFile, OperationProgress, &Handle, true))
+  {
+    THROW_SKIP_FILE_NULL;
+  }
+
+  try
+  {
+    FILE_OPERATION_LOOP_BEGIN
+    {
+      LARGE_INTEGER Position;
+      Position.QuadPart = Size;
+      THROWOSIFFALSE(SetFilePointerEx(Handle, Position, NULL, FILE_BEGIN) && SetEndOfFile(Handle));
+    }
+    FILE_OPERATION_LOOP_END(FMTLOAD(WRITE_ERROR, (LocalFile)));
+  }
+  __finally
+  {
+    CloseHandle(Handle);
+  }
+
+  TFTPSegmentedDownload Download(this, LocalFile, RemoteFile, RemotePath, Size, MaxConnections);
+  bool Complete = false;
+  try
+  {
+    // This connection downloads segments too.
+    // While waiting for the other connections, it takes over segments,
+    // they have failed with.
+    do
+    {
+      DoDownloadSegments(&Download);
+      if (Download.IsBusy())
+      {
+        Download.WaitForChange(GUIUpdateInterval);
+        SegmentedDownloadProgress(&Download);
+      }
+    }
+    while (Download.IsBusy() || (!Download.Cancelled && !Download.IsComplete()));
+
+    Complete = Download.IsComplete();
+  }
+  __finally
+  {
+    // stop the other connections, before touching the file
+    Download.Close();
+
+    if (!Complete)
+    {
+      // Keep only the part of the file downloaded continuously from its start,
+      // so that the transfer can be resumed
+      __int64 Prefix = Download.GetCompletePrefix();
+      FTerminal->LogEvent(FORMAT(L"Segmented download not completed, keeping first %s bytes of the file.", (IntToStr(Prefix))));
+      Handle = CreateFile(ApiPath(LocalFile).c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, 0);
+      if (Handle != INVALID_HANDLE_VALUE)
+      {
+        LARGE_INTEGER Position;
+        Position.QuadPart = Prefix;
+        SetFilePointerEx(Handle, Position, NULL, FILE_BEGIN);
+        SetEndOfFile(Handle);
+        CloseHandle(Handle);
+      }
+    }
+  }
+
+  if (OperationProgress->Cancel == csCancel)
+  {
+    FFileTransferCancelled = true;
+    Abort();
+  }
+
+  if (FFileTransferPreserveTime)
+  {
+    FILE_OPERATION_LOOP_BEGIN
+    {
+      Handle = CreateFile(ApiPath(LocalFile).c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, 0);
+      THROWOSIFFALSE(Handle != INVALID_HANDLE_VALUE);
+      PreserveDownloadFileTime(Handle, &UserData);
+      CloseHandle(Handle);
+    }
+    FILE_OPERATION_LOOP_END(FMTLOAD(CANT_SET_ATTRS, (LocalFile)));
+  }
+
+  DoFileTransferProgress(OperationProgress->TransferSize, OperationProgress->TransferSize);
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPFileSystem::DownloadSegments(TTerminal * Terminal, TFTPSegmentedDownload * Download)
+{
+  TFTPFileSystem * FileSystem = dynamic_cast<TFTPFileSystem *>(Terminal->FFileSystem);
+  DebugAssert(FileSystem != NULL);
+  FileSystem->DoDownloadSegments(Download);
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPFileSystem::DoDownloadSegments(TFTPSegmentedDownload * Download)
+{
+  int Index;
+  __int64 Start;
+  __int64 Length;
+  while (Download->Next(this, Index, Start, Length))
+  {
+    FTerminal->LogEvent(FORMAT(L"Downloading segment %d, %s bytes from offset %s.",
+      (Index + 1, IntToStr(Length), IntToStr(Start))));
+
+    bool Success = false;
+    FSegmentedDownload = Download;
+    FSegmentIndex = Index;
+    try
+    {
+      ResetFileTransfer();
+      FFileZillaIntf->DownloadRange(Download->LocalFile.c_str(), Download->RemoteFile.c_str(),
+        Download->RemotePath.c_str(), Download->Size, Start, Length, NULL);
+      unsigned int Reply = WaitForCommandReply();
+      GotReply(Reply, FLAGMASK(FFileTransferCancelled, REPLY_ALLOW_CANCEL));
+      Success = !FFileTransferCancelled;
+    }
+    __finally
+    {
+      FSegmentedDownload = NULL;
+      FSegmentIndex = -1;
+      Download->Done(this, Index, Success);
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TFTPFileSystem::SegmentedDownloadProgress(TFTPSegmentedDownload * Download)
+{
+  TFileOperationProgressType * OperationProgress = FTerminal->OperationProgress;
+
+  __int64 Diff = Download->GetTransferred() - OperationProgress->TransferedSize;
+  if (Diff > 0)
+  {
+    OperationProgress->AddTransfered(Diff);
+  }
+
+  if (OperationProgress->Cancel == csCancel)
+  {
+    Download->Cancel();
+  }
+  else if (Download->WantsConnection())
+  {
+    int Index = Download->Connections + 1;
+    FTerminal->LogEvent(FORMAT(L"Opening connection %d for segmented download.", (Index)));
+    // Credentials and answers of this connection are copied here, on the main thread,
+    // the new connection must not prompt the user from its worker thread
+    std::unique_ptr<TSessionData> SessionData(FTerminal->SessionData->Clone());
+    UnicodeString Password = FTerminal->RememberedPassword;
+    if (!Password.IsEmpty())
+    {
+      SessionData->Password = Password;
+    }
+    if (!FSessionInfo.CertificateFingerprint.IsEmpty())
+    {
+      // the certificate was verified by this connection already
+      SessionData->HostKey = FSessionInfo.CertificateFingerprint;
+    }
+    TFTPSegmentThread * Thread = new TFTPSegmentThread(FTerminal, SessionData.get(), Download, Index);
+    Download->AddThread(Thread);
+    Thread->Start();
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TFTPFileSystem::CopyToLocal(TStrings * FilesToCopy,
   const UnicodeString TargetDir, const TCopyParamType * CopyParam,
   int Params, TFileOperationProgressType * OperationProgress,
@@ -1717,8 +2437,19 @@ void __fastcall TFTPFileSystem::Sink(const UnicodeString FileName,
       UserData.AutoResume = FLAGSET(Flags, tfAutoResume);
       UserData.CopyParam = CopyParam;
       UserData.Modification = File->Modification;
-      FileTransfer(FileName, DestFullName, OnlyFileName,
-        FilePath, true, File->Size, TransferType, UserData, OperationProgress);
+      // With an existing target file, let the regular transfer handle
+      // the overwrite confirmation and resume
+      if ((Attrs == -1) && FLAGCLEAR(Flags, tfAutoResume) &&
+          CanDownloadSegmented(File->Size, OperationProgress))
+      {
+        DownloadSegmented(FileName, DestFullName, OnlyFileName,
+          FilePath, File->Size, UserData, OperationProgress);
+      }
+      else
+      {
+        FileTransfer(FileName, DestFullName, OnlyFileName,
+          FilePath, true, File->Size, TransferType, UserData, OperationProgress);
+      }
     }
 
     // in case dest filename is changed from overwrite dialog
@@ -3049,6 +3780,14 @@ int __fastcall TFTPFileSystem::GetOptionVal(int OptionID) const
       Result = Data->TcpNoDelay;
       break;
 
+    case OPTION_MPEXT_TRANSFER_SIZE:
+      Result = FTerminal->Configuration->FtpTransferBufferSize;
+      break;
+
+    case OPTION_MPEXT_RCVBUF:
+      Result = FTerminal->Configuration->FtpReceiveBuffer;
+      break;
+
     default:
       DebugFail();
       Result = FALSE;
@@ -3119,6 +3858,10 @@ void __fastcall TFTPFileSystem::WaitForMessages()
   {
     Result = WaitForSingleObject(FQueueEvent, GUIUpdateInterval);
     FTerminal->ProcessGUI();
+    if (Result == WAIT_TIMEOUT)
+    {
+      CheckSegmentConnectionCancelled();
+    }
   } while (Result == WAIT_TIMEOUT);
 
   if (Result != WAIT_OBJECT_0)
@@ -3127,6 +3870,18 @@ void __fastcall TFTPFileSystem::WaitForMessages()
   }
 }
 //---------------------------------------------------------------------------
+void __fastcall TFTPFileSystem::CheckSegmentConnectionCancelled()
+{
+  // A connection of a segmented download may still be connecting
+  // or waiting for a server response, while the download is being closed
+  TFTPSegmentTerminal * SegmentTerminal = dynamic_cast<TFTPSegmentTerminal *>(FTerminal);
+  if ((SegmentTerminal != NULL) && SegmentTerminal->Download->Cancelled &&
+      (FFileZillaIntf != NULL))
+  {
+    FFileZillaIntf->Cancel();
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TFTPFileSystem::PoolForFatalNonCommandReply()
 {
   DebugAssert(FReply == 0);
@@ -3574,6 +4329,11 @@ void __fastcall TFTPFileSystem::HandleReplyStatus(UnicodeString Response)
 
   if (!FMultineResponse)
   {
+    if (FPipelinedResponses != NULL)
+    {
+      FPipelinedResponses->AddObject(FLastResponse->Text.TrimRight(), reinterpret_cast<TObject *>(FLastCode));
+    }
+
     if (FLastCode == 220)
     {
       // HOST command also uses 220 response.
@@ -16,11 +16,13 @@ struct TListDataEntry;
 struct TFileTransferData;
 struct TFtpsCertificateData;
 struct TRemoteFileTime;
+class TFTPSegmentedDownload;
 //---------------------------------------------------------------------------
 class TFTPFileSystem : public TCustomFileSystem
 {
 friend class TFileZillaImpl;
 friend class TFileListHelper;
+friend class TFTPSegmentThread;
 
 public:
   __fastcall TFTPFileSystem(TTerminal * ATerminal);
@@ -180,6 +182,16 @@ protected:
     const UnicodeString & RemoteFile, const UnicodeString & RemotePath, bool Get,
     __int64 Size, int Type, TFileTransferData & UserData,
     TFileOperationProgressType * OperationProgress);
+  bool __fastcall CanDownloadSegmented(__int64 Size,
+    TFileOperationProgressType * OperationProgress);
+  void __fastcall DownloadSegmented(const UnicodeString & FileName, const UnicodeString & LocalFile,
+    const UnicodeString & RemoteFile, const UnicodeString & RemotePath, __int64 Size,
+    TFileTransferData & UserData, TFileOperationProgressType * OperationProgress);
+  void __fastcall DoDownloadSegments(TFTPSegmentedDownload * Download);
+  static void __fastcall DownloadSegments(TTerminal * Terminal, TFTPSegmentedDownload * Download);
+  void __fastcall SegmentedDownloadProgress(TFTPSegmentedDownload * Download);
+  void __fastcall SegmentTransferProgress(__int64 Bytes);
+  void __fastcall CheckSegmentConnectionCancelled();
   TDateTime __fastcall ConvertLocalTimestamp(time_t Time);
   void __fastcall RemoteFileTimeToDateTimeAndPrecision(const TRemoteFileTime & Source,
     TDateTime & DateTime, TModificationFmt & ModificationFmt);
@@ -190,7 +202,14 @@ protected:
   bool __fastcall SupportsReadingFile();
   void __fastcall AutoDetectTimeDifference(TRemoteFileList * FileList);
   void __fastcall ApplyTimeDifference(TRemoteFile * File);
-  UnicodeString __fastcall DoCalculateFileChecksum(bool UsingHashCommand, const UnicodeString & Alg, TRemoteFile * File);
+  UnicodeString __fastcall GetChecksumCommandName(bool UsingHashCommand, const UnicodeString & Alg);
+  UnicodeString __fastcall GetChecksumCommand(const UnicodeString & CommandName, TRemoteFile * File);
+  UnicodeString __fastcall ParseChecksumResponse(bool UsingHashCommand,
+    const UnicodeString & CommandName, UnicodeString ResponseText);
+  bool __fastcall DoCalculateFilesChecksumPipelined(bool UsingHashCommand,
+    const UnicodeString & Alg, TStrings * FileList, int Start, int Count, TStrings * Checksums,
+    TCalculatedChecksumEvent OnCalculatedChecksum,
+    TFileOperationProgressType * OperationProgress);
   void __fastcall DoCalculateFilesChecksum(bool UsingHashCommand, const UnicodeString & Alg,
     TStrings * FileList, TStrings * Checksums,
     TCalculatedChecksumEvent OnCalculatedChecksum,
@@ -254,6 +273,8 @@ private:
   bool FFileTransferPreserveTime;
   bool FFileTransferRemoveBOM;
   unsigned long FFileTransferCPSLimit;
+  TFTPSegmentedDownload * FSegmentedDownload;
+  int FSegmentIndex;
   bool FAwaitingProgress;
   TCaptureOutputEvent FOnCaptureOutput;
   UnicodeString FUserName;
@@ -270,6 +291,7 @@ private:
   std::unique_ptr<TStrings> FHashAlgs;
   bool FSupportsAnyChecksumFeature;
   UnicodeString FLastCommandSent;
+  TStrings * FPipelinedResponses;
   X509 * FCertificate;
   EVP_PKEY * FPrivateKey;
   bool FTransferActiveImmediately;
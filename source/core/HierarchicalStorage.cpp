@@ -10,6 +10,7 @@
 #include <TextsCore.h>
 #include <StrUtils.hpp>
 #include <vector>
+#include <set>
 //---------------------------------------------------------------------------
 #pragma package(smart_init)
 //---------------------------------------------------------------------------
@@ -701,7 +702,8 @@ __fastcall TCustomIniFileStorage::TCustomIniFileStorage(const UnicodeString Stor
   THierarchicalStorage(Storage),
   FIniFile(IniFile),
   FMasterStorageOpenFailures(0),
-  FOpeningSubKey(false)
+  FOpeningSubKey(false),
+  FCurrentSectionValid(false)
 {
 }
 //---------------------------------------------------------------------------
@@ -717,7 +719,14 @@ UnicodeString __fastcall TCustomIniFileStorage::GetSource()
 //---------------------------------------------------------------------------
 UnicodeString __fastcall TCustomIniFileStorage::GetCurrentSection()
 {
-  return ExcludeTrailingBackslash(GetCurrentSubKeyMunged());
+  // Needed by every read and write, so do not build it over and over again.
+  // The key history changes only in OpenSubKey and CloseSubKey.
+  if (!FCurrentSectionValid)
+  {
+    FCurrentSection = ExcludeTrailingBackslash(GetCurrentSubKeyMunged());
+    FCurrentSectionValid = true;
+  }
+  return FCurrentSection;
 }
 //---------------------------------------------------------------------------
 void __fastcall TCustomIniFileStorage::CacheSections()
@@ -735,6 +744,24 @@ void __fastcall TCustomIniFileStorage::ResetCache()
   FSections.reset(NULL);
 }
 //---------------------------------------------------------------------------
+void __fastcall TCustomIniFileStorage::AddCurrentSectionToCache()
+{
+  // Writing a value can create the current section only. Resetting the cache
+  // instead made saving of large site lists re-read and re-sort all sections
+  // for every site.
+  if (FSections.get() != NULL)
+  {
+    UnicodeString Section = CurrentSection;
+    int Index;
+    // the write may have been ignored (TOptionsIniFile)
+    if (!FSections->Find(Section, Index) &&
+        FIniFile->SectionExists(Section))
+    {
+      FSections->Add(Section);
+    }
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TCustomIniFileStorage::SetAccessMode(TStorageAccessMode value)
 {
   if (FMasterStorage.get() != NULL)
@@ -784,6 +811,7 @@ bool __fastcall TCustomIniFileStorage::OpenSubKey(UnicodeString Key, bool CanCre
     TAutoFlag Flag(FOpeningSubKey);
     Result = THierarchicalStorage::OpenSubKey(Key, CanCreate, Path);
   }
+  FCurrentSectionValid = false;
 
   if (FMasterStorage.get() != NULL)
   {
@@ -797,6 +825,7 @@ bool __fastcall TCustomIniFileStorage::OpenSubKey(UnicodeString Key, bool CanCre
       if (!Result && MasterResult)
       {
         Result = THierarchicalStorage::OpenSubKey(Key, true, Path);
+        FCurrentSectionValid = false;
         DebugAssert(Result);
       }
       else if (Result && !MasterResult)
@@ -812,6 +841,7 @@ bool __fastcall TCustomIniFileStorage::OpenSubKey(UnicodeString Key, bool CanCre
 void __fastcall TCustomIniFileStorage::CloseSubKey()
 {
   THierarchicalStorage::CloseSubKey();
+  FCurrentSectionValid = false;
 
   // What we are called to restore previous key from OpenSubKey,
   // when opening path component fails, the master storage was not involved yet
@@ -855,21 +885,28 @@ void __fastcall TCustomIniFileStorage::GetSubKeyNames(Classes::TStrings* Strings
   {
     FMasterStorage->GetSubKeyNames(Strings);
   }
+  // Strings->IndexOf made this quadratic with large site lists
+  std::set<UnicodeString> Added;
+  for (int Index = 0; Index < Strings->Count; Index++)
+  {
+    Added.insert(AnsiUpperCase(Strings->Strings[Index]));
+  }
   CacheSections();
+  UnicodeString SubKey = CurrentSubKey;
   for (int i = 0; i < FSections->Count; i++)
   {
     UnicodeString Section = FSections->Strings[i];
-    if (AnsiCompareText(CurrentSubKey,
-        Section.SubString(1, CurrentSubKey.Length())) == 0)
+    if (AnsiCompareText(SubKey,
+        Section.SubString(1, SubKey.Length())) == 0)
     {
-      UnicodeString SubSection = Section.SubString(CurrentSubKey.Length() + 1,
-        Section.Length() - CurrentSubKey.Length());
+      UnicodeString SubSection = Section.SubString(SubKey.Length() + 1,
+        Section.Length() - SubKey.Length());
       int P = SubSection.Pos(L"\\");
       if (P)
       {
         SubSection.SetLength(P - 1);
       }
-      if (Strings->IndexOf(SubSection) < 0)
+      if (Added.insert(AnsiUpperCase(SubSection)).second)
       {
         Strings->Add(UnMungeStr(SubSection));
       }
@@ -1109,8 +1146,8 @@ void __fastcall TCustomIniFileStorage::WriteBool(const UnicodeString Name, bool
   {
     FMasterStorage->WriteBool(Name, Value);
   }
-  ResetCache();
   FIniFile->WriteBool(CurrentSection, MungeIniName(Name), Value);
+  AddCurrentSectionToCache();
 }
 //---------------------------------------------------------------------------
 void __fastcall TCustomIniFileStorage::WriteInteger(const UnicodeString Name, int Value)
@@ -1119,8 +1156,8 @@ void __fastcall TCustomIniFileStorage::WriteInteger(const UnicodeString Name, in
   {
     FMasterStorage->WriteInteger(Name, Value);
   }
-  ResetCache();
   FIniFile->WriteInteger(CurrentSection, MungeIniName(Name), Value);
+  AddCurrentSectionToCache();
 }
 //---------------------------------------------------------------------------
 void __fastcall TCustomIniFileStorage::WriteInt64(const UnicodeString Name, __int64 Value)
@@ -1152,8 +1189,8 @@ void __fastcall TCustomIniFileStorage::WriteFloat(const UnicodeString Name, doub
 //---------------------------------------------------------------------------
 void __fastcall TCustomIniFileStorage::DoWriteStringRaw(const UnicodeString & Name, const UnicodeString & Value)
 {
-  ResetCache();
   FIniFile->WriteString(CurrentSection, MungeIniName(Name), Value);
+  AddCurrentSectionToCache();
 }
 //---------------------------------------------------------------------------
 void __fastcall TCustomIniFileStorage::WriteStringRaw(const UnicodeString Name, const UnicodeString Value)
@@ -177,6 +177,7 @@ public:
 
 private:
   UnicodeString __fastcall GetCurrentSection();
+  void __fastcall AddCurrentSectionToCache();
   inline bool __fastcall HandleByMasterStorage();
   inline bool __fastcall HandleReadByMasterStorage(const UnicodeString & Name);
   inline bool __fastcall DoValueExists(const UnicodeString & Value);
@@ -189,6 +190,8 @@ protected:
   std::unique_ptr<THierarchicalStorage> FMasterStorage;
   int FMasterStorageOpenFailures;
   bool FOpeningSubKey;
+  UnicodeString FCurrentSection;
+  bool FCurrentSectionValid;
 
   __property UnicodeString CurrentSection  = { read=GetCurrentSection };
   virtual void __fastcall SetAccessMode(TStorageAccessMode value);
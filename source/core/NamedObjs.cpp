@@ -12,7 +12,8 @@ int __fastcall NamedObjectSortProc(void * Item1, void * Item2)
   return static_cast<TNamedObject *>(Item1)->Compare(static_cast<TNamedObject *>(Item2));
 }
 //--- TNamedObject ----------------------------------------------------------
-__fastcall TNamedObject::TNamedObject(UnicodeString AName)
+__fastcall TNamedObject::TNamedObject(UnicodeString AName) :
+  FOwner(NULL)
 {
   Name = AName;
 }
@@ -21,6 +22,10 @@ void __fastcall TNamedObject::SetName(UnicodeString value)
 {
   FHidden = (value.SubString(1, TNamedObjectList::HiddenPrefix.Length()) == TNamedObjectList::HiddenPrefix);
   FName = value;
+  if (FOwner != NULL)
+  {
+    FOwner->FNameIndexValid = false;
+  }
 }
 //---------------------------------------------------------------------------
 int __fastcall TNamedObject::Compare(TNamedObject * Other)
@@ -77,6 +82,7 @@ __fastcall TNamedObjectList::TNamedObjectList():
   AutoSort = True;
   FHiddenCount = 0;
   FControlledAdd = false;
+  FNameIndexValid = false;
 }
 //---------------------------------------------------------------------------
 TNamedObject * __fastcall TNamedObjectList::AtObject(Integer Index)
@@ -119,17 +125,33 @@ int __fastcall TNamedObjectList::Add(TObject * AObject)
 //---------------------------------------------------------------------------
 void __fastcall TNamedObjectList::Notify(void *Ptr, TListNotification Action)
 {
+  TNamedObject * NamedObject = static_cast<TNamedObject *>(Ptr);
   if (Action == lnDeleted)
   {
-    TNamedObject * NamedObject = static_cast<TNamedObject *>(Ptr);
     if (NamedObject->Hidden && (FHiddenCount >= 0))
     {
       FHiddenCount--;
     }
   }
+  if ((Action == lnDeleted) || (Action == lnExtracted))
+  {
+    // Do not touch the index itself, this is called from the TObjectList destructor too
+    FNameIndexValid = false;
+    if (NamedObject->FOwner == this)
+    {
+      NamedObject->FOwner = NULL;
+    }
+  }
   TObjectList::Notify(Ptr, Action);
   if (Action == lnAdded)
   {
+    NamedObject->FOwner = this;
+    if (FNameIndexValid)
+    {
+      // keeps an existing entry, the names are unique anyway
+      FNameIndex.insert(std::make_pair(NameIndexKey(NamedObject->Name), NamedObject));
+    }
+
     if (!FControlledAdd)
     {
       FHiddenCount = -1;
@@ -141,19 +163,40 @@ void __fastcall TNamedObjectList::Notify(void *Ptr, TListNotification Action)
   }
 }
 //---------------------------------------------------------------------------
-TNamedObject * __fastcall TNamedObjectList::FindByName(const UnicodeString & Name)
+UnicodeString __fastcall TNamedObjectList::NameIndexKey(const UnicodeString & Name)
+{
+  // Matches TNamedObject::IsSameName
+  return AnsiUpperCase(Name);
+}
+//---------------------------------------------------------------------------
+void __fastcall TNamedObjectList::BuildNameIndex()
 {
-  // This should/can be optimized when list is sorted
+  FNameIndex.clear();
   for (Integer Index = 0; Index < CountIncludingHidden; Index++)
   {
-    // Not using AtObject as we iterate even hidden objects here
+    // Not using AtObject as we index even hidden objects here
     TNamedObject * NamedObject = static_cast<TNamedObject *>(Items[Index]);
-    if (NamedObject->IsSameName(Name))
-    {
-      return NamedObject;
-    }
+    FNameIndex.insert(std::make_pair(NameIndexKey(NamedObject->Name), NamedObject));
+  }
+  FNameIndexValid = true;
+}
+//---------------------------------------------------------------------------
+TNamedObject * __fastcall TNamedObjectList::FindByName(const UnicodeString & Name)
+{
+  // With thousands of sites, the linear search made loading and
+  // resolving sites quadratic. The index is rebuilt lazily, after objects
+  // are removed or renamed.
+  if (!FNameIndexValid)
+  {
+    BuildNameIndex();
   }
-  return NULL;
+  TNamedObject * Result = NULL;
+  TNameIndex::const_iterator I = FNameIndex.find(NameIndexKey(Name));
+  if ((I != FNameIndex.end()) && I->second->IsSameName(Name))
+  {
+    Result = I->second;
+  }
+  return Result;
 }
 //---------------------------------------------------------------------------
 void __fastcall TNamedObjectList::SetCount(int value)
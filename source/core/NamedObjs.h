@@ -4,14 +4,16 @@
 
 #include <system.hpp>
 #include <contnrs.hpp>
+#include <map>
 //---------------------------------------------------------------------------
 class TNamedObjectList;
 class TNamedObject : public TPersistent
 {
+friend class TNamedObjectList;
 public:
   __property UnicodeString Name = { read = FName, write = SetName };
   __property bool Hidden = { read = FHidden };
-  __fastcall TNamedObject() {};
+  __fastcall TNamedObject() : FOwner(NULL) {};
   bool __fastcall IsSameName(const UnicodeString & Name);
   virtual int __fastcall Compare(TNamedObject * Other);
   __fastcall TNamedObject(UnicodeString aName);
@@ -19,17 +21,24 @@ public:
 private:
   UnicodeString FName;
   bool FHidden;
+  TNamedObjectList * FOwner;
 
   void __fastcall SetName(UnicodeString value);
 };
 //---------------------------------------------------------------------------
 class TNamedObjectList : public TObjectList
 {
+friend class TNamedObject;
 private:
   int __fastcall GetCount();
   int __fastcall GetCountIncludingHidden();
   virtual void __fastcall Notify(void *Ptr, TListNotification Action);
   void __fastcall SetCount(int value);
+  typedef std::map<UnicodeString, TNamedObject *> TNameIndex;
+  TNameIndex FNameIndex;
+  bool FNameIndexValid;
+  static UnicodeString __fastcall NameIndexKey(const UnicodeString & Name);
+  void __fastcall BuildNameIndex();
 protected:
   int FHiddenCount;
   bool FControlledAdd;
@@ -10,6 +10,8 @@
 #include "CoreMain.h"
 #include "TextsCore.h"
 #include <StrUtils.hpp>
+#include <set>
+#include <vector>
 //---------------------------------------------------------------------------
 char sshver[50];
 const int platform_uses_x11_unix_by_default = TRUE;
@@ -17,8 +19,9 @@ CRITICAL_SECTION putty_section;
 bool SaveRandomSeed;
 char appname_[50];
 const char *const appname = appname_;
-extern const int share_can_be_downstream = FALSE;
-extern const int share_can_be_upstream = FALSE;
+extern const int share_can_be_downstream = TRUE;
+extern const int share_can_be_upstream = TRUE;
+TCriticalSection * SharedConnectionSection = NULL;
 //---------------------------------------------------------------------------
 extern "C"
 {
@@ -34,6 +37,7 @@ void __fastcall PuttyInitialize()
   SaveRandomSeed = true;
 
   InitializeCriticalSection(&putty_section);
+  SharedConnectionSection = new TCriticalSection();
 
   // make sure random generator is initialised, so random_save_seed()
   // in destructor can proceed
@@ -61,6 +65,8 @@ void __fastcall PuttyFinalize()
 
   sk_cleanup();
   win_misc_cleanup();
+  delete SharedConnectionSection;
+  SharedConnectionSection = NULL;
   DeleteCriticalSection(&putty_section);
 }
 //---------------------------------------------------------------------------
@@ -390,6 +396,386 @@ char * get_remote_username(Conf * conf)
   return result;
 }
 //---------------------------------------------------------------------------
+// Connection sharing
+//
+// PuTTY shares a connection among processes over a named pipe.
+// Our sessions all live in one process, each in its own thread,
+// so the upstream and its downstreams are connected with pairs
+// of in-memory sockets instead. Each end of the pair is serviced
+// by the thread of its session, see ProcessSharedConnections().
+// The upstream is a dedicated session with its own thread,
+// see TSharedConnection. The listeners are registered by it,
+// not by the name PuTTY derives from the host and the user,
+// so that only the sessions it was opened for can use it.
+//---------------------------------------------------------------------------
+struct TSharedListener;
+//---------------------------------------------------------------------------
+struct TSharedSocket
+{
+  const struct socket_function_table * fn;
+  Plug SocketPlug;
+  TSecureShell * Owner;
+  TSharedSocket * Peer;
+  // Set until the upstream accepts the connection
+  TSharedListener * Listener;
+  bool Downstream;
+  RawByteString Incoming;
+  bool Frozen;
+  bool PeerClosed;
+  bool ClosingNotified;
+};
+//---------------------------------------------------------------------------
+struct TSharedListener
+{
+  const struct socket_function_table * fn;
+  Plug SocketPlug;
+  TSecureShell * Owner;
+  TSharedConnection * SharedConnection;
+};
+//---------------------------------------------------------------------------
+typedef std::map<TSharedConnection *, TSharedListener *> TSharedListeners;
+typedef std::set<TSharedSocket *> TSharedSockets;
+static TSharedListeners SharedListeners;
+static TSharedSockets SharedSockets;
+//---------------------------------------------------------------------------
+static void SharedSocketNotify(TSharedSocket * SharedSocket)
+{
+  // to be called with SharedConnectionSection locked,
+  // what guarantees that the owner still exists
+  if (SharedSocket->Owner != NULL)
+  {
+    SharedSocket->Owner->NotifySharedConnection();
+  }
+}
+//---------------------------------------------------------------------------
+static void SharedSocketDetach(TSharedSocket * SharedSocket)
+{
+  // to be called with SharedConnectionSection locked
+  SharedSockets.erase(SharedSocket);
+  if (SharedSocket->Peer != NULL)
+  {
+    SharedSocket->Peer->Peer = NULL;
+    SharedSocket->Peer->PeerClosed = true;
+    SharedSocketNotify(SharedSocket->Peer);
+    SharedSocket->Peer = NULL;
+  }
+}
+//---------------------------------------------------------------------------
+static Plug SharedSocketPlug(Socket s, Plug p)
+{
+  TSharedSocket * SharedSocket = reinterpret_cast<TSharedSocket *>(s);
+  Plug Result = SharedSocket->SocketPlug;
+  if (p != NULL)
+  {
+    SharedSocket->SocketPlug = p;
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+static void SharedSocketClose(Socket s)
+{
+  TSharedSocket * SharedSocket = reinterpret_cast<TSharedSocket *>(s);
+  TSecureShell * DownstreamOwner = NULL;
+  {
+    TGuard Guard(SharedConnectionSection);
+    SharedSocketDetach(SharedSocket);
+    if (SharedSocket->Downstream)
+    {
+      DownstreamOwner = SharedSocket->Owner;
+    }
+  }
+
+  // we are in the thread of the downstream session
+  if (DownstreamOwner != NULL)
+  {
+    DownstreamOwner->UpdateSharedConnection(false);
+  }
+  delete SharedSocket;
+}
+//---------------------------------------------------------------------------
+static int SharedSocketWrite(Socket s, const char * data, int len)
+{
+  TSharedSocket * SharedSocket = reinterpret_cast<TSharedSocket *>(s);
+  TGuard Guard(SharedConnectionSection);
+  if (SharedSocket->Peer != NULL)
+  {
+    SharedSocket->Peer->Incoming += RawByteString(data, len);
+    SharedSocketNotify(SharedSocket->Peer);
+  }
+  // There's no backlog to report, the amount of data in flight
+  // is limited by windows of the individual SSH channels
+  return 0;
+}
+//---------------------------------------------------------------------------
+static void SharedSocketWriteEof(Socket s)
+{
+  TSharedSocket * SharedSocket = reinterpret_cast<TSharedSocket *>(s);
+  TGuard Guard(SharedConnectionSection);
+  if (SharedSocket->Peer != NULL)
+  {
+    SharedSocket->Peer->PeerClosed = true;
+    SharedSocketNotify(SharedSocket->Peer);
+  }
+}
+//---------------------------------------------------------------------------
+static void SharedSocketFlush(Socket /*s*/)
+{
+  // nothing
+}
+//---------------------------------------------------------------------------
+static void SharedSocketSetFrozen(Socket s, int is_frozen)
+{
+  TSharedSocket * SharedSocket = reinterpret_cast<TSharedSocket *>(s);
+  TGuard Guard(SharedConnectionSection);
+  SharedSocket->Frozen = (is_frozen != 0);
+  if (!SharedSocket->Frozen)
+  {
+    // deliver what has arrived meanwhile
+    SharedSocketNotify(SharedSocket);
+  }
+}
+//---------------------------------------------------------------------------
+static const char * SharedSocketError(Socket /*s*/)
+{
+  return NULL;
+}
+//---------------------------------------------------------------------------
+static char * SharedSocketPeerInfo(Socket /*s*/)
+{
+  return dupstr("in-process");
+}
+//---------------------------------------------------------------------------
+static const struct socket_function_table SharedSocketFunctions =
+{
+  SharedSocketPlug,
+  SharedSocketClose,
+  SharedSocketWrite,
+  SharedSocketWrite, // no out-of-band data
+  SharedSocketWriteEof,
+  SharedSocketFlush,
+  SharedSocketSetFrozen,
+  SharedSocketError,
+  SharedSocketPeerInfo
+};
+//---------------------------------------------------------------------------
+static TSharedSocket * NewSharedSocket(TSecureShell * Owner, bool Downstream)
+{
+  TSharedSocket * Result = new TSharedSocket();
+  Result->fn = &SharedSocketFunctions;
+  Result->SocketPlug = NULL;
+  Result->Owner = Owner;
+  Result->Peer = NULL;
+  Result->Listener = NULL;
+  Result->Downstream = Downstream;
+  Result->Frozen = false;
+  Result->PeerClosed = false;
+  Result->ClosingNotified = false;
+  return Result;
+}
+//---------------------------------------------------------------------------
+static Socket SharedSocketAccept(accept_ctx_t ctx, Plug plug)
+{
+  TSharedSocket * SharedSocket = static_cast<TSharedSocket *>(ctx.p);
+  {
+    TGuard Guard(SharedConnectionSection);
+    SharedSocket->SocketPlug = plug;
+    SharedSocket->Listener = NULL;
+  }
+  return reinterpret_cast<Socket>(SharedSocket);
+}
+//---------------------------------------------------------------------------
+static void SharedListenerClose(Socket s)
+{
+  TSharedListener * Listener = reinterpret_cast<TSharedListener *>(s);
+  {
+    TGuard Guard(SharedConnectionSection);
+    TSharedListeners::iterator I = SharedListeners.find(Listener->SharedConnection);
+    if ((I != SharedListeners.end()) && (I->second == Listener))
+    {
+      SharedListeners.erase(I);
+    }
+
+    // connections not accepted yet have nowhere to go
+    std::vector<TSharedSocket *> Pending;
+    for (TSharedSockets::iterator J = SharedSockets.begin(); J != SharedSockets.end(); J++)
+    {
+      if ((*J)->Listener == Listener)
+      {
+        Pending.push_back(*J);
+      }
+    }
+    for (size_t Index = 0; Index < Pending.size(); Index++)
+    {
+      SharedSocketDetach(Pending[Index]);
+      delete Pending[Index];
+    }
+  }
+  delete Listener;
+}
+//---------------------------------------------------------------------------
+static const struct socket_function_table SharedListenerFunctions =
+{
+  NULL, // no plug change
+  SharedListenerClose,
+  NULL, // no writing to listening socket
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  SharedSocketError,
+  NULL
+};
+//---------------------------------------------------------------------------
+int platform_ssh_share(const char * name, Conf * /*conf*/,
+  Plug downplug, Plug upplug, Socket * sock,
+  char ** logtext, char ** /*ds_err*/, char ** /*us_err*/,
+  int can_upstream, int can_downstream)
+{
+  int Result = SHARE_NONE;
+  // downplug is not SSH when only testing for upstream presence
+  TSecureShell * SecureShell =
+    is_ssh(downplug) ? reinterpret_cast<TSecureShell *>(get_ssh_frontend(downplug)) : NULL;
+
+  TSharedConnection * SharedConnection =
+    (SecureShell != NULL) ? SecureShell->SharedConnection : NULL;
+
+  if (SharedConnection != NULL)
+  {
+    TGuard Guard(SharedConnectionSection);
+    TSharedListeners::iterator I = SharedListeners.find(SharedConnection);
+    if (I != SharedListeners.end())
+    {
+      if (can_downstream)
+      {
+        TSharedListener * Listener = I->second;
+        TSharedSocket * Downstream = NewSharedSocket(SecureShell, true);
+        Downstream->SocketPlug = downplug;
+        TSharedSocket * Upstream = NewSharedSocket(Listener->Owner, false);
+        Upstream->Listener = Listener;
+        Downstream->Peer = Upstream;
+        Upstream->Peer = Downstream;
+        SharedSockets.insert(Downstream);
+        SharedSockets.insert(Upstream);
+        // the upstream accepts the connection in its own thread
+        SharedSocketNotify(Upstream);
+
+        *sock = reinterpret_cast<Socket>(Downstream);
+        Result = SHARE_DOWNSTREAM;
+      }
+    }
+    else if (can_upstream && SecureShell->SharedConnectionUpstream)
+    {
+      TSharedListener * Listener = new TSharedListener();
+      Listener->fn = &SharedListenerFunctions;
+      Listener->SocketPlug = upplug;
+      Listener->Owner = SecureShell;
+      Listener->SharedConnection = SharedConnection;
+      SharedListeners.insert(std::make_pair(Listener->SharedConnection, Listener));
+
+      *sock = reinterpret_cast<Socket>(Listener);
+      Result = SHARE_UPSTREAM;
+    }
+  }
+
+  if (Result != SHARE_NONE)
+  {
+    *logtext = dupstr(name);
+  }
+  if ((Result == SHARE_DOWNSTREAM) && (SecureShell != NULL))
+  {
+    SecureShell->UpdateSharedConnection(true);
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void platform_ssh_share_cleanup(const char * /*name*/)
+{
+  // nothing, the listener is unregistered when closed
+}
+//---------------------------------------------------------------------------
+bool __fastcall ProcessSharedConnections(void * Frontend)
+{
+  bool Result = false;
+  bool Any;
+  do
+  {
+    // Find one socket with pending work at a time,
+    // as the callback can close this or any other socket
+    enum { None, Accept, Receive, Closing } Action = None;
+    TSharedSocket * SharedSocket = NULL;
+    Plug APlug = NULL;
+    RawByteString Data;
+    {
+      TGuard Guard(SharedConnectionSection);
+      TSharedSockets::iterator I = SharedSockets.begin();
+      while ((Action == None) && (I != SharedSockets.end()))
+      {
+        SharedSocket = *I;
+        if (SharedSocket->Owner == Frontend)
+        {
+          if (SharedSocket->Listener != NULL)
+          {
+            Action = Accept;
+            APlug = SharedSocket->Listener->SocketPlug;
+          }
+          else if (!SharedSocket->Incoming.IsEmpty() && !SharedSocket->Frozen)
+          {
+            Action = Receive;
+            APlug = SharedSocket->SocketPlug;
+            Data = SharedSocket->Incoming;
+            SharedSocket->Incoming = RawByteString();
+          }
+          else if (SharedSocket->PeerClosed && SharedSocket->Incoming.IsEmpty() && !SharedSocket->ClosingNotified)
+          {
+            Action = Closing;
+            APlug = SharedSocket->SocketPlug;
+            SharedSocket->ClosingNotified = true;
+          }
+        }
+        I++;
+      }
+    }
+
+    Any = (Action != None);
+    switch (Action)
+    {
+      case Accept:
+        {
+          accept_ctx_t Ctx;
+          Ctx.p = SharedSocket;
+          if (plug_accepting(APlug, SharedSocketAccept, Ctx) != 0)
+          {
+            // rejected by upstream
+            TGuard Guard(SharedConnectionSection);
+            if (SharedSocket->Listener != NULL)
+            {
+              SharedSocketDetach(SharedSocket);
+              delete SharedSocket;
+            }
+          }
+        }
+        break;
+
+      case Receive:
+        plug_receive(APlug, 0, Data.c_str(), Data.Length());
+        Result = true;
+        break;
+
+      case Closing:
+        plug_closing(APlug, NULL, 0, 0);
+        Result = true;
+        break;
+    }
+  }
+  while (Any);
+
+  return Result;
+}
+//---------------------------------------------------------------------------
+// Handle of the host key "registry key", the keys are served by TConfiguration
+static int HostKeysKeyTag = 0;
+static const HKEY HostKeysKey = reinterpret_cast<HKEY>(&HostKeysKeyTag);
+//---------------------------------------------------------------------------
 static long OpenWinSCPKey(HKEY Key, const char * SubKey, HKEY * Result, bool CanCreate)
 {
   long R;
@@ -416,20 +802,12 @@ static long OpenWinSCPKey(HKEY Key, const char * SubKey, HKEY * Result, bool Can
   else
   {
     // we expect this to be called only from verify_host_key() or store_host_key()
-    DebugAssert(RegKey == L"SshHostKeys");
+    DebugAssert(RegKey == Configuration->SshHostKeysSubKey);
+    DebugUsedParam(CanCreate);
 
-    THierarchicalStorage * Storage = Configuration->CreateConfigStorage();
-    Storage->AccessMode = (CanCreate ? smReadWrite : smRead);
-    if (Storage->OpenSubKey(RegKey, CanCreate))
-    {
-      *Result = reinterpret_cast<HKEY>(Storage);
-      R = ERROR_SUCCESS;
-    }
-    else
-    {
-      delete Storage;
-      R = ERROR_CANTOPEN;
-    }
+    // no need to open the storage, the host keys are cached in memory
+    *Result = HostKeysKey;
+    R = ERROR_SUCCESS;
   }
 
   return R;
@@ -451,9 +829,8 @@ long reg_query_winscp_value_ex(HKEY Key, const char * ValueName, unsigned long *
   long R;
   DebugAssert(Configuration != NULL);
 
-  THierarchicalStorage * Storage = reinterpret_cast<THierarchicalStorage *>(Key);
   AnsiString Value;
-  if (Storage == NULL)
+  if (Key == NULL)
   {
     if (UnicodeString(ValueName) == L"RandSeedFile")
     {
@@ -468,9 +845,11 @@ long reg_query_winscp_value_ex(HKEY Key, const char * ValueName, unsigned long *
   }
   else
   {
-    if (Storage->ValueExists(ValueName))
+    DebugAssert(Key == HostKeysKey);
+    UnicodeString HostKey;
+    if (Configuration->ReadHostKey(ValueName, HostKey))
     {
-      Value = AnsiString(Storage->ReadStringRaw(ValueName, L""));
+      Value = AnsiString(HostKey);
       R = ERROR_SUCCESS;
     }
     else
@@ -499,12 +878,11 @@ long reg_set_winscp_value_ex(HKEY Key, const char * ValueName, unsigned long /*R
 
   DebugAssert(Type == REG_SZ);
   DebugUsedParam(Type);
-  THierarchicalStorage * Storage = reinterpret_cast<THierarchicalStorage *>(Key);
-  DebugAssert(Storage != NULL);
-  if (Storage != NULL)
+  DebugAssert(Key == HostKeysKey);
+  if (Key == HostKeysKey)
   {
     UnicodeString Value(reinterpret_cast<const char*>(Data), DataSize - 1);
-    Storage->WriteStringRaw(ValueName, Value);
+    Configuration->WriteHostKey(ValueName, Value);
   }
 
   return ERROR_SUCCESS;
@@ -514,11 +892,9 @@ long reg_close_winscp_key(HKEY Key)
 {
   DebugAssert(Configuration != NULL);
 
-  THierarchicalStorage * Storage = reinterpret_cast<THierarchicalStorage *>(Key);
-  if (Storage != NULL)
-  {
-    delete Storage;
-  }
+  // nothing to release, see OpenWinSCPKey
+  DebugAssert((Key == NULL) || (Key == HostKeysKey));
+  DebugUsedParam(Key);
 
   return ERROR_SUCCESS;
 }
@@ -764,4 +1140,68 @@ UnicodeString __fastcall Sha256(const char * Data, size_t Size)
   return Result;
 }
 //---------------------------------------------------------------------------
+static const struct ssh_hash * __fastcall FindChecksumHash(const UnicodeString & Alg)
+{
+  const struct ssh_hash * Result;
+  if (SameText(Alg, Sha1ChecksumAlg))
+  {
+    Result = &ssh_sha1;
+  }
+  else if (SameText(Alg, Sha256ChecksumAlg))
+  {
+    Result = &ssh_sha256;
+  }
+  else if (SameText(Alg, Sha384ChecksumAlg))
+  {
+    Result = &ssh_sha384;
+  }
+  else if (SameText(Alg, Sha512ChecksumAlg))
+  {
+    Result = &ssh_sha512;
+  }
+  else
+  {
+    Result = NULL;
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+bool __fastcall IsLocalChecksumAlg(const UnicodeString & Alg)
+{
+  return (FindChecksumHash(Alg) != NULL);
+}
+//---------------------------------------------------------------------------
+UnicodeString __fastcall CalculateStreamChecksum(TStream * Stream, const UnicodeString & Alg)
+{
+  const struct ssh_hash * Hash = FindChecksumHash(Alg);
+  if (Hash == NULL)
+  {
+    throw Exception(FMTLOAD(UNKNOWN_CHECKSUM, (Alg)));
+  }
+
+  void * Context = Hash->init();
+  try
+  {
+    std::vector<char> Buffer(128 * 1024);
+    int Read;
+    while ((Read = Stream->Read(&Buffer[0], Buffer.size())) > 0)
+    {
+      Hash->bytes(Context, &Buffer[0], Read);
+    }
+  }
+  catch(...)
+  {
+    Hash->free(Context);
+    throw;
+  }
+
+  // big enough for SHA-512
+  unsigned char Digest[64];
+  DebugAssert(Hash->hlen <= LENOF(Digest));
+  Hash->final(Context, Digest);
+  // lowercase, as SFTP checksums are
+  UnicodeString Result(BytesToHex(Digest, Hash->hlen, false));
+  return Result;
+}
+//---------------------------------------------------------------------------
 //---------------------------------------------------------------------------
@@ -6,6 +6,7 @@ void __fastcall PuttyInitialize();
 void __fastcall PuttyFinalize();
 //---------------------------------------------------------------------------
 void __fastcall DontSaveRandomSeed();
+bool __fastcall ProcessSharedConnections(void * Frontend);
 //---------------------------------------------------------------------------
 #include "PuttyTools.h"
 //---------------------------------------------------------------------------
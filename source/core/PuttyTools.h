@@ -31,5 +31,7 @@ UnicodeString __fastcall KeyTypeFromFingerprint(UnicodeString Fingerprint);
 UnicodeString __fastcall GetPuTTYVersion();
 //---------------------------------------------------------------------------
 UnicodeString __fastcall Sha256(const char * Data, size_t Size);
+bool __fastcall IsLocalChecksumAlg(const UnicodeString & Alg);
+UnicodeString __fastcall CalculateStreamChecksum(TStream * Stream, const UnicodeString & Alg);
 //---------------------------------------------------------------------------
 #endif
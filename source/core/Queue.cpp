@@ -410,6 +410,7 @@ __fastcall TTerminalQueue::TTerminalQueue(TTerminal * Terminal,
   TConfiguration * Configuration) :
   TSignalThread(true),
   FTerminal(Terminal), FTransfersLimit(2), FKeepDoneItemsFor(0), FEnabled(true),
+  FShareActionLog(false),
   FConfiguration(Configuration), FSessionData(NULL), FItems(NULL), FDoneItems(NULL),
   FTerminals(NULL), FItemsSection(NULL), FFreeTerminals(0),
   FItemsInProcess(0), FTemporaryTerminals(0), FOverallTerminals(0)
@@ -1138,6 +1139,7 @@ public:
 
 protected:
   virtual bool __fastcall DoQueryReopen(Exception * E);
+  virtual TActionLog * __fastcall GetActionLog();
 
 private:
   TTerminalItem * FItem;
@@ -1166,6 +1168,22 @@ bool __fastcall TBackgroundTerminal::DoQueryReopen(Exception * /*E*/)
   return Result;
 }
 //---------------------------------------------------------------------------
+TActionLog * __fastcall TBackgroundTerminal::GetActionLog()
+{
+  // Headless queues (scripting parallel transfers) record actions
+  // of all connections into the main XML log
+  TActionLog * Result;
+  if ((FItem != NULL) && FItem->FQueue->ShareActionLog)
+  {
+    Result = MainTerminal->ActionLog;
+  }
+  else
+  {
+    Result = TSecondaryTerminal::GetActionLog();
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
 // TTerminalItem
 //---------------------------------------------------------------------------
 __fastcall TTerminalItem::TTerminalItem(TTerminalQueue * Queue, int Index) :
@@ -79,6 +79,7 @@ public:
   __property int TransfersLimit = { read = FTransfersLimit, write = SetTransfersLimit };
   __property int KeepDoneItemsFor = { read = FKeepDoneItemsFor, write = SetKeepDoneItemsFor };
   __property bool Enabled = { read = FEnabled, write = SetEnabled };
+  __property bool ShareActionLog = { read = FShareActionLog, write = FShareActionLog };
   __property TQueryUserEvent OnQueryUser = { read = FOnQueryUser, write = FOnQueryUser };
   __property TPromptUserEvent OnPromptUser = { read = FOnPromptUser, write = FOnPromptUser };
   __property TExtendedExceptionEvent OnShowExtendedException = { read = FOnShowExtendedException, write = FOnShowExtendedException };
@@ -113,6 +114,7 @@ protected:
   int FTransfersLimit;
   int FKeepDoneItemsFor;
   bool FEnabled;
+  bool FShareActionLog;
   TDateTime FIdleInterval;
   TDateTime FLastIdle;
 
@@ -1442,6 +1442,8 @@ __fastcall TRemoteFileList::TRemoteFileList():
   TObjectList()
 {
   FTimestamp = Now();
+  FNotifiedCount = 0;
+  FOnFilesAdded = NULL;
 }
 //---------------------------------------------------------------------------
 void __fastcall TRemoteFileList::AddFile(TRemoteFile * File)
@@ -1450,6 +1452,17 @@ void __fastcall TRemoteFileList::AddFile(TRemoteFile * File)
   File->Directory = this;
 }
 //---------------------------------------------------------------------------
+void __fastcall TRemoteFileList::FilesAdded()
+{
+  // Called by the file systems whenever a batch of files was read
+  // (and finally by TTerminal once the listing is complete)
+  if ((FOnFilesAdded != NULL) && (Count > FNotifiedCount))
+  {
+    FOnFilesAdded(this, FNotifiedCount);
+    FNotifiedCount = Count;
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TRemoteFileList::DuplicateTo(TRemoteFileList * Copy)
 {
   Copy->Reset();
@@ -1465,6 +1478,7 @@ void __fastcall TRemoteFileList::DuplicateTo(TRemoteFileList * Copy)
 void __fastcall TRemoteFileList::Reset()
 {
   FTimestamp = Now();
+  FNotifiedCount = 0;
   Clear();
 }
 //---------------------------------------------------------------------------
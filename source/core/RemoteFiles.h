@@ -21,6 +21,9 @@ class TRights;
 class TRemoteFileList;
 class THierarchicalStorage;
 //---------------------------------------------------------------------------
+// Index is the first file added since the previous notification
+typedef void __fastcall (__closure *TRemoteFilesAddedEvent)(TRemoteFileList * FileList, int Index);
+//---------------------------------------------------------------------------
 class TRemoteToken
 {
 public:
@@ -201,6 +204,8 @@ friend class TWebDAVFileSystem;
 protected:
   UnicodeString FDirectory;
   TDateTime FTimestamp;
+  int FNotifiedCount;
+  TRemoteFilesAddedEvent FOnFilesAdded;
   TRemoteFile * __fastcall GetFiles(Integer Index);
   virtual void __fastcall SetDirectory(UnicodeString value);
   UnicodeString __fastcall GetFullDirectory();
@@ -214,6 +219,7 @@ public:
   TRemoteFile * __fastcall FindFile(const UnicodeString &FileName);
   virtual void __fastcall DuplicateTo(TRemoteFileList * Copy);
   virtual void __fastcall AddFile(TRemoteFile * File);
+  void __fastcall FilesAdded();
   __property UnicodeString Directory = { read = FDirectory, write = SetDirectory };
   __property TRemoteFile * Files[Integer Index] = { read = GetFiles };
   __property UnicodeString FullDirectory  = { read=GetFullDirectory };
@@ -221,6 +227,9 @@ public:
   __property UnicodeString ParentPath = { read = GetParentPath };
   __property __int64 TotalSize = { read = GetTotalSize };
   __property TDateTime Timestamp = { read = FTimestamp };
+  // Allows processing the files while the listing is still being read.
+  // The handler may delete the files it was notified about.
+  __property TRemoteFilesAddedEvent OnFilesAdded = { read = FOnFilesAdded, write = FOnFilesAdded };
 };
 //---------------------------------------------------------------------------
 class TRemoteDirectory : public TRemoteFileList
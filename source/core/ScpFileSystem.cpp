@@ -1695,7 +1695,15 @@ void __fastcall TSCPFileSystem::SCPSource(const UnicodeString FileName,
     &Attrs, &File, NULL, &MTime, &ATime, &Size);
 
   bool Dir = FLAGSET(Attrs, faDirectory);
-  TStream * Stream = new TSafeHandleStream((THandle)File);
+  TStream * Stream;
+  if (Dir)
+  {
+    Stream = new TSafeHandleStream((THandle)File);
+  }
+  else
+  {
+    Stream = FTerminal->CreateLocalFileStream(File, false);
+  }
   try
   {
     OperationProgress->SetFileInProgress();
@@ -1945,11 +1953,12 @@ void __fastcall TSCPFileSystem::SCPSource(const UnicodeString FileName,
   }
   __finally
   {
+    // the stream may still be reading from the handle
+    delete Stream;
     if (File != NULL)
     {
       CloseHandle(File);
     }
-    delete Stream;
   }
 
   /* TODO : Delete also read-only files. */
@@ -2510,7 +2519,7 @@ void __fastcall TSCPFileSystem::SCPSink(const UnicodeString TargetDir,
                   EXCEPTION;
                 }
 
-                FileStream = new TSafeHandleStream((THandle)File);
+                FileStream = FTerminal->CreateLocalFileStream(File, true);
               }
               catch (Exception &E)
               {
@@ -2574,6 +2583,14 @@ void __fastcall TSCPFileSystem::SCPSink(const UnicodeString TargetDir,
                 }
                 while (!OperationProgress->IsLocallyDone() || !
                     OperationProgress->IsTransferDone());
+
+                // wait for the data still being written behind
+                FILE_OPERATION_LOOP_BEGIN
+                {
+                  FlushStream(FileStream);
+                }
+                FILE_OPERATION_LOOP_END_EX(
+                  FMTLOAD(WRITE_ERROR, (DestFileName)), false);
               }
               catch (Exception &E)
               {
@@ -2610,8 +2627,9 @@ void __fastcall TSCPFileSystem::SCPSink(const UnicodeString TargetDir,
             }
             __finally
             {
-              if (File) CloseHandle(File);
+              // the stream may still be writing to the handle
               if (FileStream) delete FileStream;
+              if (File) CloseHandle(File);
             }
           }
           catch(Exception & E)
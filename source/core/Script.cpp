@@ -11,6 +11,10 @@
 #include "Terminal.h"
 #include "SessionData.h"
 #include "CoreMain.h"
+#include "Queue.h"
+
+#include <vector>
+#include <algorithm>
 //---------------------------------------------------------------------------
 #pragma package(smart_init)
 //---------------------------------------------------------------------------
@@ -343,6 +347,7 @@ void __fastcall TScript::Init()
   FKeepingUpToDate = false;
   FWarnNonDefaultCopyParam = false;
   FWarnNonDefaultSynchronizeParams = false;
+  FParallelFailed = false;
 
   FCommands = new TScriptCommands(this);
   FCommands->Register(L"help", SCRIPT_HELP_DESC, SCRIPT_HELP_HELP, &HelpProc, 0, -1, false);
@@ -352,8 +357,8 @@ void __fastcall TScript::Init()
   FCommands->Register(L"!", 0, SCRIPT_CALL_HELP2, &CallProc, 1, -1, true);
   FCommands->Register(L"pwd", SCRIPT_PWD_DESC, SCRIPT_PWD_HELP, &PwdProc, 0, 0, false);
   FCommands->Register(L"cd", SCRIPT_CD_DESC, SCRIPT_CD_HELP, &CdProc, 0, 1, false);
-  FCommands->Register(L"ls", SCRIPT_LS_DESC, SCRIPT_LS_HELP2, &LsProc, 0, 1, false);
-  FCommands->Register(L"dir", 0, SCRIPT_LS_HELP2, &LsProc, 0, 1, false);
+  FCommands->Register(L"ls", SCRIPT_LS_DESC, SCRIPT_LS_HELP2, &LsProc, 0, 1, true);
+  FCommands->Register(L"dir", 0, SCRIPT_LS_HELP2, &LsProc, 0, 1, true);
   FCommands->Register(L"rm", SCRIPT_RM_DESC, SCRIPT_RM_HELP2, &RmProc, 1, -1, false);
   FCommands->Register(L"rmdir", SCRIPT_RMDIR_DESC, SCRIPT_RMDIR_HELP, &RmDirProc, 1, -1, false);
   FCommands->Register(L"mv", SCRIPT_MV_DESC, SCRIPT_MV_HELP2, &MvProc, 2, -1, false);
@@ -362,12 +367,12 @@ void __fastcall TScript::Init()
   FCommands->Register(L"ln", SCRIPT_LN_DESC, SCRIPT_LN_HELP, &LnProc, 2, 2, false);
   FCommands->Register(L"symlink", 0, SCRIPT_LN_HELP, &LnProc, 2, 2, false);
   FCommands->Register(L"mkdir", SCRIPT_MKDIR_DESC, SCRIPT_MKDIR_HELP, &MkDirProc, 1, 1, false);
-  FCommands->Register(L"get", SCRIPT_GET_DESC, SCRIPT_GET_HELP8, &GetProc, 1, -1, true);
-  FCommands->Register(L"recv", 0, SCRIPT_GET_HELP8, &GetProc, 1, -1, true);
-  FCommands->Register(L"mget", 0, SCRIPT_GET_HELP8, &GetProc, 1, -1, true);
-  FCommands->Register(L"put", SCRIPT_PUT_DESC, SCRIPT_PUT_HELP8, &PutProc, 1, -1, true);
-  FCommands->Register(L"send", 0, SCRIPT_PUT_HELP8, &PutProc, 1, -1, true);
-  FCommands->Register(L"mput", 0, SCRIPT_PUT_HELP8, &PutProc, 1, -1, true);
+  FCommands->Register(L"get", SCRIPT_GET_DESC, SCRIPT_GET_HELP9, &GetProc, 1, -1, true);
+  FCommands->Register(L"recv", 0, SCRIPT_GET_HELP9, &GetProc, 1, -1, true);
+  FCommands->Register(L"mget", 0, SCRIPT_GET_HELP9, &GetProc, 1, -1, true);
+  FCommands->Register(L"put", SCRIPT_PUT_DESC, SCRIPT_PUT_HELP9, &PutProc, 1, -1, true);
+  FCommands->Register(L"send", 0, SCRIPT_PUT_HELP9, &PutProc, 1, -1, true);
+  FCommands->Register(L"mput", 0, SCRIPT_PUT_HELP9, &PutProc, 1, -1, true);
   FCommands->Register(L"option", SCRIPT_OPTION_DESC, SCRIPT_OPTION_HELP7, &OptionProc, -1, 2, false);
   FCommands->Register(L"ascii", 0, SCRIPT_OPTION_HELP7, &AsciiProc, 0, 0, false);
   FCommands->Register(L"binary", 0, SCRIPT_OPTION_HELP7, &BinaryProc, 0, 0, false);
@@ -377,6 +382,7 @@ void __fastcall TScript::Init()
   FCommands->Register(L"echo", SCRIPT_ECHO_DESC, SCRIPT_ECHO_HELP, &EchoProc, -1, -1, true);
   FCommands->Register(L"stat", SCRIPT_STAT_DESC, SCRIPT_STAT_HELP, &StatProc, 1, 1, false);
   FCommands->Register(L"checksum", SCRIPT_CHECKSUM_DESC, SCRIPT_CHECKSUM_HELP, &ChecksumProc, 2, 2, false);
+  FCommands->Register(L"stats", SCRIPT_STATS_DESC, SCRIPT_STATS_HELP, &StatsProc, 0, 0, false);
 }
 //---------------------------------------------------------------------------
 void __fastcall TScript::CheckDefaultCopyParam()
@@ -1064,6 +1070,116 @@ void __fastcall TScript::CopyParamParams(TCopyParamType & CopyParam, TScriptProc
   }
 }
 //---------------------------------------------------------------------------
+int __fastcall TScript::ParallelParams(TScriptProcParams * Parameters)
+{
+  int Result = 0;
+  UnicodeString Value;
+  if (Parameters->FindSwitch(L"parallel", Value))
+  {
+    if (!TryStrToInt(Value, Result) || (Result < 1))
+    {
+      throw Exception(FMTLOAD(SCRIPT_VALUE_UNKNOWN, (L"parallel", Value)));
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TScript::ParallelQueryUser(TObject * Sender,
+  const UnicodeString Query, TStrings * MoreMessages, unsigned int Answers,
+  const TQueryParams * Params, unsigned int & Answer, TQueryType QueryType,
+  void * Arg)
+{
+  if (FTerminal->OnQueryUser != NULL)
+  {
+    FTerminal->OnQueryUser(Sender, Query, MoreMessages, Answers, Params, Answer, QueryType, Arg);
+  }
+
+  // Skipping the file fails the transfer too, only a retry may still succeed
+  if ((QueryType == qtError) && (Answer != qaRetry))
+  {
+    FParallelFailed = true;
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TScript::ParallelShowExtendedException(
+  TTerminal * Terminal, Exception * E, void * Arg)
+{
+  // Errors the queue items continue after (e.g. skipped files)
+  // are reported only here
+  FParallelFailed = true;
+
+  if (FTerminal->OnShowExtendedException != NULL)
+  {
+    FTerminal->OnShowExtendedException(Terminal, E, Arg);
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TScript::ParallelTransfer(TStrings * FileList,
+  const UnicodeString & TargetDirectory, const TCopyParamType & CopyParam,
+  int Params, TOperationSide Side, int Parallel)
+{
+  // Each top-level file or directory makes one queue item,
+  // the queue dispatches the items over up to Parallel secondary connections.
+  // Transfer actions of the connections are recorded to the XML log
+  // of the main session, in order they were started.
+  std::unique_ptr<TTerminalQueue> Queue(new TTerminalQueue(FTerminal, Configuration));
+  Queue->TransfersLimit = Parallel;
+  Queue->ShareActionLog = true;
+  Queue->OnQueryUser = ParallelQueryUser;
+  Queue->OnPromptUser = FTerminal->OnPromptUser;
+  Queue->OnShowExtendedException = ParallelShowExtendedException;
+
+  FParallelFailed = false;
+
+  for (int Index = 0; Index < FileList->Count; Index++)
+  {
+    std::unique_ptr<TStrings> ItemFileList(new TStringList());
+    ItemFileList->AddObject(FileList->Strings[Index], FileList->Objects[Index]);
+
+    TQueueItem * QueueItem;
+    if (Side == osLocal)
+    {
+      QueueItem = new TUploadQueueItem(FTerminal, ItemFileList.get(), TargetDirectory, &CopyParam, Params, false);
+    }
+    else
+    {
+      QueueItem = new TDownloadQueueItem(FTerminal, ItemFileList.get(), TargetDirectory, &CopyParam, Params, false);
+    }
+    Queue->AddItem(QueueItem);
+  }
+
+  TTerminalQueueStatus * Status = NULL;
+  try
+  {
+    while (!Queue->IsEmpty)
+    {
+      Status = Queue->CreateStatus(Status);
+      for (int Index = 0; Index < Status->Count; Index++)
+      {
+        TQueueItemProxy * Proxy = Status->Items[Index];
+        if (TQueueItem::IsUserActionStatus(Proxy->Status))
+        {
+          Proxy->ProcessUserAction();
+        }
+      }
+
+      // keep the main session alive, while it is not used
+      FTerminal->Idle();
+      Queue->Idle();
+      Sleep(50);
+    }
+  }
+  __finally
+  {
+    delete Status;
+  }
+
+  if (FParallelFailed)
+  {
+    throw Exception(LoadStr(SCRIPT_PARALLEL_FAILED));
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TScript::ResetTransfer()
 {
 }
@@ -1206,6 +1322,15 @@ void __fastcall TScript::ChecksumProc(TScriptProcParams * Parameters)
   }
 }
 //---------------------------------------------------------------------------
+void __fastcall TScript::StatsProc(TScriptProcParams * /*Parameters*/)
+{
+  CheckSession();
+
+  UnicodeString Metrics = FTerminal->Metrics->ToJson();
+  PrintLine(Metrics);
+  TStatsSessionAction Action(FTerminal->ActionLog, Metrics);
+}
+//---------------------------------------------------------------------------
 void __fastcall TScript::TerminalCaptureLog(const UnicodeString & AddedLine,
   TCaptureOutputType OutputType)
 {
@@ -1243,6 +1368,39 @@ void __fastcall TScript::LsProc(TScriptProcParams * Parameters)
 {
   CheckSession();
 
+  bool Recursive = Parameters->FindSwitch(L"recursive");
+  UnicodeString FileMask;
+  bool HaveFileMask = Parameters->FindSwitch(L"filemask", FileMask);
+  UnicodeString DirectoriesName;
+  bool HaveDirectories = Parameters->FindSwitch(L"directories", DirectoriesName);
+  if (Recursive || HaveFileMask || HaveDirectories)
+  {
+    TLsDirectories Directories = ldMatch;
+    if (HaveDirectories)
+    {
+      static const wchar_t * DirectoriesNames[] = { L"none", L"match", L"all" };
+      int Value = TScriptCommands::FindCommand(DirectoriesNames, LENOF(DirectoriesNames), DirectoriesName);
+      if (Value < 0)
+      {
+        throw Exception(FMTLOAD(SCRIPT_VALUE_UNKNOWN, (DirectoriesName, L"directories")));
+      }
+      Directories = static_cast<TLsDirectories>(Value);
+    }
+
+    UnicodeString Directory =
+      (Parameters->ParamCount > 0) ? Parameters->Param[1] : FTerminal->CurrentDirectory;
+    TFileMasks Mask;
+    if (HaveFileMask)
+    {
+      Mask.SetMask(FileMask);
+    }
+    if (!LsEnumerate(Directory, Mask, Recursive, Directories) && HaveFileMask)
+    {
+      NoMatch(Mask.Masks, UnicodeString());
+    }
+    return;
+  }
+
   UnicodeString Directory;
   TFileMasks Mask;
   bool HaveMask = false;
@@ -1291,6 +1449,96 @@ void __fastcall TScript::LsProc(TScriptProcParams * Parameters)
   }
 }
 //---------------------------------------------------------------------------
+bool __fastcall TScript::LsEnumerate(const UnicodeString & Directory, const TFileMasks & Mask,
+  bool Recursive, TLsDirectories Directories)
+{
+  // The whole tree is walked here, in a single command, recording one compact
+  // <ls> action per directory, so that a client (the .NET assembly) can consume
+  // the entries as they come, instead of issuing "ls" for each directory.
+  bool Result = false;
+  std::vector<UnicodeString> Pending;
+  Pending.push_back(UnixIncludeTrailingBackslash(Directory));
+  while (!Pending.empty())
+  {
+    UnicodeString Path = Pending.back();
+    Pending.pop_back();
+
+    TLsSessionAction Action(FTerminal->ActionLog, FTerminal->AbsolutePath(Path, true));
+    Action.Recursive();
+
+    std::unique_ptr<TRemoteFileList> FileList;
+    try
+    {
+      FileList.reset(FTerminal->CustomReadDirectoryListing(Path, false));
+    }
+    catch (Exception & E)
+    {
+      Action.Rollback(&E);
+      throw;
+    }
+
+    // on error user may select "skip", then we get NULL
+    if (FileList.get() == NULL)
+    {
+      Action.Cancel();
+    }
+    else
+    {
+      std::unique_ptr<TRemoteFileList> Matches(new TRemoteFileList());
+      UnicodeString Output;
+      size_t SubdirectoriesStart = Pending.size();
+      for (int Index = 0; Index < FileList->Count; Index++)
+      {
+        TRemoteFile * File = FileList->Files[Index];
+        if (!File->IsThisDirectory && !File->IsParentDirectory)
+        {
+          bool Match;
+          if (File->IsDirectory && (Directories != ldMatch))
+          {
+            Match = (Directories == ldAll);
+          }
+          else
+          {
+            TFileMasks::TParams Params;
+            Params.Size = File->Size;
+            Params.Modification = File->Modification;
+            Match = Mask.Matches(File->FileName, File->IsDirectory, UnicodeString(), &Params);
+          }
+
+          if (Match)
+          {
+            Matches->AddFile(File->Duplicate(true));
+            Result = true;
+            AddToList(Output, File->ListingStr, L"\n");
+          }
+
+          // do not follow symlinks, to avoid loops
+          if (Recursive && File->IsDirectory && !File->IsSymLink)
+          {
+            Pending.push_back(UnixIncludeTrailingBackslash(Path + File->FileName));
+          }
+        }
+      }
+      // keep the listing order when walking the subdirectories
+      std::reverse(Pending.begin() + SubdirectoriesStart, Pending.end());
+
+      Action.FileList(Matches.get());
+
+      // one print per directory, to save round trips to the console
+      if (!Output.IsEmpty())
+      {
+        if (Recursive)
+        {
+          Output = Path + L":\n" + Output;
+        }
+        PrintLine(Output);
+      }
+    }
+  }
+
+  return Result;
+}
+//---------------------------------------------------------------------------
 void __fastcall TScript::RmProc(TScriptProcParams * Parameters)
 {
   CheckSession();
@@ -1422,9 +1670,17 @@ void __fastcall TScript::GetProc(TScriptProcParams * Parameters)
     int Params = 0;
     TransferParamParams(Params, Parameters);
     CopyParamParams(CopyParam, Parameters);
+    int Parallel = ParallelParams(Parameters);
     CheckParams(Parameters);
 
-    FTerminal->CopyToLocal(FileList, TargetDirectory, &CopyParam, Params);
+    if (Parallel > 1)
+    {
+      ParallelTransfer(FileList, TargetDirectory, CopyParam, Params, osRemote, Parallel);
+    }
+    else
+    {
+      FTerminal->CopyToLocal(FileList, TargetDirectory, &CopyParam, Params);
+    }
   }
   __finally
   {
@@ -1469,9 +1725,17 @@ void __fastcall TScript::PutProc(TScriptProcParams * Parameters)
     int Params = 0;
     TransferParamParams(Params, Parameters);
     CopyParamParams(CopyParam, Parameters);
+    int Parallel = ParallelParams(Parameters);
     CheckParams(Parameters);
 
-    FTerminal->CopyToRemote(FileList, TargetDirectory, &CopyParam, Params);
+    if (Parallel > 1)
+    {
+      ParallelTransfer(FileList, TargetDirectory, CopyParam, Params, osLocal, Parallel);
+    }
+    else
+    {
+      FTerminal->CopyToRemote(FileList, TargetDirectory, &CopyParam, Params);
+    }
   }
   __finally
   {
@@ -1882,8 +2146,8 @@ void __fastcall TScript::SynchronizeProc(TScriptProcParams * Parameters)
     }
     if (Parameters->FindSwitch(L"criteria", Value))
     {
-      enum { None, Time, Size, Either, EitherBoth };
-      static const wchar_t * CriteriaNames[] = { L"none", L"time", L"size", L"either", L"both" };
+      enum { None, Time, Size, Either, EitherBoth, Checksum };
+      static const wchar_t * CriteriaNames[] = { L"none", L"time", L"size", L"either", L"both", L"checksum" };
       int Criteria = TScriptCommands::FindCommand(CriteriaNames, LENOF(CriteriaNames), Value);
       switch (Criteria)
       {
@@ -1905,6 +2169,12 @@ void __fastcall TScript::SynchronizeProc(TScriptProcParams * Parameters)
           SynchronizeParams &= ~TTerminal::spNotByTime;
           SynchronizeParams |= TTerminal::spBySize;
           break;
+
+        case Checksum:
+          // time tells only the direction, size difference is implied
+          SynchronizeParams &= ~(TTerminal::spNotByTime | TTerminal::spBySize);
+          SynchronizeParams |= TTerminal::spByChecksum;
+          break;
       }
     }
     bool Preview = Parameters->FindSwitch(L"preview");
@@ -1963,7 +2233,8 @@ void __fastcall TScript::SynchronizeProc(TScriptProcParams * Parameters)
 //---------------------------------------------------------------------------
 void __fastcall TScript::Synchronize(const UnicodeString LocalDirectory,
   const UnicodeString RemoteDirectory, const TCopyParamType & CopyParam,
-  int SynchronizeParams, TSynchronizeChecklist ** Checklist)
+  int SynchronizeParams, TSynchronizeChecklist ** Checklist,
+  TSynchronizeOptions * Options)
 {
   try
   {
@@ -1971,7 +2242,7 @@ void __fastcall TScript::Synchronize(const UnicodeString LocalDirectory,
 
     TSynchronizeChecklist * AChecklist =
       FTerminal->SynchronizeCollect(LocalDirectory, RemoteDirectory, TTerminal::smRemote,
-        &CopyParam, SynchronizeParams, NULL, NULL);
+        &CopyParam, SynchronizeParams, NULL, Options);
     try
     {
       if (AChecklist->Count > 0)
@@ -59,7 +59,8 @@ public:
 
   void __fastcall Synchronize(const UnicodeString LocalDirectory,
     const UnicodeString RemoteDirectory, const TCopyParamType & CopyParam,
-    int SynchronizeParams, TSynchronizeChecklist ** Checklist);
+    int SynchronizeParams, TSynchronizeChecklist ** Checklist,
+    TSynchronizeOptions * Options);
 
   __property TScriptPrintEvent OnPrint = { read = FOnPrint, write = FOnPrint };
   __property TExtendedExceptionEvent OnShowExtendedException = { read = FOnShowExtendedException, write = FOnShowExtendedException };
@@ -100,6 +101,7 @@ protected:
   TStrings * FPendingLogLines;
   bool FWarnNonDefaultCopyParam;
   bool FWarnNonDefaultSynchronizeParams;
+  bool FParallelFailed;
 
   virtual void __fastcall ResetTransfer();
   virtual void __fastcall ConnectTerminal(TTerminal * ATerminal);
@@ -110,6 +112,16 @@ protected:
   void __fastcall CheckParams(TScriptProcParams * Parameters);
   void __fastcall CopyParamParams(TCopyParamType & CopyParam, TScriptProcParams * Parameters);
   void __fastcall TransferParamParams(int & Params, TScriptProcParams * Parameters);
+  int __fastcall ParallelParams(TScriptProcParams * Parameters);
+  void __fastcall ParallelTransfer(TStrings * FileList,
+    const UnicodeString & TargetDirectory, const TCopyParamType & CopyParam,
+    int Params, TOperationSide Side, int Parallel);
+  void __fastcall ParallelQueryUser(TObject * Sender,
+    const UnicodeString Query, TStrings * MoreMessages, unsigned int Answers,
+    const TQueryParams * Params, unsigned int & Answer, TQueryType QueryType,
+    void * Arg);
+  void __fastcall ParallelShowExtendedException(TTerminal * Terminal,
+    Exception * E, void * Arg);
   enum TFileListType
   {
     fltDefault =     0x00,
@@ -120,6 +132,9 @@ protected:
   };
   TStrings * __fastcall CreateFileList(TScriptProcParams * Parameters, int Start,
     int End, TFileListType ListType = fltDefault);
+  enum TLsDirectories { ldNone, ldMatch, ldAll };
+  bool __fastcall LsEnumerate(const UnicodeString & Directory, const TFileMasks & Mask,
+    bool Recursive, TLsDirectories Directories);
   TStrings * __fastcall CreateLocalFileList(TScriptProcParams * Parameters,
     int Start, int End, TFileListType ListType);
   void __fastcall FreeFiles(TStrings * FileList);
@@ -147,6 +162,7 @@ protected:
   void __fastcall EchoProc(TScriptProcParams * Parameters);
   void __fastcall StatProc(TScriptProcParams * Parameters);
   void __fastcall ChecksumProc(TScriptProcParams * Parameters);
+  void __fastcall StatsProc(TScriptProcParams * Parameters);
 
   void __fastcall OptionImpl(UnicodeString OptionName, UnicodeString ValueName);
   void __fastcall SynchronizeDirectories(TScriptProcParams * Parameters,
@@ -36,6 +36,7 @@ __fastcall TSecureShell::TSecureShell(TSessionUI* UI,
   FSessionData = SessionData;
   FLog = Log;
   FConfiguration = Configuration;
+  FMetrics = NULL;
   FActive = false;
   FWaiting = 0;
   FOpened = false;
@@ -50,6 +51,8 @@ __fastcall TSecureShell::TSecureShell(TSessionUI* UI,
   FSocketEvent = CreateEvent(NULL, false, false, NULL);
   FFrozen = false;
   FSimple = false;
+  FSharedConnection = NULL;
+  FSharedConnectionUpstream = false;
   FCollectPrivateKeyUsage = false;
   FWaitingForData = 0;
 }
@@ -105,6 +108,13 @@ inline void __fastcall TSecureShell::UpdateSessionInfo()
       FSessionInfo.CSCipher = CipherNames[FuncToSsh1Cipher(get_cipher(FBackendHandle))];
       FSessionInfo.SCCipher = CipherNames[FuncToSsh1Cipher(get_cipher(FBackendHandle))];
     }
+    else if (get_cscipher(FBackendHandle) == NULL)
+    {
+      // Over a shared connection, the encryption is handled by the session
+      // that owns the connection
+      FSessionInfo.CSCipher = L"";
+      FSessionInfo.SCCipher = L"";
+    }
     else
     {
       FSessionInfo.CSCipher = CipherNames[FuncToSsh2Cipher(get_cscipher(FBackendHandle))];
@@ -330,6 +340,12 @@ Conf * __fastcall TSecureShell::StoreToConfig(TSessionData * Data, bool Simple)
   conf_set_int(conf, CONF_connect_timeout, Data->Timeout * MSecsPerSec);
   conf_set_int(conf, CONF_sndbuf, Data->SendBuf);
 
+  // Connection sharing is set up in Open(),
+  // as it depends on the role of the session
+  conf_set_int(conf, CONF_ssh_connection_sharing, FALSE);
+  conf_set_int(conf, CONF_ssh_connection_sharing_upstream, FALSE);
+  conf_set_int(conf, CONF_ssh_connection_sharing_downstream, FALSE);
+
   // permanent settings
   conf_set_int(conf, CONF_nopty, TRUE);
   conf_set_int(conf, CONF_tcp_keepalives, 0);
@@ -366,6 +382,20 @@ void __fastcall TSecureShell::Open()
     Conf * conf = StoreToConfig(FSessionData, Simple);
     try
     {
+      // The upstream is a dedicated connection without a shell,
+      // the sessions open their channels over it as downstreams
+      // (see TSharedConnection and platform_ssh_share in PuttyIntf.cpp)
+      if (FSharedConnection != NULL)
+      {
+        conf_set_int(conf, CONF_ssh_connection_sharing, TRUE);
+        conf_set_int(conf, CONF_ssh_connection_sharing_upstream, FSharedConnectionUpstream);
+        conf_set_int(conf, CONF_ssh_connection_sharing_downstream, !FSharedConnectionUpstream);
+        if (FSharedConnectionUpstream)
+        {
+          conf_set_int(conf, CONF_ssh_no_shell, TRUE);
+        }
+      }
+
       InitError = FBackend->init(this, &FBackendHandle, conf,
         AnsiString(FSessionData->HostNameExpanded).c_str(), FSessionData->PortNumber, &RealHost,
         (FSessionData->TcpNoDelay ? 1 : 0),
@@ -535,8 +565,10 @@ void __fastcall TSecureShell::Init()
         WaitForData();
       }
 
-      // unless this is tunnel session, it must be safe to send now
-      DebugAssert(FBackend->sendok(FBackendHandle) || !FSessionData->TunnelPortFwd.IsEmpty());
+      // unless this is tunnel session or upstream of a shared connection,
+      // it must be safe to send now
+      DebugAssert(FBackend->sendok(FBackendHandle) || !FSessionData->TunnelPortFwd.IsEmpty() ||
+        FSharedConnectionUpstream);
     }
     catch(Exception & E)
     {
@@ -919,6 +951,10 @@ void __fastcall TSecureShell::FromBackend(bool IsStdErr, const unsigned char * D
   {
     LogEvent(FORMAT(L"Received %u bytes (%d)", (Length, int(IsStdErr))));
   }
+  if (FMetrics != NULL)
+  {
+    FMetrics->DataReceived(Length);
+  }
 
   // Following is taken from scp.c from_backend() and modified
 
@@ -1184,6 +1220,7 @@ void __fastcall TSecureShell::SendBuffer(unsigned int & Result)
 void __fastcall TSecureShell::DispatchSendBuffer(int BufSize)
 {
   TDateTime Start = Now();
+  unsigned int StallStart = GetTickCount();
   do
   {
     CheckConnection();
@@ -1193,7 +1230,13 @@ void __fastcall TSecureShell::DispatchSendBuffer(int BufSize)
         "need to send at least another %u bytes",
         (BufSize, BufSize - MAX_BUFSIZE)));
     }
-    EventSelectLoop(100, false, NULL);
+    // Instead of polling, block until FD_WRITE (socket drained) or
+    // FD_READ (e.g. window adjust) wakes us, at most until the timeout
+    TDateTime Deadline = Start + FSessionData->TimeoutDT;
+    TDateTime Current = Now();
+    unsigned int MSec =
+      (Current < Deadline) ? static_cast<unsigned int>(MilliSecondsBetween(Deadline, Current)) : 0;
+    EventSelectLoop(MSec, false, NULL);
     BufSize = FBackend->sendbuffer(FBackendHandle);
     if (Configuration->ActualLogProtocol >= 1)
     {
@@ -1225,6 +1268,11 @@ void __fastcall TSecureShell::DispatchSendBuffer(int BufSize)
     }
   }
   while (BufSize > MAX_BUFSIZE);
+
+  if (FMetrics != NULL)
+  {
+    FMetrics->SendBufferStall(GetTickCount() - StallStart);
+  }
 }
 //---------------------------------------------------------------------------
 void __fastcall TSecureShell::Send(const unsigned char * Buf, Integer Len)
@@ -1237,6 +1285,10 @@ void __fastcall TSecureShell::Send(const unsigned char * Buf, Integer Len)
     LogEvent(FORMAT(L"There are %u bytes remaining in the send buffer", (BufSize)));
   }
   FLastDataSent = Now();
+  if (FMetrics != NULL)
+  {
+    FMetrics->DataSent(Len);
+  }
   // among other forces receive of pending data to free the servers's send buffer
   EventSelectLoop(0, false, NULL);
 
@@ -1519,6 +1571,36 @@ void __fastcall TSecureShell::UpdateSocket(SOCKET value, bool Startup)
   }
 }
 //---------------------------------------------------------------------------
+void __fastcall TSecureShell::UpdateSharedConnection(bool Startup)
+{
+  // Counterpart of UpdateSocket for a session running over
+  // a connection of another session, which has no socket of its own
+  if (!FActive && !Startup)
+  {
+    // no-op, see UpdateSocket
+  }
+  else
+  {
+    DebugAssert(FSocket == INVALID_SOCKET);
+    if (Startup)
+    {
+      LogEvent(L"Using shared connection.");
+      FActive = true;
+    }
+    else
+    {
+      Discard();
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSecureShell::NotifySharedConnection()
+{
+  // Called from a thread of another session, that has queued data
+  // for our end of a shared connection
+  SetEvent(FSocketEvent);
+}
+//---------------------------------------------------------------------------
 void __fastcall TSecureShell::UpdatePortFwdSocket(SOCKET value, bool Startup)
 {
   if (Configuration->ActualLogProtocol >= 2)
@@ -1865,7 +1947,11 @@ bool __fastcall TSecureShell::EventSelectLoop(unsigned int MSec, bool ReadEventR
           LogEvent(L"Detected network event");
         }
 
-        if (Events == NULL)
+        if (FSocket == INVALID_SOCKET)
+        {
+          // session over shared connection, handled below
+        }
+        else if (Events == NULL)
         {
           if (ProcessNetworkEvents(FSocket))
           {
@@ -1880,6 +1966,11 @@ bool __fastcall TSecureShell::EventSelectLoop(unsigned int MSec, bool ReadEventR
           }
         }
 
+        if (ProcessSharedConnections(this))
+        {
+          Result = true;
+        }
+
         {
           TSockets::iterator i = FPortFwdSockets.begin();
           while (i != FPortFwdSockets.end())
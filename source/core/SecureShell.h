@@ -17,6 +17,7 @@ typedef struct _WSANETWORKEVENTS WSANETWORKEVENTS;
 typedef UINT_PTR SOCKET;
 typedef std::set<SOCKET> TSockets;
 struct TPuttyTranslation;
+class TSharedConnection;
 enum TSshImplementation { sshiUnknown, sshiOpenSSH, sshiProFTPD, sshiBitvise, sshiTitan, sshiOpenVMS, sshiCerberus };
 //---------------------------------------------------------------------------
 class TSecureShell
@@ -46,6 +47,8 @@ private:
   bool FOpened;
   int FWaiting;
   bool FSimple;
+  TSharedConnection * FSharedConnection;
+  bool FSharedConnectionUpstream;
   bool FNoConnectionResponse;
   bool FCollectPrivateKeyUsage;
   int FWaitingForData;
@@ -58,6 +61,7 @@ private:
   unsigned char * Pending;
   TSessionLog * FLog;
   TConfiguration * FConfiguration;
+  TSessionMetrics * FMetrics;
   bool FAuthenticating;
   bool FAuthenticated;
   UnicodeString FStdErrorTemp;
@@ -143,6 +147,8 @@ public:
   // interface to PuTTY core
   void __fastcall UpdateSocket(SOCKET value, bool Startup);
   void __fastcall UpdatePortFwdSocket(SOCKET value, bool Startup);
+  void __fastcall UpdateSharedConnection(bool Startup);
+  void __fastcall NotifySharedConnection();
   void __fastcall PuttyFatalError(UnicodeString Error);
   TPromptKind __fastcall IdentifyPromptKind(UnicodeString & Name);
   bool __fastcall PromptUser(bool ToServer,
@@ -168,8 +174,11 @@ public:
   __property UnicodeString LastTunnelError = { read = FLastTunnelError };
   __property UnicodeString UserName = { read = FUserName };
   __property bool Simple = { read = FSimple, write = FSimple };
+  __property TSharedConnection * SharedConnection = { read = FSharedConnection, write = FSharedConnection };
+  __property bool SharedConnectionUpstream = { read = FSharedConnectionUpstream, write = FSharedConnectionUpstream };
   __property TSshImplementation SshImplementation = { read = FSshImplementation };
   __property bool UtfStrings = { read = FUtfStrings, write = FUtfStrings };
+  __property TSessionMetrics * Metrics = { read = FMetrics, write = FMetrics };
 };
 //---------------------------------------------------------------------------
 #endif
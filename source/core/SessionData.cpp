@@ -17,6 +17,7 @@
 #include <XMLDoc.hpp>
 #include <StrUtils.hpp>
 #include <algorithm>
+#include <set>
 //---------------------------------------------------------------------------
 #pragma package(smart_init)
 //---------------------------------------------------------------------------
@@ -70,6 +71,7 @@ __fastcall TSessionData::TSessionData(UnicodeString aName):
 {
   Default();
   FModified = true;
+  FLoadPending = false;
 }
 //---------------------------------------------------------------------
 _fastcall TSessionData::~TSessionData()
@@ -134,6 +136,7 @@ void __fastcall TSessionData::Default()
   FPuttyProtocol = L"";
   TcpNoDelay = false;
   SendBuf = DefaultSendBuf;
+  ConnectionSharing = false;
   SshSimple = true;
   HostKey = L"";
   FOverrideCachedHostKey = true;
@@ -225,6 +228,7 @@ void __fastcall TSessionData::Default()
   FtpPingInterval = 30;
   FtpPingType = ptDummyCommand;
   FtpTransferActiveImmediately = asAuto;
+  FtpDownloadSegments = 1;
   Ftps = ftpsNone;
   MinTlsVersion = tls10;
   MaxTlsVersion = tls12;
@@ -315,6 +319,7 @@ void __fastcall TSessionData::NonPersistant()
   PROPERTY(TimeDifferenceAuto); \
   PROPERTY(TcpNoDelay); \
   PROPERTY(SendBuf); \
+  PROPERTY(ConnectionSharing); \
   PROPERTY(SshSimple); \
   PROPERTY(AuthKI); \
   PROPERTY(AuthKIPassword); \
@@ -371,6 +376,7 @@ void __fastcall TSessionData::NonPersistant()
   PROPERTY(FtpPingInterval); \
   PROPERTY(FtpPingType); \
   PROPERTY(FtpTransferActiveImmediately); \
+  PROPERTY(FtpDownloadSegments); \
   PROPERTY(FtpListAll); \
   PROPERTY(FtpHost); \
   PROPERTY(SslSessionReuse); \
@@ -586,6 +592,7 @@ void __fastcall TSessionData::DoLoad(THierarchicalStorage * Storage, bool & Rewr
   TcpNoDelay = Storage->ReadBool(L"TcpNoDelay", TcpNoDelay);
   SendBuf = Storage->ReadInteger(L"SendBuf", Storage->ReadInteger("SshSendBuf", SendBuf));
   SshSimple = Storage->ReadBool(L"SshSimple", SshSimple);
+  ConnectionSharing = Storage->ReadBool(L"ConnectionSharing", ConnectionSharing);
 
   ProxyMethod = (TProxyMethod)Storage->ReadInteger(L"ProxyMethod", ProxyMethod);
   ProxyHost = Storage->ReadString(L"ProxyHost", ProxyHost);
@@ -682,6 +689,7 @@ void __fastcall TSessionData::DoLoad(THierarchicalStorage * Storage, bool & Rewr
   FtpPingInterval = Storage->ReadInteger(L"FtpPingInterval", FtpPingInterval);
   FtpPingType = static_cast<TPingType>(Storage->ReadInteger(L"FtpPingType", FtpPingType));
   FtpTransferActiveImmediately = static_cast<TAutoSwitch>(Storage->ReadInteger(L"FtpTransferActiveImmediately2", FtpTransferActiveImmediately));
+  FtpDownloadSegments = Storage->ReadInteger(L"FtpDownloadSegments", FtpDownloadSegments);
   Ftps = static_cast<TFtps>(Storage->ReadInteger(L"Ftps", Ftps));
   FtpListAll = TAutoSwitch(Storage->ReadInteger(L"FtpListAll", FtpListAll));
   FtpHost = TAutoSwitch(Storage->ReadInteger(L"FtpHost", FtpHost));
@@ -850,6 +858,7 @@ void __fastcall TSessionData::DoSave(THierarchicalStorage * Storage,
   WRITE_DATA(Integer, RekeyTime);
 
   WRITE_DATA(Bool, TcpNoDelay);
+  WRITE_DATA(Bool, ConnectionSharing);
 
   if (PuttyExport)
   {
@@ -985,6 +994,7 @@ void __fastcall TSessionData::DoSave(THierarchicalStorage * Storage,
     WRITE_DATA(Integer, FtpPingInterval);
     WRITE_DATA(Integer, FtpPingType);
     WRITE_DATA_EX(Integer, L"FtpTransferActiveImmediately2", FtpTransferActiveImmediately, );
+    WRITE_DATA(Integer, FtpDownloadSegments);
     WRITE_DATA(Integer, Ftps);
     WRITE_DATA(Integer, FtpListAll);
     WRITE_DATA(Integer, FtpHost);
@@ -1342,19 +1352,16 @@ void __fastcall TSessionData::CacheHostKeyIfNotCached()
 {
   UnicodeString KeyType = KeyTypeFromFingerprint(HostKey);
 
-  UnicodeString TargetKey = Configuration->RegistryStorageKey + L"\\" + Configuration->SshHostKeysSubKey;
-  std::unique_ptr<TRegistryStorage> Storage(new TRegistryStorage(TargetKey));
-  Storage->AccessMode = smReadWrite;
-  if (Storage->OpenRootKey(true))
+  // go through the shared host key cache, so that the sessions see the key
+  UnicodeString HostKeyName = PuttyMungeStr(FORMAT(L"%s@%d:%s", (KeyType, PortNumber, HostName)));
+  UnicodeString CachedKey;
+  if (!Configuration->ReadHostKey(HostKeyName, CachedKey))
   {
-    UnicodeString HostKeyName = PuttyMungeStr(FORMAT(L"%s@%d:%s", (KeyType, PortNumber, HostName)));
-    if (!Storage->ValueExists(HostKeyName))
-    {
-      // fingerprint is MD5 of host key, so it cannot be translated back to host key,
-      // so we store fingerprint and TSecureShell::VerifyHostKey was
-      // modified to accept also fingerprint
-      Storage->WriteString(HostKeyName, HostKey);
-    }
+    // fingerprint is MD5 of host key, so it cannot be translated back to host key,
+    // so we store fingerprint and TSecureShell::VerifyHostKey was
+    // modified to accept also fingerprint
+    Configuration->WriteHostKey(HostKeyName, HostKey);
+    Configuration->FlushHostKeys();
   }
 }
 //---------------------------------------------------------------------
@@ -1491,25 +1498,27 @@ bool __fastcall TSessionData::ParseUrl(UnicodeString Url, TOptions * Options,
       for (Integer Index = 0; Index < StoredSessions->CountIncludingHidden; Index++)
       {
         TSessionData * AData = (TSessionData *)StoredSessions->Items[Index];
-        if (!AData->IsWorkspace)
+        bool Match = false;
+        // Comparison optimizations as this is called many times
+        // e.g. when updating jumplist
+        if ((AData->Name.Length() == DecodedUrl.Length()) &&
+            SameText(AData->Name, DecodedUrl))
         {
-          bool Match = false;
-          // Comparison optimizations as this is called many times
-          // e.g. when updating jumplist
-          if ((AData->Name.Length() == DecodedUrl.Length()) &&
-              SameText(AData->Name, DecodedUrl))
-          {
-            Match = true;
-          }
-          else if ((AData->Name.Length() < DecodedUrl.Length()) &&
-                   (DecodedUrl[AData->Name.Length() + 1] == L'/') &&
-                   // StrLIComp is an equivalent of SameText
-                   (StrLIComp(AData->Name.c_str(), DecodedUrl.c_str(), AData->Name.Length()) == 0))
-          {
-            Match = true;
-          }
+          Match = true;
+        }
+        else if ((AData->Name.Length() < DecodedUrl.Length()) &&
+                 (DecodedUrl[AData->Name.Length() + 1] == L'/') &&
+                 // StrLIComp is an equivalent of SameText
+                 (StrLIComp(AData->Name.c_str(), DecodedUrl.c_str(), AData->Name.Length()) == 0))
+        {
+          Match = true;
+        }
 
-          if (Match)
+        // Matching by name first, so that only the matched site needs to be loaded
+        if (Match)
+        {
+          StoredSessions->EnsureLoaded(AData);
+          if (!AData->IsWorkspace)
           {
             Data = AData;
             break;
@@ -3139,6 +3148,11 @@ void __fastcall TSessionData::SetSendBuf(int value)
   SET_SESSION_PROPERTY(SendBuf);
 }
 //---------------------------------------------------------------------
+void __fastcall TSessionData::SetConnectionSharing(bool value)
+{
+  SET_SESSION_PROPERTY(ConnectionSharing);
+}
+//---------------------------------------------------------------------
 void __fastcall TSessionData::SetSshSimple(bool value)
 {
   SET_SESSION_PROPERTY(SshSimple);
@@ -3394,6 +3408,11 @@ void __fastcall TSessionData::SetFtpTransferActiveImmediately(TAutoSwitch value)
   SET_SESSION_PROPERTY(FtpTransferActiveImmediately);
 }
 //---------------------------------------------------------------------------
+void __fastcall TSessionData::SetFtpDownloadSegments(int value)
+{
+  SET_SESSION_PROPERTY(FtpDownloadSegments);
+}
+//---------------------------------------------------------------------------
 void __fastcall TSessionData::SetFtps(TFtps value)
 {
   SET_SESSION_PROPERTY(Ftps);
@@ -3523,7 +3542,7 @@ UnicodeString __fastcall TSessionData::ComposePath(
 }
 //=== TStoredSessionList ----------------------------------------------
 __fastcall TStoredSessionList::TStoredSessionList(bool aReadOnly):
-  TNamedObjectList(), FReadOnly(aReadOnly)
+  TNamedObjectList(), FReadOnly(aReadOnly), FLoadPending(false)
 {
   DebugAssert(Configuration);
   FDefaultSettings = new TSessionData(DefaultName);
@@ -3536,10 +3555,11 @@ __fastcall TStoredSessionList::~TStoredSessionList()
 }
 //---------------------------------------------------------------------
 void __fastcall TStoredSessionList::Load(THierarchicalStorage * Storage,
-  bool AsModified, bool UseDefaults)
+  bool AsModified, bool UseDefaults, bool NamesOnly)
 {
   TStringList *SubKeys = new TStringList();
-  TList * Loaded = new TList;
+  // With large site lists, TList::IndexOf made the cleanup below quadratic
+  std::set<TObject *> Loaded;
   try
   {
     DebugAssert(AutoSort);
@@ -3596,8 +3616,19 @@ void __fastcall TStoredSessionList::Load(THierarchicalStorage * Storage,
             SessionData->Name = SessionName;
             Add(SessionData);
           }
-          Loaded->Add(SessionData);
-          SessionData->Load(Storage);
+          Loaded.insert(SessionData);
+          // With NamesOnly, the site is loaded on demand by EnsureLoaded/LoadPending,
+          // so that the console does not read a large site list as a whole
+          if (NamesOnly && (SessionData != FDefaultSettings))
+          {
+            SessionData->FLoadPending = true;
+            FLoadPending = true;
+          }
+          else
+          {
+            SessionData->Load(Storage);
+            SessionData->FLoadPending = false;
+          }
           if (AsModified)
           {
             SessionData->Modified = true;
@@ -3610,7 +3641,7 @@ void __fastcall TStoredSessionList::Load(THierarchicalStorage * Storage,
     {
       for (int Index = 0; Index < TObjectList::Count; Index++)
       {
-        if (Loaded->IndexOf(Items[Index]) < 0)
+        if (Loaded.find(Items[Index]) == Loaded.end())
         {
           Delete(Index);
           Index--;
@@ -3623,7 +3654,6 @@ void __fastcall TStoredSessionList::Load(THierarchicalStorage * Storage,
     AutoSort = true;
     AlphaSort();
     delete SubKeys;
-    delete Loaded;
   }
 }
 //---------------------------------------------------------------------
@@ -3642,6 +3672,42 @@ void __fastcall TStoredSessionList::Load()
   }
 }
 //---------------------------------------------------------------------
+void __fastcall TStoredSessionList::LoadPending()
+{
+  if (FLoadPending)
+  {
+    bool SessionList = true;
+    std::unique_ptr<THierarchicalStorage> Storage(Configuration->CreateScpStorage(SessionList));
+    if (Storage->OpenSubKey(Configuration->StoredSessionsSubKey, False))
+    {
+      for (int Index = 0; Index < CountIncludingHidden; Index++)
+      {
+        TSessionData * SessionData = (TSessionData *)Items[Index];
+        if (SessionData->FLoadPending)
+        {
+          SessionData->Load(Storage.get());
+          SessionData->FLoadPending = false;
+        }
+      }
+    }
+    FLoadPending = false;
+  }
+}
+//---------------------------------------------------------------------
+void __fastcall TStoredSessionList::EnsureLoaded(TSessionData * Data)
+{
+  if ((Data != NULL) && Data->FLoadPending)
+  {
+    bool SessionList = true;
+    std::unique_ptr<THierarchicalStorage> Storage(Configuration->CreateScpStorage(SessionList));
+    if (Storage->OpenSubKey(Configuration->StoredSessionsSubKey, False))
+    {
+      Data->Load(Storage.get());
+    }
+    Data->FLoadPending = false;
+  }
+}
+//---------------------------------------------------------------------
 void __fastcall TStoredSessionList::DoSave(THierarchicalStorage * Storage,
   TSessionData * Data, bool All, bool RecryptPasswordOnly,
   TSessionData * FactoryDefaults)
@@ -3662,6 +3728,11 @@ void __fastcall TStoredSessionList::DoSave(THierarchicalStorage * Storage,
 void __fastcall TStoredSessionList::DoSave(THierarchicalStorage * Storage,
   bool All, bool RecryptPasswordOnly, TStrings * RecryptPasswordErrors)
 {
+  if (All)
+  {
+    LoadPending();
+  }
+
   TSessionData * FactoryDefaults = new TSessionData(L"");
   try
   {
@@ -3814,6 +3885,7 @@ void __fastcall TStoredSessionList::SelectAll(bool Select)
 void __fastcall TStoredSessionList::Import(TStoredSessionList * From,
   bool OnlySelected, TList * Imported)
 {
+  From->LoadPending();
   for (int Index = 0; Index < From->Count; Index++)
   {
     if (!OnlySelected || From->Sessions[Index]->Selected)
@@ -3836,6 +3908,7 @@ void __fastcall TStoredSessionList::Import(TStoredSessionList * From,
 void __fastcall TStoredSessionList::SelectSessionsToImport
   (TStoredSessionList * Dest, bool SSHOnly)
 {
+  LoadPending();
   for (int Index = 0; Index < Count; Index++)
   {
     Sessions[Index]->Selected =
@@ -3869,6 +3942,13 @@ void __fastcall TStoredSessionList::Cleanup()
 //---------------------------------------------------------------------------
 void __fastcall TStoredSessionList::UpdateStaticUsage()
 {
+  // Do not load all sites just to collect the statistics,
+  // the GUI loads them before updating the usage (see Execute in WinMain.cpp)
+  if (FLoadPending)
+  {
+    return;
+  }
+
   int SCP = 0;
   int SFTP = 0;
   int FTP = 0;
@@ -4004,6 +4084,8 @@ TSessionData * __fastcall TStoredSessionList::FindSame(TSessionData * Data)
   else
   {
     Result = dynamic_cast<TSessionData *>(FindByName(Data->Name));
+    // the caller typically modifies and saves the site
+    EnsureLoaded(Result);
   }
   return Result;
 }
@@ -4019,6 +4101,7 @@ TSessionData * __fastcall TStoredSessionList::NewSession(
   UnicodeString SessionName, TSessionData * Session)
 {
   TSessionData * DuplicateSession = (TSessionData*)FindByName(SessionName);
+  EnsureLoaded(DuplicateSession);
   if (!DuplicateSession)
   {
     DuplicateSession = new TSessionData(L"");
@@ -4063,6 +4146,8 @@ void __fastcall TStoredSessionList::ImportHostKeys(const UnicodeString TargetKey
   TRegistryStorage * SourceStorage = NULL;
   TRegistryStorage * TargetStorage = NULL;
   TStringList * KeyList = NULL;
+  // the keys are written directly to the registry, bypassing the host key cache
+  Configuration->FlushHostKeys();
   try
   {
     SourceStorage = new TRegistryStorage(SourceKey);
@@ -4078,6 +4163,7 @@ void __fastcall TStoredSessionList::ImportHostKeys(const UnicodeString TargetKey
       TSessionData * Session;
       UnicodeString HostKeyName;
       DebugAssert(Sessions != NULL);
+      Sessions->LoadPending();
       for (int Index = 0; Index < Sessions->Count; Index++)
       {
         Session = Sessions->Sessions[Index];
@@ -4104,6 +4190,7 @@ void __fastcall TStoredSessionList::ImportHostKeys(const UnicodeString TargetKey
     delete SourceStorage;
     delete TargetStorage;
     delete KeyList;
+    Configuration->InvalidateHostKeys();
   }
 }
 //---------------------------------------------------------------------------
@@ -4124,10 +4211,12 @@ bool __fastcall TStoredSessionList::IsFolderOrWorkspace(
     }
   }
 
-  return
-    Result &&
-    DebugAlwaysTrue(FirstData != NULL) &&
-    (FirstData->IsWorkspace == Workspace);
+  if (Result && DebugAlwaysTrue(FirstData != NULL))
+  {
+    EnsureLoaded(FirstData);
+    Result = (FirstData->IsWorkspace == Workspace);
+  }
+  return Result;
 }
 //---------------------------------------------------------------------------
 bool __fastcall TStoredSessionList::IsFolder(const UnicodeString & Name)
@@ -4145,6 +4234,7 @@ TSessionData * __fastcall TStoredSessionList::CheckIsInFolderOrWorkspaceAndResol
 {
   if (Data->IsInFolderOrWorkspace(Name))
   {
+    EnsureLoaded(Data);
     Data = ResolveWorkspaceData(Data);
 
     if ((Data != NULL) && Data->CanLogin &&
@@ -4205,6 +4295,7 @@ TStrings * __fastcall TStoredSessionList::GetFolderOrWorkspaceList(
 //---------------------------------------------------------------------------
 TStrings * __fastcall TStoredSessionList::GetWorkspaces()
 {
+  LoadPending();
   std::unique_ptr<TStringList> Result(CreateSortedStringList());
 
   for (int Index = 0; (Index < Count); Index++)
@@ -4248,6 +4339,7 @@ void __fastcall TStoredSessionList::NewWorkspace(
 //---------------------------------------------------------------------------
 bool __fastcall TStoredSessionList::HasAnyWorkspace()
 {
+  LoadPending();
   bool Result = false;
   for (int Index = 0; !Result && (Index < Count); Index++)
   {
@@ -4291,6 +4383,7 @@ TSessionData * __fastcall TStoredSessionList::ResolveWorkspaceData(TSessionData
     Data = dynamic_cast<TSessionData *>(FindByName(Data->Link));
     if (Data != NULL)
     {
+      EnsureLoaded(Data);
       Data = ResolveWorkspaceData(Data);
     }
   }
@@ -116,6 +116,7 @@ private:
   UnicodeString FPuttyProtocol;
   TFSProtocol FFSProtocol;
   bool FModified;
+  bool FLoadPending;
   UnicodeString FLocalDirectory;
   UnicodeString FRemoteDirectory;
   bool FLockInHome;
@@ -136,6 +137,7 @@ private:
   bool FIgnoreLsWarnings;
   bool FTcpNoDelay;
   int FSendBuf;
+  bool FConnectionSharing;
   bool FSshSimple;
   TProxyMethod FProxyMethod;
   UnicodeString FProxyHost;
@@ -189,6 +191,7 @@ private:
   int FFtpPingInterval;
   TPingType FFtpPingType;
   TAutoSwitch FFtpTransferActiveImmediately;
+  int FFtpDownloadSegments;
   TFtps FFtps;
   TTlsVersion FMinTlsVersion;
   TTlsVersion FMaxTlsVersion;
@@ -276,6 +279,7 @@ private:
   void __fastcall SetIgnoreLsWarnings(bool value);
   void __fastcall SetTcpNoDelay(bool value);
   void __fastcall SetSendBuf(int value);
+  void __fastcall SetConnectionSharing(bool value);
   void __fastcall SetSshSimple(bool value);
   UnicodeString __fastcall GetSshProtStr();
   bool __fastcall GetUsesSsh();
@@ -342,6 +346,7 @@ private:
   void __fastcall SetFtpPingInterval(int value);
   void __fastcall SetFtpPingType(TPingType value);
   void __fastcall SetFtpTransferActiveImmediately(TAutoSwitch value);
+  void __fastcall SetFtpDownloadSegments(int value);
   void __fastcall SetFtps(TFtps value);
   void __fastcall SetMinTlsVersion(TTlsVersion value);
   void __fastcall SetMaxTlsVersion(TTlsVersion value);
@@ -511,6 +516,7 @@ public:
   __property bool IgnoreLsWarnings  = { read=FIgnoreLsWarnings, write=SetIgnoreLsWarnings };
   __property bool TcpNoDelay  = { read=FTcpNoDelay, write=SetTcpNoDelay };
   __property int SendBuf  = { read=FSendBuf, write=SetSendBuf };
+  __property bool ConnectionSharing  = { read=FConnectionSharing, write=SetConnectionSharing };
   __property bool SshSimple  = { read=FSshSimple, write=SetSshSimple };
   __property UnicodeString SshProtStr  = { read=GetSshProtStr };
   __property UnicodeString CipherList  = { read=GetCipherList, write=SetCipherList };
@@ -568,6 +574,7 @@ public:
   __property TDateTime FtpPingIntervalDT  = { read=GetFtpPingIntervalDT };
   __property TPingType FtpPingType = { read = FFtpPingType, write = SetFtpPingType };
   __property TAutoSwitch FtpTransferActiveImmediately = { read = FFtpTransferActiveImmediately, write = SetFtpTransferActiveImmediately };
+  __property int FtpDownloadSegments = { read = FFtpDownloadSegments, write = SetFtpDownloadSegments };
   __property TFtps Ftps = { read = FFtps, write = SetFtps };
   __property TTlsVersion MinTlsVersion = { read = FMinTlsVersion, write = SetMinTlsVersion };
   __property TTlsVersion MaxTlsVersion = { read = FMaxTlsVersion, write = SetMaxTlsVersion };
@@ -597,7 +604,9 @@ public:
   void __fastcall ImportFromFilezilla(const UnicodeString FileName);
   void __fastcall Export(const UnicodeString FileName);
   void __fastcall Load(THierarchicalStorage * Storage, bool AsModified = false,
-    bool UseDefaults = false);
+    bool UseDefaults = false, bool NamesOnly = false);
+  void __fastcall LoadPending();
+  void __fastcall EnsureLoaded(TSessionData * Data);
   void __fastcall Save(THierarchicalStorage * Storage, bool All = false);
   void __fastcall SelectAll(bool Select);
   void __fastcall Import(TStoredSessionList * From, bool OnlySelected, TList * Imported);
@@ -633,6 +642,7 @@ public:
 private:
   TSessionData * FDefaultSettings;
   bool FReadOnly;
+  bool FLoadPending;
   void __fastcall SetDefaultSettings(TSessionData * value);
   void __fastcall DoSave(THierarchicalStorage * Storage, bool All,
     bool RecryptPasswordOnly, TStrings * RecryptPasswordErrors);
@@ -7,6 +7,7 @@
 #define SECURITY_WIN32
 #include <sspi.h>
 #include <secext.h>
+#include <DateUtils.hpp>
 
 #include "Common.h"
 #include "SessionInfo.h"
@@ -142,7 +143,36 @@ public:
               (FNames->Strings[Index], XmlAttributeEscape(Value))));
           }
         }
-        if (FFileList != NULL)
+        if ((FFileList != NULL) && FRecursive)
+        {
+          // Recursive listings can be huge, so use a compact
+          // single-element-per-file form
+          FLog->AddIndented(L"  <files>");
+          for (int Index = 0; Index < FFileList->Count; Index++)
+          {
+            TRemoteFile * File = FFileList->Files[Index];
+
+            UnicodeString FileAttrs =
+              FORMAT(L"name=\"%s\" type=\"%s\"", (XmlAttributeEscape(File->FileName), XmlAttributeEscape(File->Type)));
+            if (!File->IsDirectory)
+            {
+              FileAttrs += FORMAT(L" size=\"%s\"", (IntToStr(File->Size)));
+            }
+            FileAttrs += FORMAT(L" modification=\"%s\" permissions=\"%s\"",
+              (StandardTimestamp(File->Modification), XmlAttributeEscape(File->Rights->Text)));
+            if (File->Owner.IsSet)
+            {
+              FileAttrs += FORMAT(L" owner=\"%s\"", (XmlAttributeEscape(File->Owner.DisplayText)));
+            }
+            if (File->Group.IsSet)
+            {
+              FileAttrs += FORMAT(L" group=\"%s\"", (XmlAttributeEscape(File->Group.DisplayText)));
+            }
+            FLog->AddIndented(FORMAT(L"    <file %s />", (FileAttrs)));
+          }
+          FLog->AddIndented(L"  </files>");
+        }
+        else if (FFileList != NULL)
         {
           FLog->AddIndented(L"  <files>");
           for (int Index = 0; Index < FFileList->Count; Index++)
@@ -283,6 +313,11 @@ public:
     Parameter(L"cwd", Path);
   }
 
+  void __fastcall Metrics(const UnicodeString & Metrics)
+  {
+    Parameter(L"metrics", Metrics);
+  }
+
   void __fastcall FileList(TRemoteFileList * FileList)
   {
     if (FFileList == NULL)
@@ -327,6 +362,7 @@ protected:
       case laStat: return L"stat";
       case laChecksum: return L"checksum";
       case laCwd: return L"cwd";
+      case laStats: return L"stats";
       default: DebugFail(); return L"";
     }
   }
@@ -567,6 +603,14 @@ __fastcall TLsSessionAction::TLsSessionAction(TActionLog * Log,
   }
 }
 //---------------------------------------------------------------------------
+void __fastcall TLsSessionAction::Recursive()
+{
+  if (FRecord != NULL)
+  {
+    FRecord->Recursive();
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TLsSessionAction::FileList(TRemoteFileList * FileList)
 {
   if (FRecord != NULL)
@@ -613,6 +657,15 @@ __fastcall TCwdSessionAction::TCwdSessionAction(TActionLog * Log, const UnicodeS
   }
 }
 //---------------------------------------------------------------------------
+__fastcall TStatsSessionAction::TStatsSessionAction(TActionLog * Log, const UnicodeString & Metrics) :
+  TSessionAction(Log, laStats)
+{
+  if (FRecord != NULL)
+  {
+    FRecord->Metrics(Metrics);
+  }
+}
+//---------------------------------------------------------------------------
 //---------------------------------------------------------------------------
 TSessionInfo::TSessionInfo()
 {
@@ -624,6 +677,119 @@ TFileSystemInfo::TFileSystemInfo()
   memset(&IsCapable, false, sizeof(IsCapable));
 }
 //---------------------------------------------------------------------------
+TMetricsHistogram::TMetricsHistogram()
+{
+  memset(FBuckets, 0, sizeof(FBuckets));
+  FCount = 0;
+  FSum = 0;
+  FMin = 0;
+  FMax = 0;
+}
+//---------------------------------------------------------------------------
+void __fastcall TMetricsHistogram::Add(unsigned int Value)
+{
+  int Bucket = 0;
+  unsigned int V = Value;
+  while ((V > 0) && (Bucket < BucketCount - 1))
+  {
+    Bucket++;
+    V >>= 1;
+  }
+  FBuckets[Bucket]++;
+  if ((FCount == 0) || (Value < FMin))
+  {
+    FMin = Value;
+  }
+  if (Value > FMax)
+  {
+    FMax = Value;
+  }
+  FCount++;
+  FSum += Value;
+}
+//---------------------------------------------------------------------------
+UnicodeString __fastcall TMetricsHistogram::ToJson() const
+{
+  // omit trailing empty buckets
+  int Used = BucketCount;
+  while ((Used > 0) && (FBuckets[Used - 1] == 0))
+  {
+    Used--;
+  }
+  UnicodeString Buckets;
+  for (int Index = 0; Index < Used; Index++)
+  {
+    AddToList(Buckets, IntToStr(static_cast<__int64>(FBuckets[Index])), L",");
+  }
+  return
+    FORMAT(L"{\"count\":%s,\"sum\":%s,\"min\":%s,\"max\":%s,\"buckets\":[%s]}",
+      (IntToStr(FCount), IntToStr(FSum), IntToStr(static_cast<__int64>(FMin)),
+       IntToStr(static_cast<__int64>(FMax)), Buckets));
+}
+//---------------------------------------------------------------------------
+TSessionMetrics::TSessionMetrics()
+{
+  FStart = Now();
+  FBytesSent = 0;
+  FBytesReceived = 0;
+  FPacketsSent = 0;
+  FPacketsReceived = 0;
+  FBytesTransferred = 0;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSessionMetrics::DataSent(int Length)
+{
+  FBytesSent += Length;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSessionMetrics::DataReceived(int Length)
+{
+  FBytesReceived += Length;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSessionMetrics::SendBufferStall(unsigned int MSecs)
+{
+  FSendBufferStalls.Add(MSecs);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSessionMetrics::PacketSent(unsigned int Outstanding)
+{
+  FPacketsSent++;
+  FOutstandingRequests.Add(Outstanding);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSessionMetrics::PacketReceived()
+{
+  FPacketsReceived++;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSessionMetrics::RequestLatency(unsigned int MSecs)
+{
+  FRequestLatencies.Add(MSecs);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSessionMetrics::FileTransferred(__int64 Size, unsigned int MSecs)
+{
+  FBytesTransferred += Size;
+  FFileDurations.Add(MSecs);
+}
+//---------------------------------------------------------------------------
+UnicodeString __fastcall TSessionMetrics::ToJson() const
+{
+  // Durations are in milliseconds
+  return
+    FORMAT(L"{\"duration\":%s,\"bytesSent\":%s,\"bytesReceived\":%s,"
+      "\"sendBufferStalls\":%s,"
+      "\"packetsSent\":%s,\"packetsReceived\":%s,"
+      "\"outstandingRequests\":%s,\"requestLatencies\":%s,"
+      "\"filesTransferred\":%s,\"bytesTransferred\":%s,\"fileDurations\":%s}",
+      (IntToStr(MilliSecondsBetween(Now(), FStart)), IntToStr(FBytesSent), IntToStr(FBytesReceived),
+       FSendBufferStalls.ToJson(),
+       IntToStr(FPacketsSent), IntToStr(FPacketsReceived),
+       FOutstandingRequests.ToJson(), FRequestLatencies.ToJson(),
+       IntToStr(FFileDurations.Count), IntToStr(FBytesTransferred), FFileDurations.ToJson()));
+}
+//---------------------------------------------------------------------------
 //---------------------------------------------------------------------------
 FILE * __fastcall OpenFile(UnicodeString LogFileName, TSessionData * SessionData, bool Append, UnicodeString & NewFileName)
 {
@@ -1130,6 +1296,8 @@ void __fastcall TSessionLog::DoAddStartupInfo(TSessionData * Data)
           (Data->SshProtStr, BooleanToEngStr(Data->Compression)));
         ADF(L"Bypass authentication: %s",
          (BooleanToEngStr(Data->SshNoUserAuth)));
+        ADF(L"Connection sharing: %s",
+         (BooleanToEngStr(Data->ConnectionSharing)));
         ADF(L"Try agent: %s; Agent forwarding: %s; TIS/CryptoCard: %s; KI: %s; GSSAPI: %s",
           (BooleanToEngStr(Data->TryAgent), BooleanToEngStr(Data->AgentFwd), BooleanToEngStr(Data->AuthTIS),
            BooleanToEngStr(Data->AuthKI), BooleanToEngStr(Data->AuthGSSAPI)));
@@ -1203,6 +1371,10 @@ void __fastcall TSessionLog::DoAddStartupInfo(TSessionData * Data)
         {
           ADF(L"Transfer active immediately: %s", (EnumName(Data->FtpTransferActiveImmediately, AutoSwitchNames)));
         }
+        if (Data->FtpDownloadSegments > 1)
+        {
+          ADF(L"Download segments: %d", (Data->FtpDownloadSegments));
+        }
         ADF(L"FTP: FTPS: %s [Client certificate: %s]; Passive: %s [Force IP: %s]; MLSD: %s [List all: %s]",
           (Ftps, LogSensitive(Data->TlsCertificateFile), BooleanToEngStr(Data->FtpPasvMode),
            EnumName(Data->FtpForcePasvIp, AutoSwitchNames),
@@ -1338,6 +1510,8 @@ void __fastcall TActionLog::Init(TSessionUI * UI, TSessionData * SessionData,
   FIndent = L"  ";
   FInGroup = false;
   FEnabled = true;
+  FLogToFile = false;
+  FStreaming = false;
 }
 //---------------------------------------------------------------------------
 __fastcall TActionLog::~TActionLog()
@@ -1358,16 +1532,25 @@ void __fastcall TActionLog::Add(const UnicodeString & Line)
     try
     {
       TGuard Guard(FCriticalSection);
-      if (FFile == NULL)
+      if (FStreaming)
       {
-        OpenLogFile();
+        // delivered in FlushStream, once the whole record is complete
+        FStreamBuffer += Line + L"\n";
       }
 
-      if (FFile != NULL)
+      if (FLogToFile)
       {
-        UTF8String UtfLine = UTF8String(Line);
-        fwrite(UtfLine.c_str(), 1, UtfLine.Length(), (FILE *)FFile);
-        fwrite("\n", 1, 1, (FILE *)FFile);
+        if (FFile == NULL)
+        {
+          OpenLogFile();
+        }
+
+        if (FFile != NULL)
+        {
+          UTF8String UtfLine = UTF8String(Line);
+          fwrite(UtfLine.c_str(), 1, UtfLine.Length(), (FILE *)FFile);
+          fwrite("\n", 1, 1, (FILE *)FFile);
+        }
       }
     }
     catch (Exception &E)
@@ -1396,9 +1579,11 @@ void __fastcall TActionLog::AddIndented(const UnicodeString & Line)
 //---------------------------------------------------------------------------
 void __fastcall TActionLog::AddFailure(TStrings * Messages)
 {
+  TGuard Guard(FCriticalSection);
   AddIndented(L"<failure>");
   AddMessages(L"  ", Messages);
   AddIndented(L"</failure>");
+  FlushStream();
 }
 //---------------------------------------------------------------------------
 void __fastcall TActionLog::AddFailure(Exception * E)
@@ -1436,11 +1621,15 @@ void __fastcall TActionLog::ReflectSettings()
   if (ALogging && !FLogging)
   {
     FLogging = true;
+    FStreaming = (FConfiguration->OnActionsLog != NULL);
+    // with a stream consumer, the file is optional
+    FLogToFile = !FStreaming || !FConfiguration->ActionsLogFileName.IsEmpty();
     Add(L"<?xml version=\"1.0\" encoding=\"UTF-8\"?>");
     UnicodeString SessionName =
       (FSessionData != NULL) ? XmlAttributeEscape(FSessionData->SessionName) : UnicodeString(L"nosession");
     Add(FORMAT(L"<session xmlns=\"http://winscp.net/schema/session/1.0\" name=\"%s\" start=\"%s\">",
       (SessionName, StandardTimestamp())));
+    FlushStream();
   }
   else if (!ALogging && FLogging)
   {
@@ -1449,12 +1638,15 @@ void __fastcall TActionLog::ReflectSettings()
       EndGroup();
     }
     // do not try to close the file, if it has not been opened, to avoid recursion
-    if (FFile != NULL)
+    if (HasOutput())
     {
       Add(L"</session>");
     }
+    FlushStream();
     CloseLogFile();
     FLogging = false;
+    FStreaming = false;
+    FLogToFile = false;
   }
 
 }
@@ -1484,7 +1676,12 @@ void __fastcall TActionLog::OpenLogFile()
     // We failed logging to file, turn it off and notify user.
     FCurrentLogFileName = L"";
     FCurrentFileName = L"";
-    FConfiguration->LogActions = false;
+    FLogToFile = false;
+    // The stream consumer does not depend on the file
+    if (!FStreaming)
+    {
+      FConfiguration->LogActions = false;
+    }
     try
     {
       throw ExtException(&E, LoadStr(LOG_GEN_ERROR));
@@ -1501,40 +1698,70 @@ void __fastcall TActionLog::OpenLogFile()
 //---------------------------------------------------------------------------
 void __fastcall TActionLog::AddPendingAction(TSessionActionRecord * Action)
 {
+  // the log can be shared by background terminals of a headless queue
+  TGuard Guard(FCriticalSection);
   FPendingActions->Add(Action);
 }
 //---------------------------------------------------------------------------
 void __fastcall TActionLog::RecordPendingActions()
 {
+  TGuard Guard(FCriticalSection);
   while ((FPendingActions->Count > 0) &&
          static_cast<TSessionActionRecord *>(FPendingActions->Items[0])->Record())
   {
     FPendingActions->Delete(0);
   }
+  FlushStream();
 }
 //---------------------------------------------------------------------------
 void __fastcall TActionLog::BeginGroup(UnicodeString Name)
 {
+  TGuard Guard(FCriticalSection);
   DebugAssert(!FInGroup);
   FInGroup = true;
   DebugAssert(FIndent == L"  ");
   AddIndented(FORMAT(L"<group name=\"%s\" start=\"%s\">",
     (XmlAttributeEscape(Name), StandardTimestamp())));
   FIndent = L"    ";
+  FlushStream();
 }
 //---------------------------------------------------------------------------
 void __fastcall TActionLog::EndGroup()
 {
+  TGuard Guard(FCriticalSection);
   DebugAssert(FInGroup);
   FInGroup = false;
   DebugAssert(FIndent == L"    ");
   FIndent = L"  ";
   // this is called from ReflectSettings that in turn is called when logging fails,
   // so do not try to close the group, if it has not been opened, to avoid recursion
-  if (FFile != NULL)
+  if (HasOutput())
   {
     AddIndented(L"</group>");
   }
+  FlushStream();
+}
+//---------------------------------------------------------------------------
+bool __fastcall TActionLog::HasOutput()
+{
+  return FStreaming || (FFile != NULL);
+}
+//---------------------------------------------------------------------------
+void __fastcall TActionLog::FlushStream()
+{
+  // Hand over only complete records, so that the consumer can parse
+  // the log as it arrives, without waiting for the session to close.
+  // Called with FCriticalSection held.
+  if (FStreaming && !FStreamBuffer.IsEmpty())
+  {
+    UnicodeString Data = FStreamBuffer;
+    FStreamBuffer = L"";
+    TActionsLogEvent OnActionsLog = FConfiguration->OnActionsLog;
+    if (OnActionsLog != NULL)
+    {
+      OnActionsLog(Data);
+    }
+  }
 }
 //---------------------------------------------------------------------------
 void __fastcall TActionLog::SetEnabled(bool value)
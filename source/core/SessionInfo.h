@@ -55,6 +55,58 @@ struct TFileSystemInfo
   bool IsCapable[fcCount];
 };
 //---------------------------------------------------------------------------
+// Fixed-size histogram with power-of-two buckets, so that recording a sample
+// is cheap and the memory does not grow with the session length.
+class TMetricsHistogram
+{
+public:
+  TMetricsHistogram();
+
+  void __fastcall Add(unsigned int Value);
+  UnicodeString __fastcall ToJson() const;
+
+  __property __int64 Count = { read = FCount };
+
+private:
+  // Bucket 0 counts zeros, bucket N counts values in [2^(N-1), 2^N),
+  // the last bucket is open-ended
+  static const int BucketCount = 24;
+  unsigned int FBuckets[BucketCount];
+  __int64 FCount;
+  __int64 FSum;
+  unsigned int FMin;
+  unsigned int FMax;
+};
+//---------------------------------------------------------------------------
+// Session telemetry, for capacity planning. Accessed from the thread
+// of the owning terminal only.
+class TSessionMetrics
+{
+public:
+  TSessionMetrics();
+
+  void __fastcall DataSent(int Length);
+  void __fastcall DataReceived(int Length);
+  void __fastcall SendBufferStall(unsigned int MSecs);
+  void __fastcall PacketSent(unsigned int Outstanding);
+  void __fastcall PacketReceived();
+  void __fastcall RequestLatency(unsigned int MSecs);
+  void __fastcall FileTransferred(__int64 Size, unsigned int MSecs);
+  UnicodeString __fastcall ToJson() const;
+
+private:
+  TDateTime FStart;
+  __int64 FBytesSent;
+  __int64 FBytesReceived;
+  __int64 FPacketsSent;
+  __int64 FPacketsReceived;
+  __int64 FBytesTransferred;
+  TMetricsHistogram FSendBufferStalls;
+  TMetricsHistogram FOutstandingRequests;
+  TMetricsHistogram FRequestLatencies;
+  TMetricsHistogram FFileDurations;
+};
+//---------------------------------------------------------------------------
 class TSessionUI
 {
 public:
@@ -80,7 +132,7 @@ enum TLogLineType { llOutput, llInput, llStdError, llMessage, llException };
 enum TLogAction
 {
   laUpload, laDownload, laTouch, laChmod, laMkdir, laRm, laMv, laCall, laLs,
-  laStat, laChecksum, laCwd
+  laStat, laChecksum, laCwd, laStats
 };
 //---------------------------------------------------------------------------
 enum TCaptureOutputType { cotOutput, cotError, cotExitCode };
@@ -194,6 +246,7 @@ class TLsSessionAction : public TSessionAction
 public:
   __fastcall TLsSessionAction(TActionLog * Log, const UnicodeString & Destination);
 
+  void __fastcall Recursive();
   void __fastcall FileList(TRemoteFileList * FileList);
 };
 //---------------------------------------------------------------------------
@@ -219,6 +272,12 @@ public:
   __fastcall TCwdSessionAction(TActionLog * Log, const UnicodeString & Path);
 };
 //---------------------------------------------------------------------------
+class TStatsSessionAction : public TSessionAction
+{
+public:
+  __fastcall TStatsSessionAction(TActionLog * Log, const UnicodeString & Metrics);
+};
+//---------------------------------------------------------------------------
 class TSessionLog : protected TStringList
 {
 public:
@@ -335,10 +394,15 @@ private:
   bool FInGroup;
   UnicodeString FIndent;
   bool FEnabled;
+  bool FLogToFile;
+  bool FStreaming;
+  UnicodeString FStreamBuffer;
 
   void __fastcall OpenLogFile();
   UnicodeString __fastcall GetLogFileName();
   void __fastcall SetEnabled(bool value);
+  bool __fastcall HasOutput();
+  void __fastcall FlushStream();
 };
 //---------------------------------------------------------------------------
 #endif
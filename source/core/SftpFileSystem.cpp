@@ -14,6 +14,7 @@
 #include "SecureShell.h"
 #include <WideStrUtils.hpp>
 #include <limits>
+#include <map>
 
 #include <memory>
 //---------------------------------------------------------------------------
@@ -1524,7 +1525,7 @@ public:
     int ConvertParams)
   {
     FFileName = AFileName;
-    FStream = new TSafeHandleStream((THandle)AFile);
+    FStream = FFileSystem->FTerminal->CreateLocalFileStream(AFile, false);
     OperationProgress = AOperationProgress;
     FHandle = AHandle;
     FTransfered = ATransfered;
@@ -1814,6 +1815,78 @@ private:
   int FIndex;
 };
 //---------------------------------------------------------------------------
+class TSFTPResolveSymlinksQueue : public TSFTPFixedLenQueue
+{
+public:
+  TSFTPResolveSymlinksQueue(TSFTPFileSystem * AFileSystem) :
+    TSFTPFixedLenQueue(AFileSystem)
+  {
+    FIndex = 0;
+    FType = 0;
+  }
+  virtual __fastcall ~TSFTPResolveSymlinksQueue(){}
+
+  // Type is either SSH_FXP_READLINK or SSH_FXP_STAT
+  bool __fastcall Init(int QueueLen, unsigned char Type, TStrings * FileList)
+  {
+    FType = Type;
+    FFileList = FileList;
+
+    return TSFTPFixedLenQueue::Init(QueueLen);
+  }
+
+  bool __fastcall ReceivePacket(TSFTPPacket * Packet, TRemoteFile *& File)
+  {
+    void * Token;
+    int ExpectedType = (FType == SSH_FXP_READLINK) ? SSH_FXP_NAME : SSH_FXP_ATTRS;
+    bool Result = TSFTPFixedLenQueue::ReceivePacket(Packet, ExpectedType, asAll, &Token);
+    File = static_cast<TRemoteFile *>(Token);
+    return Result;
+  }
+
+protected:
+  virtual bool __fastcall InitRequest(TSFTPQueuePacket * Request)
+  {
+    bool Result = (FIndex < FFileList->Count);
+    if (Result)
+    {
+      TRemoteFile * File = static_cast<TRemoteFile *>(FFileList->Objects[FIndex]);
+      DebugAssert((File != NULL) && File->IsSymLink);
+      FIndex++;
+
+      Request->ChangeType(FType);
+      // both requests are for the link itself, STAT follows it to the target
+      Request->AddPathString(FFileSystem->LocalCanonify(File->FullFileName),
+        FFileSystem->FUtfStrings);
+      if ((FType == SSH_FXP_STAT) && (FFileSystem->FVersion >= 4))
+      {
+        Request->AddCardinal(SSH_FILEXFER_ATTR_COMMON);
+      }
+      Request->Token = File;
+    }
+
+    return Result;
+  }
+
+  virtual bool __fastcall SendRequest()
+  {
+    bool Result =
+      (FIndex < FFileList->Count) &&
+      TSFTPFixedLenQueue::SendRequest();
+    return Result;
+  }
+
+  virtual bool __fastcall End(TSFTPPacket * /*Response*/)
+  {
+    return (FRequests->Count == 0);
+  }
+
+private:
+  unsigned char FType;
+  TStrings * FFileList;
+  int FIndex;
+};
+//---------------------------------------------------------------------------
 #pragma warn .inl
 //---------------------------------------------------------------------------
 class TSFTPBusy
@@ -1861,6 +1934,109 @@ struct TSinkFileParams
   bool Skipped;
   unsigned int Flags;
 };
+//---------------------------------------------------------------------------
+// State of one small file transferred by TSFTPFileSystem::SFTPSourcePipelined
+// or TSFTPFileSystem::SFTPSinkPipelined.
+// All packets double as reserved responses,
+// destroying the object releases the reservations.
+class TSFTPPipelinedTransfer
+{
+public:
+  __fastcall TSFTPPipelinedTransfer()
+  {
+    Packets = new TList();
+    Failed = false;
+  }
+
+  virtual __fastcall ~TSFTPPipelinedTransfer()
+  {
+    for (int Index = 0; Index < Packets->Count; Index++)
+    {
+      delete static_cast<TSFTPPacket *>(Packets->Items[Index]);
+    }
+    delete Packets;
+  }
+
+  UnicodeString FileName;
+  UnicodeString DestFullName;
+  bool Failed;
+  RawByteString Handle;
+  TSFTPPacket OpenPacket;
+  // data requests (and close request for uploads)
+  TList * Packets;
+};
+//---------------------------------------------------------------------------
+class TSFTPPipelinedUpload : public TSFTPPipelinedTransfer
+{
+public:
+  __fastcall TSFTPPipelinedUpload()
+  {
+    LocalFileAttrs = 0;
+    Size = 0;
+    MTime = 0;
+    ATime = 0;
+    SetProperties = false;
+  }
+
+  TFileBuffer Buffer;
+  int LocalFileAttrs;
+  __int64 Size;
+  __int64 MTime;
+  __int64 ATime;
+  bool SetProperties;
+  TSFTPPacket PropertiesPacket;
+};
+//---------------------------------------------------------------------------
+class TSFTPPipelinedDownload : public TSFTPPipelinedTransfer
+{
+public:
+  __fastcall TSFTPPipelinedDownload()
+  {
+    File = NULL;
+    LocalFileAttrs = -1;
+    BlockSize = 0;
+  }
+
+  UnicodeString RemoteFileName;
+  const TRemoteFile * File;
+  int LocalFileAttrs;
+  unsigned long BlockSize;
+  TSFTPPacket StatPacket;
+};
+//---------------------------------------------------------------------------
+// REMOVE, RMDIR or SETSTAT request sent within recursive delete
+// or properties change, see TSFTPFileSystem::SFTPSendMutation.
+// The packet doubles as the reserved response.
+class TSFTPPipelinedMutation
+{
+public:
+  __fastcall TSFTPPipelinedMutation()
+  {
+    Directory = false;
+    DeleteParams = 0;
+  }
+
+  void __fastcall CancelAction()
+  {
+    if (RmAction.get() != NULL)
+    {
+      RmAction->Cancel();
+    }
+    if (ChmodAction.get() != NULL)
+    {
+      ChmodAction->Cancel();
+    }
+  }
+
+  UnicodeString FileName;
+  bool Directory;
+  // for retrying failed request the regular way
+  int DeleteParams;
+  TRemoteProperties Properties;
+  std::unique_ptr<TRmSessionAction> RmAction;
+  std::unique_ptr<TChmodSessionAction> ChmodAction;
+  TSFTPPacket Packet;
+};
 //===========================================================================
 __fastcall TSFTPFileSystem::TSFTPFileSystem(TTerminal * ATerminal,
   TSecureShell * SecureShell):
@@ -1883,6 +2059,8 @@ __fastcall TSFTPFileSystem::TSFTPFileSystem(TTerminal * ATerminal,
 
   FChecksumAlgs.reset(new TStringList());
   FChecksumSftpAlgs.reset(new TStringList());
+  FMutations.reset(new TList());
+  FMutationDepth = 0;
   // List as defined by draft-ietf-secsh-filexfer-extensions-00
   // MD5 moved to the back
   RegisterChecksumAlg(Sha1ChecksumAlg, L"sha1");
@@ -1896,6 +2074,7 @@ __fastcall TSFTPFileSystem::TSFTPFileSystem(TTerminal * ATerminal,
 //---------------------------------------------------------------------------
 __fastcall TSFTPFileSystem::~TSFTPFileSystem()
 {
+  DebugAssert(FMutations->Count == 0);
   delete FSupport;
   ResetConnection();
   delete FPacketReservations;
@@ -1907,6 +2086,12 @@ __fastcall TSFTPFileSystem::~TSFTPFileSystem()
 void __fastcall TSFTPFileSystem::Open()
 {
   // this is used for reconnects only
+
+  // requests pipelined over the lost connection will never be answered
+  SFTPDiscardMutations();
+  // neither will any other request, do not keep counting them as in flight
+  FRequestTicks.clear();
+
   FSecureShell->Open();
 }
 //---------------------------------------------------------------------------
@@ -2315,6 +2500,13 @@ void __fastcall TSFTPFileSystem::SendPacket(const TSFTPPacket * Packet)
       }
     }
     FSecureShell->Send(Packet->SendData, Packet->SendLength);
+
+    // keep the memory bounded, should responses never come
+    if (FRequestTicks.size() < 10000)
+    {
+      FRequestTicks[Packet->MessageNumber] = GetTickCount();
+    }
+    FTerminal->Metrics->PacketSent(FRequestTicks.size());
   }
   __finally
   {
@@ -2526,6 +2718,14 @@ int __fastcall TSFTPFileSystem::ReceivePacket(TSFTPPacket * Packet,
         FSecureShell->Receive(Packet->Data, Length);
         Packet->DataUpdated(Length);
 
+        FTerminal->Metrics->PacketReceived();
+        std::map<unsigned int, unsigned int>::iterator RequestTicks = FRequestTicks.find(Packet->MessageNumber);
+        if (RequestTicks != FRequestTicks.end())
+        {
+          FTerminal->Metrics->RequestLatency(GetTickCount() - RequestTicks->second);
+          FRequestTicks.erase(RequestTicks);
+        }
+
         if (FTerminal->Log->Logging)
         {
           if ((FPreviousLoggedPacket != SSH_FXP_READ &&
@@ -3402,6 +3602,10 @@ void __fastcall TSFTPFileSystem::ReadDirectory(TRemoteFileList * FileList)
     int Total = 0;
     bool HasParentDirectory = false;
     TRemoteFile * File;
+    // symlinks are collected and resolved in a pipeline once the listing
+    // is read, instead of one READLINK/STAT round trip per link
+    bool ResolveSymlinksPipelined = FTerminal->ResolvingSymlinks && (FVersion >= 3);
+    std::unique_ptr<TStringList> Symlinks(new TStringList());
 
     Packet.ChangeType(SSH_FXP_READDIR);
     Packet.AddString(Handle);
@@ -3426,11 +3630,15 @@ void __fastcall TSFTPFileSystem::ReadDirectory(TRemoteFileList * FileList)
         int ResolvedLinks = 0;
         for (unsigned long Index = 0; !isEOF && (Index < Count); Index++)
         {
-          File = LoadFile(&ListingPacket, NULL, L"", FileList);
+          File = LoadFile(&ListingPacket, NULL, L"", FileList, !ResolveSymlinksPipelined);
           if (FTerminal->Configuration->ActualLogProtocol >= 1)
           {
             FTerminal->LogEvent(FORMAT(L"Read file '%s' from listing", (File->FileName)));
           }
+          if (ResolveSymlinksPipelined && File->IsSymLink)
+          {
+            Symlinks->AddObject(L"", File);
+          }
           if (File->LinkedFile != NULL)
           {
             ResolvedLinks++;
@@ -3465,6 +3673,22 @@ void __fastcall TSFTPFileSystem::ReadDirectory(TRemoteFileList * FileList)
           FTerminal->LogEvent(L"Empty directory listing packet. Aborting directory reading.");
           isEOF = true;
         }
+
+        // Hand over the batch to the caller, if it asked for it,
+        // while the next SSH_FXP_READDIR is already on its way
+        if (FileList->OnFilesAdded != NULL)
+        {
+          if (Symlinks->Count > 0)
+          {
+            ResolveSymlinks(Symlinks.get(), Total);
+            Symlinks->Clear();
+          }
+          // The handle and the reserved response would not survive
+          // a reconnect, so the callbacks must not reconnect
+          // (see TRobustOperationLoop::TryReopen)
+          TAutoNestingCounter StreamingListingCounter(FTerminal->FStreamingListing);
+          FileList->FilesAdded();
+        }
       }
       else if (Response.Type == SSH_FXP_STATUS)
       {
@@ -3477,6 +3701,11 @@ void __fastcall TSFTPFileSystem::ReadDirectory(TRemoteFileList * FileList)
     }
     while (!isEOF);
 
+    if (Symlinks->Count > 0)
+    {
+      ResolveSymlinks(Symlinks.get(), Total);
+    }
+
     if (Total == 0)
     {
       bool Failure = false;
@@ -3596,6 +3825,144 @@ void __fastcall TSFTPFileSystem::ReadSymlink(TRemoteFile * SymlinkFile,
     UnixExtractFileName(SymlinkFile->LinkTo));
 }
 //---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::ResolveSymlinks(TStrings * Symlinks, int Total)
+{
+  // Equivalent of TRemoteFile::Complete for all symlinks of a listing.
+  // First all link targets are read, then each distinct target is stat-ed once,
+  // both using a fixed-length pipeline. Errors leave the link unresolved,
+  // as in TRemoteFile::FindLinkedFile.
+  FTerminal->LogEvent(FORMAT(L"Resolving %d symlinks.", (Symlinks->Count)));
+
+  static int ResolveSymlinksQueueLen = 32;
+  bool Cancel = false;
+
+  {
+    TSFTPResolveSymlinksQueue Queue(this);
+    try
+    {
+      if (Queue.Init(ResolveSymlinksQueueLen, SSH_FXP_READLINK, Symlinks))
+      {
+        TRemoteFile * File;
+        TSFTPPacket Packet;
+        bool Next;
+        do
+        {
+          Next = Queue.ReceivePacket(&Packet, File);
+          DebugAssert(File != NULL);
+          if (Packet.Type == SSH_FXP_NAME)
+          {
+            if (Packet.GetCardinal() != 1)
+            {
+              FTerminal->FatalError(NULL, LoadStr(SFTP_NON_ONE_FXP_NAME_PACKET));
+            }
+            File->LinkTo = Packet.GetPathString(FUtfStrings);
+            FTerminal->LogEvent(FORMAT(L"Link \"%s\" resolved to \"%s\".", (File->FileName, File->LinkTo)));
+          }
+          else
+          {
+            FTerminal->LogEvent(FORMAT(L"Cannot read link \"%s\".", (File->FileName)));
+          }
+        }
+        while (Next);
+      }
+    }
+    __finally
+    {
+      Queue.DisposeSafe();
+    }
+  }
+
+  // Links pointing to the same target (as is common e.g. for shared library
+  // versions) need the target attributes retrieved only once
+  // (the cache lives for this listing only).
+  // All links are in the same directory, so the same link target text
+  // means the same target, even if relative. The link itself is stat-ed,
+  // as the server follows it, the same way as ReadSymlink does.
+  std::unique_ptr<TStringList> Targets(new TStringList());
+  std::unique_ptr<TStringList> TargetsIndex(new TStringList());
+  TargetsIndex->Sorted = true;
+  TargetsIndex->CaseSensitive = true;
+  for (int Index = 0; Index < Symlinks->Count; Index++)
+  {
+    TRemoteFile * File = static_cast<TRemoteFile *>(Symlinks->Objects[Index]);
+    UnicodeString Target = File->LinkTo;
+    if (!Target.IsEmpty())
+    {
+      if (TargetsIndex->IndexOf(Target) < 0)
+      {
+        TargetsIndex->AddObject(Target, File);
+        Targets->AddObject(Target, File);
+      }
+    }
+    Symlinks->Strings[Index] = Target;
+  }
+
+  // keyed by the link that represents the target in the STAT pipeline
+  std::map<TRemoteFile *, TSFTPPacket> TargetAttrs;
+  if (Targets->Count > 0)
+  {
+    TSFTPResolveSymlinksQueue Queue(this);
+    try
+    {
+      if (Queue.Init(ResolveSymlinksQueueLen, SSH_FXP_STAT, Targets.get()))
+      {
+        TRemoteFile * File;
+        TSFTPPacket Packet;
+        bool Next;
+        int Received = 0;
+        do
+        {
+          Next = Queue.ReceivePacket(&Packet, File);
+          DebugAssert(File != NULL);
+          if (Packet.Type == SSH_FXP_ATTRS)
+          {
+            TargetAttrs[File] = Packet;
+          }
+          else
+          {
+            FTerminal->LogEvent(FORMAT(L"Cannot read attributes of link target \"%s\".", (File->LinkTo)));
+          }
+
+          Received++;
+          if (Received % 10 == 0)
+          {
+            FTerminal->DoReadDirectoryProgress(Total, Received, Cancel);
+            if (Cancel)
+            {
+              FTerminal->LogEvent(L"Resolving of symlinks cancelled.");
+              Next = false;
+            }
+          }
+        }
+        while (Next);
+      }
+    }
+    __finally
+    {
+      Queue.DisposeSafe();
+    }
+  }
+
+  int ResolvedLinks = 0;
+  for (int Index = 0; Index < Symlinks->Count; Index++)
+  {
+    TRemoteFile * File = static_cast<TRemoteFile *>(Symlinks->Objects[Index]);
+    int TargetIndex = TargetsIndex->IndexOf(Symlinks->Strings[Index]);
+    std::map<TRemoteFile *, TSFTPPacket>::const_iterator I =
+      (TargetIndex >= 0) ? TargetAttrs.find(static_cast<TRemoteFile *>(TargetsIndex->Objects[TargetIndex])) : TargetAttrs.end();
+    if (I != TargetAttrs.end())
+    {
+      // LoadFile consumes the packet, so work on a copy
+      TSFTPPacket AttrsPacket(I->second);
+      File->LinkedFile = LoadFile(&AttrsPacket, File, UnixExtractFileName(File->LinkTo));
+      ResolvedLinks++;
+    }
+  }
+  FTerminal->LogEvent(FORMAT(L"Resolved %d of %d symlinks, %d distinct targets.",
+    (ResolvedLinks, Symlinks->Count, Targets->Count)));
+  FTerminal->DoReadDirectoryProgress(Total, ResolvedLinks, Cancel);
+}
+//---------------------------------------------------------------------------
 void __fastcall TSFTPFileSystem::ReadFile(const UnicodeString FileName,
   TRemoteFile *& File)
 {
@@ -3680,16 +4047,31 @@ void __fastcall TSFTPFileSystem::DeleteFile(const UnicodeString FileName,
   const TRemoteFile * File, int Params, TRmSessionAction & Action)
 {
   unsigned char Type;
-  if (File && File->IsDirectory && !File->IsSymLink)
+  bool Directory = (File && File->IsDirectory && !File->IsSymLink);
+  if (Directory)
   {
     if (FLAGCLEAR(Params, dfNoRecursive))
     {
       try
       {
-        FTerminal->ProcessDirectory(FileName, FTerminal->DeleteFile, &Params);
+        FMutationDepth++;
+        try
+        {
+          FTerminal->ProcessDirectory(FileName, FTerminal->DeleteFile, &Params);
+        }
+        __finally
+        {
+          FMutationDepth--;
+        }
+        // the directory can be removed only once all its children are gone
+        SFTPFlushMutations();
       }
       catch(...)
       {
+        if (FMutationDepth == 0)
+        {
+          SFTPDiscardMutations();
+        }
         Action.Cancel();
         throw;
       }
@@ -3701,61 +4083,200 @@ void __fastcall TSFTPFileSystem::DeleteFile(const UnicodeString FileName,
     Type = SSH_FXP_REMOVE;
   }
 
-  DoDeleteFile(FileName, Type);
+  if (FMutationDepth > 0)
+  {
+    TSFTPPipelinedMutation * Mutation = new TSFTPPipelinedMutation();
+    Mutation->FileName = FileName;
+    Mutation->Directory = Directory;
+    Mutation->DeleteParams = Params;
+    Mutation->RmAction.reset(new TRmSessionAction(FTerminal->ActionLog, FTerminal->AbsolutePath(FileName, true)));
+    Mutation->Packet.ChangeType(Type);
+    Mutation->Packet.AddPathString(LocalCanonify(FileName), FUtfStrings);
+    // recorded once the response arrives
+    Action.Cancel();
+    SFTPSendMutation(Mutation);
+  }
+  else
+  {
+    DoDeleteFile(FileName, Type);
+  }
 }
 //---------------------------------------------------------------------------
-void __fastcall TSFTPFileSystem::RenameFile(const UnicodeString FileName,
-  const UnicodeString NewName)
+void __fastcall TSFTPFileSystem::SFTPSendMutation(TSFTPPipelinedMutation * Mutation)
 {
-  TSFTPPacket Packet(SSH_FXP_RENAME);
-  UnicodeString RealName = LocalCanonify(FileName);
-  Packet.AddPathString(RealName, FUtfStrings);
-  UnicodeString TargetName;
-  if (UnixExtractFilePath(NewName).IsEmpty())
+  // Keeps up to SFTPMutationQueueLen requests of recursive delete/properties
+  // change in flight. Entries that fail are retried the regular way,
+  // which reports (and allows retrying or skipping) the error of the particular entry.
+  static int SFTPMutationQueueLen = 64;
+
+  try
   {
-    // rename case (TTerminal::RenameFile)
-    TargetName = UnixExtractFilePath(RealName) + NewName;
+    SendPacket(&Mutation->Packet);
+    ReserveResponse(&Mutation->Packet, &Mutation->Packet);
   }
-  else
+  catch(...)
   {
-    TargetName = LocalCanonify(NewName);
+    Mutation->CancelAction();
+    delete Mutation;
+    throw;
   }
-  Packet.AddPathString(TargetName, FUtfStrings);
-  if (FVersion >= 5)
+  FMutations->Add(Mutation);
+
+  while (FMutations->Count > SFTPMutationQueueLen)
   {
-    Packet.AddCardinal(0);
+    SFTPReceiveMutation();
   }
-  SendPacketAndReceiveResponse(&Packet, &Packet, SSH_FXP_STATUS);
-}
-//---------------------------------------------------------------------------
-void __fastcall TSFTPFileSystem::CopyFile(const UnicodeString FileName,
-  const UnicodeString NewName)
-{
-  // Implemented by ProFTPD/mod_sftp and Bitvise WinSSHD (without announcing it)
-  DebugAssert(SupportsExtension(SFTP_EXT_COPY_FILE) || (FSecureShell->SshImplementation == sshiBitvise));
-  TSFTPPacket Packet(SSH_FXP_EXTENDED);
-  Packet.AddString(SFTP_EXT_COPY_FILE);
-  Packet.AddPathString(Canonify(FileName), FUtfStrings);
-  Packet.AddPathString(Canonify(NewName), FUtfStrings);
-  Packet.AddBool(false);
-  SendPacketAndReceiveResponse(&Packet, &Packet, SSH_FXP_STATUS);
-}
-//---------------------------------------------------------------------------
-void __fastcall TSFTPFileSystem::CreateDirectory(const UnicodeString DirName)
-{
-  TSFTPPacket Packet(SSH_FXP_MKDIR);
-  UnicodeString CanonifiedName = Canonify(DirName);
-  Packet.AddPathString(CanonifiedName, FUtfStrings);
-  Packet.AddProperties(NULL, 0, true, FVersion, FUtfStrings, NULL);
-  SendPacketAndReceiveResponse(&Packet, &Packet, SSH_FXP_STATUS);
 }
 //---------------------------------------------------------------------------
-void __fastcall TSFTPFileSystem::CreateLink(const UnicodeString FileName,
-  const UnicodeString PointTo, bool Symbolic)
+void __fastcall TSFTPFileSystem::SFTPReceiveMutation()
 {
-  // Cerberus server does not even response to LINK or SYMLINK,
-  // Although its log says:
-  // Unrecognized SFTP client command: (20)
+  std::unique_ptr<TSFTPPipelinedMutation> Mutation(
+    static_cast<TSFTPPipelinedMutation *>(FMutations->Items[0]));
+  FMutations->Delete(0);
+
+  // The request completes only now, long after the operation moved
+  // to other files. Have the progress show the file of the request,
+  // so that its failure is reported (and retried or skipped) for it.
+  TFileOperationProgressType * OperationProgress = FTerminal->OperationProgress;
+  UnicodeString PrevFileName;
+  if (OperationProgress != NULL)
+  {
+    PrevFileName = OperationProgress->FullFileName;
+    OperationProgress->SetFile(Mutation->FileName);
+  }
+
+  try
+  {
+    bool Failed = false;
+    try
+    {
+      ReceiveResponse(&Mutation->Packet, &Mutation->Packet, SSH_FXP_STATUS);
+    }
+    catch(Exception & E)
+    {
+      if (!FTerminal->Active)
+      {
+        throw;
+      }
+      FTerminal->LogEvent(FORMAT(L"Pipelined request for \"%s\" failed, retrying the regular way.", (Mutation->FileName)));
+      FTerminal->Log->AddException(&E);
+      Failed = true;
+    }
+
+    if (Failed)
+    {
+      Mutation->CancelAction();
+
+      // the entry on its own, synchronously
+      int PrevMutationDepth = FMutationDepth;
+      FMutationDepth = 0;
+      try
+      {
+        if (Mutation->ChmodAction.get() != NULL)
+        {
+          FTerminal->DoChangeFileProperties(Mutation->FileName, NULL, &Mutation->Properties);
+        }
+        else
+        {
+          std::unique_ptr<TRemoteFile> File;
+          if (Mutation->Directory)
+          {
+            File.reset(new TRemoteFile());
+            File->Type = FILETYPE_DIRECTORY;
+          }
+          // the children were processed already
+          FTerminal->DoDeleteFile(Mutation->FileName, File.get(), Mutation->DeleteParams | dfNoRecursive);
+        }
+      }
+      __finally
+      {
+        FMutationDepth = PrevMutationDepth;
+      }
+    }
+    // otherwise the action is committed by the destructor
+  }
+  __finally
+  {
+    if (OperationProgress != NULL)
+    {
+      OperationProgress->SetFile(PrevFileName);
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::SFTPFlushMutations()
+{
+  while (FMutations->Count > 0)
+  {
+    SFTPReceiveMutation();
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::SFTPDiscardMutations()
+{
+  // the operation was aborted, outcome of the pending requests is not known,
+  // destroying the packets releases the reservations
+  for (int Index = 0; Index < FMutations->Count; Index++)
+  {
+    TSFTPPipelinedMutation * Mutation = static_cast<TSFTPPipelinedMutation *>(FMutations->Items[Index]);
+    Mutation->CancelAction();
+    delete Mutation;
+  }
+  FMutations->Clear();
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::RenameFile(const UnicodeString FileName,
+  const UnicodeString NewName)
+{
+  TSFTPPacket Packet(SSH_FXP_RENAME);
+  UnicodeString RealName = LocalCanonify(FileName);
+  Packet.AddPathString(RealName, FUtfStrings);
+  UnicodeString TargetName;
+  if (UnixExtractFilePath(NewName).IsEmpty())
+  {
+    // rename case (TTerminal::RenameFile)
+    TargetName = UnixExtractFilePath(RealName) + NewName;
+  }
+  else
+  {
+    TargetName = LocalCanonify(NewName);
+  }
+  Packet.AddPathString(TargetName, FUtfStrings);
+  if (FVersion >= 5)
+  {
+    Packet.AddCardinal(0);
+  }
+  SendPacketAndReceiveResponse(&Packet, &Packet, SSH_FXP_STATUS);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::CopyFile(const UnicodeString FileName,
+  const UnicodeString NewName)
+{
+  // Implemented by ProFTPD/mod_sftp and Bitvise WinSSHD (without announcing it)
+  DebugAssert(SupportsExtension(SFTP_EXT_COPY_FILE) || (FSecureShell->SshImplementation == sshiBitvise));
+  TSFTPPacket Packet(SSH_FXP_EXTENDED);
+  Packet.AddString(SFTP_EXT_COPY_FILE);
+  Packet.AddPathString(Canonify(FileName), FUtfStrings);
+  Packet.AddPathString(Canonify(NewName), FUtfStrings);
+  Packet.AddBool(false);
+  SendPacketAndReceiveResponse(&Packet, &Packet, SSH_FXP_STATUS);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::CreateDirectory(const UnicodeString DirName)
+{
+  TSFTPPacket Packet(SSH_FXP_MKDIR);
+  UnicodeString CanonifiedName = Canonify(DirName);
+  Packet.AddPathString(CanonifiedName, FUtfStrings);
+  Packet.AddProperties(NULL, 0, true, FVersion, FUtfStrings, NULL);
+  SendPacketAndReceiveResponse(&Packet, &Packet, SSH_FXP_STATUS);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::CreateLink(const UnicodeString FileName,
+  const UnicodeString PointTo, bool Symbolic)
+{
+  // Cerberus server does not even response to LINK or SYMLINK,
+  // Although its log says:
+  // Unrecognized SFTP client command: (20)
   // Unknown SFTP packet - Sending Unsupported OP response
 
   DebugAssert(FVersion >= 3); // links are supported with SFTP version 3 and later
@@ -3852,7 +4373,7 @@ void __fastcall TSFTPFileSystem::CreateLink(const UnicodeString FileName,
 }
 //---------------------------------------------------------------------------
 void __fastcall TSFTPFileSystem::ChangeFileProperties(const UnicodeString FileName,
-  const TRemoteFile * /*File*/, const TRemoteProperties * AProperties,
+  const TRemoteFile * AFile, const TRemoteProperties * AProperties,
   TChmodSessionAction & Action)
 {
   DebugAssert(AProperties != NULL);
@@ -3860,7 +4381,16 @@ void __fastcall TSFTPFileSystem::ChangeFileProperties(const UnicodeString FileNa
   TRemoteFile * File;
 
   UnicodeString RealFileName = LocalCanonify(FileName);
-  ReadFile(RealFileName, File);
+  // within recursive operation, the file comes from a fresh listing
+  bool Pipeline = (FMutationDepth > 0) && (AFile != NULL);
+  if (Pipeline)
+  {
+    File = AFile->Duplicate();
+  }
+  else
+  {
+    ReadFile(RealFileName, File);
+  }
 
   try
   {
@@ -3870,11 +4400,26 @@ void __fastcall TSFTPFileSystem::ChangeFileProperties(const UnicodeString FileNa
     {
       try
       {
-        FTerminal->ProcessDirectory(FileName, FTerminal->ChangeFileProperties,
-          (void*)AProperties);
+        FMutationDepth++;
+        try
+        {
+          FTerminal->ProcessDirectory(FileName, FTerminal->ChangeFileProperties,
+            (void*)AProperties);
+        }
+        __finally
+        {
+          FMutationDepth--;
+        }
+        // keep the order of the original implementation,
+        // the children first (think of removing "x" permission)
+        SFTPFlushMutations();
       }
       catch(...)
       {
+        if (FMutationDepth == 0)
+        {
+          SFTPDiscardMutations();
+        }
         Action.Cancel();
         throw;
       }
@@ -3897,10 +4442,28 @@ void __fastcall TSFTPFileSystem::ChangeFileProperties(const UnicodeString FileNa
       Properties.Valid << vpGroup;
     }
 
-    TSFTPPacket Packet(SSH_FXP_SETSTAT);
-    Packet.AddPathString(RealFileName, FUtfStrings);
-    Packet.AddProperties(&Properties, *File->Rights, File->IsDirectory, FVersion, FUtfStrings, &Action);
-    SendPacketAndReceiveResponse(&Packet, &Packet, SSH_FXP_STATUS);
+    if (Pipeline)
+    {
+      TSFTPPipelinedMutation * Mutation = new TSFTPPipelinedMutation();
+      Mutation->FileName = FileName;
+      Mutation->Properties = *AProperties;
+      Mutation->Properties.Recursive = false;
+      Mutation->ChmodAction.reset(new TChmodSessionAction(FTerminal->ActionLog, FTerminal->AbsolutePath(FileName, true)));
+      Mutation->Packet.ChangeType(SSH_FXP_SETSTAT);
+      Mutation->Packet.AddPathString(RealFileName, FUtfStrings);
+      Mutation->Packet.AddProperties(
+        &Properties, *File->Rights, File->IsDirectory, FVersion, FUtfStrings, Mutation->ChmodAction.get());
+      // recorded once the response arrives
+      Action.Cancel();
+      SFTPSendMutation(Mutation);
+    }
+    else
+    {
+      TSFTPPacket Packet(SSH_FXP_SETSTAT);
+      Packet.AddPathString(RealFileName, FUtfStrings);
+      Packet.AddProperties(&Properties, *File->Rights, File->IsDirectory, FVersion, FUtfStrings, &Action);
+      SendPacketAndReceiveResponse(&Packet, &Packet, SSH_FXP_STATUS);
+    }
   }
   __finally
   {
@@ -4256,6 +4819,23 @@ void __fastcall TSFTPFileSystem::CopyToRemote(TStrings * FilesToCopy,
 
   UnicodeString FileName, FileNameOnly;
   UnicodeString FullTargetDir = UnixIncludeTrailingBackslash(TargetDir);
+
+  // Small files are uploaded in a pipeline first,
+  // whatever the pipeline cannot handle is left for the regular upload below
+  std::unique_ptr<TStrings> RemainingFiles;
+  if ((FilesToCopy->Count > 1) &&
+      SFTPCanPipelineUpload(CopyParam, Params, OperationProgress))
+  {
+    if (FTerminal->SessionData->CacheDirectories)
+    {
+      FTerminal->DirectoryModified(TargetDir, false);
+    }
+    RemainingFiles.reset(new TStringList());
+    SFTPSourcePipelined(FilesToCopy, FullTargetDir, CopyParam, Params,
+      OperationProgress, OnceDoneOperation, RemainingFiles.get());
+    FilesToCopy = RemainingFiles.get();
+  }
+
   int Index = 0;
   while (Index < FilesToCopy->Count && !OperationProgress->Cancel)
   {
@@ -4283,21 +4863,416 @@ void __fastcall TSFTPFileSystem::CopyToRemote(TStrings * FilesToCopy,
           tfFirstLevel);
         Success = true;
       }
-      catch(EScpSkipFile & E)
+      catch(EScpSkipFile & E)
+      {
+        TSuspendFileOperationProgress Suspend(OperationProgress);
+        if (!FTerminal->HandleException(&E))
+        {
+          throw;
+        }
+      }
+    }
+    __finally
+    {
+      FAvoidBusy = false;
+      OperationProgress->Finish(FileName, Success, OnceDoneOperation);
+    }
+    Index++;
+  }
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSFTPFileSystem::SFTPCanPipelineUpload(
+  const TCopyParamType * CopyParam, int Params, TFileOperationProgressType * OperationProgress)
+{
+  return
+    (FTerminal->SessionData->SFTPUploadQueue > 1) &&
+    // moving files and clearing archive attribute are left for the regular upload
+    FLAGCLEAR(Params, cpDelete) &&
+    !CopyParam->ClearArchive &&
+    // overwritten files have to be looked up before being opened
+    !FTerminal->SessionData->OverwrittenToRecycleBin &&
+    // speed limit is applied per block
+    (OperationProgress->CPSLimit == 0);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::SFTPSourcePipelined(TStrings * FilesToCopy,
+  const UnicodeString & TargetDir, const TCopyParamType * CopyParam, int Params,
+  TFileOperationProgressType * OperationProgress, TOnceDoneOperation & OnceDoneOperation,
+  TStrings * RemainingFiles)
+{
+  // Keeps up to SFTPUploadQueue small files in flight:
+  // - Opening: OPEN request sent, waiting for the handle,
+  // - Closing: WRITE, CLOSE and SETSTAT requests sent, waiting for the statuses.
+  // Files that do not qualify or that fail are left in RemainingFiles
+  // for the regular upload, which reports (and allows retrying)
+  // the error of the particular file.
+  int QueueLen = FTerminal->SessionData->SFTPUploadQueue;
+  std::unique_ptr<TList> Opening(new TList());
+  std::unique_ptr<TList> Closing(new TList());
+
+  FTerminal->LogEvent(FORMAT(L"Uploading small files in a pipeline of %d files.", (QueueLen)));
+
+  DebugAssert(!FAvoidBusy);
+  FAvoidBusy = true;
+
+  try
+  {
+    try
+    {
+      int Index = 0;
+      while ((Index < FilesToCopy->Count) || (Opening->Count > 0) || (Closing->Count > 0))
+      {
+        while ((Index < FilesToCopy->Count) &&
+               (Opening->Count + Closing->Count < QueueLen) &&
+               !OperationProgress->Cancel)
+        {
+          TSFTPPipelinedUpload * Upload =
+            SFTPPipelinedUploadOpen(FilesToCopy->Strings[Index], TargetDir,
+              CopyParam, Params, OperationProgress, OnceDoneOperation, RemainingFiles);
+          if (Upload != NULL)
+          {
+            Opening->Add(Upload);
+          }
+          Index++;
+        }
+
+        if (OperationProgress->Cancel)
+        {
+          // the regular upload loop stops on the cancel on its own
+          while (Index < FilesToCopy->Count)
+          {
+            RemainingFiles->Add(FilesToCopy->Strings[Index]);
+            Index++;
+          }
+        }
+
+        if (Opening->Count > 0)
+        {
+          TSFTPPipelinedUpload * Upload = static_cast<TSFTPPipelinedUpload *>(Opening->Items[0]);
+          Opening->Delete(0);
+          Closing->Add(Upload);
+          SFTPPipelinedUploadWrite(Upload, CopyParam, OperationProgress);
+        }
+
+        if ((Closing->Count > 0) &&
+            ((Opening->Count == 0) || (Opening->Count + Closing->Count >= QueueLen)))
+        {
+          std::unique_ptr<TSFTPPipelinedUpload> Upload(
+            static_cast<TSFTPPipelinedUpload *>(Closing->Items[0]));
+          Closing->Delete(0);
+          if (SFTPPipelinedUploadComplete(Upload.get(), CopyParam, OperationProgress))
+          {
+            OperationProgress->Finish(Upload->FileName, true, OnceDoneOperation);
+          }
+          else
+          {
+            RemainingFiles->Add(Upload->FileName);
+          }
+        }
+      }
+    }
+    catch(...)
+    {
+      // data of these files were not sent yet
+      for (int Index = 0; Index < Opening->Count; Index++)
+      {
+        SFTPPipelinedUploadDispose(static_cast<TSFTPPipelinedUpload *>(Opening->Items[Index]));
+      }
+      throw;
+    }
+  }
+  __finally
+  {
+    FAvoidBusy = false;
+    // releases reservations of responses we are no longer interested in
+    for (int Index = 0; Index < Opening->Count; Index++)
+    {
+      delete static_cast<TSFTPPipelinedUpload *>(Opening->Items[Index]);
+    }
+    for (int Index = 0; Index < Closing->Count; Index++)
+    {
+      delete static_cast<TSFTPPipelinedUpload *>(Closing->Items[Index]);
+    }
+  }
+}
+//---------------------------------------------------------------------------
+TSFTPPipelinedUpload * __fastcall TSFTPFileSystem::SFTPPipelinedUploadOpen(
+  const UnicodeString & FileName, const UnicodeString & TargetDir,
+  const TCopyParamType * CopyParam, int Params,
+  TFileOperationProgressType * OperationProgress, TOnceDoneOperation & OnceDoneOperation,
+  TStrings * RemainingFiles)
+{
+  // larger files gain nothing from the pipeline
+  // and we do not want to hold many of them in memory
+  static const __int64 PipelinedUploadMaxSize = 128 * 1024;
+
+  std::unique_ptr<TSFTPPipelinedUpload> Upload(new TSFTPPipelinedUpload());
+  Upload->FileName = FileName;
+  bool Skipped = false;
+  bool Pipeline = false;
+
+  OperationProgress->SetFile(FileName, false);
+
+  try
+  {
+    if (!FTerminal->AllowLocalFileTransfer(FileName, CopyParam, OperationProgress))
+    {
+      Skipped = true;
+    }
+    else
+    {
+      HANDLE File;
+      FTerminal->OpenLocalFile(FileName, GENERIC_READ, &Upload->LocalFileAttrs,
+        &File, NULL, &Upload->MTime, &Upload->ATime, &Upload->Size);
+
+      try
+      {
+        TFileMasks::TParams MaskParams;
+        MaskParams.Size = Upload->Size;
+        MaskParams.Modification = UnixToDateTime(Upload->MTime, FTerminal->SessionData->DSTMode);
+
+        // everything that may need a lookup or a confirmation is left for the regular upload
+        Pipeline =
+          FLAGCLEAR(Upload->LocalFileAttrs, faDirectory) &&
+          (Upload->Size <= PipelinedUploadMaxSize) &&
+          !(CopyParam->AllowResume(Upload->Size) && IsCapable(fcRename)) &&
+          !CopyParam->UseAsciiTransfer(FTerminal->GetBaseFileName(FileName), osLocal, MaskParams) &&
+          !FTerminal->CheckRemoteFile(FileName, CopyParam, Params, OperationProgress);
+
+        if (Pipeline)
+        {
+          TSafeHandleStream Stream((THandle)File);
+          FILE_OPERATION_LOOP_BEGIN
+          {
+            Upload->Buffer.LoadStream(&Stream, static_cast<DWORD>(Upload->Size), false);
+          }
+          FILE_OPERATION_LOOP_END(FMTLOAD(READ_ERROR, (FileName)));
+          Upload->Size = Upload->Buffer.Size;
+        }
+      }
+      __finally
+      {
+        CloseHandle(File);
+      }
+    }
+  }
+  catch(EScpSkipFile & E)
+  {
+    // the same as in CopyToRemote
+    TSuspendFileOperationProgress Suspend(OperationProgress);
+    if (!FTerminal->HandleException(&E))
+    {
+      throw;
+    }
+    Skipped = true;
+  }
+
+  TSFTPPipelinedUpload * Result = NULL;
+  if (Skipped)
+  {
+    OperationProgress->Finish(FileName, false, OnceDoneOperation);
+  }
+  else if (!Pipeline)
+  {
+    RemainingFiles->Add(FileName);
+  }
+  else
+  {
+    UnicodeString DestFileName =
+      FTerminal->ChangeFileName(CopyParam, ExtractFileName(FileName), osLocal, true);
+    Upload->DestFullName = LocalCanonify(TargetDir + DestFileName);
+    Upload->SetProperties = (CopyParam->PreserveTime || CopyParam->PreserveRights);
+
+    FTerminal->LogEvent(FORMAT(L"Copying \"%s\" to remote directory started.", (FileName)));
+
+    SFTPOpenRemoteFileRequest(Upload->OpenPacket, Upload->DestFullName,
+      SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC, Upload->Size);
+    SendPacket(&Upload->OpenPacket);
+    ReserveResponse(&Upload->OpenPacket, &Upload->OpenPacket);
+
+    Result = Upload.release();
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::SFTPPipelinedTransferFailed(
+  TSFTPPipelinedTransfer * Transfer, Exception * E)
+{
+  // report the first error only, the rest is typically its consequence
+  if (!Transfer->Failed)
+  {
+    FTerminal->LogEvent(FORMAT(L"Pipelined transfer of \"%s\" failed, leaving it for regular transfer.", (Transfer->FileName)));
+    FTerminal->Log->AddException(E);
+    Transfer->Failed = true;
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::SFTPPipelinedUploadWrite(TSFTPPipelinedUpload * Upload,
+  const TCopyParamType * CopyParam, TFileOperationProgressType * OperationProgress)
+{
+  try
+  {
+    ReceiveResponse(&Upload->OpenPacket, &Upload->OpenPacket, SSH_FXP_HANDLE);
+    Upload->Handle = Upload->OpenPacket.GetFileHandle();
+  }
+  catch(Exception & E)
+  {
+    if (!FTerminal->Active)
+    {
+      throw;
+    }
+    SFTPPipelinedTransferFailed(Upload, &E);
+  }
+
+  if (!Upload->Handle.IsEmpty())
+  {
+    unsigned long BlockSize = UploadBlockSize(Upload->Handle, OperationProgress);
+    if (BlockSize == 0)
+    {
+      FTerminal->LogEvent(FORMAT(L"Cannot fit data of \"%s\" into a packet.", (Upload->FileName)));
+      Upload->Failed = true;
+    }
+
+    TSFTPPacket * Packet;
+    int Offset = 0;
+    while (!Upload->Failed && (Offset < Upload->Buffer.Size))
+    {
+      int Len = std::min(static_cast<int>(BlockSize), Upload->Buffer.Size - Offset);
+      Packet = new TSFTPPacket(SSH_FXP_WRITE);
+      Upload->Packets->Add(Packet);
+      Packet->AddString(Upload->Handle);
+      Packet->AddInt64(Offset);
+      Packet->AddData(Upload->Buffer.Data + Offset, Len);
+      SendPacket(Packet);
+      ReserveResponse(Packet, Packet);
+      Offset += Len;
+    }
+    Upload->Buffer.Size = 0;
+
+    // do not wait for the writes, the same as in SFTPSource
+    Packet = new TSFTPPacket(SSH_FXP_CLOSE);
+    Upload->Packets->Add(Packet);
+    Packet->AddString(Upload->Handle);
+    SendPacket(Packet);
+    ReserveResponse(Packet, Packet);
+
+    if (!Upload->Failed && Upload->SetProperties)
+    {
+      TSFTPPacket & PropertiesRequest = Upload->PropertiesPacket;
+      PropertiesRequest.ChangeType(SSH_FXP_SETSTAT);
+      PropertiesRequest.AddPathString(Upload->DestFullName, FUtfStrings);
+      TRights Rights = CopyParam->RemoteFileRights(Upload->LocalFileAttrs);
+      unsigned short RightsNumber = Rights.NumberSet;
+      PropertiesRequest.AddProperties(
+        CopyParam->PreserveRights ? &RightsNumber : NULL, NULL, NULL,
+        CopyParam->PreserveTime ? &Upload->MTime : NULL,
+        CopyParam->PreserveTime ? &Upload->ATime : NULL,
+        NULL, false, FVersion, FUtfStrings);
+      SendPacket(&PropertiesRequest);
+      ReserveResponse(&PropertiesRequest, &PropertiesRequest);
+    }
+    else
+    {
+      Upload->SetProperties = false;
+    }
+  }
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSFTPFileSystem::SFTPPipelinedUploadComplete(TSFTPPipelinedUpload * Upload,
+  const TCopyParamType * CopyParam, TFileOperationProgressType * OperationProgress)
+{
+  // collect all responses, even after a failure, not to leave the handle open
+  for (int Index = 0; Index < Upload->Packets->Count; Index++)
+  {
+    TSFTPPacket * Packet = static_cast<TSFTPPacket *>(Upload->Packets->Items[Index]);
+    try
+    {
+      ReceiveResponse(Packet, Packet, SSH_FXP_STATUS);
+    }
+    catch(Exception & E)
+    {
+      if (!FTerminal->Active)
+      {
+        throw;
+      }
+      SFTPPipelinedTransferFailed(Upload, &E);
+    }
+  }
+
+  if (Upload->SetProperties)
+  {
+    try
+    {
+      ReceiveResponse(&Upload->PropertiesPacket, &Upload->PropertiesPacket, SSH_FXP_STATUS,
+        asOK | FLAGMASK(CopyParam->IgnorePermErrors, asPermDenied));
+    }
+    catch(Exception & E)
+    {
+      if (!FTerminal->Active)
+      {
+        throw;
+      }
+      SFTPPipelinedTransferFailed(Upload, &E);
+    }
+  }
+
+  bool Result = !Upload->Failed;
+  if (Result)
+  {
+    OperationProgress->SetFile(Upload->FileName);
+    OperationProgress->SetLocalSize(Upload->Size);
+    OperationProgress->SetTransferSize(Upload->Size);
+    OperationProgress->AddLocallyUsed(Upload->Size);
+    OperationProgress->AddTransfered(Upload->Size);
+
+    TUploadSessionAction Action(FTerminal->ActionLog);
+    Action.FileName(ExpandUNCFileName(Upload->FileName));
+    Action.Destination(Upload->DestFullName);
+
+    if (CopyParam->PreserveTime)
+    {
+      TDateTime MDateTime = UnixToDateTime(Upload->MTime, FTerminal->SessionData->DSTMode);
+      FTerminal->LogEvent(FORMAT(L"Preserving timestamp [%s]",
+        (StandardTimestamp(MDateTime))));
+      TTouchSessionAction TouchAction(FTerminal->ActionLog, Upload->DestFullName, MDateTime);
+    }
+    if (CopyParam->PreserveRights)
+    {
+      TChmodSessionAction ChmodAction(FTerminal->ActionLog, Upload->DestFullName,
+        CopyParam->RemoteFileRights(Upload->LocalFileAttrs));
+    }
+
+    FTerminal->LogFileDone(OperationProgress);
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::SFTPPipelinedUploadDispose(TSFTPPipelinedUpload * Upload)
+{
+  // the file was created (truncated) by the OPEN request, but no data were written
+  if (FTerminal->Active)
+  {
+    try
+    {
+      ReceiveResponse(&Upload->OpenPacket, &Upload->OpenPacket, SSH_FXP_HANDLE);
+      TSFTPPacket Packet(SSH_FXP_CLOSE);
+      Packet.AddString(Upload->OpenPacket.GetFileHandle());
+      SendPacketAndReceiveResponse(&Packet, &Packet, SSH_FXP_STATUS);
+      DoDeleteFile(Upload->DestFullName, SSH_FXP_REMOVE);
+    }
+    catch(Exception & E)
+    {
+      if (FTerminal->Active)
+      {
+        FTerminal->LogEvent(L"Error while disposing the SFTP upload pipeline.");
+        FTerminal->Log->AddException(&E);
+      }
+      else
       {
-        TSuspendFileOperationProgress Suspend(OperationProgress);
-        if (!FTerminal->HandleException(&E))
-        {
-          throw;
-        }
+        FTerminal->LogEvent(L"Fatal error while disposing the SFTP upload pipeline.");
+        throw;
       }
     }
-    __finally
-    {
-      FAvoidBusy = false;
-      OperationProgress->Finish(FileName, Success, OnceDoneOperation);
-    }
-    Index++;
   }
 }
 //---------------------------------------------------------------------------
@@ -5025,10 +6000,10 @@ void __fastcall TSFTPFileSystem::SFTPSource(const UnicodeString FileName,
   }
 }
 //---------------------------------------------------------------------------
-RawByteString __fastcall TSFTPFileSystem::SFTPOpenRemoteFile(
+void __fastcall TSFTPFileSystem::SFTPOpenRemoteFileRequest(TSFTPPacket & Packet,
   const UnicodeString & FileName, unsigned int OpenType, __int64 Size)
 {
-  TSFTPPacket Packet(SSH_FXP_OPEN);
+  Packet.ChangeType(SSH_FXP_OPEN);
 
   Packet.AddPathString(FileName, FUtfStrings);
   if (FVersion < 5)
@@ -5079,6 +6054,13 @@ RawByteString __fastcall TSFTPFileSystem::SFTPOpenRemoteFile(
     (!FSupport->Loaded || FLAGSET(FSupport->AttributeMask, Packet.AllocationSizeAttribute(FVersion)));
   Packet.AddProperties(NULL, NULL, NULL, NULL, NULL,
     SendSize ? &Size : NULL, false, FVersion, FUtfStrings);
+}
+//---------------------------------------------------------------------------
+RawByteString __fastcall TSFTPFileSystem::SFTPOpenRemoteFile(
+  const UnicodeString & FileName, unsigned int OpenType, __int64 Size)
+{
+  TSFTPPacket Packet;
+  SFTPOpenRemoteFileRequest(Packet, FileName, OpenType, Size);
 
   SendPacketAndReceiveResponse(&Packet, &Packet, SSH_FXP_HANDLE);
 
@@ -5423,6 +6405,18 @@ void __fastcall TSFTPFileSystem::CopyToLocal(TStrings * FilesToCopy,
 
   UnicodeString FileName;
   UnicodeString FullTargetDir = IncludeTrailingBackslash(TargetDir);
+
+  // see CopyToRemote
+  std::unique_ptr<TStrings> RemainingFiles;
+  if ((FilesToCopy->Count > 1) &&
+      SFTPCanPipelineDownload(CopyParam, Params, OperationProgress))
+  {
+    RemainingFiles.reset(new TStringList());
+    SFTPSinkPipelined(FilesToCopy, FullTargetDir, CopyParam, Params,
+      OperationProgress, OnceDoneOperation, RemainingFiles.get());
+    FilesToCopy = RemainingFiles.get();
+  }
+
   const TRemoteFile * File;
   bool Success;
   int Index = 0;
@@ -5466,6 +6460,444 @@ void __fastcall TSFTPFileSystem::CopyToLocal(TStrings * FilesToCopy,
   }
 }
 //---------------------------------------------------------------------------
+bool __fastcall TSFTPFileSystem::SFTPCanPipelineDownload(
+  const TCopyParamType * /*CopyParam*/, int Params, TFileOperationProgressType * OperationProgress)
+{
+  return
+    (FTerminal->SessionData->SFTPDownloadQueue > 1) &&
+    // moving files is left for the regular download
+    FLAGCLEAR(Params, cpDelete) &&
+    // speed limit is applied per block
+    (OperationProgress->CPSLimit == 0);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::SFTPSinkPipelined(TStrings * FilesToCopy,
+  const UnicodeString & TargetDir, const TCopyParamType * CopyParam, int Params,
+  TFileOperationProgressType * OperationProgress, TOnceDoneOperation & OnceDoneOperation,
+  TStrings * RemainingFiles)
+{
+  // The same as SFTPSourcePipelined, just that up to SFTPDownloadQueue
+  // small files are in flight:
+  // - Opening: OPEN request sent, waiting for the handle,
+  // - Reading: FSTAT, READ and CLOSE requests sent, waiting for the data.
+  int QueueLen = FTerminal->SessionData->SFTPDownloadQueue;
+  std::unique_ptr<TList> Opening(new TList());
+  std::unique_ptr<TList> Reading(new TList());
+
+  FTerminal->LogEvent(FORMAT(L"Downloading small files in a pipeline of %d files.", (QueueLen)));
+
+  DebugAssert(!FAvoidBusy);
+  FAvoidBusy = true;
+
+  try
+  {
+    try
+    {
+      int Index = 0;
+      while ((Index < FilesToCopy->Count) || (Opening->Count > 0) || (Reading->Count > 0))
+      {
+        while ((Index < FilesToCopy->Count) &&
+               (Opening->Count + Reading->Count < QueueLen) &&
+               !OperationProgress->Cancel)
+        {
+          TSFTPPipelinedDownload * Download =
+            SFTPPipelinedDownloadOpen(FilesToCopy->Strings[Index],
+              static_cast<const TRemoteFile *>(FilesToCopy->Objects[Index]), TargetDir,
+              CopyParam, Params, OperationProgress, RemainingFiles);
+          if (Download != NULL)
+          {
+            Opening->Add(Download);
+          }
+          Index++;
+        }
+
+        if (OperationProgress->Cancel)
+        {
+          // the regular download loop stops on the cancel on its own
+          while (Index < FilesToCopy->Count)
+          {
+            RemainingFiles->AddObject(FilesToCopy->Strings[Index], FilesToCopy->Objects[Index]);
+            Index++;
+          }
+        }
+
+        if (Opening->Count > 0)
+        {
+          TSFTPPipelinedDownload * Download = static_cast<TSFTPPipelinedDownload *>(Opening->Items[0]);
+          Opening->Delete(0);
+          Reading->Add(Download);
+          SFTPPipelinedDownloadRead(Download, OperationProgress);
+        }
+
+        if ((Reading->Count > 0) &&
+            ((Opening->Count == 0) || (Opening->Count + Reading->Count >= QueueLen)))
+        {
+          std::unique_ptr<TSFTPPipelinedDownload> Download(
+            static_cast<TSFTPPipelinedDownload *>(Reading->Items[0]));
+          Reading->Delete(0);
+          bool Success = false;
+          bool Failed = false;
+          try
+          {
+            Success = SFTPPipelinedDownloadComplete(Download.get(), CopyParam, Params, OperationProgress);
+            Failed = !Success;
+          }
+          catch(EScpSkipFile & E)
+          {
+            // the same as in CopyToLocal
+            TSuspendFileOperationProgress Suspend(OperationProgress);
+            if (!FTerminal->HandleException(&E))
+            {
+              throw;
+            }
+          }
+
+          if (Failed)
+          {
+            RemainingFiles->AddObject(Download->FileName, const_cast<TRemoteFile *>(Download->File));
+          }
+          else
+          {
+            OperationProgress->Finish(Download->FileName, Success, OnceDoneOperation);
+          }
+        }
+      }
+    }
+    catch(...)
+    {
+      for (int Index = 0; Index < Opening->Count; Index++)
+      {
+        SFTPPipelinedDownloadDispose(static_cast<TSFTPPipelinedDownload *>(Opening->Items[Index]));
+      }
+      throw;
+    }
+  }
+  __finally
+  {
+    FAvoidBusy = false;
+    // releases reservations of responses we are no longer interested in
+    for (int Index = 0; Index < Opening->Count; Index++)
+    {
+      delete static_cast<TSFTPPipelinedDownload *>(Opening->Items[Index]);
+    }
+    for (int Index = 0; Index < Reading->Count; Index++)
+    {
+      delete static_cast<TSFTPPipelinedDownload *>(Reading->Items[Index]);
+    }
+  }
+}
+//---------------------------------------------------------------------------
+TSFTPPipelinedDownload * __fastcall TSFTPFileSystem::SFTPPipelinedDownloadOpen(
+  const UnicodeString & FileName, const TRemoteFile * File, const UnicodeString & TargetDir,
+  const TCopyParamType * CopyParam, int Params,
+  TFileOperationProgressType * OperationProgress, TStrings * RemainingFiles)
+{
+  // see SFTPPipelinedUploadOpen
+  static const __int64 PipelinedDownloadMaxSize = 128 * 1024;
+
+  TSFTPPipelinedDownload * Result = NULL;
+  UnicodeString RemoteFileName = LocalCanonify(FileName);
+
+  // everything that may need a lookup or a confirmation is left for the regular download,
+  // including files excluded from the transfer, for the regular download to log them
+  bool Pipeline = (File != NULL) && !File->IsDirectory && !File->IsSymLink &&
+    (File->Size <= PipelinedDownloadMaxSize);
+  UnicodeString DestFullName;
+  int LocalFileAttrs = -1;
+  if (Pipeline)
+  {
+    TFileMasks::TParams MaskParams;
+    MaskParams.Size = File->Size;
+    MaskParams.Modification = File->Modification;
+    UnicodeString BaseFileName = FTerminal->GetBaseFileName(RemoteFileName);
+
+    Pipeline =
+      CopyParam->AllowTransfer(BaseFileName, osRemote, false, MaskParams) &&
+      !CopyParam->SkipTransfer(RemoteFileName, false) &&
+      !CopyParam->UseAsciiTransfer(BaseFileName, osRemote, MaskParams) &&
+      (FLAGSET(Params, cpTemporary) || !CopyParam->AllowResume(File->Size));
+
+    if (Pipeline)
+    {
+      UnicodeString DestFileName =
+        FTerminal->ChangeFileName(
+          CopyParam, UnixExtractFileName(RemoteFileName), osRemote, true);
+      DestFullName = TargetDir + DestFileName;
+      LocalFileAttrs = FileGetAttr(ApiPath(DestFullName));
+      Pipeline =
+        (LocalFileAttrs < 0) ||
+        (FLAGCLEAR(LocalFileAttrs, faDirectory) &&
+         !FTerminal->CheckRemoteFile(RemoteFileName, CopyParam, Params, OperationProgress));
+    }
+  }
+
+  if (!Pipeline)
+  {
+    RemainingFiles->AddObject(FileName, const_cast<TRemoteFile *>(File));
+  }
+  else
+  {
+    std::unique_ptr<TSFTPPipelinedDownload> Download(new TSFTPPipelinedDownload());
+    Download->FileName = FileName;
+    Download->RemoteFileName = RemoteFileName;
+    Download->File = File;
+    Download->DestFullName = DestFullName;
+    Download->LocalFileAttrs = LocalFileAttrs;
+
+    FTerminal->LogEvent(FORMAT(L"Copying \"%s\" to local directory started.", (RemoteFileName)));
+
+    SFTPOpenRemoteFileRequest(Download->OpenPacket, RemoteFileName, SSH_FXF_READ, -1);
+    SendPacket(&Download->OpenPacket);
+    ReserveResponse(&Download->OpenPacket, &Download->OpenPacket);
+
+    Result = Download.release();
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::SFTPPipelinedDownloadRead(TSFTPPipelinedDownload * Download,
+  TFileOperationProgressType * OperationProgress)
+{
+  try
+  {
+    ReceiveResponse(&Download->OpenPacket, &Download->OpenPacket, SSH_FXP_HANDLE);
+    Download->Handle = Download->OpenPacket.GetFileHandle();
+  }
+  catch(Exception & E)
+  {
+    if (!FTerminal->Active)
+    {
+      throw;
+    }
+    SFTPPipelinedTransferFailed(Download, &E);
+  }
+
+  if (!Download->Handle.IsEmpty())
+  {
+    Download->StatPacket.ChangeType(SSH_FXP_FSTAT);
+    Download->StatPacket.AddString(Download->Handle);
+    SendCustomReadFile(&Download->StatPacket, &Download->StatPacket,
+      SSH_FILEXFER_ATTR_MODIFYTIME);
+
+    // Read the file as we know it from the listing,
+    // plus one more request, which should hit the end of file
+    Download->BlockSize = DownloadBlockSize(OperationProgress);
+    __int64 Size = Download->File->Size;
+    __int64 Offset = 0;
+    do
+    {
+      unsigned long Len = Download->BlockSize;
+      if (Offset < Size)
+      {
+        Len = static_cast<unsigned long>(std::min(Size - Offset, static_cast<__int64>(Len)));
+      }
+      TSFTPPacket * Packet = new TSFTPPacket(SSH_FXP_READ);
+      Download->Packets->Add(Packet);
+      Packet->AddString(Download->Handle);
+      Packet->AddInt64(Offset);
+      Packet->AddCardinal(Len);
+      SendPacket(Packet);
+      ReserveResponse(Packet, Packet);
+      Offset += Len;
+    }
+    while (Offset <= Size);
+
+    // do not wait for the response, the same as in SFTPSink
+    TSFTPPacket CloseRequest(SSH_FXP_CLOSE);
+    CloseRequest.AddString(Download->Handle);
+    SendPacket(&CloseRequest);
+    ReserveResponse(&CloseRequest, NULL);
+  }
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSFTPFileSystem::SFTPPipelinedDownloadComplete(TSFTPPipelinedDownload * Download,
+  const TCopyParamType * CopyParam, int Params, TFileOperationProgressType * OperationProgress)
+{
+  const TRemoteFile * File = Download->File;
+  TDateTime Modification = File->Modification;
+  TDateTime LastAccess = File->LastAccess;
+  TFileBuffer Buffer;
+
+  if (!Download->Failed)
+  {
+    // ignore errors, the same as in SFTPSink
+    ReceiveResponse(&Download->StatPacket, &Download->StatPacket);
+    if (Download->StatPacket.Type == SSH_FXP_ATTRS)
+    {
+      std::unique_ptr<TRemoteFile> AFile(
+        LoadFile(&Download->StatPacket, NULL, UnixExtractFileName(Download->RemoteFileName), NULL, false));
+      Modification = AFile->Modification;
+      LastAccess = AFile->LastAccess;
+    }
+  }
+
+  // collect all responses, even after a failure
+  for (int Index = 0; Index < Download->Packets->Count; Index++)
+  {
+    TSFTPPacket * Packet = static_cast<TSFTPPacket *>(Download->Packets->Items[Index]);
+    try
+    {
+      ReceiveResponse(Packet, Packet, SSH_FXP_DATA, asEOF);
+      bool Last = (Index == Download->Packets->Count - 1);
+      if (Download->Failed)
+      {
+        // noop
+      }
+      else if (Packet->Type == SSH_FXP_STATUS)
+      {
+        // premature end of file, the file has shrunk since the listing
+        if (!Last || (Buffer.Size < File->Size))
+        {
+          FTerminal->LogEvent(FORMAT(L"File \"%s\" is smaller than expected.", (Download->RemoteFileName)));
+          Download->Failed = true;
+        }
+      }
+      else if (Last)
+      {
+        FTerminal->LogEvent(FORMAT(L"File \"%s\" is larger than expected.", (Download->RemoteFileName)));
+        Download->Failed = true;
+      }
+      else
+      {
+        unsigned long DataLen = Packet->GetCardinal();
+        __int64 Expected =
+          std::min(File->Size - Buffer.Size, static_cast<__int64>(Download->BlockSize));
+        // do not bother filling the gaps (see SFTPSink), leave it for the regular download
+        if (static_cast<__int64>(DataLen) != Expected)
+        {
+          FTerminal->LogEvent(FORMAT(L"Received incomplete data of \"%s\".", (Download->RemoteFileName)));
+          Download->Failed = true;
+        }
+        else
+        {
+          Buffer.Insert(Buffer.Size, reinterpret_cast<const char *>(Packet->GetNextData(DataLen)), DataLen);
+          Packet->DataConsumed(DataLen);
+        }
+      }
+    }
+    catch(Exception & E)
+    {
+      if (!FTerminal->Active)
+      {
+        throw;
+      }
+      SFTPPipelinedTransferFailed(Download, &E);
+    }
+  }
+
+  bool Result = !Download->Failed;
+  if (Result)
+  {
+    FTerminal->LogFileDetails(Download->RemoteFileName, File->Modification, File->Size);
+    OperationProgress->SetFile(Download->RemoteFileName);
+    OperationProgress->SetTransferSize(Buffer.Size);
+    OperationProgress->SetLocalSize(Buffer.Size);
+    OperationProgress->AddTransfered(Buffer.Size);
+
+    TDownloadSessionAction Action(FTerminal->ActionLog);
+    Action.FileName(Download->RemoteFileName);
+    UnicodeString DestFullName = Download->DestFullName;
+    Action.Destination(ExpandUNCFileName(DestFullName));
+
+    try
+    {
+      HANDLE LocalHandle;
+      if (!FTerminal->CreateLocalFile(DestFullName, OperationProgress,
+             &LocalHandle, FLAGSET(Params, cpNoConfirmation)))
+      {
+        THROW_SKIP_FILE_NULL;
+      }
+
+      bool DeleteLocalFile = true;
+      try
+      {
+        std::unique_ptr<TStream> FileStream(new TSafeHandleStream((THandle)LocalHandle));
+        FILE_OPERATION_LOOP_BEGIN
+        {
+          Buffer.WriteToStream(FileStream.get(), Buffer.Size);
+        }
+        FILE_OPERATION_LOOP_END(FMTLOAD(WRITE_ERROR, (DestFullName)));
+        OperationProgress->AddLocallyUsed(Buffer.Size);
+
+        if (CopyParam->PreserveTime)
+        {
+          FTerminal->LogEvent(FORMAT(L"Preserving timestamp [%s]",
+            (StandardTimestamp(Modification))));
+          FILETIME AcTime = DateTimeToFileTime(LastAccess, FTerminal->SessionData->DSTMode);
+          FILETIME WrTime = DateTimeToFileTime(Modification, FTerminal->SessionData->DSTMode);
+          SetFileTime(LocalHandle, NULL, &AcTime, &WrTime);
+        }
+
+        DeleteLocalFile = false;
+      }
+      __finally
+      {
+        CloseHandle(LocalHandle);
+        if (DeleteLocalFile)
+        {
+          FILE_OPERATION_LOOP_BEGIN
+          {
+            THROWOSIFFALSE(Sysutils::DeleteFile(ApiPath(DestFullName)));
+          }
+          FILE_OPERATION_LOOP_END(FMTLOAD(DELETE_LOCAL_FILE_ERROR, (DestFullName)));
+        }
+      }
+
+      int Attrs = Download->LocalFileAttrs;
+      if (Attrs == -1)
+      {
+        Attrs = faArchive;
+      }
+      int NewAttrs = CopyParam->LocalFileAttrs(*File->Rights);
+      if ((NewAttrs & Attrs) != NewAttrs)
+      {
+        FILE_OPERATION_LOOP_BEGIN
+        {
+          THROWOSIFFALSE(FileSetAttr(ApiPath(DestFullName), Attrs | NewAttrs) == 0);
+        }
+        FILE_OPERATION_LOOP_END(FMTLOAD(CANT_SET_ATTRS, (DestFullName)));
+      }
+    }
+    catch(Exception & E)
+    {
+      FTerminal->RollbackAction(Action, OperationProgress, &E);
+      throw;
+    }
+
+    FTerminal->LogFileDone(OperationProgress);
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::SFTPPipelinedDownloadDispose(TSFTPPipelinedDownload * Download)
+{
+  // close the handle that we will never read from
+  if (FTerminal->Active)
+  {
+    try
+    {
+      ReceiveResponse(&Download->OpenPacket, &Download->OpenPacket, SSH_FXP_HANDLE);
+      TSFTPPacket CloseRequest(SSH_FXP_CLOSE);
+      CloseRequest.AddString(Download->OpenPacket.GetFileHandle());
+      SendPacket(&CloseRequest);
+      ReserveResponse(&CloseRequest, NULL);
+    }
+    catch(Exception & E)
+    {
+      if (FTerminal->Active)
+      {
+        FTerminal->LogEvent(L"Error while disposing the SFTP download pipeline.");
+        FTerminal->Log->AddException(&E);
+      }
+      else
+      {
+        FTerminal->LogEvent(L"Fatal error while disposing the SFTP download pipeline.");
+        throw;
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TSFTPFileSystem::SFTPSinkRobust(const UnicodeString FileName,
   const TRemoteFile * File, const UnicodeString TargetDir,
   const TCopyParamType * CopyParam, int Params,
@@ -5849,7 +7281,13 @@ void __fastcall TSFTPFileSystem::SFTPSink(const UnicodeString FileName,
 
       DeleteLocalFile = true;
 
-      FileStream = new TSafeHandleStream((THandle)LocalHandle);
+      FileStream = FTerminal->CreateLocalFileStream(LocalHandle, true);
+      TAsynchronousHandleStream * AsynchronousStream = dynamic_cast<TAsynchronousHandleStream *>(FileStream);
+      if ((AsynchronousStream != NULL) && FTerminal->Configuration->LocalIOPreallocate &&
+          (OverwriteMode == omOverwrite))
+      {
+        AsynchronousStream->Preallocate(File->Size);
+      }
 
       // at end of this block queue is discarded
       {
@@ -6002,6 +7440,13 @@ void __fastcall TSFTPFileSystem::SFTPSink(const UnicodeString FileName,
         // queue is discarded here
       }
 
+      // wait for the data still being written behind
+      FILE_OPERATION_LOOP_BEGIN
+      {
+        FlushStream(FileStream);
+      }
+      FILE_OPERATION_LOOP_END(FMTLOAD(WRITE_ERROR, (LocalFileName)));
+
       if (CopyParam->PreserveTime)
       {
         FTerminal->LogEvent(FORMAT(L"Preserving timestamp [%s]",
@@ -6046,8 +7491,9 @@ void __fastcall TSFTPFileSystem::SFTPSink(const UnicodeString FileName,
     }
     __finally
     {
-      if (LocalHandle) CloseHandle(LocalHandle);
+      // the stream may still be writing to the handle
       if (FileStream) delete FileStream;
+      if (LocalHandle) CloseHandle(LocalHandle);
       if (DeleteLocalFile && (!ResumeAllowed || OperationProgress->LocallyUsed == 0) &&
           (OverwriteMode == omOverwrite))
       {
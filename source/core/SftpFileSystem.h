@@ -3,10 +3,15 @@
 #define SftpFileSystemH
 
 #include <FileSystems.h>
+#include <map>
 //---------------------------------------------------------------------------
 class TSFTPPacket;
 class TOverwriteFileParams;
 struct TSFTPSupport;
+class TSFTPPipelinedTransfer;
+class TSFTPPipelinedUpload;
+class TSFTPPipelinedDownload;
+class TSFTPPipelinedMutation;
 class TSecureShell;
 //---------------------------------------------------------------------------
 enum TSFTPOverwriteMode { omOverwrite, omAppend, omResume };
@@ -21,6 +26,7 @@ friend class TSFTPUploadQueue;
 friend class TSFTPDownloadQueue;
 friend class TSFTPLoadFilesPropertiesQueue;
 friend class TSFTPCalculateFilesChecksumQueue;
+friend class TSFTPResolveSymlinksQueue;
 friend class TSFTPBusy;
 public:
   __fastcall TSFTPFileSystem(TTerminal * ATerminal, TSecureShell * SecureShell);
@@ -96,6 +102,8 @@ protected:
   AnsiString FEOL;
   TList * FPacketReservations;
   Variant FPacketNumbers;
+  // send ticks of requests awaiting response, for metrics
+  std::map<unsigned int, unsigned int> FRequestTicks;
   char FPreviousLoggedPacket;
   int FNotLoggedPackets;
   int FBusy;
@@ -112,6 +120,8 @@ protected:
   bool FSupportsHardlink;
   std::unique_ptr<TStringList> FChecksumAlgs;
   std::unique_ptr<TStringList> FChecksumSftpAlgs;
+  std::unique_ptr<TList> FMutations;
+  int FMutationDepth;
 
   void __fastcall SendCustomReadFile(TSFTPPacket * Packet, TSFTPPacket * Response,
     unsigned long Flags);
@@ -144,6 +154,7 @@ protected:
     TSFTPPacket * Response, int ExpectedType = -1, int AllowStatus = -1);
   void __fastcall UnreserveResponse(TSFTPPacket * Response);
   void __fastcall TryOpenDirectory(const UnicodeString Directory);
+  void __fastcall ResolveSymlinks(TStrings * Symlinks, int Total);
   bool __fastcall SupportsExtension(const UnicodeString & Extension) const;
   void __fastcall ResetConnection();
   void __fastcall DoCalculateFilesChecksum(
@@ -153,6 +164,10 @@ protected:
     TFileOperationProgressType * OperationProgress, bool FirstLevel);
   void __fastcall RegisterChecksumAlg(const UnicodeString & Alg, const UnicodeString & SftpAlg);
   void __fastcall DoDeleteFile(const UnicodeString FileName, unsigned char Type);
+  void __fastcall SFTPSendMutation(TSFTPPipelinedMutation * Mutation);
+  void __fastcall SFTPReceiveMutation();
+  void __fastcall SFTPFlushMutations();
+  void __fastcall SFTPDiscardMutations();
 
   void __fastcall SFTPSourceRobust(const UnicodeString FileName,
     const UnicodeString TargetDir, const TCopyParamType * CopyParam, int Params,
@@ -161,6 +176,25 @@ protected:
     const UnicodeString TargetDir, const TCopyParamType * CopyParam, int Params,
     TFileOperationProgressType * OperationProgress, unsigned int Flags,
     TUploadSessionAction & Action, bool & ChildError);
+  bool __fastcall SFTPCanPipelineUpload(const TCopyParamType * CopyParam, int Params,
+    TFileOperationProgressType * OperationProgress);
+  void __fastcall SFTPSourcePipelined(TStrings * FilesToCopy,
+    const UnicodeString & TargetDir, const TCopyParamType * CopyParam, int Params,
+    TFileOperationProgressType * OperationProgress, TOnceDoneOperation & OnceDoneOperation,
+    TStrings * RemainingFiles);
+  TSFTPPipelinedUpload * __fastcall SFTPPipelinedUploadOpen(
+    const UnicodeString & FileName, const UnicodeString & TargetDir,
+    const TCopyParamType * CopyParam, int Params,
+    TFileOperationProgressType * OperationProgress, TOnceDoneOperation & OnceDoneOperation,
+    TStrings * RemainingFiles);
+  void __fastcall SFTPPipelinedTransferFailed(TSFTPPipelinedTransfer * Transfer, Exception * E);
+  void __fastcall SFTPPipelinedUploadWrite(TSFTPPipelinedUpload * Upload,
+    const TCopyParamType * CopyParam, TFileOperationProgressType * OperationProgress);
+  bool __fastcall SFTPPipelinedUploadComplete(TSFTPPipelinedUpload * Upload,
+    const TCopyParamType * CopyParam, TFileOperationProgressType * OperationProgress);
+  void __fastcall SFTPPipelinedUploadDispose(TSFTPPipelinedUpload * Upload);
+  void __fastcall SFTPOpenRemoteFileRequest(TSFTPPacket & Packet,
+    const UnicodeString & FileName, unsigned int OpenType, __int64 Size);
   RawByteString __fastcall SFTPOpenRemoteFile(const UnicodeString & FileName,
     unsigned int OpenType, __int64 Size = -1);
   int __fastcall SFTPOpenRemote(void * AOpenParams, void * Param2);
@@ -186,6 +220,21 @@ protected:
     TDownloadSessionAction & Action, bool & ChildError);
   void __fastcall SFTPSinkFile(UnicodeString FileName,
     const TRemoteFile * File, void * Param);
+  bool __fastcall SFTPCanPipelineDownload(const TCopyParamType * CopyParam, int Params,
+    TFileOperationProgressType * OperationProgress);
+  void __fastcall SFTPSinkPipelined(TStrings * FilesToCopy,
+    const UnicodeString & TargetDir, const TCopyParamType * CopyParam, int Params,
+    TFileOperationProgressType * OperationProgress, TOnceDoneOperation & OnceDoneOperation,
+    TStrings * RemainingFiles);
+  TSFTPPipelinedDownload * __fastcall SFTPPipelinedDownloadOpen(
+    const UnicodeString & FileName, const TRemoteFile * File, const UnicodeString & TargetDir,
+    const TCopyParamType * CopyParam, int Params,
+    TFileOperationProgressType * OperationProgress, TStrings * RemainingFiles);
+  void __fastcall SFTPPipelinedDownloadRead(TSFTPPipelinedDownload * Download,
+    TFileOperationProgressType * OperationProgress);
+  bool __fastcall SFTPPipelinedDownloadComplete(TSFTPPipelinedDownload * Download,
+    const TCopyParamType * CopyParam, int Params, TFileOperationProgressType * OperationProgress);
+  void __fastcall SFTPPipelinedDownloadDispose(TSFTPPipelinedDownload * Download);
   char * __fastcall GetEOL() const;
   inline void __fastcall BusyStart();
   inline void __fastcall BusyEnd();
@@ -23,6 +23,8 @@
 #include "HelpCore.h"
 #include "CoreMain.h"
 #include "Queue.h"
+#include <map>
+#include <vector>
 #include <openssl/pkcs12.h>
 #include <openssl/err.h>
 
@@ -326,7 +328,7 @@ void __fastcall TTunnelThread::Execute()
 class TTunnelUI : public TSessionUI
 {
 public:
-  __fastcall TTunnelUI(TTerminal * Terminal);
+  __fastcall TTunnelUI(TTerminal * Terminal, bool Tunnel = true);
   virtual void __fastcall Information(const UnicodeString & Str, bool Status);
   virtual unsigned int __fastcall QueryUser(const UnicodeString Query,
     TStrings * MoreMessages, unsigned int Answers, const TQueryParams * Params,
@@ -346,12 +348,14 @@ public:
 private:
   TTerminal * FTerminal;
   unsigned int FTerminalThread;
+  bool FTunnel;
 };
 //---------------------------------------------------------------------------
-__fastcall TTunnelUI::TTunnelUI(TTerminal * Terminal)
+__fastcall TTunnelUI::TTunnelUI(TTerminal * Terminal, bool Tunnel)
 {
   FTerminal = Terminal;
   FTerminalThread = GetCurrentThreadId();
+  FTunnel = Tunnel;
 }
 //---------------------------------------------------------------------------
 void __fastcall TTunnelUI::Information(const UnicodeString & Str, bool Status)
@@ -400,7 +404,7 @@ bool __fastcall TTunnelUI::PromptUser(TSessionData * Data, TPromptKind Kind,
   bool Result;
   if (GetCurrentThreadId() == FTerminalThread)
   {
-    if (IsAuthenticationPrompt(Kind))
+    if (FTunnel && IsAuthenticationPrompt(Kind))
     {
       Instructions = LoadStr(TUNNEL_INSTRUCTION) +
         (Instructions.IsEmpty() ? L"" : L"\n") +
@@ -448,6 +452,129 @@ void __fastcall TTunnelUI::ProcessGUI()
 }
 //---------------------------------------------------------------------------
 //---------------------------------------------------------------------------
+// SSH connection shared by a session and its secondary sessions
+// (background transfers, separate shell session).
+// It has no shell and it is serviced by its own thread, so it does not
+// depend on any of the sessions that run their channels over it.
+// It is closed only with the session that owns it.
+class TSharedConnection
+{
+public:
+  __fastcall TSharedConnection(TTerminal * Terminal);
+  __fastcall ~TSharedConnection();
+
+  bool __fastcall Connect(TTerminal * Terminal);
+
+private:
+  TTerminal * FTerminal;
+  TCriticalSection * FSection;
+  bool FOpening;
+  TSessionData * FData;
+  TSessionLog * FLog;
+  TTunnelUI * FUI;
+  TSecureShell * FSecureShell;
+  TTunnelThread * FThread;
+
+  void __fastcall Open(TTerminal * Terminal);
+  void __fastcall Close();
+};
+//---------------------------------------------------------------------------
+__fastcall TSharedConnection::TSharedConnection(TTerminal * Terminal) :
+  FTerminal(Terminal),
+  FOpening(false),
+  FData(NULL),
+  FLog(NULL),
+  FUI(NULL),
+  FSecureShell(NULL),
+  FThread(NULL)
+{
+  FSection = new TCriticalSection();
+}
+//---------------------------------------------------------------------------
+__fastcall TSharedConnection::~TSharedConnection()
+{
+  Close();
+  delete FSection;
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSharedConnection::Connect(TTerminal * Terminal)
+{
+  bool Result;
+  bool DoOpen;
+  {
+    TGuard Guard(FSection);
+    Result = !FOpening && (FSecureShell != NULL) && FSecureShell->Active;
+    // If other session is opening the connection, it may be waiting for
+    // the user to answer a prompt, connect directly instead of waiting.
+    DoOpen = !FOpening && !Result;
+    if (DoOpen)
+    {
+      FOpening = true;
+    }
+  }
+
+  if (DoOpen)
+  {
+    try
+    {
+      // The previous connection was lost, all its downstreams
+      // have been closed already
+      Close();
+      try
+      {
+        Open(Terminal);
+      }
+      catch(...)
+      {
+        Close();
+        throw;
+      }
+      Result = true;
+    }
+    __finally
+    {
+      TGuard Guard(FSection);
+      FOpening = false;
+    }
+  }
+
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSharedConnection::Open(TTerminal * Terminal)
+{
+  Terminal->LogEvent(L"Opening shared connection.");
+
+  FData = Terminal->SessionData->Clone();
+  FLog = new TSessionLog(FTerminal, FData, FTerminal->Configuration);
+  FLog->Parent = FTerminal->Log;
+  FLog->Name = L"Shared";
+  FLog->ReflectSettings();
+  // prompts are presented by the session that opens the connection,
+  // once the connection is serviced by the thread, there are none
+  FUI = new TTunnelUI(Terminal, false);
+  FSecureShell = new TSecureShell(FUI, FData, FLog, FTerminal->Configuration);
+  FSecureShell->SharedConnection = this;
+  FSecureShell->SharedConnectionUpstream = true;
+  FSecureShell->Open();
+
+  FThread = new TTunnelThread(FSecureShell);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSharedConnection::Close()
+{
+  SAFE_DESTROY_EX(TTunnelThread, FThread);
+  if ((FSecureShell != NULL) && FSecureShell->Active)
+  {
+    FSecureShell->Close();
+  }
+  SAFE_DESTROY_EX(TSecureShell, FSecureShell);
+  SAFE_DESTROY_EX(TTunnelUI, FUI);
+  SAFE_DESTROY_EX(TSessionLog, FLog);
+  SAFE_DESTROY(FData);
+}
+//---------------------------------------------------------------------------
+//---------------------------------------------------------------------------
 class TCallbackGuard
 {
 public:
@@ -537,8 +664,13 @@ TRobustOperationLoop::TRobustOperationLoop(TTerminal * Terminal, TFileOperationP
 //---------------------------------------------------------------------------
 bool TRobustOperationLoop::TryReopen(Exception & E)
 {
+  // While files of a listing are being processed, the listing itself
+  // still waits for the server (see TSFTPFileSystem::ReadDirectory),
+  // leave reconnecting to the loop around the listing,
+  // which restarts it (see TTerminal::CustomReadDirectory)
   FRetry =
     !FTerminal->Active &&
+    (FTerminal->FStreamingListing == 0) &&
     FTerminal->QueryReopen(&E, ropNoReadDirectory, FOperationProgress);
   return FRetry;
 }
@@ -687,6 +819,8 @@ __fastcall TTerminal::TTerminal(TSessionData * SessionData,
   FUseBusyCursor = True;
   FLockDirectory = L"";
   FDirectoryCache = new TRemoteDirectoryCache();
+  FTransferListings = NULL;
+  FCollectingTransferListings = false;
   FDirectoryChangesCache = NULL;
   FFSProtocol = cfsUnknown;
   FCommandSession = NULL;
@@ -694,14 +828,19 @@ __fastcall TTerminal::TTerminal(TSessionData * SessionData,
   FReadingCurrentDirectory = false;
   FStatus = ssClosed;
   FOpening = 0;
+  FStreamingListing = 0;
   FTunnelThread = NULL;
   FTunnel = NULL;
   FTunnelData = NULL;
   FTunnelLog = NULL;
   FTunnelUI = NULL;
   FTunnelOpening = false;
+  FSharedConnection = NULL;
   FCallbackGuard = NULL;
   FNesting = 0;
+  FMetrics = new TSessionMetrics();
+  FMetricsLogged = Now();
+  FLocalFileIOWorker = new TLocalFileIOWorker();
 }
 //---------------------------------------------------------------------------
 __fastcall TTerminal::~TTerminal()
@@ -728,8 +867,12 @@ __fastcall TTerminal::~TTerminal()
   }
 
   SAFE_DESTROY_EX(TCustomFileSystem, FFileSystem);
+  // after all sessions running over the connection
+  SAFE_DESTROY_EX(TSharedConnection, FSharedConnection);
   SAFE_DESTROY_EX(TSessionLog, FLog);
   SAFE_DESTROY_EX(TActionLog, FActionLog);
+  delete FLocalFileIOWorker;
+  delete FMetrics;
   delete FFiles;
   delete FDirectoryCache;
   delete FDirectoryChangesCache;
@@ -754,6 +897,14 @@ void __fastcall TTerminal::Idle()
     DebugAssert(FFileSystem != NULL);
     FFileSystem->Idle();
 
+    // every minute
+    if (Log->Logging && (Now() - FMetricsLogged > TDateTime(0, 1, 0, 0)))
+    {
+      LogMetrics();
+    }
+
+    FlushHostKeys(false);
+
     if (CommandSessionOpened)
     {
       try
@@ -935,6 +1086,12 @@ void __fastcall TTerminal::Open()
               try
               {
                 FSecureShell = new TSecureShell(this, FSessionData, Log, Configuration);
+                FSecureShell->Metrics = FMetrics;
+                TSharedConnection * SharedConnection = GetSharedConnection();
+                if ((SharedConnection != NULL) && SharedConnection->Connect(this))
+                {
+                  FSecureShell->SharedConnection = SharedConnection;
+                }
                 try
                 {
                   // there will be only one channel in this session
@@ -1152,6 +1309,11 @@ void __fastcall TTerminal::Closed()
     CloseTunnel();
   }
 
+  LogMetrics();
+
+  // let other processes see host keys accepted in this session
+  FlushHostKeys(true);
+
   if (OnClose)
   {
     TCallbackGuard Guard(this);
@@ -1162,6 +1324,26 @@ void __fastcall TTerminal::Closed()
   FStatus = ssClosed;
 }
 //---------------------------------------------------------------------------
+void __fastcall TTerminal::FlushHostKeys(bool All)
+{
+  try
+  {
+    if (All)
+    {
+      Configuration->FlushHostKeys();
+    }
+    else
+    {
+      Configuration->FlushOverdueHostKeys();
+    }
+  }
+  catch (Exception & E)
+  {
+    // the keys stay pending, they get written with the configuration eventually
+    LogEvent(FORMAT(L"Cannot write host keys: %s", (E.Message)));
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TTerminal::ProcessGUI()
 {
   // Do not process GUI here, as we are called directly from a GUI loop and may
@@ -1283,6 +1465,17 @@ TTerminal * __fastcall TTerminal::GetPasswordSource()
   return this;
 }
 //---------------------------------------------------------------------------
+TSharedConnection * __fastcall TTerminal::GetSharedConnection()
+{
+  // Created when the session opens for the first time,
+  // what is always before any of its secondary sessions do
+  if ((FSharedConnection == NULL) && FSessionData->ConnectionSharing)
+  {
+    FSharedConnection = new TSharedConnection(this);
+  }
+  return FSharedConnection;
+}
+//---------------------------------------------------------------------------
 bool __fastcall TTerminal::DoPromptUser(TSessionData * /*Data*/, TPromptKind Kind,
   UnicodeString Name, UnicodeString Instructions, TStrings * Prompts, TStrings * Results)
 {
@@ -2736,6 +2929,8 @@ void __fastcall TTerminal::LogFileDetails(const UnicodeString & FileName, TDateT
 //---------------------------------------------------------------------------
 void __fastcall TTerminal::LogFileDone(TFileOperationProgressType * OperationProgress)
 {
+  FMetrics->FileTransferred(OperationProgress->TransferedSize,
+    static_cast<unsigned int>(TimeToMSec(OperationProgress->FileTimeElapsed())));
   // optimization
   if (Log->Logging)
   {
@@ -2743,6 +2938,15 @@ void __fastcall TTerminal::LogFileDone(TFileOperationProgressType * OperationPro
   }
 }
 //---------------------------------------------------------------------------
+void __fastcall TTerminal::LogMetrics()
+{
+  if (Log->Logging)
+  {
+    LogEvent(FORMAT(L"Session metrics: %s", (FMetrics->ToJson())));
+  }
+  FMetricsLogged = Now();
+}
+//---------------------------------------------------------------------------
 void __fastcall TTerminal::CustomReadDirectory(TRemoteFileList * FileList)
 {
   DebugAssert(FileList);
@@ -2770,6 +2974,9 @@ void __fastcall TTerminal::CustomReadDirectory(TRemoteFileList * FileList)
    }
   while (RobustLoop.Retry());
 
+  // deliver files that the file system has not notified about yet
+  // (all of them, if it does not support incremental listing)
+  FileList->FilesAdded();
 
   if (Log->Logging)
   {
@@ -2851,7 +3058,8 @@ TRemoteFile * __fastcall TTerminal::ReadFileListing(UnicodeString Path)
   return File;
 }
 //---------------------------------------------------------------------------
-TRemoteFileList * __fastcall TTerminal::CustomReadDirectoryListing(UnicodeString Directory, bool UseCache)
+TRemoteFileList * __fastcall TTerminal::CustomReadDirectoryListing(UnicodeString Directory, bool UseCache,
+  TRemoteFilesAddedEvent OnFilesAdded)
 {
   TRemoteFileList * FileList = NULL;
   TRetryOperationLoop RetryLoop(this);
@@ -2859,7 +3067,7 @@ TRemoteFileList * __fastcall TTerminal::CustomReadDirectoryListing(UnicodeString
   {
     try
     {
-      FileList = DoReadDirectoryListing(Directory, UseCache);
+      FileList = DoReadDirectoryListing(Directory, UseCache, OnFilesAdded);
     }
     catch(Exception & E)
     {
@@ -2870,12 +3078,15 @@ TRemoteFileList * __fastcall TTerminal::CustomReadDirectoryListing(UnicodeString
   return FileList;
 }
 //---------------------------------------------------------------------------
-TRemoteFileList * __fastcall TTerminal::DoReadDirectoryListing(UnicodeString Directory, bool UseCache)
+TRemoteFileList * __fastcall TTerminal::DoReadDirectoryListing(UnicodeString Directory, bool UseCache,
+  TRemoteFilesAddedEvent OnFilesAdded)
 {
   TRemoteFileList * FileList = new TRemoteFileList();
   try
   {
     bool Cache = UseCache && SessionData->CacheDirectories;
+    // the handler may release the files, so the listing cannot be cached then
+    DebugAssert(!Cache || (OnFilesAdded == NULL));
     bool LoadedFromCache = Cache && FDirectoryCache->HasFileList(Directory);
     if (LoadedFromCache)
     {
@@ -2885,6 +3096,7 @@ TRemoteFileList * __fastcall TTerminal::DoReadDirectoryListing(UnicodeString Dir
     if (!LoadedFromCache)
     {
       FileList->Directory = Directory;
+      FileList->OnFilesAdded = OnFilesAdded;
 
       ExceptionOnFail = true;
       try
@@ -2910,36 +3122,179 @@ TRemoteFileList * __fastcall TTerminal::DoReadDirectoryListing(UnicodeString Dir
   return FileList;
 }
 //---------------------------------------------------------------------------
+class TProcessDirectoryStream : public TObject
+{
+public:
+  __fastcall TProcessDirectoryStream(TTerminal * Terminal, const UnicodeString & DirName,
+    TProcessFileEvent CallBackFunc, void * Param);
+  virtual __fastcall ~TProcessDirectoryStream();
+
+  void __fastcall FilesAdded(TRemoteFileList * FileList, int Index);
+  void __fastcall Check();
+
+private:
+  TTerminal * FTerminal;
+  UnicodeString FDirectory;
+  TProcessFileEvent FCallBackFunc;
+  void * FParam;
+  std::unique_ptr<TStringList> FProcessed;
+  Exception * FException;
+  int FExceptionOnFail;
+};
+//---------------------------------------------------------------------------
+__fastcall TProcessDirectoryStream::TProcessDirectoryStream(TTerminal * Terminal,
+  const UnicodeString & DirName, TProcessFileEvent CallBackFunc, void * Param)
+{
+  FTerminal = Terminal;
+  FDirectory = UnixIncludeTrailingBackslash(DirName);
+  FCallBackFunc = CallBackFunc;
+  FParam = Param;
+  // the listing may be restarted after reconnect,
+  // make sure no file is processed twice
+  FProcessed.reset(CreateSortedStringList(true));
+  FException = NULL;
+  FExceptionOnFail = Terminal->FExceptionOnFail;
+}
+//---------------------------------------------------------------------------
+__fastcall TProcessDirectoryStream::~TProcessDirectoryStream()
+{
+  delete FException;
+}
+//---------------------------------------------------------------------------
+void __fastcall TProcessDirectoryStream::FilesAdded(TRemoteFileList * FileList, int Index)
+{
+  // the listing is read with exception-on-fail enabled,
+  // run the callbacks with the state the caller had
+  int PrevExceptionOnFail = FTerminal->FExceptionOnFail;
+  try
+  {
+    FTerminal->FExceptionOnFail = FExceptionOnFail;
+    try
+    {
+      for (int FileIndex = Index; FileIndex < FileList->Count; FileIndex++)
+      {
+        TRemoteFile * File = FileList->Files[FileIndex];
+        if (FTerminal->Log->Logging)
+        {
+          FTerminal->LogRemoteFile(File);
+        }
+        if (!File->IsParentDirectory && !File->IsThisDirectory &&
+            (FProcessed->IndexOf(File->FileName) < 0))
+        {
+          FCallBackFunc(FDirectory + File->FileName, File, FParam);
+          // only once processed, the callback may fail fatally,
+          // in which case the file is processed again after the listing is restarted
+          FProcessed->Add(File->FileName);
+        }
+      }
+    }
+    __finally
+    {
+      FTerminal->FExceptionOnFail = PrevExceptionOnFail;
+    }
+  }
+  catch (Exception & E)
+  {
+    // Fatal errors are left to the robust/retry loops of the listing,
+    // anything else must not be mistaken for a listing error,
+    // so it is rethrown by Check() once the listing is unwound.
+    if (!FTerminal->Active || E.InheritsFrom(__classid(EFatal)))
+    {
+      throw;
+    }
+    delete FException;
+    FException = CloneException(&E);
+    Abort();
+  }
+
+  // the files are not needed anymore, do not keep whole listing in memory
+  while (FileList->Count > Index)
+  {
+    FileList->Delete(FileList->Count - 1);
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TProcessDirectoryStream::Check()
+{
+  if (FException != NULL)
+  {
+    RethrowException(FException);
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TTerminal::ProcessDirectory(const UnicodeString DirName,
   TProcessFileEvent CallBackFunc, void * Param, bool UseCache, bool IgnoreErrors)
 {
   TRemoteFileList * FileList = NULL;
-  if (IgnoreErrors)
+  // the directory was already listed while calculating size of the transfer
+  if ((FTransferListings != NULL) && !FCollectingTransferListings &&
+      FTransferListings->HasFileList(DirName))
   {
-    ExceptionOnFail = true;
-    try
+    FileList = new TRemoteFileList();
+    FTransferListings->GetFileList(DirName, FileList);
+    // each directory is transferred once only
+    FTransferListings->ClearFileList(DirName, false);
+  }
+  else
+  {
+    // Unless the listing is to be cached or kept for the transfer,
+    // process the files as soon as the file system delivers them
+    // (see TRemoteFileList::FilesAdded).
+    std::unique_ptr<TProcessDirectoryStream> Stream;
+    TRemoteFilesAddedEvent OnFilesAdded = NULL;
+    if ((!UseCache || !SessionData->CacheDirectories) && !FCollectingTransferListings)
+    {
+      Stream.reset(new TProcessDirectoryStream(this, DirName, CallBackFunc, Param));
+      OnFilesAdded = Stream->FilesAdded;
+    }
+
+    if (IgnoreErrors)
+    {
+      ExceptionOnFail = true;
+      try
+      {
+        try
+        {
+          FileList = CustomReadDirectoryListing(DirName, UseCache, OnFilesAdded);
+        }
+        catch(...)
+        {
+          if (!Active)
+          {
+            throw;
+          }
+          if (Stream.get() != NULL)
+          {
+            Stream->Check();
+          }
+        }
+      }
+      __finally
+      {
+        ExceptionOnFail = false;
+      }
+    }
+    else
     {
       try
       {
-        FileList = CustomReadDirectoryListing(DirName, UseCache);
+        FileList = CustomReadDirectoryListing(DirName, UseCache, OnFilesAdded);
       }
       catch(...)
       {
-        if (!Active)
+        if (Stream.get() != NULL)
         {
-          throw;
+          Stream->Check();
         }
+        throw;
       }
     }
-    __finally
+
+    if ((FileList != NULL) && FCollectingTransferListings)
     {
-      ExceptionOnFail = false;
+      FTransferListings->AddFileList(FileList);
     }
   }
-  else
-  {
-    FileList = CustomReadDirectoryListing(DirName, UseCache);
-  }
 
   // skip if directory listing fails and user selects "skip"
   if (FileList)
@@ -4284,7 +4639,11 @@ void __fastcall TTerminal::OpenLocalFile(const UnicodeString FileName,
 
     FILE_OPERATION_LOOP_BEGIN
     {
-      DWORD Flags = FLAGMASK(FLAGSET(Attrs, faDirectory), FILE_FLAG_BACKUP_SEMANTICS);
+      DWORD Flags =
+        FLAGMASK(FLAGSET(Attrs, faDirectory), FILE_FLAG_BACKUP_SEMANTICS) |
+        FLAGMASK((Access == GENERIC_READ) && FLAGCLEAR(Attrs, faDirectory) &&
+          (AHandle != NULL) && Configuration->LocalIOSequentialScan,
+          FILE_FLAG_SEQUENTIAL_SCAN);
       Handle = CreateFile(ApiPath(FileName).c_str(), Access,
         Access == GENERIC_READ ? FILE_SHARE_READ | FILE_SHARE_WRITE : FILE_SHARE_READ,
         NULL, OPEN_EXISTING, Flags, 0);
@@ -4356,6 +4715,21 @@ void __fastcall TTerminal::OpenLocalFile(const UnicodeString FileName,
   if (AHandle) *AHandle = Handle;
 }
 //---------------------------------------------------------------------------
+TStream * __fastcall TTerminal::CreateLocalFileStream(HANDLE Handle, bool Write)
+{
+  TStream * Result;
+  if (Configuration->LocalIOBuffers > 0)
+  {
+    Result =
+      new TAsynchronousHandleStream((THandle)Handle, Write, Configuration->LocalIOBuffers, FLocalFileIOWorker);
+  }
+  else
+  {
+    Result = new TSafeHandleStream((THandle)Handle);
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
 bool __fastcall TTerminal::AllowLocalFileTransfer(UnicodeString FileName,
   const TCopyParamType * CopyParam, TFileOperationProgressType * OperationProgress)
 {
@@ -4511,80 +4885,583 @@ bool __fastcall TTerminal::CalculateLocalFilesSize(TStrings * FileList,
   return Result;
 }
 //---------------------------------------------------------------------------
-struct TSynchronizeFileData
-{
-  bool Modified;
-  bool New;
-  bool IsDirectory;
-  TSynchronizeChecklist::TItem::TFileInfo Info;
-  TSynchronizeChecklist::TItem::TFileInfo MatchingRemoteFile;
-  TRemoteFile * MatchingRemoteFileFile;
-  int MatchingRemoteFileImageIndex;
-  FILETIME LocalLastWriteTime;
-};
+const int LocalChecksumCacheMaxSize = 100000;
+// the disk rather than the CPU is the bottleneck with more threads
+const unsigned int LocalChecksumMaxThreads = 4;
 //---------------------------------------------------------------------------
-const int sfFirstLevel = 0x01;
-struct TSynchronizeData
+struct TLocalChecksumRequest
 {
-  UnicodeString LocalDirectory;
-  UnicodeString RemoteDirectory;
-  TTerminal::TSynchronizeMode Mode;
-  int Params;
-  TSynchronizeDirectory OnSynchronizeDirectory;
-  TSynchronizeOptions * Options;
-  int Flags;
-  TStringList * LocalFileList;
-  const TCopyParamType * CopyParam;
-  TSynchronizeChecklist * Checklist;
+  UnicodeString FileName;
+  __int64 Size;
+  __int64 Modification;
+  UnicodeString Checksum;
 };
 //---------------------------------------------------------------------------
-TSynchronizeChecklist * __fastcall TTerminal::SynchronizeCollect(const UnicodeString LocalDirectory,
-  const UnicodeString RemoteDirectory, TSynchronizeMode Mode,
-  const TCopyParamType * CopyParam, int Params,
-  TSynchronizeDirectory OnSynchronizeDirectory,
-  TSynchronizeOptions * Options)
+// Checksums of local files, persisted across sessions.
+// An entry is valid only as long as the file size and modification time match.
+class TLocalChecksumCache
 {
-  TValueRestorer<bool> UseBusyCursorRestorer(FUseBusyCursor);
-  FUseBusyCursor = false;
+public:
+  __fastcall TLocalChecksumCache(const UnicodeString & Alg, const UnicodeString & FileName);
 
-  TSynchronizeChecklist * Checklist = new TSynchronizeChecklist();
-  try
-  {
-    DoSynchronizeCollectDirectory(LocalDirectory, RemoteDirectory, Mode,
-      CopyParam, Params, OnSynchronizeDirectory, Options, sfFirstLevel,
-      Checklist);
-    Checklist->Sort();
-  }
-  catch(...)
+  void __fastcall Load();
+  void __fastcall Save();
+  bool __fastcall Find(TLocalChecksumRequest & Request);
+  void __fastcall Store(const TLocalChecksumRequest & Request);
+
+  __property UnicodeString Alg = { read = FAlg };
+  __property UnicodeString FileName = { read = FFileName };
+
+private:
+  struct TEntry
   {
-    delete Checklist;
-    throw;
-  }
-  return Checklist;
+    __int64 Size;
+    __int64 Modification;
+    UnicodeString Checksum;
+    bool Used;
+  };
+  typedef std::map<UnicodeString, TEntry> TEntries;
+
+  UnicodeString FAlg;
+  UnicodeString FFileName;
+  TEntries FEntries;
+  bool FModified;
+
+  UnicodeString __fastcall Key(const UnicodeString & Alg, const UnicodeString & FileName);
+};
+//---------------------------------------------------------------------------
+__fastcall TLocalChecksumCache::TLocalChecksumCache(
+    const UnicodeString & Alg, const UnicodeString & FileName) :
+  FAlg(Alg), FFileName(FileName), FModified(false)
+{
 }
 //---------------------------------------------------------------------------
-static void __fastcall AddFlagName(UnicodeString & ParamsStr, int & Params, int Param, const UnicodeString & Name)
+UnicodeString __fastcall TLocalChecksumCache::Key(
+  const UnicodeString & Alg, const UnicodeString & FileName)
 {
-  if (FLAGSET(Params, Param))
+  // local paths are case-insensitive
+  return LowerCase(Alg) + L"\t" + AnsiLowerCase(FileName);
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalChecksumCache::Load()
+{
+  if (!FFileName.IsEmpty() && FileExists(ApiPath(FFileName)))
   {
-    AddToList(ParamsStr, Name, ", ");
+    std::unique_ptr<TStringList> Lines(new TStringList());
+    Lines->LoadFromFile(ApiPath(FFileName), TEncoding::UTF8);
+    // alg, size, modification, checksum, path
+    for (int Index = 0; Index < Lines->Count; Index++)
+    {
+      UnicodeString Line = Lines->Strings[Index];
+      UnicodeString EntryAlg = CutToChar(Line, L'\t', false);
+      TEntry Entry;
+      Entry.Size = StrToInt64Def(CutToChar(Line, L'\t', false), -1);
+      Entry.Modification = StrToInt64Def(CutToChar(Line, L'\t', false), -1);
+      Entry.Checksum = CutToChar(Line, L'\t', false);
+      Entry.Used = false;
+      if (!EntryAlg.IsEmpty() && (Entry.Size >= 0) && !Entry.Checksum.IsEmpty() && !Line.IsEmpty())
+      {
+        FEntries[Key(EntryAlg, Line)] = Entry;
+      }
+    }
   }
-  Params &= ~Param;
 }
 //---------------------------------------------------------------------------
-UnicodeString __fastcall TTerminal::SynchronizeModeStr(TSynchronizeMode Mode)
+void __fastcall TLocalChecksumCache::Save()
 {
-  UnicodeString ModeStr;
-  switch (Mode)
+  if (!FFileName.IsEmpty() && FModified)
   {
-    case smRemote:
-      ModeStr = L"Remote";
-      break;
-    case smLocal:
-      ModeStr = L"Local";
-      break;
-    case smBoth:
-      ModeStr = L"Both";
+    // Merge with entries saved meanwhile by other processes.
+    // Only the entries used by this session take precedence,
+    // the others may be older than those in the file.
+    TEntries Entries;
+    Entries.swap(FEntries);
+    try
+    {
+      Load();
+    }
+    catch (...)
+    {
+      // unreadable cache gets overwritten
+      FEntries.clear();
+    }
+    TEntries::const_iterator EI = Entries.begin();
+    while (EI != Entries.end())
+    {
+      if (EI->second.Used || (FEntries.find(EI->first) == FEntries.end()))
+      {
+        FEntries[EI->first] = EI->second;
+      }
+      ++EI;
+    }
+
+    std::unique_ptr<TStringList> Lines(new TStringList());
+    // entries used by this session first, so that they survive the trimming
+    for (int Pass = 0; Pass < 2; Pass++)
+    {
+      TEntries::const_iterator I = FEntries.begin();
+      while ((I != FEntries.end()) && (Lines->Count < LocalChecksumCacheMaxSize))
+      {
+        if (I->second.Used == (Pass == 0))
+        {
+          UnicodeString EntryKey = I->first;
+          UnicodeString EntryAlg = CutToChar(EntryKey, L'\t', false);
+          Lines->Add(FORMAT(L"%s\t%s\t%s\t%s\t%s",
+            (EntryAlg, IntToStr(I->second.Size), IntToStr(I->second.Modification),
+             I->second.Checksum, EntryKey)));
+        }
+        ++I;
+      }
+    }
+    // Replace the cache at once, so that a crash while saving
+    // or a concurrent process never sees it truncated
+    UnicodeString TempFileName = FORMAT(L"%s.%d.tmp", (FFileName, int(GetCurrentProcessId())));
+    Lines->SaveToFile(ApiPath(TempFileName), TEncoding::UTF8);
+    if (!MoveFileEx(ApiPath(TempFileName).c_str(), ApiPath(FFileName).c_str(),
+          MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+      int Error = GetLastError();
+      DeleteFile(ApiPath(TempFileName).c_str());
+      RaiseLastOSError(Error);
+    }
+    FModified = false;
+  }
+}
+//---------------------------------------------------------------------------
+bool __fastcall TLocalChecksumCache::Find(TLocalChecksumRequest & Request)
+{
+  TEntries::iterator I = FEntries.find(Key(FAlg, Request.FileName));
+  bool Result =
+    (I != FEntries.end()) &&
+    (I->second.Size == Request.Size) &&
+    (I->second.Modification == Request.Modification);
+  if (Result)
+  {
+    I->second.Used = true;
+    Request.Checksum = I->second.Checksum;
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalChecksumCache::Store(const TLocalChecksumRequest & Request)
+{
+  DebugAssert(!Request.Checksum.IsEmpty());
+  TEntry & Entry = FEntries[Key(FAlg, Request.FileName)];
+  Entry.Size = Request.Size;
+  Entry.Modification = Request.Modification;
+  Entry.Checksum = Request.Checksum;
+  Entry.Used = true;
+  FModified = true;
+}
+//---------------------------------------------------------------------------
+class TLocalChecksumCalculator;
+//---------------------------------------------------------------------------
+class TLocalChecksumThread : public TSimpleThread
+{
+public:
+  __fastcall TLocalChecksumThread(TLocalChecksumCalculator * Calculator) :
+    TSimpleThread(), FCalculator(Calculator)
+  {
+    Start();
+  }
+
+  virtual __fastcall ~TLocalChecksumThread()
+  {
+    // Terminate() cannot be called from the base class destructor
+    Close();
+  }
+
+  virtual void __fastcall Terminate()
+  {
+    // the calculator stops handing out files and aborts the file being hashed
+  }
+
+protected:
+  virtual void __fastcall Execute();
+
+private:
+  TLocalChecksumCalculator * FCalculator;
+};
+//---------------------------------------------------------------------------
+// Pool of threads calculating checksums of local files,
+// one for the whole synchronization, fed with a batch of files per directory.
+// A file whose checksum cannot be calculated is left with an empty checksum.
+class TLocalChecksumCalculator
+{
+friend class TLocalChecksumThread;
+public:
+  __fastcall TLocalChecksumCalculator(const UnicodeString & Alg);
+  __fastcall ~TLocalChecksumCalculator();
+
+  void __fastcall Add(std::vector<TLocalChecksumRequest *> & Requests);
+  bool __fastcall WaitFor(unsigned int Milliseconds);
+  void __fastcall Stop();
+
+private:
+  class TAbortableStream;
+
+  UnicodeString FAlg;
+  std::vector<TLocalChecksumRequest *> * FRequests;
+  std::vector<TLocalChecksumThread *> FThreads;
+  TCriticalSection * FSection;
+  HANDLE FWorkEvent;
+  HANDLE FDoneEvent;
+  size_t FNext;
+  size_t FDone;
+  bool FStopped;
+  bool FTerminated;
+
+  bool __fastcall Next(TLocalChecksumRequest *& Request);
+  bool __fastcall GetAborted();
+};
+//---------------------------------------------------------------------------
+// Lets the calculation be aborted in the middle of a large file
+class TLocalChecksumCalculator::TAbortableStream : public TSafeHandleStream
+{
+public:
+  __fastcall TAbortableStream(HANDLE Handle, TLocalChecksumCalculator * Calculator) :
+    TSafeHandleStream((THandle)Handle), FCalculator(Calculator)
+  {
+  }
+
+  virtual int __fastcall Read(void * Buffer, int Count)
+  {
+    CheckAborted();
+    return TSafeHandleStream::Read(Buffer, Count);
+  }
+
+  virtual int __fastcall Read(System::DynamicArray<System::Byte> Buffer, int Offset, int Count)
+  {
+    CheckAborted();
+    return TSafeHandleStream::Read(Buffer, Offset, Count);
+  }
+
+private:
+  TLocalChecksumCalculator * FCalculator;
+
+  void __fastcall CheckAborted()
+  {
+    if (FCalculator->GetAborted())
+    {
+      Abort();
+    }
+  }
+};
+//---------------------------------------------------------------------------
+void __fastcall TLocalChecksumThread::Execute()
+{
+  TLocalChecksumRequest * Request = NULL;
+  while (FCalculator->Next(Request))
+  {
+    try
+    {
+      HANDLE Handle = CreateFile(ApiPath(Request->FileName).c_str(), GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+      if (Handle != INVALID_HANDLE_VALUE)
+      {
+        try
+        {
+          std::unique_ptr<TLocalChecksumCalculator::TAbortableStream> Stream(
+            new TLocalChecksumCalculator::TAbortableStream(Handle, FCalculator));
+          Request->Checksum = CalculateStreamChecksum(Stream.get(), FCalculator->FAlg);
+        }
+        __finally
+        {
+          CloseHandle(Handle);
+        }
+      }
+    }
+    catch (...)
+    {
+      // the file is compared as if there were no checksum
+      Request->Checksum = L"";
+    }
+  }
+}
+//---------------------------------------------------------------------------
+__fastcall TLocalChecksumCalculator::TLocalChecksumCalculator(const UnicodeString & Alg) :
+  FAlg(Alg), FRequests(NULL), FNext(0), FDone(0), FStopped(false), FTerminated(false)
+{
+  FSection = new TCriticalSection();
+  // manual reset, signaled while there are files to hand out
+  FWorkEvent = CreateEvent(NULL, true, false, NULL);
+  DebugAssert(FWorkEvent != NULL);
+  // manual reset, remains signaled once all files of the batch are done
+  FDoneEvent = CreateEvent(NULL, true, true, NULL);
+  DebugAssert(FDoneEvent != NULL);
+}
+//---------------------------------------------------------------------------
+__fastcall TLocalChecksumCalculator::~TLocalChecksumCalculator()
+{
+  {
+    TGuard Guard(FSection);
+    FTerminated = true;
+    SetEvent(FWorkEvent);
+  }
+  for (size_t Index = 0; Index < FThreads.size(); Index++)
+  {
+    // waits for the file being processed
+    delete FThreads[Index];
+  }
+  CloseHandle(FWorkEvent);
+  CloseHandle(FDoneEvent);
+  delete FSection;
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalChecksumCalculator::Add(std::vector<TLocalChecksumRequest *> & Requests)
+{
+  {
+    TGuard Guard(FSection);
+    DebugAssert(FRequests == NULL);
+    FRequests = &Requests;
+    FNext = 0;
+    FDone = 0;
+    FStopped = false;
+    if (FRequests->empty())
+    {
+      SetEvent(FDoneEvent);
+    }
+    else
+    {
+      ResetEvent(FDoneEvent);
+      SetEvent(FWorkEvent);
+    }
+  }
+
+  // the threads are kept for the following batches
+  SYSTEM_INFO SystemInfo;
+  GetSystemInfo(&SystemInfo);
+  unsigned int Threads =
+    std::min(static_cast<unsigned int>(SystemInfo.dwNumberOfProcessors), LocalChecksumMaxThreads);
+  Threads = std::min(Threads, static_cast<unsigned int>(Requests.size()));
+  while (FThreads.size() < Threads)
+  {
+    FThreads.push_back(new TLocalChecksumThread(this));
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalChecksumCalculator::Stop()
+{
+  // Noop for a completed batch. Otherwise the files not handed out yet
+  // are left without checksum and the files being hashed are aborted.
+  {
+    TGuard Guard(FSection);
+    if (FRequests != NULL)
+    {
+      FStopped = true;
+      FDone += FRequests->size() - FNext;
+      FNext = FRequests->size();
+      if (FDone == FRequests->size())
+      {
+        SetEvent(FDoneEvent);
+      }
+    }
+  }
+  WaitForSingleObject(FDoneEvent, INFINITE);
+  {
+    TGuard Guard(FSection);
+    FRequests = NULL;
+  }
+}
+//---------------------------------------------------------------------------
+bool __fastcall TLocalChecksumCalculator::Next(TLocalChecksumRequest *& Request)
+{
+  // Returns the next file to process, once the previous one (if any) is done.
+  // Waits while there is nothing to process, returns false when the pool is destroyed.
+  bool Result = false;
+  bool Done = false;
+  while (!Done)
+  {
+    {
+      TGuard Guard(FSection);
+      if (Request != NULL)
+      {
+        FDone++;
+        if (FDone == FRequests->size())
+        {
+          SetEvent(FDoneEvent);
+        }
+        Request = NULL;
+      }
+
+      if (FTerminated)
+      {
+        Done = true;
+      }
+      else if ((FRequests != NULL) && (FNext < FRequests->size()))
+      {
+        Request = (*FRequests)[FNext];
+        FNext++;
+        Result = true;
+        Done = true;
+      }
+      else
+      {
+        ResetEvent(FWorkEvent);
+      }
+    }
+
+    if (!Done)
+    {
+      WaitForSingleObject(FWorkEvent, INFINITE);
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+bool __fastcall TLocalChecksumCalculator::GetAborted()
+{
+  TGuard Guard(FSection);
+  return FTerminated || FStopped;
+}
+//---------------------------------------------------------------------------
+bool __fastcall TLocalChecksumCalculator::WaitFor(unsigned int Milliseconds)
+{
+  return (WaitForSingleObject(FDoneEvent, Milliseconds) == WAIT_OBJECT_0);
+}
+//---------------------------------------------------------------------------
+struct TSynchronizeFileData
+{
+  bool Modified;
+  bool New;
+  bool IsDirectory;
+  // to be compared by checksum, see DoSynchronizeCollectChecksums
+  bool ChecksumPending;
+  TSynchronizeChecklist::TItem::TFileInfo Info;
+  TSynchronizeChecklist::TItem::TFileInfo MatchingRemoteFile;
+  TRemoteFile * MatchingRemoteFileFile;
+  int MatchingRemoteFileImageIndex;
+  FILETIME LocalLastWriteTime;
+};
+//---------------------------------------------------------------------------
+const int sfFirstLevel = 0x01;
+struct TSynchronizeData
+{
+  UnicodeString LocalDirectory;
+  UnicodeString RemoteDirectory;
+  TTerminal::TSynchronizeMode Mode;
+  int Params;
+  TSynchronizeDirectory OnSynchronizeDirectory;
+  TSynchronizeOptions * Options;
+  int Flags;
+  TStringList * LocalFileList;
+  const TCopyParamType * CopyParam;
+  TSynchronizeChecklist * Checklist;
+  TLocalChecksumCache * ChecksumCache;
+  TLocalChecksumCalculator * ChecksumCalculator;
+};
+//---------------------------------------------------------------------------
+TSynchronizeChecklist * __fastcall TTerminal::SynchronizeCollect(const UnicodeString LocalDirectory,
+  const UnicodeString RemoteDirectory, TSynchronizeMode Mode,
+  const TCopyParamType * CopyParam, int Params,
+  TSynchronizeDirectory OnSynchronizeDirectory,
+  TSynchronizeOptions * Options)
+{
+  TValueRestorer<bool> UseBusyCursorRestorer(FUseBusyCursor);
+  FUseBusyCursor = false;
+
+  std::unique_ptr<TLocalChecksumCache> ChecksumCache;
+  std::unique_ptr<TLocalChecksumCalculator> ChecksumCalculator;
+  if (FLAGSET(Params, spByChecksum) && FLAGCLEAR(Params, spTimestamp))
+  {
+    UnicodeString Alg = SynchronizeChecksumAlg();
+    if (Alg.IsEmpty())
+    {
+      LogEvent(L"Cannot calculate checksums of remote files using an algorithm available locally, comparing by time and size only.");
+    }
+    else
+    {
+      LogEvent(FORMAT(L"Comparing files of the same size by %s checksum.", (Alg)));
+      ChecksumCache.reset(new TLocalChecksumCache(Alg, Configuration->ChecksumCacheFileName));
+      try
+      {
+        ChecksumCache->Load();
+      }
+      catch (Exception & E)
+      {
+        LogEvent(FORMAT(L"Cannot load checksum cache from \"%s\": %s", (ChecksumCache->FileName, E.Message)));
+      }
+      ChecksumCalculator.reset(new TLocalChecksumCalculator(Alg));
+    }
+  }
+
+  TSynchronizeChecklist * Checklist = new TSynchronizeChecklist();
+  try
+  {
+    try
+    {
+      DoSynchronizeCollectDirectory(LocalDirectory, RemoteDirectory, Mode,
+        CopyParam, Params, OnSynchronizeDirectory, Options, sfFirstLevel,
+        Checklist, ChecksumCache.get(), ChecksumCalculator.get());
+      Checklist->Sort();
+    }
+    __finally
+    {
+      // keep the checksums calculated so far even if the collection was aborted
+      if (ChecksumCache.get() != NULL)
+      {
+        try
+        {
+          ChecksumCache->Save();
+        }
+        catch (Exception & E)
+        {
+          LogEvent(FORMAT(L"Cannot save checksum cache to \"%s\": %s", (ChecksumCache->FileName, E.Message)));
+        }
+      }
+    }
+  }
+  catch(...)
+  {
+    delete Checklist;
+    throw;
+  }
+  return Checklist;
+}
+//---------------------------------------------------------------------------
+UnicodeString __fastcall TTerminal::SynchronizeChecksumAlg()
+{
+  UnicodeString Result;
+  if (IsCapable[fcCalculatingChecksum])
+  {
+    std::unique_ptr<TStrings> Algs(new TStringList());
+    GetSupportedChecksumAlgs(Algs.get());
+    const UnicodeString * PreferredAlgs[] =
+      { &Sha256ChecksumAlg, &Sha1ChecksumAlg, &Sha512ChecksumAlg, &Sha384ChecksumAlg };
+    for (unsigned int Index = 0; Result.IsEmpty() && (Index < LENOF(PreferredAlgs)); Index++)
+    {
+      const UnicodeString & Alg = *PreferredAlgs[Index];
+      if ((Algs->IndexOf(Alg) >= 0) && IsLocalChecksumAlg(Alg))
+      {
+        Result = Alg;
+      }
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+static void __fastcall AddFlagName(UnicodeString & ParamsStr, int & Params, int Param, const UnicodeString & Name)
+{
+  if (FLAGSET(Params, Param))
+  {
+    AddToList(ParamsStr, Name, ", ");
+  }
+  Params &= ~Param;
+}
+//---------------------------------------------------------------------------
+UnicodeString __fastcall TTerminal::SynchronizeModeStr(TSynchronizeMode Mode)
+{
+  UnicodeString ModeStr;
+  switch (Mode)
+  {
+    case smRemote:
+      ModeStr = L"Remote";
+      break;
+    case smLocal:
+      ModeStr = L"Local";
+      break;
+    case smBoth:
+      ModeStr = L"Both";
       break;
     default:
       ModeStr = L"Unknown";
@@ -4609,6 +5486,7 @@ UnicodeString __fastcall TTerminal::SynchronizeParamsStr(int Params)
   AddFlagName(ParamsStr, Params, spBySize, L"BySize");
   AddFlagName(ParamsStr, Params, spSelectedOnly, L"*SelectedOnly"); // GUI only
   AddFlagName(ParamsStr, Params, spMirror, L"Mirror");
+  AddFlagName(ParamsStr, Params, spByChecksum, L"ByChecksum");
   if (Params > 0)
   {
     AddToList(ParamsStr, FORMAT(L"0x%x", (int(Params))), L", ");
@@ -4620,7 +5498,8 @@ void __fastcall TTerminal::DoSynchronizeCollectDirectory(const UnicodeString Loc
   const UnicodeString RemoteDirectory, TSynchronizeMode Mode,
   const TCopyParamType * CopyParam, int Params,
   TSynchronizeDirectory OnSynchronizeDirectory, TSynchronizeOptions * Options,
-  int Flags, TSynchronizeChecklist * Checklist)
+  int Flags, TSynchronizeChecklist * Checklist, TLocalChecksumCache * ChecksumCache,
+  TLocalChecksumCalculator * ChecksumCalculator)
 {
   TSynchronizeData Data;
 
@@ -4634,6 +5513,8 @@ void __fastcall TTerminal::DoSynchronizeCollectDirectory(const UnicodeString Loc
   Data.Options = Options;
   Data.Flags = Flags;
   Data.Checklist = Checklist;
+  Data.ChecksumCache = ChecksumCache;
+  Data.ChecksumCalculator = ChecksumCalculator;
 
   LogEvent(FORMAT(L"Collecting synchronization list for local directory '%s' and remote directory '%s', "
     "mode = %s, params = 0x%x (%s)", (LocalDirectory, RemoteDirectory,
@@ -4700,6 +5581,7 @@ void __fastcall TTerminal::DoSynchronizeCollectDirectory(const UnicodeString Loc
             FileData->LocalLastWriteTime = SearchRec.FindData.ftLastWriteTime;
             FileData->New = true;
             FileData->Modified = false;
+            FileData->ChecksumPending = false;
             Data.LocalFileList->AddObject(FileName,
               reinterpret_cast<TObject*>(FileData));
             LogEvent(FORMAT(L"Local file %s included to synchronization",
@@ -4736,6 +5618,11 @@ void __fastcall TTerminal::DoSynchronizeCollectDirectory(const UnicodeString Loc
       ProcessDirectory(RemoteDirectory, SynchronizeCollectFile, &Data,
         FLAGSET(Params, spUseCache));
 
+      if (Data.ChecksumCache != NULL)
+      {
+        DoSynchronizeCollectChecksums(Data);
+      }
+
       TSynchronizeFileData * FileData;
       for (int Index = 0; Index < Data.LocalFileList->Count; Index++)
       {
@@ -4825,6 +5712,10 @@ void __fastcall TTerminal::DoSynchronizeCollectDirectory(const UnicodeString Loc
       {
         TSynchronizeFileData * FileData = reinterpret_cast<TSynchronizeFileData*>
           (Data.LocalFileList->Objects[Index]);
+        if (FileData->ChecksumPending)
+        {
+          delete FileData->MatchingRemoteFileFile;
+        }
         delete FileData;
       }
       delete Data.LocalFileList;
@@ -4849,6 +5740,209 @@ void __fastcall TTerminal::SynchronizeCollectFile(const UnicodeString FileName,
   }
 }
 //---------------------------------------------------------------------------
+static void __fastcall SynchronizeModifiedSide(
+  const TSynchronizeData * Data, int TimeCompare, bool & Modified, bool & LocalModified)
+{
+  if (TimeCompare < 0)
+  {
+    if ((FLAGCLEAR(Data->Params, TTerminal::spTimestamp) && FLAGCLEAR(Data->Params, TTerminal::spMirror)) ||
+        (Data->Mode == TTerminal::smBoth) || (Data->Mode == TTerminal::smLocal))
+    {
+      Modified = true;
+    }
+    else
+    {
+      LocalModified = true;
+    }
+  }
+  else if (TimeCompare > 0)
+  {
+    if ((FLAGCLEAR(Data->Params, TTerminal::spTimestamp) && FLAGCLEAR(Data->Params, TTerminal::spMirror)) ||
+        (Data->Mode == TTerminal::smBoth) || (Data->Mode == TTerminal::smRemote))
+    {
+      LocalModified = true;
+    }
+    else
+    {
+      Modified = true;
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TTerminal::DoSynchronizeCollectChecksums(TSynchronizeData & Data)
+{
+  std::vector<TSynchronizeFileData *> Pending;
+  for (int Index = 0; Index < Data.LocalFileList->Count; Index++)
+  {
+    TSynchronizeFileData * FileData =
+      reinterpret_cast<TSynchronizeFileData *>(Data.LocalFileList->Objects[Index]);
+    if (FileData->ChecksumPending)
+    {
+      Pending.push_back(FileData);
+    }
+  }
+
+  if (!Pending.empty())
+  {
+    UnicodeString Alg = Data.ChecksumCache->Alg;
+
+    // one batch for all files of the directory, the file system pipelines the requests
+    std::unique_ptr<TStrings> RemoteFileList(new TStringList());
+    std::vector<TLocalChecksumRequest> LocalRequests(Pending.size());
+    std::vector<TLocalChecksumRequest *> LocalMissing;
+    for (size_t Index = 0; Index < Pending.size(); Index++)
+    {
+      TSynchronizeFileData * FileData = Pending[Index];
+      RemoteFileList->AddObject(
+        FileData->MatchingRemoteFileFile->FullFileName, FileData->MatchingRemoteFileFile);
+
+      TLocalChecksumRequest & Request = LocalRequests[Index];
+      Request.FileName = FileData->Info.Directory + FileData->Info.FileName;
+      Request.Size = FileData->Info.Size;
+      ULARGE_INTEGER Modification;
+      Modification.LowPart = FileData->LocalLastWriteTime.dwLowDateTime;
+      Modification.HighPart = FileData->LocalLastWriteTime.dwHighDateTime;
+      Request.Modification = static_cast<__int64>(Modification.QuadPart);
+      if (!Data.ChecksumCache->Find(Request))
+      {
+        LocalMissing.push_back(&Request);
+      }
+    }
+
+    LogEvent(FORMAT(L"Calculating checksums of %d file pairs, %d local checksums are cached.",
+      (int(Pending.size()), int(Pending.size() - LocalMissing.size()))));
+
+    std::unique_ptr<TStrings> RemoteChecksums(new TStringList());
+    // local files are hashed meanwhile
+    Data.ChecksumCalculator->Add(LocalMissing);
+    try
+    {
+      ExceptionOnFail = true;
+      try
+      {
+        try
+        {
+          CalculateFilesChecksum(Alg, RemoteFileList.get(), RemoteChecksums.get(), NULL);
+        }
+        catch (Exception & E)
+        {
+          if (!Active || E.InheritsFrom(__classid(EAbort)))
+          {
+            throw;
+          }
+          // the remaining files are compared by time and size
+          LogEvent(FORMAT(L"Error calculating checksums of remote files: %s", (E.Message)));
+        }
+      }
+      __finally
+      {
+        ExceptionOnFail = false;
+      }
+
+      while (!Data.ChecksumCalculator->WaitFor(GUIUpdateInterval))
+      {
+        DoSynchronizeProgress(Data, true);
+      }
+    }
+    __finally
+    {
+      Data.ChecksumCalculator->Stop();
+    }
+
+    for (size_t Index = 0; Index < LocalMissing.size(); Index++)
+    {
+      if (!LocalMissing[Index]->Checksum.IsEmpty())
+      {
+        Data.ChecksumCache->Store(*LocalMissing[Index]);
+      }
+    }
+
+    for (size_t Index = 0; Index < Pending.size(); Index++)
+    {
+      TSynchronizeFileData * FileData = Pending[Index];
+      FileData->ChecksumPending = false;
+      TRemoteFile * File = FileData->MatchingRemoteFileFile;
+      FileData->MatchingRemoteFileFile = NULL;
+
+      UnicodeString LocalFileName = LocalRequests[Index].FileName;
+      UnicodeString LocalChecksum = LocalRequests[Index].Checksum;
+      // checksums are collected in order of the files, until the first error
+      UnicodeString RemoteChecksum =
+        (static_cast<int>(Index) < RemoteChecksums->Count) ? RemoteChecksums->Strings[Index] : UnicodeString();
+
+      TSynchronizeChecklist::TItem::TFileInfo Local = FileData->Info;
+      const TSynchronizeChecklist::TItem::TFileInfo & Remote = FileData->MatchingRemoteFile;
+      Local.Modification = ReduceDateTimePrecision(Local.Modification, Remote.ModificationFmt);
+      int TimeCompare = CompareFileTime(Local.Modification, Remote.Modification);
+
+      bool Modified = false;
+      bool LocalModified = false;
+      if (LocalChecksum.IsEmpty() || RemoteChecksum.IsEmpty())
+      {
+        LogEvent(FORMAT(L"Checksum of local file %s or remote file %s is not known, comparing by time",
+          (LocalFileName, File->FullFileName)));
+        if (FLAGCLEAR(Data.Params, spNotByTime))
+        {
+          SynchronizeModifiedSide(&Data, TimeCompare, Modified, LocalModified);
+        }
+      }
+      else if (SameText(LocalChecksum, RemoteChecksum))
+      {
+        LogEvent(FORMAT(L"Local file %s and remote file %s have the same checksum",
+          (LocalFileName, File->FullFileName)));
+      }
+      // timestamp tells which file is the newer one
+      else if ((TimeCompare != 0) && FLAGCLEAR(Data.Params, spNotByTime))
+      {
+        SynchronizeModifiedSide(&Data, TimeCompare, Modified, LocalModified);
+      }
+      else if (Data.Mode != smBoth)
+      {
+        Modified = true;
+        LocalModified = true;
+      }
+      else
+      {
+        LogEvent(FORMAT(L"Local file %s and remote file %s differ, but there is no newer one",
+          (LocalFileName, File->FullFileName)));
+      }
+
+      if (LocalModified)
+      {
+        FileData->Modified = true;
+        // for custom commands over checklist, see DoSynchronizeCollectFile
+        FileData->MatchingRemoteFileFile = File->Duplicate();
+        LogEvent(FORMAT(L"Local file %s is modified comparing to remote file %s",
+          (FormatFileDetailsForLog(LocalFileName, FileData->Info.Modification, FileData->Info.Size),
+           FormatFileDetailsForLog(File->FullFileName, File->Modification, File->Size))));
+      }
+
+      if (Modified)
+      {
+        LogEvent(FORMAT(L"Remote file %s is modified comparing to local file %s",
+          (FormatFileDetailsForLog(File->FullFileName, File->Modification, File->Size),
+           FormatFileDetailsForLog(LocalFileName, FileData->Info.Modification, FileData->Info.Size))));
+
+        if ((Data.Mode == smBoth) || (Data.Mode == smLocal))
+        {
+          TSynchronizeChecklist::TItem * ChecklistItem = new TSynchronizeChecklist::TItem();
+          ChecklistItem->IsDirectory = false;
+          ChecklistItem->ImageIndex = FileData->MatchingRemoteFileImageIndex;
+          ChecklistItem->Local = Local;
+          ChecklistItem->Remote = Remote;
+          ChecklistItem->Action = TSynchronizeChecklist::saDownloadUpdate;
+          ChecklistItem->Checked = true;
+          ChecklistItem->RemoteFile = File;
+          File = NULL;
+          Data.Checklist->Add(ChecklistItem);
+        }
+      }
+
+      delete File;
+    }
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TTerminal::DoSynchronizeCollectFile(const UnicodeString FileName,
   const TRemoteFile * File, /*TSynchronizeData*/ void * Param)
 {
@@ -4928,31 +6022,25 @@ void __fastcall TTerminal::DoSynchronizeCollectFile(const UnicodeString FileName
             {
               TimeCompare = 0;
             }
-            if (TimeCompare < 0)
+            bool ByChecksum = (Data->ChecksumCache != NULL);
+            if (ByChecksum && (ChecklistItem->Local.Size == ChecklistItem->Remote.Size))
             {
-              if ((FLAGCLEAR(Data->Params, spTimestamp) && FLAGCLEAR(Data->Params, spMirror)) ||
-                  (Data->Mode == smBoth) || (Data->Mode == smLocal))
-              {
-                Modified = true;
-              }
-              else
+              // empty files are identical
+              if (ChecklistItem->Local.Size > 0)
               {
-                LocalModified = true;
+                // resolved once the checksums are calculated
+                // for all files of the directory at once
+                LocalData->ChecksumPending = true;
+                LocalData->MatchingRemoteFile = ChecklistItem->Remote;
+                LocalData->MatchingRemoteFileImageIndex = ChecklistItem->ImageIndex;
+                LocalData->MatchingRemoteFileFile = File->Duplicate();
               }
             }
-            else if (TimeCompare > 0)
+            else if (TimeCompare != 0)
             {
-              if ((FLAGCLEAR(Data->Params, spTimestamp) && FLAGCLEAR(Data->Params, spMirror)) ||
-                  (Data->Mode == smBoth) || (Data->Mode == smRemote))
-              {
-                LocalModified = true;
-              }
-              else
-              {
-                Modified = true;
-              }
+              SynchronizeModifiedSide(Data, TimeCompare, Modified, LocalModified);
             }
-            else if (FLAGSET(Data->Params, spBySize) &&
+            else if ((FLAGSET(Data->Params, spBySize) || (ByChecksum && (Data->Mode != smBoth))) &&
                      (ChecklistItem->Local.Size != ChecklistItem->Remote.Size) &&
                      FLAGCLEAR(Data->Params, spTimestamp))
             {
@@ -4990,7 +6078,7 @@ void __fastcall TTerminal::DoSynchronizeCollectFile(const UnicodeString FileName
               Data->RemoteDirectory + File->FileName,
               Data->Mode, Data->CopyParam, Data->Params, Data->OnSynchronizeDirectory,
               Data->Options, (Data->Flags & ~sfFirstLevel),
-              Data->Checklist);
+              Data->Checklist, Data->ChecksumCache, Data->ChecksumCalculator);
           }
         }
         else
@@ -5391,6 +6479,50 @@ void __fastcall TTerminal::SpaceAvailable(const UnicodeString Path,
   }
 }
 //---------------------------------------------------------------------------
+void __fastcall TTerminal::CheckRemoteSpaceAvailable(const UnicodeString & TargetDir, __int64 Size)
+{
+  // small uploads fail quickly anyway, not worth the extra round trip
+  const __int64 MinSize = 10 * 1024 * 1024;
+  if ((Size >= MinSize) && IsCapable[fcCheckingSpaceAvailable])
+  {
+    TSpaceAvailable ASpaceAvailable;
+    bool Checked = false;
+    try
+    {
+      FFileSystem->SpaceAvailable(TargetDir, ASpaceAvailable);
+      Checked = true;
+    }
+    catch (Exception & E)
+    {
+      if (!Active)
+      {
+        throw;
+      }
+      // this is just a preflight, the upload itself will report real problems
+      LogEvent(FORMAT(L"Cannot check space available in \"%s\": %s", (TargetDir, E.Message)));
+    }
+
+    // some servers report zero when they do not know
+    if (Checked && (ASpaceAvailable.UnusedBytesAvailableToUser > 0))
+    {
+      LogEvent(FORMAT(L"Space available in \"%s\": %s bytes, size of upload: %s bytes",
+        (TargetDir, IntToStr(ASpaceAvailable.UnusedBytesAvailableToUser), IntToStr(Size))));
+      // Files that are going to be overwritten may free some space,
+      // so let the user decide (in batch mode this fails the upload)
+      if (ASpaceAvailable.UnusedBytesAvailableToUser < Size)
+      {
+        UnicodeString Message =
+          FMTLOAD(REMOTE_SPACE_INSUFFICIENT, (TargetDir, FormatSize(Size),
+            FormatSize(ASpaceAvailable.UnusedBytesAvailableToUser)));
+        if (QueryUser(Message, NULL, qaYes | qaNo, NULL, qtWarning) != qaYes)
+        {
+          Abort();
+        }
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TTerminal::LockFile(const UnicodeString FileName,
   const TRemoteFile * File, void * /*Param*/)
 {
@@ -5554,6 +6686,11 @@ bool __fastcall TTerminal::CopyToRemote(TStrings * FilesToCopy,
         (FLAGCLEAR(Params, cpDelete) ? CopyParam : NULL),
         CopyParam->CalculateSize);
 
+    if (CalculatedSize && FLAGCLEAR(Params, cpTemporary))
+    {
+      CheckRemoteSpaceAvailable(TargetDir, Size);
+    }
+
     TFileOperationProgressType OperationProgress(&DoProgress, &DoFinished);
     OperationProgress.Start((Params & cpDelete ? foMove : foCopy), osLocal,
       FilesToCopy->Count, Params & cpTemporary, TargetDir, CopyParam->CPSLimit);
@@ -5650,6 +6787,16 @@ bool __fastcall TTerminal::CopyToLocal(TStrings * FilesToCopy,
     }
 
     BeginTransaction();
+    // Keep the listings read while calculating the size, so that the tree
+    // does not need to be listed again by the transfer itself
+    // (SCP downloads whole directories with "scp -r", not using the listings)
+    std::unique_ptr<TRemoteDirectoryCache> TransferListings;
+    DebugAssert(FTransferListings == NULL);
+    if (CopyParam->CalculateSize && (FFSProtocol != cfsSCP))
+    {
+      TransferListings.reset(new TRemoteDirectoryCache());
+      FTransferListings = TransferListings.get();
+    }
     try
     {
       __int64 TotalSize;
@@ -5657,6 +6804,7 @@ bool __fastcall TTerminal::CopyToLocal(TStrings * FilesToCopy,
       TFileOperationProgressType OperationProgress(&DoProgress, &DoFinished);
 
       ExceptionOnFail = true;
+      FCollectingTransferListings = (FTransferListings != NULL);
       try
       {
         // dirty trick: when moving, do not pass copy param to avoid exclude mask
@@ -5670,6 +6818,7 @@ bool __fastcall TTerminal::CopyToLocal(TStrings * FilesToCopy,
       }
       __finally
       {
+        FCollectingTransferListings = false;
         ExceptionOnFail = false;
       }
 
@@ -5741,6 +6890,7 @@ bool __fastcall TTerminal::CopyToLocal(TStrings * FilesToCopy,
     }
     __finally
     {
+      FTransferListings = NULL;
       // If session is still active (no fatal error) we reload directory
       // by calling EndTransaction
       EndTransaction();
@@ -5769,6 +6919,11 @@ void __fastcall TTerminal::ReflectSettings()
   // also FTunnelLog ?
 }
 //---------------------------------------------------------------------------
+TActionLog * __fastcall TTerminal::GetActionLog()
+{
+  return FActionLog;
+}
+//---------------------------------------------------------------------------
 void __fastcall TTerminal::CollectUsage()
 {
   switch (SessionData->FSProtocol)
@@ -6010,7 +7165,8 @@ __fastcall TSecondaryTerminal::TSecondaryTerminal(TTerminal * MainTerminal,
 {
   Log->Parent = FMainTerminal->Log;
   Log->Name = Name;
-  ActionLog->Enabled = false;
+  // not using the virtual ActionLog property, as descendants may redirect it
+  FActionLog->Enabled = false;
   SessionData->NonPersistant();
   DebugAssert(FMainTerminal != NULL);
   if (!FMainTerminal->UserName.IsEmpty())
@@ -6045,6 +7201,11 @@ TTerminal * __fastcall TSecondaryTerminal::GetPasswordSource()
   return FMainTerminal;
 }
 //---------------------------------------------------------------------------
+TSharedConnection * __fastcall TSecondaryTerminal::GetSharedConnection()
+{
+  return FMainTerminal->GetSharedConnection();
+}
+//---------------------------------------------------------------------------
 __fastcall TTerminalList::TTerminalList(TConfiguration * AConfiguration) :
   TObjectList()
 {
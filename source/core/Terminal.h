@@ -22,11 +22,15 @@ struct TOverwriteFileParams;
 struct TSynchronizeData;
 struct TSynchronizeOptions;
 class TSynchronizeChecklist;
+class TLocalChecksumCache;
+class TLocalChecksumCalculator;
+class TLocalFileIOWorker;
 struct TCalculateSizeStats;
 struct TFileSystemInfo;
 struct TSpaceAvailable;
 struct TFilesFindParams;
 class TTunnelUI;
+class TSharedConnection;
 class TCallbackGuard;
 //---------------------------------------------------------------------------
 typedef void __fastcall (__closure *TQueryUserEvent)
@@ -134,6 +138,7 @@ public:
   static const int spBySize = 0x400; // cannot be combined with smBoth, has opposite meaning for spTimestamp
   static const int spSelectedOnly = 0x800; // not used by core
   static const int spMirror = 0x1000;
+  static const int spByChecksum = 0x2000; // files of the same size are compared by content, ignored for spTimestamp
   static const int spDefault = TTerminal::spNoConfirmation | TTerminal::spPreviewChanges;
 
 // for TranslateLockedPath()
@@ -144,9 +149,12 @@ friend class TSFTPFileSystem;
 friend class TFTPFileSystem;
 friend class TWebDAVFileSystem;
 friend class TTunnelUI;
+friend class TSharedConnection;
 friend class TCallbackGuard;
 friend class TSecondaryTerminal;
 friend class TRetryOperationLoop;
+friend class TRobustOperationLoop;
+friend class TProcessDirectoryStream;
 
 private:
   TSessionData * FSessionData;
@@ -174,6 +182,8 @@ private:
   TFileOperationProgressType * FOperationProgress;
   bool FUseBusyCursor;
   TRemoteDirectoryCache * FDirectoryCache;
+  TRemoteDirectoryCache * FTransferListings;
+  bool FCollectingTransferListings;
   TRemoteDirectoryChangesCache * FDirectoryChangesCache;
   TSecureShell * FSecureShell;
   UnicodeString FLastDirectoryChange;
@@ -184,6 +194,7 @@ private:
   bool * FClosedOnCompletion;
   TSessionStatus FStatus;
   int FOpening;
+  int FStreamingListing;
   RawByteString FRememberedPassword;
   RawByteString FRememberedTunnelPassword;
   TTunnelThread * FTunnelThread;
@@ -193,6 +204,7 @@ private:
   TTunnelUI * FTunnelUI;
   int FTunnelLocalPortNumber;
   UnicodeString FTunnelError;
+  TSharedConnection * FSharedConnection;
   TQueryUserEvent FOnQueryUser;
   TPromptUserEvent FOnPromptUser;
   TDisplayBannerEvent FOnDisplayBanner;
@@ -206,6 +218,9 @@ private:
   bool FRememberedPasswordTried;
   bool FRememberedTunnelPasswordTried;
   int FNesting;
+  TSessionMetrics * FMetrics;
+  TDateTime FMetricsLogged;
+  TLocalFileIOWorker * FLocalFileIOWorker;
 
   void __fastcall CommandError(Exception * E, const UnicodeString Msg);
   unsigned int __fastcall CommandError(Exception * E, const UnicodeString Msg,
@@ -283,6 +298,7 @@ protected:
   void __fastcall OpenLocalFile(const UnicodeString FileName, unsigned int Access,
     int * Attrs, HANDLE * Handle, __int64 * ACTime, __int64 * MTime,
     __int64 * ATime, __int64 * Size, bool TryWriteReadOnly = true);
+  TStream * __fastcall CreateLocalFileStream(HANDLE Handle, bool Write);
   bool __fastcall AllowLocalFileTransfer(UnicodeString FileName,
     const TCopyParamType * CopyParam, TFileOperationProgressType * OperationProgress);
   bool __fastcall HandleException(Exception * E);
@@ -294,6 +310,7 @@ protected:
     const TSearchRec Rec, /*__int64*/ void * Size);
   bool __fastcall CalculateLocalFilesSize(TStrings * FileList, __int64 & Size,
     const TCopyParamType * CopyParam, bool AllowDirs);
+  void __fastcall CheckRemoteSpaceAvailable(const UnicodeString & TargetDir, __int64 Size);
   TBatchOverwrite __fastcall EffectiveBatchOverwrite(
     const UnicodeString & SourceFullFileName, const TCopyParamType * CopyParam, int Params,
     TFileOperationProgressType * OperationProgress, bool Special);
@@ -309,7 +326,10 @@ protected:
     const UnicodeString RemoteDirectory, TSynchronizeMode Mode,
     const TCopyParamType * CopyParam, int Params,
     TSynchronizeDirectory OnSynchronizeDirectory,
-    TSynchronizeOptions * Options, int Level, TSynchronizeChecklist * Checklist);
+    TSynchronizeOptions * Options, int Level, TSynchronizeChecklist * Checklist,
+    TLocalChecksumCache * ChecksumCache, TLocalChecksumCalculator * ChecksumCalculator);
+  void __fastcall DoSynchronizeCollectChecksums(TSynchronizeData & Data);
+  UnicodeString __fastcall SynchronizeChecksumAlg();
   void __fastcall DoSynchronizeCollectFile(const UnicodeString FileName,
     const TRemoteFile * File, /*TSynchronizeData*/ void * Param);
   void __fastcall SynchronizeCollectFile(const UnicodeString FileName,
@@ -368,14 +388,19 @@ protected:
     TFileOperationProgressType * OperationProgress, Exception * E = NULL);
   void __fastcall DoAnyCommand(const UnicodeString Command, TCaptureOutputEvent OutputEvent,
     TCallSessionAction * Action);
-  TRemoteFileList * __fastcall DoReadDirectoryListing(UnicodeString Directory, bool UseCache);
+  TRemoteFileList * __fastcall DoReadDirectoryListing(UnicodeString Directory, bool UseCache,
+    TRemoteFilesAddedEvent OnFilesAdded = NULL);
   RawByteString __fastcall EncryptPassword(const UnicodeString & Password);
   UnicodeString __fastcall DecryptPassword(const RawByteString & Password);
   void __fastcall LogRemoteFile(TRemoteFile * File);
   UnicodeString __fastcall FormatFileDetailsForLog(const UnicodeString & FileName, TDateTime Modification, __int64 Size);
   void __fastcall LogFileDetails(const UnicodeString & FileName, TDateTime Modification, __int64 Size);
   void __fastcall LogFileDone(TFileOperationProgressType * OperationProgress);
+  void __fastcall LogMetrics();
+  void __fastcall FlushHostKeys(bool All);
   virtual TTerminal * __fastcall GetPasswordSource();
+  virtual TSharedConnection * __fastcall GetSharedConnection();
+  virtual TActionLog * __fastcall GetActionLog();
   void __fastcall DoEndTransaction(bool Inform);
   bool  __fastcall VerifyCertificate(
     const UnicodeString & CertificateStorageKey, const UnicodeString & SiteKey,
@@ -412,7 +437,8 @@ public:
   void __fastcall ReadCurrentDirectory();
   void __fastcall ReadDirectory(bool ReloadOnly, bool ForceCache = false);
   TRemoteFileList * __fastcall ReadDirectoryListing(UnicodeString Directory, const TFileMasks & Mask);
-  TRemoteFileList * __fastcall CustomReadDirectoryListing(UnicodeString Directory, bool UseCache);
+  TRemoteFileList * __fastcall CustomReadDirectoryListing(UnicodeString Directory, bool UseCache,
+    TRemoteFilesAddedEvent OnFilesAdded = NULL);
   TRemoteFile * __fastcall ReadFileListing(UnicodeString Path);
   void __fastcall ReadFile(const UnicodeString FileName, TRemoteFile *& File);
   bool __fastcall FileExists(const UnicodeString FileName, TRemoteFile ** File = NULL);
@@ -502,7 +528,8 @@ public:
 
   __property TSessionData * SessionData = { read = FSessionData };
   __property TSessionLog * Log = { read = FLog };
-  __property TActionLog * ActionLog = { read = FActionLog };
+  __property TActionLog * ActionLog = { read = GetActionLog };
+  __property TSessionMetrics * Metrics = { read = FMetrics };
   __property TConfiguration * Configuration = { read = FConfiguration };
   __property bool Active = { read = GetActive };
   __property TSessionStatus Status = { read = FStatus };
@@ -559,6 +586,7 @@ protected:
   virtual void __fastcall DirectoryModified(const UnicodeString Path,
     bool SubDirs);
   virtual TTerminal * __fastcall GetPasswordSource();
+  virtual TSharedConnection * __fastcall GetSharedConnection();
 
 private:
   TTerminal * FMainTerminal;
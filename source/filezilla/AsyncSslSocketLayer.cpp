@@ -12,6 +12,12 @@
 #include <openssl/x509v3.h>
 #include <openssl/err.h>
 
+// Size of the BIO pair buffers, large enough to hold several TLS records,
+// so that a bulk data transfer does not stall on a full network bio
+#define SSL_BIO_BUFSIZE (128 * 1024)
+// Maximal amount of network data read at once
+#define SSL_RECEIVE_BUFSIZE 32768
+
 /////////////////////////////////////////////////////////////////////////////
 // CAsyncSslSocketLayer
 CCriticalSectionWrapper CAsyncSslSocketLayer::m_sCriticalSection;
@@ -103,14 +109,14 @@ void CAsyncSslSocketLayer::OnReceive(int nErrorCode)
       return;
     }
 
-    char buffer[16384];
+    char buffer[SSL_RECEIVE_BUFSIZE];
 
     m_mayTriggerRead = false;
 
     //Get number of bytes we can receive and store in the network input bio
     int len = BIO_ctrl_get_write_guarantee(m_nbio);
-    if (len > 16384)
-      len = 16384;
+    if (len > SSL_RECEIVE_BUFSIZE)
+      len = SSL_RECEIVE_BUFSIZE;
     else if (!len)
     {
       m_mayTriggerRead = true;
@@ -724,7 +730,7 @@ int CAsyncSslSocketLayer::InitSSLConnection(bool clientMode,
 
   //Create bios
   m_sslbio = BIO_new(BIO_f_ssl());
-  BIO_new_bio_pair(&m_ibio, 32768, &m_nbio, 32768);
+  BIO_new_bio_pair(&m_ibio, SSL_BIO_BUFSIZE, &m_nbio, SSL_BIO_BUFSIZE);
 
   if (!m_sslbio || !m_nbio || !m_ibio)
   {
@@ -240,6 +240,29 @@ bool __fastcall TFileZillaIntf::FileTransfer(const wchar_t * LocalFile,
   // 1 = ascii, 2 = binary
   Transfer.nType = Type;
   Transfer.nUserData = reinterpret_cast<int>(UserData);
+  Transfer.nRangeStart = -1;
+  Transfer.nRangeLength = -1;
+
+  return Check(FFileZillaApi->FileTransfer(Transfer), L"filetransfer");
+}
+//---------------------------------------------------------------------------
+bool __fastcall TFileZillaIntf::DownloadRange(const wchar_t * LocalFile,
+  const wchar_t * RemoteFile, const wchar_t * RemotePath, __int64 Size,
+  __int64 RangeStart, __int64 RangeLength, void * UserData)
+{
+  t_transferfile Transfer;
+
+  Transfer.localfile = LocalFile;
+  Transfer.remotefile = RemoteFile;
+  Transfer.remotepath = CServerPath(RemotePath);
+  Transfer.get = true;
+  Transfer.size = Size;
+  Transfer.server = *FServer;
+  // ranges make sense with binary transfer only
+  Transfer.nType = 2;
+  Transfer.nUserData = reinterpret_cast<int>(UserData);
+  Transfer.nRangeStart = RangeStart;
+  Transfer.nRangeLength = RangeLength;
 
   return Check(FFileZillaApi->FileTransfer(Transfer), L"filetransfer");
 }
@@ -192,6 +192,9 @@ public:
 
   bool __fastcall FileTransfer(const wchar_t * LocalFile, const wchar_t * RemoteFile,
     const wchar_t * RemotePath, bool Get, __int64 Size, int Type, void * UserData);
+  bool __fastcall DownloadRange(const wchar_t * LocalFile, const wchar_t * RemoteFile,
+    const wchar_t * RemotePath, __int64 Size, __int64 RangeStart, __int64 RangeLength,
+    void * UserData);
 
   virtual const wchar_t * __fastcall Option(int OptionID) const = 0;
   virtual int __fastcall OptionVal(int OptionID) const = 0;
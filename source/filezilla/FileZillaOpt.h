@@ -51,5 +51,7 @@
 #define OPTION_MPEXT_LOG_SENSITIVE 1008
 #define OPTION_MPEXT_HOST 1009
 #define OPTION_MPEXT_NODELAY 1010
+#define OPTION_MPEXT_TRANSFER_SIZE 1011
+#define OPTION_MPEXT_RCVBUF 1012
 //---------------------------------------------------------------------------
 #endif // FileZillaOptH
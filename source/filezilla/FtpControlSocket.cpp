@@ -25,6 +25,7 @@ public:
     bUseAbsolutePaths = FALSE;
     bTriedPortPasvOnce = FALSE;
     askOnResumeFail = false;
+    rangeComplete = false;
   };
   ~CFileTransferData()
   {
@@ -55,6 +56,7 @@ public:
   int newZlibLevel;
 #endif
   bool askOnResumeFail;
+  bool rangeComplete;
 };
 
 class CFtpControlSocket::CLogonData:public CFtpControlSocket::t_operation::COpData
@@ -184,7 +186,9 @@ CFtpControlSocket::CFtpControlSocket(CMainThread *pMainThread, CFileZillaTools *
   m_ListFile = "";
 
   m_awaitsReply = false;
-  m_skipReply = false;
+  m_skipReply = 0;
+  m_nPipelinedReplies = 0;
+  m_bPipelinedError = false;
 
   m_sendBuffer = 0;
   m_sendBufferLen = 0;
@@ -1319,10 +1323,10 @@ void CFtpControlSocket::ProcessReply()
   if ( reply == L"" )
     return;
 
-  // After Cancel, we might have to skip a reply
-  if (m_skipReply)
+  // After Cancel, we might have to skip a reply (or several)
+  if (m_skipReply > 0)
   {
-    m_skipReply = false;
+    m_skipReply--;
     m_RecvBuffer.pop_front();
     return;
   }
@@ -1336,7 +1340,15 @@ void CFtpControlSocket::ProcessReply()
     LogOnToServer();
   else if (m_Operation.nOpMode& (CSMODE_COMMAND|CSMODE_CHMOD) )
   {
-    if (GetReplyCode()== 2 || GetReplyCode()== 3)
+    bool bSuccess = (GetReplyCode()== 2 || GetReplyCode()== 3);
+    if (m_nPipelinedReplies > 1)
+    {
+      // Wait for replies to the remaining pipelined commands
+      m_nPipelinedReplies--;
+      if (!bSuccess)
+        m_bPipelinedError = true;
+    }
+    else if (bSuccess && !m_bPipelinedError)
       ResetOperation(FZ_REPLY_OK);
     else
       ResetOperation(FZ_REPLY_ERROR);
@@ -1429,7 +1441,7 @@ BOOL CFtpControlSocket::Send(CString str)
     WideCharToMultiByte(CP_UTF8, 0, unicode, -1, utf8, len + 1, 0, 0);
 
     int sendLen = strlen(utf8);
-    if (!m_awaitsReply && !m_sendBuffer)
+    if ((!m_awaitsReply || (m_nPipelinedReplies > 0)) && !m_sendBuffer)
       res = CAsyncSocketEx::Send(utf8, strlen(utf8));
     else
       res = -2;
@@ -1467,7 +1479,7 @@ BOOL CFtpControlSocket::Send(CString str)
     LPCSTR lpszAsciiSend = T2CA(str);
 
     int sendLen = strlen(lpszAsciiSend);
-    if (!m_awaitsReply && !m_sendBuffer)
+    if ((!m_awaitsReply || (m_nPipelinedReplies > 0)) && !m_sendBuffer)
       res = CAsyncSocketEx::Send(lpszAsciiSend, strlen(lpszAsciiSend));
     else
       res = -2;
@@ -1545,7 +1557,9 @@ void CFtpControlSocket::DoClose(int nError /*=0*/)
   m_ListFile = "";
 
   m_awaitsReply = false;
-  m_skipReply = false;
+  m_skipReply = 0;
+  m_nPipelinedReplies = 0;
+  m_bPipelinedError = false;
 
   delete [] m_sendBuffer;
   m_sendBuffer = 0;
@@ -1591,7 +1605,36 @@ void CFtpControlSocket::CheckForTimeout()
 void CFtpControlSocket::FtpCommand(LPCTSTR pCommand)
 {
   m_Operation.nOpMode=CSMODE_COMMAND;
-  Send(pCommand);
+  // Several commands separated by a new line are pipelined,
+  // i.e. they are all sent at once without waiting for the replies.
+  // The operation finishes with the reply to the last command
+  // and fails, if any of the commands failed.
+  CString Commands = pCommand;
+  m_nPipelinedReplies = 0;
+  m_bPipelinedError = false;
+  if (Commands.Find(L'\n') < 0)
+  {
+    Send(Commands);
+  }
+  else
+  {
+    int nPos = 0;
+    while (nPos < Commands.GetLength())
+    {
+      int nEnd = Commands.Find(L'\n', nPos);
+      if (nEnd < 0)
+        nEnd = Commands.GetLength();
+      CString Command = Commands.Mid(nPos, nEnd - nPos);
+      Command.TrimRight(L"\r");
+      if (!Command.IsEmpty())
+      {
+        m_nPipelinedReplies++;
+        if (!Send(Command))
+          break;
+      }
+      nPos = nEnd + 1;
+    }
+  }
 }
 
 bool CFtpControlSocket::UsingMlsd()
@@ -2762,6 +2805,8 @@ void CFtpControlSocket::FileTransfer(t_transferfile *transferfile/*=0*/,BOOL bFi
         ResetOperation(FZ_REPLY_ERROR);
         return;
       }
+      if (m_pTransferSocket->m_transferdata.bRange && (m_pTransferSocket->m_transferdata.transferleft <= 0))
+        pData->rangeComplete = true;
       pData->nGotTransferEndReply |= 2;
       if (m_Operation.nOpState!=FILETRANSFER_WAITFINISH)
         return;
@@ -2814,6 +2859,7 @@ void CFtpControlSocket::FileTransfer(t_transferfile *transferfile/*=0*/,BOOL bFi
     pData->transferdata.bResume = FALSE;
     pData->transferdata.bResumeAppend = FALSE;
     pData->transferdata.bType = (pData->transferfile.nType == 1) ? TRUE : FALSE;
+    pData->transferdata.bRange = (pData->transferfile.get && (pData->transferfile.nRangeStart >= 0)) ? TRUE : FALSE;
 
     CServerPath path;
     DebugCheck(m_pOwner->GetCurrentPath(path));
@@ -3530,7 +3576,7 @@ void CFtpControlSocket::FileTransfer(t_transferfile *transferfile/*=0*/,BOOL bFi
           DebugCheck(m_pTransferSocket->AsyncSelect());
         }
 
-        if (pData->transferdata.bResume)
+        if (pData->transferdata.bResume || (pData->transferdata.bRange && (pData->transferfile.nRangeStart > 0)))
           m_Operation.nOpState = FILETRANSFER_REST;
         else
           m_Operation.nOpState = FILETRANSFER_RETRSTOR;
@@ -3539,7 +3585,10 @@ void CFtpControlSocket::FileTransfer(t_transferfile *transferfile/*=0*/,BOOL bFi
           m_pDataFile = new CFile;
         if (pData->transferfile.get)
         {
-          if (pData->transferdata.bResume)
+          // other parts of the file are being written by other connections
+          if (pData->transferdata.bRange)
+            res = m_pDataFile->Open(pData->transferfile.localfile,CFile::modeCreate|CFile::modeWrite|CFile::modeNoTruncate|CFile::shareDenyNone);
+          else if (pData->transferdata.bResume)
             res = m_pDataFile->Open(pData->transferfile.localfile,CFile::modeCreate|CFile::modeWrite|CFile::modeNoTruncate|CFile::shareDenyWrite);
           else
             res = m_pDataFile->Open(pData->transferfile.localfile,CFile::modeWrite|CFile::modeCreate|CFile::shareDenyWrite);
@@ -3613,6 +3662,17 @@ void CFtpControlSocket::FileTransfer(t_transferfile *transferfile/*=0*/,BOOL bFi
             }
           else if (pData->pFileSize)
             pData->transferdata.transfersize=*pData->pFileSize;
+          if (pData->transferdata.bRange)
+          {
+            pData->transferdata.transfersize=pData->transferfile.nRangeLength;
+            LONG low = static_cast<LONG>(pData->transferfile.nRangeStart&0xFFFFFFFF);
+            LONG high = static_cast<LONG>(pData->transferfile.nRangeStart>>32);
+            if (SetFilePointer((HANDLE)m_pDataFile->m_hFile, low, &high, FILE_BEGIN)==0xFFFFFFFF && GetLastError()!=NO_ERROR)
+            {
+              ShowStatus(IDS_ERRORMSG_SETFILEPOINTER, FZ_LOG_ERROR);
+              nReplyError = FZ_REPLY_ERROR;
+            }
+          }
           pData->transferdata.transferleft=pData->transferdata.transfersize;
         }
       }
@@ -3630,7 +3690,12 @@ void CFtpControlSocket::FileTransfer(t_transferfile *transferfile/*=0*/,BOOL bFi
         if (code==3 || code==2)
         {
           LONG high = 0;
-          if (pData->transferfile.get)
+          if (pData->transferdata.bRange)
+          {
+            // file pointer was already set to the start of the range
+            m_Operation.nOpState = FILETRANSFER_RETRSTOR;
+          }
+          else if (pData->transferfile.get)
           {
             pData->transferdata.transferleft = pData->transferdata.transfersize - GetLength64(*m_pDataFile);
             if (SetFilePointer((HANDLE)m_pDataFile->m_hFile, 0, &high, FILE_END)==0xFFFFFFFF && GetLastError()!=NO_ERROR)
@@ -3646,6 +3711,11 @@ void CFtpControlSocket::FileTransfer(t_transferfile *transferfile/*=0*/,BOOL bFi
             m_Operation.nOpState = FILETRANSFER_RETRSTOR;
           }
         }
+        else if (pData->transferdata.bRange)
+        {
+          // without resume support, the range cannot be downloaded
+          nReplyError = FZ_REPLY_ERROR | FZ_REPLY_CRITICALERROR;
+        }
         else
         {
           if (code==5 && GetReply()[1]==L'0')
@@ -3781,7 +3851,18 @@ void CFtpControlSocket::FileTransfer(t_transferfile *transferfile/*=0*/,BOOL bFi
           break;
         }
         else if (code!=2 && code!=3)
-          nReplyError = FZ_REPLY_ERROR;
+        {
+          // We have closed the data connection ourselves, once we got the whole range,
+          // so the server reports the transfer as aborted
+          if (pData->rangeComplete ||
+              (m_pTransferSocket && m_pTransferSocket->m_transferdata.bRange && (m_pTransferSocket->m_transferdata.transferleft <= 0)))
+          {
+            LogMessage(FZ_LOG_INFO, L"Range transferred, ignoring transfer abort reply");
+            pData->nGotTransferEndReply |= 1;
+          }
+          else
+            nReplyError = FZ_REPLY_ERROR;
+        }
         else
         {
           pData->nGotTransferEndReply |= 1;
@@ -4267,6 +4348,8 @@ void CFtpControlSocket::FileTransfer(t_transferfile *transferfile/*=0*/,BOOL bFi
     {
       CString command;
       __int64 transferoffset =
+        pData->transferdata.bRange ?
+          pData->transferfile.nRangeStart :
         pData->transferfile.get ?
           GetLength64(*m_pDataFile) :
           pData->transferdata.transfersize-pData->transferdata.transferleft;
@@ -4397,7 +4480,7 @@ void CFtpControlSocket::TransferFinished(bool preserveFileTimeForUploads)
   CFileTransferData *pData=static_cast<CFileTransferData *>(m_Operation.pData);
 
   if (GetOptionVal(OPTION_PRESERVEDOWNLOADFILETIME) && m_pDataFile &&
-        pData->transferfile.get)
+        pData->transferfile.get && !pData->transferdata.bRange)
   {
     m_pTools->PreserveDownloadFileTime(
       (HANDLE)m_pDataFile->m_hFile, reinterpret_cast<void *>(pData->transferfile.nUserData));
@@ -4443,18 +4526,19 @@ void CFtpControlSocket::TransferFinished(bool preserveFileTimeForUploads)
 void CFtpControlSocket::Cancel(BOOL bQuit/*=FALSE*/)
 {
   const int nOpMode = m_Operation.nOpMode;
+  const int nPipelinedReplies = m_nPipelinedReplies;
   if (nOpMode==CSMODE_CONNECT)
     DoClose(FZ_REPLY_CANCEL);
   else if (nOpMode & CSMODE_LIST)
   {
     if (m_Operation.nOpState == LIST_WAITFINISH)
-      m_skipReply = true;
+      m_skipReply = 1;
     ResetOperation(FZ_REPLY_ERROR | FZ_REPLY_CANCEL);
   }
   else if (nOpMode & CSMODE_TRANSFER)
   {
     if (m_Operation.nOpState == FILETRANSFER_WAITFINISH || m_Operation.nOpState == FILETRANSFER_LIST_WAITFINISH)
-      m_skipReply = true;
+      m_skipReply = 1;
     ResetOperation(FZ_REPLY_ERROR | FZ_REPLY_CANCEL | FZ_REPLY_ABORTED);
   }
   else if (nOpMode != CSMODE_NONE)
@@ -4463,8 +4547,10 @@ void CFtpControlSocket::Cancel(BOOL bQuit/*=FALSE*/)
   if (nOpMode != CSMODE_NONE && !bQuit)
     ShowStatus(IDS_ERRORMSG_INTERRUPTED, FZ_LOG_ERROR);
 
-  if (m_awaitsReply)
-    m_skipReply = true;
+  if (nPipelinedReplies > 0)
+    m_skipReply = nPipelinedReplies;
+  else if (m_awaitsReply)
+    m_skipReply = 1;
 }
 
 void CFtpControlSocket::TransfersocketListenFinished(unsigned int ip, unsigned short port)
@@ -4534,6 +4620,9 @@ void CFtpControlSocket::ResetOperation(int nSuccessful /*=FALSE*/)
     delete m_pDataFile;
   m_pDataFile=0;
 
+  m_nPipelinedReplies = 0;
+  m_bPipelinedError = false;
+
   if (m_Operation.nOpMode)
   {
     //Unset busy attribute so that new commands can be executed
@@ -4892,6 +4981,13 @@ int CFtpControlSocket::CheckOverwriteFile()
 
   CFileTransferData *pData = reinterpret_cast<CFileTransferData *>(m_Operation.pData);
 
+  // range is always downloaded into a file prepared by the caller
+  if (pData->transferdata.bRange)
+  {
+    m_Operation.nOpState = FILETRANSFER_TYPE;
+    return 0;
+  }
+
   int nReplyError = 0;
   CFileStatus64 status;
   BOOL res = GetStatus64(pData->transferfile.localfile, status);
@@ -6183,7 +6279,7 @@ CString CFtpControlSocket::GetReply()
 
 void CFtpControlSocket::OnSend(int nErrorCode)
 {
-  if (!m_sendBufferLen || !m_sendBuffer || m_awaitsReply)
+  if (!m_sendBufferLen || !m_sendBuffer || (m_awaitsReply && !m_nPipelinedReplies))
     return;
 
   int res = CAsyncSocketEx::Send(m_sendBuffer, m_sendBufferLen);
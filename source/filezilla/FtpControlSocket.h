@@ -32,7 +32,7 @@ class CMainThread;
 //---------------------------------------------------------------------------
 typedef struct
 {
-  BOOL bResume,bResumeAppend,bType;
+  BOOL bResume,bResumeAppend,bType,bRange;
   __int64 transfersize,transferleft;
 } t_transferdata;
 //---------------------------------------------------------------------------
@@ -198,7 +198,10 @@ protected:
   bool m_isFileZilla;
 
   bool m_awaitsReply;
-  bool m_skipReply;
+  int m_skipReply;
+  // Number of replies still expected for pipelined custom commands
+  int m_nPipelinedReplies;
+  bool m_bPipelinedError;
 
   char * m_sendBuffer;
   int m_sendBufferLen;
@@ -527,15 +527,50 @@ BOOL CFtpListResult::parseLine(const char *lineToParse, const int linelen, t_dir
   return FALSE;
 }
 
+// Minimal size of chunks allocated by AppendData
+#define LIST_CHUNK_SIZE (64 * 1024)
+
 // Used only with LISTDEBUG
 void CFtpListResult::AddData(char *data, int size)
 {
-  #ifdef _DEBUG
-  USES_CONVERSION;
-  #endif
   if (!size)
     return;
 
+  AddChunk(data, size, size);
+  ParseData();
+}
+
+void CFtpListResult::AppendData(const char *data, int size)
+{
+  if (!size)
+    return;
+
+  // Copy to the free space of the last chunk first,
+  // so that not every received block needs its own allocation
+  if (m_curlistaddpos && (m_curlistaddpos->size > m_curlistaddpos->len))
+  {
+    int copylen = m_curlistaddpos->size - m_curlistaddpos->len;
+    if (copylen > size)
+      copylen = size;
+    memcpy(&m_curlistaddpos->buffer[m_curlistaddpos->len], data, copylen);
+    m_curlistaddpos->len += copylen;
+    data += copylen;
+    size -= copylen;
+  }
+
+  if (size)
+  {
+    int chunksize = (size > LIST_CHUNK_SIZE) ? size : LIST_CHUNK_SIZE;
+    char *buffer = new char[chunksize];
+    memcpy(buffer, data, size);
+    AddChunk(buffer, size, chunksize);
+  }
+
+  ParseData();
+}
+
+void CFtpListResult::AddChunk(char *data, int len, int size)
+{
   if (!m_curlistaddpos)
     m_curlistaddpos = new t_list;
   else
@@ -549,9 +584,16 @@ void CFtpListResult::AddData(char *data, int size)
     listhead = m_curlistaddpos;
   }
   m_curlistaddpos->buffer = data;
-  m_curlistaddpos->len = size;
+  m_curlistaddpos->len = len;
+  m_curlistaddpos->size = size;
   m_curlistaddpos->next = 0;
+}
 
+void CFtpListResult::ParseData()
+{
+  #ifdef _DEBUG
+  USES_CONVERSION;
+  #endif
   t_list *pOldListPos = curpos;
   int nOldListBufferPos = pos;
 
@@ -33,6 +33,7 @@ public:
   t_server m_server;
   void SendToMessageLog();
   void AddData(char * data,int size);
+  void AppendData(const char * data, int size);
   CFtpListResult(t_server server, bool * bUTF8 = 0);
   virtual ~CFtpListResult();
   t_directory::t_direntry * getList(int & num, bool mlst);
@@ -68,6 +69,8 @@ private:
   {
     char * buffer;
     int len;
+    // allocated size of the buffer, may exceed len for chunks filled by AppendData
+    int size;
     t_list * next;
   } * listhead, * curpos, * m_curlistaddpos;
 
@@ -84,6 +87,8 @@ protected:
   const char * strnstr(const char * str, int len, const char * c) const;
   _int64 strntoi64(const char * str, int len) const;
   void AddLine(t_directory::t_direntry & direntry);
+  void AddChunk(char * data, int len, int size);
+  void ParseData();
   char * GetLine();
   bool IsNumeric(const char * str, int len) const;
   char * m_prevline;
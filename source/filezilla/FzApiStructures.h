@@ -35,6 +35,10 @@ typedef struct
     t_server server;
     int nType;
     int nUserData;
+    // download of part of a file only, into existing local file,
+    // nRangeStart < 0 for complete file transfer
+    __int64 nRangeStart;
+    __int64 nRangeLength;
 } t_transferfile;
 //---------------------------------------------------------------------------
 #endif // FzApiStructuresH
@@ -29,12 +29,16 @@ CTransferSocket::CTransferSocket(CFtpControlSocket *pOwner, int nMode)
   m_pBuffer2 = 0;
 #endif
   m_bufferpos = 0;
+  m_nBufSize = GetOptionVal(OPTION_MPEXT_TRANSFER_SIZE);
+  if (m_nBufSize < BUFSIZE)
+    m_nBufSize = BUFSIZE;
   m_pFile = 0;
   m_bListening = FALSE;
   m_bSentClose = FALSE;
   m_nInternalMessageID = 0;
   m_transferdata.transfersize = 0;
   m_transferdata.transferleft = 0;
+  m_transferdata.bRange = FALSE;
   m_nNotifyWaiting = 0;
   m_bActivationPending = false;
 
@@ -112,8 +116,11 @@ void CTransferSocket::OnReceive(int nErrorCode)
     if (m_nTransferState == STATE_STARTING)
       OnConnect(0);
 
-    char *buffer = new char[BUFSIZE];
-    int numread = CAsyncSocketEx::Receive(buffer, BUFSIZE);
+    // The receive buffer is reused,
+    // the list result appends the data to its own chunks
+    if (!m_pBuffer)
+      m_pBuffer = new char[m_nBufSize];
+    int numread = CAsyncSocketEx::Receive(m_pBuffer, m_nBufSize);
     if (numread != SOCKET_ERROR && numread)
     {
       m_LastActiveTime = CTime::GetCurrentTime();
@@ -121,7 +128,7 @@ void CTransferSocket::OnReceive(int nErrorCode)
 #ifndef MPEXT_NO_ZLIB
       if (m_useZlib)
       {
-        m_zlibStream.next_in = (Bytef *)buffer;
+        m_zlibStream.next_in = (Bytef *)m_pBuffer;
         m_zlibStream.avail_in = numread;
         char *out = new char[BUFSIZE];
         m_zlibStream.next_out = (Bytef *)out;
@@ -135,7 +142,6 @@ void CTransferSocket::OnReceive(int nErrorCode)
           m_zlibStream.avail_out = BUFSIZE;
           res = inflate(&m_zlibStream, 0);
         }
-        delete [] buffer;
         if (res == Z_STREAM_END)
           m_pListResult->AddData(out, BUFSIZE - m_zlibStream.avail_out);
         else if (res != Z_OK && res != Z_BUF_ERROR)
@@ -149,7 +155,7 @@ void CTransferSocket::OnReceive(int nErrorCode)
       }
       else
 #endif
-        m_pListResult->AddData(buffer, numread);
+        m_pListResult->AppendData(m_pBuffer, numread);
       m_transferdata.transfersize += numread;
       t_ffam_transferstatus *status = new t_ffam_transferstatus;
       status->bFileTransfer = FALSE;
@@ -157,8 +163,6 @@ void CTransferSocket::OnReceive(int nErrorCode)
       status->bytes = m_transferdata.transfersize;
       GetIntern()->PostMessage(FZ_MSG_MAKEMSG(FZ_MSG_TRANSFERSTATUS, 0), (LPARAM)status);
     }
-    else
-      delete [] buffer;
     if (!numread)
     {
       CloseAndEnsureSendClose(0);
@@ -188,114 +192,143 @@ void CTransferSocket::OnReceive(int nErrorCode)
     if (m_nTransferState == STATE_STARTING)
       OnConnect(0);
 
-    bool beenWaiting = false;
-    _int64 ableToRead;
-    if (GetState() != closed)
-      ableToRead = m_pOwner->GetAbleToTransferSize(CFtpControlSocket::download, beenWaiting);
-    else
-      ableToRead = BUFSIZE;
-
-    if (!beenWaiting)
-      DebugAssert(ableToRead);
-    else if (!ableToRead)
-    {
-      TriggerEvent(FD_READ);
-      return;
-    }
-
     if (!m_pBuffer)
-      m_pBuffer = new char[BUFSIZE];
-
-    int numread = CAsyncSocketEx::Receive(m_pBuffer, static_cast<int>(ableToRead));
-    if (numread!=SOCKET_ERROR)
-    {
-      m_pOwner->SpeedLimitAddTransferredBytes(CFtpControlSocket::download, numread);
-    }
+      m_pBuffer = new char[m_nBufSize];
 
-    if (!numread)
+    // Drain the socket until it would block, instead of doing a single
+    // read per FD_READ notification
+    while (TRUE)
     {
-      CloseAndEnsureSendClose(0);
-      return;
-    }
+      bool beenWaiting = false;
+      _int64 ableToRead;
+      if (GetState() != closed)
+        ableToRead = m_pOwner->GetAbleToTransferSize(CFtpControlSocket::download, beenWaiting, m_nBufSize);
+      else
+        ableToRead = m_nBufSize;
 
-    if (numread == SOCKET_ERROR)
-    {
-      int nError = GetLastError();
-      if (nError == WSAENOTCONN)
+      if (!beenWaiting)
+        DebugAssert(ableToRead);
+      else if (!ableToRead)
       {
-        //Not yet connected
+        TriggerEvent(FD_READ);
         return;
       }
-      else if (m_pSslLayer && nError == WSAESHUTDOWN)
+
+      // do not read past the end of the requested range
+      if (m_transferdata.bRange && (ableToRead > m_transferdata.transferleft))
+        ableToRead = m_transferdata.transferleft;
+
+      int numread = CAsyncSocketEx::Receive(m_pBuffer, static_cast<int>(ableToRead));
+      if (numread!=SOCKET_ERROR)
       {
-        // Do nothing, wait for shutdown complete notification.
-        return;
+        m_pOwner->SpeedLimitAddTransferredBytes(CFtpControlSocket::download, numread);
       }
-      else if (nError != WSAEWOULDBLOCK)
+
+      if (!numread)
       {
-        LogError(nError);
-        CloseAndEnsureSendClose(CSMODE_TRANSFERERROR);
+        CloseAndEnsureSendClose(0);
+        return;
       }
 
-      UpdateStatusBar(false);
-      return;
-    }
-
-    int written = 0;
-    m_LastActiveTime = CTime::GetCurrentTime();
-    TRY
-    {
-#ifndef MPEXT_NO_ZLIB
-      if (m_useZlib)
+      if (numread == SOCKET_ERROR)
       {
-        if (!m_pBuffer2)
-          m_pBuffer2 = new char[BUFSIZE];
-
-        m_zlibStream.next_in = (Bytef *)m_pBuffer;
-        m_zlibStream.avail_in = numread;
-        m_zlibStream.next_out = (Bytef *)m_pBuffer2;
-        m_zlibStream.avail_out = BUFSIZE;
-        int res = inflate(&m_zlibStream, 0);
-        while (res == Z_OK)
+        int nError = GetLastError();
+        if (nError == WSAENOTCONN)
         {
-          m_pFile->Write(m_pBuffer2, BUFSIZE - m_zlibStream.avail_out);
-          written += BUFSIZE - m_zlibStream.avail_out;
-          m_zlibStream.next_out = (Bytef *)m_pBuffer2;
-          m_zlibStream.avail_out = BUFSIZE;
-          res = inflate(&m_zlibStream, 0);
+          //Not yet connected
+          return;
         }
-        if (res == Z_STREAM_END)
+        else if (m_pSslLayer && nError == WSAESHUTDOWN)
         {
-          m_pFile->Write(m_pBuffer2, BUFSIZE - m_zlibStream.avail_out);
-          written += BUFSIZE - m_zlibStream.avail_out;
+          // Do nothing, wait for shutdown complete notification.
+          return;
         }
-        else if (res != Z_OK && res != Z_BUF_ERROR)
+        else if (nError != WSAEWOULDBLOCK)
         {
-          m_pOwner->ShowStatus(L"Compression error", FZ_LOG_ERROR);
+          LogError(nError);
           CloseAndEnsureSendClose(CSMODE_TRANSFERERROR);
-          return;
         }
+
+        UpdateStatusBar(false);
+        return;
       }
-      else
+
+      int written = 0;
+      m_LastActiveTime = CTime::GetCurrentTime();
+      TRY
+      {
+#ifndef MPEXT_NO_ZLIB
+        if (m_useZlib)
+        {
+          if (!m_pBuffer2)
+            m_pBuffer2 = new char[m_nBufSize];
+
+          m_zlibStream.next_in = (Bytef *)m_pBuffer;
+          m_zlibStream.avail_in = numread;
+          m_zlibStream.next_out = (Bytef *)m_pBuffer2;
+          m_zlibStream.avail_out = m_nBufSize;
+          int res = inflate(&m_zlibStream, 0);
+          while (res == Z_OK)
+          {
+            m_pFile->Write(m_pBuffer2, m_nBufSize - m_zlibStream.avail_out);
+            written += m_nBufSize - m_zlibStream.avail_out;
+            m_zlibStream.next_out = (Bytef *)m_pBuffer2;
+            m_zlibStream.avail_out = m_nBufSize;
+            res = inflate(&m_zlibStream, 0);
+          }
+          if (res == Z_STREAM_END)
+          {
+            m_pFile->Write(m_pBuffer2, m_nBufSize - m_zlibStream.avail_out);
+            written += m_nBufSize - m_zlibStream.avail_out;
+          }
+          else if (res != Z_OK && res != Z_BUF_ERROR)
+          {
+            m_pOwner->ShowStatus(L"Compression error", FZ_LOG_ERROR);
+            CloseAndEnsureSendClose(CSMODE_TRANSFERERROR);
+            return;
+          }
+        }
+        else
 #endif
+        {
+          m_pFile->Write(m_pBuffer, numread);
+          written = numread;
+        }
+      }
+      CATCH(CFileException,e)
       {
-        m_pFile->Write(m_pBuffer, numread);
-        written = numread;
+        LPTSTR msg = new TCHAR[BUFSIZE];
+        if (e->GetErrorMessage(msg, BUFSIZE))
+          m_pOwner->ShowStatus(msg, FZ_LOG_ERROR);
+        delete [] msg;
+        CloseAndEnsureSendClose(CSMODE_TRANSFERERROR);
+        return;
       }
-    }
-    CATCH(CFileException,e)
-    {
-      LPTSTR msg = new TCHAR[BUFSIZE];
-      if (e->GetErrorMessage(msg, BUFSIZE))
-        m_pOwner->ShowStatus(msg, FZ_LOG_ERROR);
-      delete [] msg;
-      CloseAndEnsureSendClose(CSMODE_TRANSFERERROR);
-      return;
-    }
-    END_CATCH;
-    m_transferdata.transferleft -= written;
+      END_CATCH;
+      m_transferdata.transferleft -= written;
+
+      UpdateStatusBar(false);
 
-    UpdateStatusBar(false);
+      // The server would send the rest of the file,
+      // close the connection once we have the whole range
+      if (m_transferdata.bRange && (m_transferdata.transferleft <= 0))
+      {
+        CloseAndEnsureSendClose(0);
+        return;
+      }
+
+      //Check if there are other commands in the command queue.
+      //Once the socket is closed, read all remaining data at once.
+      MSG msg;
+      if ((GetState() != closed) &&
+          PeekMessage(&msg, 0, m_nInternalMessageID, m_nInternalMessageID, PM_NOREMOVE))
+      {
+        //Send resume message
+        LogMessage(FZ_LOG_DEBUG, L"Message waiting in queue, resuming later");
+        TriggerEvent(FD_READ);
+        return;
+      }
+    }
   }
 }
 
@@ -314,14 +347,14 @@ void CTransferSocket::SetBuffers()
     SetSockOpt(SO_SNDBUF, &value, sizeof(value));
   }
 
-  // For now we increase receive buffer, whenever send buffer is set.
-  // The size is not configurable. The constant taken from FZ.
-  if (sndbuf > 0)
+  // The receive buffer is set independently on the send buffer,
+  // zero keeps the system default (and its autotuning)
+  int rcvbuf = GetOptionVal(OPTION_MPEXT_RCVBUF);
+  if (rcvbuf > 0)
   {
     value = 0;
     len = sizeof(value);
     GetSockOpt(SO_RCVBUF, &value, &len);
-    int rcvbuf = 4 * 1024 * 1024;
     if (value < rcvbuf)
     {
       value = rcvbuf;
@@ -544,15 +577,15 @@ void CTransferSocket::OnSend(int nErrorCode)
   {
     if (!m_pBuffer)
     {
-      m_pBuffer = new char[BUFSIZE];
+      m_pBuffer = new char[m_nBufSize];
       m_bufferpos = 0;
 
       m_zlibStream.next_out = (Bytef *)m_pBuffer;
-      m_zlibStream.avail_out = BUFSIZE;
+      m_zlibStream.avail_out = m_nBufSize;
     }
     if (!m_pBuffer2)
     {
-      m_pBuffer2 = new char[BUFSIZE];
+      m_pBuffer2 = new char[m_nBufSize];
 
       m_zlibStream.next_in = (Bytef *)m_pBuffer2;
     }
@@ -566,7 +599,7 @@ void CTransferSocket::OnSend(int nErrorCode)
         if (m_pFile)
         {
           DWORD numread;
-          numread = ReadDataFromFile(m_pBuffer2, BUFSIZE);
+          numread = ReadDataFromFile(m_pBuffer2, m_nBufSize);
           if (numread < 0)
           {
             return;
@@ -576,17 +609,17 @@ void CTransferSocket::OnSend(int nErrorCode)
           m_zlibStream.next_in = (Bytef *)m_pBuffer2;
           m_zlibStream.avail_in = numread;
 
-          if (numread < BUFSIZE)
+          if (numread < m_nBufSize)
             m_pFile = 0;
         }
       }
       if (!m_zlibStream.avail_out)
       {
-        if (m_bufferpos >= BUFSIZE)
+        if (m_bufferpos >= m_nBufSize)
         {
           m_bufferpos = 0;
           m_zlibStream.next_out = (Bytef *)m_pBuffer;
-          m_zlibStream.avail_out = BUFSIZE;
+          m_zlibStream.avail_out = m_nBufSize;
         }
       }
 
@@ -602,17 +635,17 @@ void CTransferSocket::OnSend(int nErrorCode)
         }
       }
 
-      numsend = BUFSIZE;
-      int len = BUFSIZE - m_bufferpos - m_zlibStream.avail_out;
+      numsend = m_nBufSize;
+      int len = m_nBufSize - m_bufferpos - m_zlibStream.avail_out;
       if (!len && !m_pFile)
       {
         break;
       }
 
-      if (len < BUFSIZE)
+      if (len < m_nBufSize)
         numsend = len;
 
-      int nLimit = (int)m_pOwner->GetAbleToTransferSize(CFtpControlSocket::upload, beenWaiting);
+      int nLimit = (int)m_pOwner->GetAbleToTransferSize(CFtpControlSocket::upload, beenWaiting, m_nBufSize);
       if (nLimit != -1 && GetState() != closed && numsend > nLimit)
         numsend = nLimit;
 
@@ -652,7 +685,7 @@ void CTransferSocket::OnSend(int nErrorCode)
       UpdateStatusBar(false);
 
       if (!m_zlibStream.avail_in && !m_pFile && m_zlibStream.avail_out &&
-        m_zlibStream.avail_out + m_bufferpos == BUFSIZE && res == Z_STREAM_END)
+        m_zlibStream.avail_out + m_bufferpos == m_nBufSize && res == Z_STREAM_END)
       {
         CloseOnShutDownOrError(0);
         return;
@@ -675,16 +708,16 @@ void CTransferSocket::OnSend(int nErrorCode)
       return;
     }
     if (!m_pBuffer)
-      m_pBuffer = new char[BUFSIZE];
+      m_pBuffer = new char[m_nBufSize];
 
     int numread;
 
     bool beenWaiting = false;
     _int64 currentBufferSize;
     if (GetState() != closed)
-      currentBufferSize = m_pOwner->GetAbleToTransferSize(CFtpControlSocket::upload, beenWaiting);
+      currentBufferSize = m_pOwner->GetAbleToTransferSize(CFtpControlSocket::upload, beenWaiting, m_nBufSize);
     else
-      currentBufferSize = BUFSIZE;
+      currentBufferSize = m_nBufSize;
 
     if (!currentBufferSize && !m_bufferpos)
     {
@@ -708,7 +741,7 @@ void CTransferSocket::OnSend(int nErrorCode)
     else
       numread = 0;
 
-    DebugAssert((numread+m_bufferpos) <= BUFSIZE);
+    DebugAssert((numread+m_bufferpos) <= m_nBufSize);
     DebugAssert(numread>=0);
     DebugAssert(m_bufferpos>=0);
 
@@ -759,7 +792,7 @@ void CTransferSocket::OnSend(int nErrorCode)
       {
         int pos = numread + m_bufferpos - numsent;
 
-        if (pos < 0 || (numsent + pos) > BUFSIZE)
+        if (pos < 0 || (numsent + pos) > m_nBufSize)
         {
           LogMessage(FZ_LOG_WARNING, L"Index out of range");
           CloseOnShutDownOrError(CSMODE_TRANSFERERROR);
@@ -793,9 +826,9 @@ void CTransferSocket::OnSend(int nErrorCode)
       UpdateStatusBar(false);
 
       if (GetState() != closed)
-        currentBufferSize = m_pOwner->GetAbleToTransferSize(CFtpControlSocket::upload, beenWaiting);
+        currentBufferSize = m_pOwner->GetAbleToTransferSize(CFtpControlSocket::upload, beenWaiting, m_nBufSize);
       else
-        currentBufferSize = BUFSIZE;
+        currentBufferSize = m_nBufSize;
 
       if (m_bufferpos < currentBufferSize)
       {
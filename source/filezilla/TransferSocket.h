@@ -69,6 +69,7 @@ protected:
   BOOL m_bSentClose;
   int m_bufferpos;
   char * m_pBuffer;
+  int m_nBufSize;
 #ifndef MPEXT_NO_ZLIB
   char * m_pBuffer2; // Used by zlib transfers
 #endif
@@ -0,0 +1,991 @@
+/*
+ * Specialised field and group arithmetic for Curve25519 and Ed25519.
+ *
+ * The generic elliptic curve code in sshecc.c works on Bignums, which
+ * makes every curve25519-sha256 key exchange and every ssh-ed25519
+ * signature check cost a lot of modmul/modpow calls. The functions
+ * here do the same maths with fixed-size field elements instead.
+ *
+ * Field elements are represented in radix 2^25.5, i.e. as ten signed
+ * 32-bit limbs of alternately 26 and 25 bits, so that all products
+ * fit in 64 bits. (A radix 2^51 representation would need 128-bit
+ * products, which our 32-bit compilers do not have.)
+ *
+ * The X25519 function is a Montgomery ladder with constant-time
+ * conditional swaps. Multiples of the Ed25519 base point use a table
+ * of precomputed multiples, which is built on first use and read in
+ * constant time. The X25519 public key is derived via the Ed25519
+ * base point, as the two curves are birationally equivalent.
+ *
+ * References:
+ *
+ * Curve25519 (RFC 7748):
+ *   https://tools.ietf.org/html/rfc7748
+ *
+ * Ed25519 (RFC 8032), and the "ref10" implementation in SUPERCOP:
+ *   https://tools.ietf.org/html/rfc8032
+ *
+ * Twisted Edwards curves revisited (extended coordinates):
+ *   https://eprint.iacr.org/2008/522
+ */
+
+#include <string.h>
+
+#include "ssh.h"
+
+#if defined _MSC_VER || defined MPEXT
+typedef __int64 fe_wide;
+#else
+typedef long long fe_wide;
+#endif
+
+typedef int fe[10];
+
+/* ----------------------------------------------------------------------
+ * Field arithmetic modulo p = 2^255 - 19
+ */
+
+/*
+ * Limb i holds bits from ceil(25.5*i) upwards, i.e. even limbs are
+ * 26 bits wide and odd limbs 25 bits wide.
+ */
+#define FE_LIMB_BITS(i) (((i) & 1) ? 25 : 26)
+
+static const int fe_limb_offset[10] = {
+    0, 26, 51, 77, 102, 128, 153, 179, 204, 230
+};
+
+static void fe_0(fe h)
+{
+    memset(h, 0, sizeof(fe));
+}
+
+static void fe_1(fe h)
+{
+    fe_0(h);
+    h[0] = 1;
+}
+
+static void fe_copy(fe h, const fe f)
+{
+    memcpy(h, f, sizeof(fe));
+}
+
+/*
+ * Addition, subtraction and negation do not carry. Their results
+ * may be used as inputs to fe_mul/fe_sq, but not as inputs to
+ * further additions without fe_carry.
+ */
+static void fe_add(fe h, const fe f, const fe g)
+{
+    int i;
+    for (i = 0; i < 10; i++)
+        h[i] = f[i] + g[i];
+}
+
+static void fe_sub(fe h, const fe f, const fe g)
+{
+    int i;
+    for (i = 0; i < 10; i++)
+        h[i] = f[i] - g[i];
+}
+
+static void fe_neg(fe h, const fe f)
+{
+    int i;
+    for (i = 0; i < 10; i++)
+        h[i] = -f[i];
+}
+
+/*
+ * Reduce 64-bit limbs to the canonical limb sizes (up to a small
+ * excess in the second limb). Carries are rounded, so that the
+ * limbs are signed and at most half of their range in magnitude.
+ */
+static void fe_reduce(fe h, fe_wide t[10])
+{
+    fe_wide c;
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        int bits = FE_LIMB_BITS(i);
+        c = (t[i] + ((fe_wide)1 << (bits - 1))) >> bits;
+        t[i] -= c * ((fe_wide)1 << bits);
+        if (i < 9)
+            t[i + 1] += c;
+        else
+            t[0] += c * 19;
+    }
+    c = (t[0] + ((fe_wide)1 << 25)) >> 26;
+    t[0] -= c * ((fe_wide)1 << 26);
+    t[1] += c;
+
+    for (i = 0; i < 10; i++)
+        h[i] = (int)t[i];
+}
+
+static void fe_carry(fe h)
+{
+    fe_wide t[10];
+    int i;
+    for (i = 0; i < 10; i++)
+        t[i] = h[i];
+    fe_reduce(h, t);
+}
+
+/*
+ * h = f * g. The product of limbs i and j has weight 2^(i+j) limbs
+ * up, with an extra factor of 2 when both limbs are 25-bit ones.
+ * Anything above 2^255 wraps around multiplied by 19.
+ */
+static void fe_mul(fe h, const fe f, const fe g)
+{
+    fe_wide t[10];
+    int g19[10];
+    int i, j;
+
+    for (i = 0; i < 10; i++) {
+        g19[i] = 19 * g[i];
+        t[i] = 0;
+    }
+
+    for (i = 0; i < 10; i++) {
+        int fi[2];
+        fi[0] = f[i];
+        fi[1] = (i & 1) ? 2 * f[i] : f[i];
+        for (j = 0; i + j < 10; j++)
+            t[i + j] += (fe_wide)fi[j & 1] * g[j];
+        for (; j < 10; j++)
+            t[i + j - 10] += (fe_wide)fi[j & 1] * g19[j];
+    }
+
+    fe_reduce(h, t);
+}
+
+/* h = f^2, as fe_mul, with each cross product computed once */
+static void fe_sq(fe h, const fe f)
+{
+    fe_wide t[10];
+    int f19[10];
+    int i, j;
+
+    for (i = 0; i < 10; i++) {
+        f19[i] = 19 * f[i];
+        t[i] = 0;
+    }
+
+    for (i = 0; i < 10; i++) {
+        int fi[2];
+        int d = (i & 1) ? 2 * f[i] : f[i];
+        if (2 * i < 10)
+            t[2 * i] += (fe_wide)d * f[i];
+        else
+            t[2 * i - 10] += (fe_wide)d * f19[i];
+        fi[0] = 2 * f[i];
+        fi[1] = 2 * d;
+        for (j = i + 1; i + j < 10; j++)
+            t[i + j] += (fe_wide)fi[j & 1] * f[j];
+        for (; j < 10; j++)
+            t[i + j - 10] += (fe_wide)fi[j & 1] * f19[j];
+    }
+
+    fe_reduce(h, t);
+}
+
+/* h = f^(2^n) */
+static void fe_sqn(fe h, const fe f, int n)
+{
+    int i;
+    fe_sq(h, f);
+    for (i = 1; i < n; i++)
+        fe_sq(h, h);
+}
+
+static void fe_mul_small(fe h, const fe f, int n)
+{
+    fe_wide t[10];
+    int i;
+    for (i = 0; i < 10; i++)
+        t[i] = (fe_wide)f[i] * n;
+    fe_reduce(h, t);
+}
+
+/*
+ * Computes z^(2^250 - 1) as the common part of the exponentiation
+ * chains below, also returning z^11 in z11.
+ */
+static void fe_pow2_250(fe h, fe z11, const fe z)
+{
+    fe t0, t1, t2;
+
+    fe_sq(t0, z);                       /* z^2 */
+    fe_sqn(t1, t0, 2);                  /* z^8 */
+    fe_mul(t1, z, t1);                  /* z^9 */
+    fe_mul(z11, t0, t1);                /* z^11 */
+    fe_sq(t0, z11);                     /* z^22 */
+    fe_mul(t0, t1, t0);                 /* z^(2^5 - 1) */
+    fe_sqn(t1, t0, 5);
+    fe_mul(t0, t1, t0);                 /* z^(2^10 - 1) */
+    fe_sqn(t1, t0, 10);
+    fe_mul(t1, t1, t0);                 /* z^(2^20 - 1) */
+    fe_sqn(t2, t1, 20);
+    fe_mul(t1, t2, t1);                 /* z^(2^40 - 1) */
+    fe_sqn(t1, t1, 10);
+    fe_mul(t0, t1, t0);                 /* z^(2^50 - 1) */
+    fe_sqn(t1, t0, 50);
+    fe_mul(t1, t1, t0);                 /* z^(2^100 - 1) */
+    fe_sqn(t2, t1, 100);
+    fe_mul(t1, t2, t1);                 /* z^(2^200 - 1) */
+    fe_sqn(t1, t1, 50);
+    fe_mul(h, t1, t0);                  /* z^(2^250 - 1) */
+}
+
+/* h = z^(p-2) = 1/z */
+static void fe_invert(fe h, const fe z)
+{
+    fe t, z11;
+    fe_pow2_250(t, z11, z);
+    fe_sqn(t, t, 5);                    /* z^(2^255 - 2^5) */
+    fe_mul(h, t, z11);                  /* z^(2^255 - 21) */
+}
+
+/* h = z^((p-5)/8), used for square roots */
+static void fe_pow22523(fe h, const fe z)
+{
+    fe t, z11;
+    fe_pow2_250(t, z11, z);
+    fe_sqn(t, t, 2);                    /* z^(2^252 - 4) */
+    fe_mul(h, t, z);                    /* z^(2^252 - 3) */
+}
+
+/* Loads 255 bits from little-endian bytes, ignoring the top bit. */
+static void fe_frombytes(fe h, const unsigned char *s)
+{
+    int i, j;
+    for (i = 0; i < 10; i++) {
+        int offset = fe_limb_offset[i];
+        fe_wide v = 0;
+        /* a limb spans at most 5 bytes */
+        for (j = 0; (j < 5) && (offset / 8 + j < 32); j++)
+            v |= (fe_wide)s[offset / 8 + j] << (8 * j);
+        h[i] = (int)((v >> (offset % 8)) & ((1 << FE_LIMB_BITS(i)) - 1));
+    }
+}
+
+/* Stores the fully reduced value as 32 little-endian bytes. */
+static void fe_tobytes(unsigned char *s, const fe f)
+{
+    fe h;
+    int q, i;
+    fe_wide acc;
+    int accbits, pos;
+
+    fe_copy(h, f);
+    fe_carry(h);
+
+    /*
+     * Now |h| < 2^255 + small. Work out whether h >= p, i.e. whether
+     * h + 19 overflows 2^255, and if so subtract p by adding 19 and
+     * dropping the top carry.
+     */
+    q = (19 * h[9] + (1 << 24)) >> 25;
+    for (i = 0; i < 10; i++)
+        q = (h[i] + q) >> FE_LIMB_BITS(i);
+
+    h[0] += 19 * q;
+    for (i = 0; i < 9; i++) {
+        int bits = FE_LIMB_BITS(i);
+        int c = h[i] >> bits;
+        h[i + 1] += c;
+        h[i] -= c * (1 << bits);
+    }
+    h[9] &= (1 << 25) - 1;
+
+    acc = 0;
+    accbits = 0;
+    pos = 0;
+    for (i = 0; i < 10; i++) {
+        acc |= (fe_wide)h[i] << accbits;
+        accbits += FE_LIMB_BITS(i);
+        while (accbits >= 8) {
+            s[pos++] = (unsigned char)(acc & 0xFF);
+            acc >>= 8;
+            accbits -= 8;
+        }
+    }
+    /* 255 bits leave 7 bits for the last byte */
+    s[pos] = (unsigned char)(acc & 0xFF);
+}
+
+static int fe_isnegative(const fe f)
+{
+    unsigned char s[32];
+    fe_tobytes(s, f);
+    return s[0] & 1;
+}
+
+static int fe_isnonzero(const fe f)
+{
+    unsigned char s[32];
+    unsigned char r = 0;
+    int i;
+    fe_tobytes(s, f);
+    for (i = 0; i < 32; i++)
+        r |= s[i];
+    return r != 0;
+}
+
+/* Conditional move and swap, b must be 0 or 1 and is not branched on. */
+static void fe_cmov(fe f, const fe g, unsigned int b)
+{
+    int mask = -(int)b;
+    int i;
+    for (i = 0; i < 10; i++)
+        f[i] ^= (f[i] ^ g[i]) & mask;
+}
+
+static void fe_cswap(fe f, fe g, unsigned int b)
+{
+    int mask = -(int)b;
+    int i;
+    for (i = 0; i < 10; i++) {
+        int x = (f[i] ^ g[i]) & mask;
+        f[i] ^= x;
+        g[i] ^= x;
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * X25519 (RFC 7748)
+ */
+
+void x25519_scalarmult(unsigned char *out, const unsigned char *scalar,
+                       const unsigned char *point)
+{
+    unsigned char e[32];
+    fe x1, x2, z2, x3, z3, a, aa, b, bb, c, d, da, cb, ee, t;
+    unsigned int swap, bit;
+    int pos;
+
+    memcpy(e, scalar, 32);
+    e[0] &= 248;
+    e[31] &= 127;
+    e[31] |= 64;
+
+    fe_frombytes(x1, point);
+    fe_1(x2);
+    fe_0(z2);
+    fe_copy(x3, x1);
+    fe_1(z3);
+
+    swap = 0;
+    for (pos = 254; pos >= 0; pos--) {
+        bit = (e[pos / 8] >> (pos & 7)) & 1;
+        swap ^= bit;
+        fe_cswap(x2, x3, swap);
+        fe_cswap(z2, z3, swap);
+        swap = bit;
+
+        fe_add(a, x2, z2);
+        fe_sq(aa, a);
+        fe_sub(b, x2, z2);
+        fe_sq(bb, b);
+        fe_sub(ee, aa, bb);
+        fe_add(c, x3, z3);
+        fe_sub(d, x3, z3);
+        fe_mul(da, d, a);
+        fe_mul(cb, c, b);
+        fe_add(t, da, cb);
+        fe_sq(x3, t);
+        fe_sub(t, da, cb);
+        fe_sq(t, t);
+        fe_mul(z3, x1, t);
+        fe_mul(x2, aa, bb);
+        fe_mul_small(t, ee, 121665);
+        fe_add(t, aa, t);
+        fe_mul(z2, ee, t);
+    }
+    fe_cswap(x2, x3, swap);
+    fe_cswap(z2, z3, swap);
+
+    fe_invert(z2, z2);
+    fe_mul(x2, x2, z2);
+    fe_tobytes(out, x2);
+
+    smemclr(e, sizeof(e));
+}
+
+/* ----------------------------------------------------------------------
+ * Ed25519 group arithmetic, in extended twisted Edwards coordinates
+ * (X:Y:Z:T) with x = X/Z, y = Y/Z, xy = T/Z.
+ */
+
+typedef struct {
+    fe X, Y, Z, T;
+} ge_p3;
+
+/* Affine point with precomputed y+x, y-x and 2dxy */
+typedef struct {
+    fe yplusx, yminusx, xy2d;
+} ge_precomp;
+
+/* Projective point with precomputed Y+X, Y-X, Z and 2dT */
+typedef struct {
+    fe YplusX, YminusX, Z, T2d;
+} ge_cached;
+
+/* d = -121665/121666 */
+static const fe ed25519_d = {
+    -10913610, 13857413, -15372611, 6949391, 114729,
+    -8787816, -6275908, -3247719, -18696448, -12055116
+};
+
+/* 2d */
+static const fe ed25519_d2 = {
+    -21827239, -5839606, -30745221, 13898782, 229458,
+    15978800, -12551817, -6495438, 29715968, 9444199
+};
+
+/* sqrt(-1) */
+static const fe ed25519_sqrtm1 = {
+    -32595792, -7943725, 9377950, 3500415, 12389472,
+    -272473, -25146209, -2005654, 326686, 11406482
+};
+
+/* The base point, y = 4/5 */
+static const unsigned char ed25519_base_enc[32] = {
+    0x58, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66
+};
+
+static void ge_p3_0(ge_p3 *h)
+{
+    fe_0(h->X);
+    fe_1(h->Y);
+    fe_1(h->Z);
+    fe_0(h->T);
+}
+
+static void ge_precomp_0(ge_precomp *h)
+{
+    fe_1(h->yplusx);
+    fe_1(h->yminusx);
+    fe_0(h->xy2d);
+}
+
+static void ge_p3_to_cached(ge_cached *r, const ge_p3 *p)
+{
+    fe_add(r->YplusX, p->Y, p->X);
+    fe_carry(r->YplusX);
+    fe_sub(r->YminusX, p->Y, p->X);
+    fe_carry(r->YminusX);
+    fe_copy(r->Z, p->Z);
+    fe_mul(r->T2d, p->T, ed25519_d2);
+}
+
+/*
+ * Completes an addition or doubling from E, F, G, H
+ * ("add-2008-hwcd-3" and "dbl-2008-hwcd" formulas).
+ */
+static void ge_p3_from_efgh(ge_p3 *r, const fe e, const fe f,
+                            const fe g, const fe h)
+{
+    fe_mul(r->X, e, f);
+    fe_mul(r->Y, g, h);
+    fe_mul(r->T, e, h);
+    fe_mul(r->Z, f, g);
+}
+
+/* r = p + q */
+static void ge_add(ge_p3 *r, const ge_p3 *p, const ge_cached *q)
+{
+    fe a, b, c, d, e, f, g, h;
+
+    fe_sub(a, p->Y, p->X);
+    fe_mul(a, a, q->YminusX);
+    fe_add(b, p->Y, p->X);
+    fe_mul(b, b, q->YplusX);
+    fe_mul(c, p->T, q->T2d);
+    fe_mul(d, p->Z, q->Z);
+    fe_add(d, d, d);
+    fe_carry(d);
+    fe_sub(e, b, a);
+    fe_sub(f, d, c);
+    fe_add(g, d, c);
+    fe_add(h, b, a);
+    ge_p3_from_efgh(r, e, f, g, h);
+}
+
+/* r = p + q, with q affine */
+static void ge_madd(ge_p3 *r, const ge_p3 *p, const ge_precomp *q)
+{
+    fe a, b, c, d, e, f, g, h;
+
+    fe_sub(a, p->Y, p->X);
+    fe_mul(a, a, q->yminusx);
+    fe_add(b, p->Y, p->X);
+    fe_mul(b, b, q->yplusx);
+    fe_mul(c, p->T, q->xy2d);
+    fe_add(d, p->Z, p->Z);
+    fe_carry(d);
+    fe_sub(e, b, a);
+    fe_sub(f, d, c);
+    fe_add(g, d, c);
+    fe_add(h, b, a);
+    ge_p3_from_efgh(r, e, f, g, h);
+}
+
+/* r = 2p */
+static void ge_double(ge_p3 *r, const ge_p3 *p)
+{
+    fe a, b, c, e, f, g, h;
+
+    fe_sq(a, p->X);
+    fe_sq(b, p->Y);
+    fe_sq(c, p->Z);
+    fe_add(c, c, c);
+    fe_carry(c);
+    fe_add(e, p->X, p->Y);
+    fe_sq(e, e);
+    fe_sub(e, e, a);
+    fe_sub(e, e, b);
+    fe_carry(e);
+    fe_sub(g, b, a);
+    fe_carry(g);
+    fe_sub(f, g, c);
+    fe_add(h, a, b);
+    fe_neg(h, h);
+    ge_p3_from_efgh(r, e, f, g, h);
+}
+
+static void ge_tobytes(unsigned char *s, const ge_p3 *h)
+{
+    fe recip, x, y;
+
+    fe_invert(recip, h->Z);
+    fe_mul(x, h->X, recip);
+    fe_mul(y, h->Y, recip);
+    fe_tobytes(s, y);
+    s[31] ^= fe_isnegative(x) << 7;
+}
+
+static void ge_affine(unsigned char *xs, unsigned char *ys, const ge_p3 *h)
+{
+    fe recip, x, y;
+
+    fe_invert(recip, h->Z);
+    fe_mul(x, h->X, recip);
+    fe_mul(y, h->Y, recip);
+    fe_tobytes(xs, x);
+    fe_tobytes(ys, y);
+}
+
+/*
+ * Decodes a point (RFC 8032, 5.1.3). Returns 0 if the encoding is
+ * not a point on the curve.
+ */
+static int ge_frombytes(ge_p3 *h, const unsigned char *s)
+{
+    fe u, v, v3, vxx, check;
+    int ret = 1;
+
+    fe_frombytes(h->Y, s);
+    fe_1(h->Z);
+    fe_sq(u, h->Y);
+    fe_mul(v, u, ed25519_d);
+    fe_sub(u, u, h->Z);                 /* u = y^2 - 1 */
+    fe_add(v, v, h->Z);                 /* v = dy^2 + 1 */
+    fe_carry(u);
+    fe_carry(v);
+
+    fe_sq(v3, v);
+    fe_mul(v3, v3, v);                  /* v3 = v^3 */
+    fe_sq(h->X, v3);
+    fe_mul(h->X, h->X, v);
+    fe_mul(h->X, h->X, u);              /* x = uv^7 */
+
+    fe_pow22523(h->X, h->X);            /* x = (uv^7)^((q-5)/8) */
+    fe_mul(h->X, h->X, v3);
+    fe_mul(h->X, h->X, u);              /* x = uv^3(uv^7)^((q-5)/8) */
+
+    fe_sq(vxx, h->X);
+    fe_mul(vxx, vxx, v);
+    fe_sub(check, vxx, u);              /* vx^2 - u */
+    if (fe_isnonzero(check)) {
+        fe_add(check, vxx, u);          /* vx^2 + u */
+        if (fe_isnonzero(check))
+            ret = 0;
+        else
+            fe_mul(h->X, h->X, ed25519_sqrtm1);
+    }
+
+    if (ret) {
+        if (fe_isnegative(h->X) != (s[31] >> 7)) {
+            if (!fe_isnonzero(h->X))
+                ret = 0;                /* x = 0 cannot be negative */
+            else
+                fe_neg(h->X, h->X);
+        }
+        fe_carry(h->X);
+        fe_mul(h->T, h->X, h->Y);
+    }
+
+    return ret;
+}
+
+/* ----------------------------------------------------------------------
+ * Fixed-base multiplication: ed25519_base_table[i][j] = (j+1) 256^i B
+ */
+
+static ge_precomp ed25519_base_table[32][8];
+static volatile int ed25519_base_table_ready = 0;
+
+static void ge_p3_to_precomp(ge_precomp *r, const ge_p3 *p)
+{
+    fe recip, x, y;
+
+    fe_invert(recip, p->Z);
+    fe_mul(x, p->X, recip);
+    fe_mul(y, p->Y, recip);
+    fe_add(r->yplusx, y, x);
+    fe_carry(r->yplusx);
+    fe_sub(r->yminusx, y, x);
+    fe_carry(r->yminusx);
+    fe_mul(r->xy2d, x, y);
+    fe_mul(r->xy2d, r->xy2d, ed25519_d2);
+}
+
+static void ed25519_init_base_table(void)
+{
+    /*
+     * Building the table twice from several threads at once is
+     * harmless, as they all store the same values.
+     */
+    if (!ed25519_base_table_ready) {
+        ge_p3 base, p, q;
+        ge_cached c;
+        int i, j, k;
+
+        ge_frombytes(&base, ed25519_base_enc);
+        for (i = 0; i < 32; i++) {
+            /* base = 256^i B */
+            ge_p3_to_cached(&c, &base);
+            p = base;
+            for (j = 0; j < 8; j++) {
+                ge_p3_to_precomp(&ed25519_base_table[i][j], &p);
+                ge_add(&q, &p, &c);
+                p = q;
+            }
+            for (k = 0; k < 8; k++) {
+                ge_double(&q, &base);
+                base = q;
+            }
+        }
+        ed25519_base_table_ready = 1;
+    }
+}
+
+static unsigned int ct_equal(int b, int c)
+{
+    unsigned int x = (unsigned int)(b ^ c);
+    return ((x - 1) >> 31) & 1; /* x is at most 8 */
+}
+
+/* t = b * 256^pos B, for -8 <= b <= 8, reading all table entries */
+static void ge_select(ge_precomp *t, int pos, int b)
+{
+    ge_precomp minust;
+    unsigned int bnegative = ((unsigned int)b >> 31) & 1;
+    int babs = b - ((-(int)bnegative & b) * 2);
+    int j;
+
+    ge_precomp_0(t);
+    for (j = 0; j < 8; j++) {
+        const ge_precomp *e = &ed25519_base_table[pos][j];
+        unsigned int eq = ct_equal(babs, j + 1);
+        fe_cmov(t->yplusx, e->yplusx, eq);
+        fe_cmov(t->yminusx, e->yminusx, eq);
+        fe_cmov(t->xy2d, e->xy2d, eq);
+    }
+    fe_copy(minust.yplusx, t->yminusx);
+    fe_copy(minust.yminusx, t->yplusx);
+    fe_neg(minust.xy2d, t->xy2d);
+    fe_cmov(t->yplusx, minust.yplusx, bnegative);
+    fe_cmov(t->yminusx, minust.yminusx, bnegative);
+    fe_cmov(t->xy2d, minust.xy2d, bnegative);
+}
+
+/* h = a B, where a < 2^255 is given as 32 little-endian bytes */
+static void ge_scalarmult_base(ge_p3 *h, const unsigned char *a)
+{
+    signed char e[64];
+    int carry, i;
+    ge_precomp t;
+    ge_p3 r;
+
+    ed25519_init_base_table();
+
+    /* Signed radix-16 digits, -8 <= e[i] < 8 (e[63] <= 8) */
+    for (i = 0; i < 32; i++) {
+        e[2 * i + 0] = (a[i] >> 0) & 15;
+        e[2 * i + 1] = (a[i] >> 4) & 15;
+    }
+    carry = 0;
+    for (i = 0; i < 63; i++) {
+        e[i] += carry;
+        carry = (e[i] + 8) >> 4;
+        e[i] -= carry * 16;
+    }
+    e[63] += carry;
+
+    ge_p3_0(h);
+    for (i = 1; i < 64; i += 2) {
+        ge_select(&t, i / 2, e[i]);
+        ge_madd(&r, h, &t);
+        *h = r;
+    }
+
+    for (i = 0; i < 4; i++) {
+        ge_double(&r, h);
+        *h = r;
+    }
+
+    for (i = 0; i < 64; i += 2) {
+        ge_select(&t, i / 2, e[i]);
+        ge_madd(&r, h, &t);
+        *h = r;
+    }
+
+    smemclr(e, sizeof(e));
+}
+
+/*
+ * h = a P, for public a and P only (not constant time), with a
+ * given as 32 little-endian bytes. Uses a fixed 4-bit window.
+ */
+static void ge_scalarmult_vartime(ge_p3 *h, const unsigned char *a,
+                                  const ge_p3 *p)
+{
+    ge_cached table[16];
+    ge_p3 multiple, r;
+    int i, j;
+
+    ge_p3_0(&multiple);
+    for (i = 0; i < 16; i++) {
+        ge_p3_to_cached(&table[i], &multiple);
+        if (i < 15) {
+            ge_cached pc;
+            ge_p3_to_cached(&pc, p);
+            ge_add(&r, &multiple, &pc);
+            multiple = r;
+        }
+    }
+
+    ge_p3_0(h);
+    for (i = 63; i >= 0; i--) {
+        int nibble = (a[i / 2] >> ((i & 1) * 4)) & 15;
+        for (j = 0; j < 4; j++) {
+            ge_double(&r, h);
+            *h = r;
+        }
+        if (nibble) {
+            ge_add(&r, h, &table[nibble]);
+            *h = r;
+        }
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Exposed interface
+ */
+
+/*
+ * The X25519 public key for a private scalar, i.e. the u coordinate
+ * of scalar * (u = 9). Computed as the Montgomery form of the
+ * corresponding Ed25519 base point multiple: u = (1 + y) / (1 - y).
+ */
+void x25519_scalarmult_base(unsigned char *out, const unsigned char *scalar)
+{
+    unsigned char e[32];
+    ge_p3 h;
+    fe zplusy, zminusy;
+
+    memcpy(e, scalar, 32);
+    e[0] &= 248;
+    e[31] &= 127;
+    e[31] |= 64;
+
+    ge_scalarmult_base(&h, e);
+    fe_add(zplusy, h.Z, h.Y);
+    fe_sub(zminusy, h.Z, h.Y);
+    fe_invert(zminusy, zminusy);
+    fe_mul(zplusy, zplusy, zminusy);
+    fe_tobytes(out, zplusy);
+
+    smemclr(e, sizeof(e));
+}
+
+/*
+ * Affine coordinates of scalar * B on Ed25519, all values being 32
+ * little-endian bytes. The scalar must be less than 2^255.
+ */
+void ed25519_scalarmult_base(unsigned char *x, unsigned char *y,
+                             const unsigned char *scalar)
+{
+    ge_p3 h;
+    ge_scalarmult_base(&h, scalar);
+    ge_affine(x, y, &h);
+}
+
+/*
+ * Checks the Ed25519 verification equation, encode(sB - hA) == R,
+ * with s and h already reduced modulo the group order. Returns 0
+ * for a mismatch and for an invalid public key encoding.
+ */
+int ed25519_verify_equation(const unsigned char *R, const unsigned char *A,
+                            const unsigned char *s, const unsigned char *h)
+{
+    ge_p3 a, sb, ha, r;
+    ge_cached c;
+    unsigned char check[32];
+    int ret = 0;
+
+    if (ge_frombytes(&a, A)) {
+        fe_neg(a.X, a.X);
+        fe_neg(a.T, a.T);               /* a = -A */
+        ge_scalarmult_vartime(&ha, h, &a);
+        ge_scalarmult_base(&sb, s);
+        ge_p3_to_cached(&c, &ha);
+        ge_add(&r, &sb, &c);
+        ge_tobytes(check, &r);
+        ret = !memcmp(check, R, 32);
+    }
+
+    return ret;
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+void smemclr(void *b, size_t len)
+{
+    memset(b, 0, len);
+}
+
+static void fromhex(unsigned char *out, const char *hex)
+{
+    int i;
+    for (i = 0; hex[2 * i]; i++) {
+        unsigned int v;
+        sscanf(hex + 2 * i, "%2x", &v);
+        out[i] = (unsigned char)v;
+    }
+}
+
+static int check(const char *name, const unsigned char *got,
+                 const char *expected)
+{
+    unsigned char exp[32];
+    int i;
+
+    fromhex(exp, expected);
+    if (memcmp(got, exp, 32)) {
+        printf("%s: failed\n  got      ", name);
+        for (i = 0; i < 32; i++)
+            printf("%02x", got[i]);
+        printf("\n  expected %s\n", expected);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    unsigned char scalar[32], point[32], out[32], x[32], y[32];
+    unsigned char R[32], A[32], s[32], h[32];
+    int errors = 0;
+    int i, n;
+    clock_t start;
+    double secs;
+
+    /* RFC 7748, 5.2 */
+    fromhex(scalar, "a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4");
+    fromhex(point, "e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c");
+    x25519_scalarmult(out, scalar, point);
+    errors += check("x25519 #1", out,
+                    "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552");
+
+    fromhex(scalar, "4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d");
+    fromhex(point, "e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493");
+    x25519_scalarmult(out, scalar, point);
+    errors += check("x25519 #2", out,
+                    "95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957");
+
+    /* RFC 7748, 6.1 */
+    fromhex(scalar, "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a");
+    x25519_scalarmult_base(out, scalar);
+    errors += check("x25519 base (Alice)", out,
+                    "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a");
+    memset(point, 0, sizeof(point));
+    point[0] = 9;
+    x25519_scalarmult(out, scalar, point);
+    errors += check("x25519 ladder (Alice)", out,
+                    "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a");
+    fromhex(point, "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f");
+    x25519_scalarmult(out, scalar, point);
+    errors += check("x25519 shared secret", out,
+                    "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742");
+
+    /*
+     * RFC 8032, 7.1, TEST 1: the public key from the clamped hash of
+     * the secret key, and the verification equation, with h reduced
+     * modulo the group order in advance.
+     */
+    fromhex(scalar, "307c83864f2833cb427a2ef1c00a013cfdff2768d980c0a3a520f006904de94f");
+    ed25519_scalarmult_base(x, y, scalar);
+    y[31] ^= (x[0] & 1) << 7;
+    errors += check("ed25519 public key", y,
+                    "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a");
+
+    fromhex(R, "e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e06522490155");
+    fromhex(A, "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a");
+    fromhex(s, "5fb8821590a33bacc61e39701cf9b46bd25bf5f0595bbe24655141438e7a100b");
+    fromhex(h, "86eabc8e4c96193d290504e7c600df6cf8d8256131ec2c138a3e7e162e525404");
+    if (!ed25519_verify_equation(R, A, s, h)) {
+        printf("ed25519 verify: failed\n");
+        errors++;
+    }
+    s[0] ^= 1;
+    if (ed25519_verify_equation(R, A, s, h)) {
+        printf("ed25519 verify of a bad signature: succeeded\n");
+        errors++;
+    }
+
+    printf("%d errors\n", errors);
+
+    /* Benchmark of the key exchange part of a handshake */
+    n = 1000;
+    start = clock();
+    for (i = 0; i < n; i++) {
+        scalar[i % 32] ^= (unsigned char)i;
+        x25519_scalarmult_base(point, scalar);
+        x25519_scalarmult(out, scalar, point);
+    }
+    secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("curve25519 key exchanges: %.0f per second\n", n / secs);
+
+    start = clock();
+    for (i = 0; i < n; i++)
+        ed25519_verify_equation(R, A, s, h);
+    secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("ed25519 verifications: %.0f per second\n", n / secs);
+
+    return errors ? 1 : 0;
+}
+
+#endif
@@ -8,6 +8,10 @@
  *       Montgomery form curves are supported for DH. (Curve25519)
  *
  *       Edwards form curves are supported for DSA. (Ed25519)
+ *
+ *       The Curve25519 key exchange, Ed25519 signature verification
+ *       and multiples of the Ed25519 base point are done by the
+ *       specialised field arithmetic in ssh25519.c instead.
  */
 
 /*
@@ -1400,6 +1404,33 @@ static Bignum *ecp_edx(const struct ec_curve *curve, const Bignum y)
     return x;
 }
 
+/* ----------------------------------------------------------------------
+ * a*B on Ed25519, using the precomputed multiples of the base point
+ */
+
+static struct ec_point *ecp_mul_ed25519_base(const struct ec_curve *curve,
+                                             const Bignum a)
+{
+    unsigned char scalar[32], x[32], y[32];
+    Bignum reduced;
+    int i;
+
+    assert(curve->type == EC_EDWARDS && curve->fieldBits == 256);
+
+    /* B has order l, and the table needs a scalar below 2^255 */
+    reduced = bigmod(a, curve->e.l);
+    for (i = 0; i < 32; ++i) {
+        scalar[i] = bignum_byte(reduced, i);
+    }
+    freebn(reduced);
+
+    ed25519_scalarmult_base(x, y, scalar);
+    smemclr(scalar, sizeof(scalar));
+
+    return ec_point_new(curve, bignum_from_bytes_le(x, 32),
+                        bignum_from_bytes_le(y, 32), NULL, 0);
+}
+
 /* ----------------------------------------------------------------------
  * Public point from private
  */
@@ -1436,7 +1467,7 @@ struct ec_point *ec_public(const Bignum privateKey, const struct ec_curve *curve
         /* Chop off the top part and convert to int */
         a = bignum_from_bytes_le(hash, 32);
 
-        ret = ecp_mul(&curve->e.B, a);
+        ret = ecp_mul_ed25519_base(curve, a);
         freebn(a);
         return ret;
     } else {
@@ -2270,8 +2301,9 @@ static int ecdsa_verifysig(void *key, const char *sig, int siglen,
     getstring(&sig, &siglen, &p, &slen);
     if (!p) return 0;
     if (ec->publicKey.curve->type == EC_EDWARDS) {
-        struct ec_point *r;
         Bignum s, h;
+        unsigned char pk[32], sbytes[32], hbytes[32];
+        int i, pointlen;
 
         /* Check that the signature is two times the length of a point */
         if (slen != (ec->publicKey.curve->fieldBits / 8) * 2) {
@@ -2282,40 +2314,35 @@ static int ecdsa_verifysig(void *key, const char *sig, int siglen,
         if (ec->publicKey.curve->fieldBits != 256) {
             return 0;
         }
+        pointlen = ec->publicKey.curve->fieldBits / 8;
 
-        /* Get the signature */
-        r = ec_point_new(ec->publicKey.curve, NULL, NULL, NULL, 0);
-        if (!r) {
-            return 0;
+        /* Encode pk */
+        for (i = 0; i < pointlen - 1; ++i) {
+            pk[i] = bignum_byte(ec->publicKey.y, i);
         }
-        if (!decodepoint(p, ec->publicKey.curve->fieldBits / 8, r)) {
-            ec_point_free(r);
+        /* Unset last bit of y and set first bit of x in its place */
+        pk[i] = bignum_byte(ec->publicKey.y, i) & 0x7f;
+        pk[i] |= bignum_bit(ec->publicKey.x, 0) << 7;
+
+        /* Get the signature, s has to be reduced */
+        s = bignum_from_bytes_le((unsigned char*)p + pointlen, pointlen);
+        if (bignum_cmp(s, ec->publicKey.curve->e.l) >= 0) {
+            freebn(s);
             return 0;
         }
-        s = bignum_from_bytes_le((unsigned char*)p + (ec->publicKey.curve->fieldBits / 8),
-                                 ec->publicKey.curve->fieldBits / 8);
 
         /* Get the hash of the encoded value of R + encoded value of pk + message */
         {
-            int i, pointlen;
-            unsigned char b;
             unsigned char digest[512 / 8];
+            Bignum tmp;
             SHA512_State hs;
             SHA512_Init(&hs);
 
             /* Add encoded r (no need to encode it again, it was in the signature) */
-            SHA512_Bytes(&hs, p, ec->publicKey.curve->fieldBits / 8);
+            SHA512_Bytes(&hs, p, pointlen);
 
-            /* Encode pk and add it */
-            pointlen = ec->publicKey.curve->fieldBits / 8;
-            for (i = 0; i < pointlen - 1; ++i) {
-                b = bignum_byte(ec->publicKey.y, i);
-                SHA512_Bytes(&hs, &b, 1);
-            }
-            /* Unset last bit of y and set first bit of x in its place */
-            b = bignum_byte(ec->publicKey.y, i) & 0x7f;
-            b |= bignum_bit(ec->publicKey.x, 0) << 7;
-            SHA512_Bytes(&hs, &b, 1);
+            /* Add encoded pk */
+            SHA512_Bytes(&hs, pk, pointlen);
 
             /* Add the message itself */
             SHA512_Bytes(&hs, data, datalen);
@@ -2324,49 +2351,20 @@ static int ecdsa_verifysig(void *key, const char *sig, int siglen,
             SHA512_Final(&hs, digest);
 
             /* Convert to Bignum */
-            h = bignum_from_bytes_le(digest, sizeof(digest));
+            tmp = bignum_from_bytes_le(digest, sizeof(digest));
+            h = bigmod(tmp, ec->publicKey.curve->e.l);
+            freebn(tmp);
         }
 
-        /* Verify sB == r + h*publicKey */
-        {
-            struct ec_point *lhs, *rhs, *tmp;
-
-            /* lhs = sB */
-            lhs = ecp_mul(&ec->publicKey.curve->e.B, s);
-            freebn(s);
-            if (!lhs) {
-                ec_point_free(r);
-                freebn(h);
-                return 0;
-            }
-
-            /* rhs = r + h*publicKey */
-            tmp = ecp_mul(&ec->publicKey, h);
-            freebn(h);
-            if (!tmp) {
-                ec_point_free(lhs);
-                ec_point_free(r);
-                return 0;
-            }
-            rhs = ecp_add(r, tmp, 0);
-            ec_point_free(r);
-            ec_point_free(tmp);
-            if (!rhs) {
-                ec_point_free(lhs);
-                return 0;
-            }
-
-            /* Check the point is the same */
-            ret = !bignum_cmp(lhs->x, rhs->x);
-            if (ret) {
-                ret = !bignum_cmp(lhs->y, rhs->y);
-                if (ret) {
-                    ret = 1;
-                }
-            }
-            ec_point_free(lhs);
-            ec_point_free(rhs);
+        /* Verify sB == r + h*publicKey, i.e. r == sB - h*publicKey */
+        for (i = 0; i < pointlen; ++i) {
+            sbytes[i] = bignum_byte(s, i);
+            hbytes[i] = bignum_byte(h, i);
         }
+        freebn(s);
+        freebn(h);
+        ret = ed25519_verify_equation((const unsigned char *)p, pk,
+                                      sbytes, hbytes);
     } else {
         Bignum r, s;
         unsigned char digest[512 / 8];
@@ -2455,7 +2453,7 @@ static unsigned char *ecdsa_sign(void *key, const char *data, int datalen,
             SHA512_Final(&hs, hash);
 
             r = bignum_from_bytes_le(hash, 512/8);
-            rp = ecp_mul(&ec->publicKey.curve->e.B, r);
+            rp = ecp_mul_ed25519_base(ec->publicKey.curve, r);
             if (!rp) {
                 freebn(r);
                 freebn(a);
@@ -2696,34 +2694,6 @@ static Bignum ecdh_calculate(const Bignum private,
     ret = p->x;
     p->x = NULL;
 
-    if (p->curve->type == EC_MONTGOMERY) {
-        /*
-         * Endianness-swap. The Curve25519 algorithm definition
-         * assumes you were doing your computation in arrays of 32
-         * little-endian bytes, and now specifies that you take your
-         * final one of those and convert it into a bignum in
-         * _network_ byte order, i.e. big-endian.
-         *
-         * In particular, the spec says, you convert the _whole_ 32
-         * bytes into a bignum. That is, on the rare occasions that
-         * p->x has come out with the most significant 8 bits zero, we
-         * have to imagine that being represented by a 32-byte string
-         * with the last byte being zero, so that has to be converted
-         * into an SSH-2 bignum with the _low_ byte zero, i.e. a
-         * multiple of 256.
-         */
-        int i;
-        int bytes = (p->curve->fieldBits+7) / 8;
-        unsigned char *byteorder = snewn(bytes, unsigned char);
-        for (i = 0; i < bytes; ++i) {
-            byteorder[i] = bignum_byte(ret, i);
-        }
-        freebn(ret);
-        ret = bignum_from_bytes(byteorder, bytes);
-        smemclr(byteorder, bytes);
-        sfree(byteorder);
-    }
-
     ec_point_free(p);
     return ret;
 }
@@ -2751,6 +2721,7 @@ void *ssh_ecdhkex_newkey(const struct ssh_kex *kex)
 
     if (curve->type == EC_MONTGOMERY) {
         unsigned char bytes[32] = {0};
+        unsigned char point[32];
         int i;
 
         for (i = 0; i < sizeof(bytes); ++i)
@@ -2760,25 +2731,17 @@ void *ssh_ecdhkex_newkey(const struct ssh_kex *kex)
         bytes[0] &= 248;
         bytes[31] &= 127;
         bytes[31] |= 64;
-        key->privateKey = bignum_from_bytes(bytes, sizeof(bytes));
-        for (i = 0; i < sizeof(bytes); ++i)
-        {
-            ((volatile char*)bytes)[i] = 0;
-        }
+        key->privateKey = bignum_from_bytes_le(bytes, sizeof(bytes));
         if (!key->privateKey) {
+            smemclr(bytes, sizeof(bytes));
             sfree(key);
             return NULL;
         }
-        publicKey = ecp_mul(&key->publicKey.curve->m.G, key->privateKey);
-        if (!publicKey) {
-            freebn(key->privateKey);
-            sfree(key);
-            return NULL;
-        }
-        key->publicKey.x = publicKey->x;
-        key->publicKey.y = publicKey->y;
+        x25519_scalarmult_base(point, bytes);
+        smemclr(bytes, sizeof(bytes));
+        key->publicKey.x = bignum_from_bytes_le(point, sizeof(point));
+        key->publicKey.y = NULL;
         key->publicKey.z = NULL;
-        sfree(publicKey);
     } else {
         key->privateKey = bignum_random_in_range(One, key->publicKey.curve->w.n);
         if (!key->privateKey) {
@@ -2845,22 +2808,52 @@ Bignum ssh_ecdhkex_getkey(void *key, char *remoteKey, int remoteKeyLen)
         if (!decodepoint(remoteKey, remoteKeyLen, &remote)) {
             return NULL;
         }
+
+        ret = ecdh_calculate(ec->privateKey, &remote);
+        if (remote.x) freebn(remote.x);
+        if (remote.y) freebn(remote.y);
     } else {
+        unsigned char scalar[32], shared[32];
+        unsigned char nonzero;
+        int i;
+
         /* Point length has to be the same length */
-        if (remoteKeyLen != (bignum_bitcount(ec->publicKey.curve->p) + 7) / 8) {
+        if (remoteKeyLen != sizeof(shared)) {
             return NULL;
         }
 
-        remote.curve = ec->publicKey.curve;
-        remote.infinity = 0;
-        remote.x = bignum_from_bytes_le((unsigned char*)remoteKey, remoteKeyLen);
-        remote.y = NULL;
-        remote.z = NULL;
+        for (i = 0; i < sizeof(scalar); ++i) {
+            scalar[i] = bignum_byte(ec->privateKey, i);
+        }
+        x25519_scalarmult(shared, scalar, (const unsigned char *)remoteKey);
+        smemclr(scalar, sizeof(scalar));
+
+        /*
+         * Endianness-swap. The Curve25519 algorithm definition
+         * assumes you were doing your computation in arrays of 32
+         * little-endian bytes, and now specifies that you take your
+         * final one of those and convert it into a bignum in
+         * _network_ byte order, i.e. big-endian.
+         *
+         * In particular, the spec says, you convert the _whole_ 32
+         * bytes into a bignum. That is, on the rare occasions that
+         * the result has come out with the most significant 8 bits
+         * zero, we have to imagine that being represented by a
+         * 32-byte string with the last byte being zero, so that has
+         * to be converted into an SSH-2 bignum with the _low_ byte
+         * zero, i.e. a multiple of 256.
+         *
+         * An all-zero result means the peer sent a point of small
+         * order, and the exchange has to be aborted.
+         */
+        nonzero = 0;
+        for (i = 0; i < sizeof(shared); ++i) {
+            nonzero |= shared[i];
+        }
+        ret = nonzero ? bignum_from_bytes(shared, sizeof(shared)) : NULL;
+        smemclr(shared, sizeof(shared));
     }
 
-    ret = ecdh_calculate(ec->privateKey, &remote);
-    if (remote.x) freebn(remote.x);
-    if (remote.y) freebn(remote.y);
     return ret;
 }
 
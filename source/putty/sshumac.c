@@ -0,0 +1,596 @@
+/*
+ * UMAC message authentication for SSH-2, as the OpenSSH extensions
+ * umac-64@openssh.com and umac-128@openssh.com (and their
+ * encrypt-then-MAC variants).
+ *
+ * UMAC spec (RFC 4418):
+ *   https://tools.ietf.org/html/rfc4418
+ *
+ * OpenSSH usage:
+ *   https://cvsweb.openbsd.org/src/usr.bin/ssh/PROTOCOL
+ *
+ * UMAC hashes the message with a universal hash (NH, then a
+ * polynomial hash, then an inner product hash) and encrypts the
+ * result with a pad generated by AES from a nonce. The universal
+ * hash costs a couple of 32x32 bit multiplications per 8 bytes of
+ * message, which is a lot cheaper than running the message through
+ * SHA-1 or SHA-256 twice as HMAC does.
+ *
+ * In SSH the nonce is the packet sequence number as a 64-bit
+ * big-endian integer, and the MAC is computed over the packet alone.
+ * The partial-packet interface in struct ssh_mac passes the sequence
+ * number as the first four bytes of data, as it does for HMAC, so
+ * those bytes are taken as the nonce here.
+ *
+ * Only the 64-bit polynomial hash is implemented. RFC 4418 switches
+ * to a 128-bit one for messages over 2 MB, which is far more than an
+ * SSH packet can hold.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "ssh.h"
+
+#if defined _MSC_VER || defined MPEXT
+typedef unsigned __int64 umac_u64;
+#else
+typedef unsigned long long umac_u64;
+#endif
+
+#define UMAC_U64(hi, lo) (((umac_u64)(hi) << 32) | (lo))
+
+#define UMAC_L1_KEY_LEN 1024	       /* bytes hashed by NH per chunk */
+#define UMAC_NH_BLOCK 32	       /* bytes NH consumes at once */
+#define UMAC_MAX_STREAMS 4	       /* UMAC-128 has four 32-bit words */
+#define UMAC_MAX_MESSAGE (1 << 21)     /* limit of the 64-bit poly hash */
+
+/* p64 = 2^64 - 59 and p36 = 2^36 - 5 */
+#define UMAC_P64_OFFSET 59
+#define UMAC_P64 (~(umac_u64)0 - (UMAC_P64_OFFSET - 1))
+#define UMAC_P36 (UMAC_U64(0xF, 0xFFFFFFFB))
+#define UMAC_MASK36 (UMAC_U64(0xF, 0xFFFFFFFF))
+
+struct umac_ctx {
+    int streams;		       /* tag length in 32-bit words */
+    void *pdf;			       /* AES keyed for the pad */
+
+    /* Keys derived from the MAC key */
+    word32 l1key[UMAC_L1_KEY_LEN / 4 + 4 * (UMAC_MAX_STREAMS - 1)];
+    umac_u64 l2key[UMAC_MAX_STREAMS];
+    umac_u64 l3key1[UMAC_MAX_STREAMS][8];
+    word32 l3key2[UMAC_MAX_STREAMS];
+
+    /* The message being hashed */
+    unsigned char nonce[8];
+    int noncelen;		       /* sequence bytes still to come */
+    unsigned char buf[UMAC_NH_BLOCK];
+    int buflen;
+    int chunkpos;		       /* bytes of current chunk in nh[] */
+    int chunks;			       /* chunks finished before this one */
+    umac_u64 nh[UMAC_MAX_STREAMS];
+    umac_u64 last[UMAC_MAX_STREAMS];   /* L1 hash of previous chunk */
+    umac_u64 poly[UMAC_MAX_STREAMS];
+
+    /* Pad of the last nonce, which UMAC-64 can use twice */
+    unsigned char pdfnonce[8];
+    unsigned char pdfblock[16];
+    int pdfvalid;
+};
+
+/* ----------------------------------------------------------------------
+ * Key derivation and pad generation, both made from AES-128.
+ */
+
+static void umac_aes_block(void *aes, const unsigned char *in,
+			   unsigned char *out)
+{
+    static const unsigned char zero_iv[16] = { 0 };
+
+    /* One block of CBC with a zero IV is a plain AES encryption */
+    memcpy(out, in, 16);
+    aes_iv(aes, (unsigned char *)zero_iv);
+    aes_ssh2_encrypt_blk(aes, out, 16);
+}
+
+static void umac_kdf(void *aes, int index, unsigned char *out, int len)
+{
+    unsigned char in[16], block[16];
+    word32 i;
+
+    memset(in, 0, sizeof(in));
+    PUT_32BIT_MSB_FIRST(in + 4, index);
+    for (i = 1; len > 0; i++) {
+	PUT_32BIT_MSB_FIRST(in + 12, i);
+	umac_aes_block(aes, in, block);
+	memcpy(out, block, len < 16 ? len : 16);
+	out += 16;
+	len -= 16;
+    }
+    smemclr(block, sizeof(block));
+}
+
+static void umac_pad(struct umac_ctx *ctx, const unsigned char *nonce,
+		     unsigned char *pad)
+{
+    unsigned char in[16];
+    int index = 0;
+
+    memset(in, 0, sizeof(in));
+    memcpy(in, nonce, 8);
+    if (ctx->streams == 2) {
+	/* UMAC-64 uses either half of the block for a pair of nonces */
+	index = in[7] & 1;
+	in[7] &= ~1;
+    }
+
+    if (!ctx->pdfvalid || memcmp(ctx->pdfnonce, in, 8)) {
+	umac_aes_block(ctx->pdf, in, ctx->pdfblock);
+	memcpy(ctx->pdfnonce, in, 8);
+	ctx->pdfvalid = TRUE;
+    }
+    memcpy(pad, ctx->pdfblock + index * ctx->streams * 4,
+	   ctx->streams * 4);
+}
+
+/* ----------------------------------------------------------------------
+ * The universal hash.
+ */
+
+/*
+ * NH: add 32 bytes of message, at the current position in the chunk,
+ * to each stream's hash. Message words are little-endian.
+ */
+static void umac_nh(struct umac_ctx *ctx, umac_u64 *nh,
+		    const unsigned char *p, int chunkpos)
+{
+    word32 m[8];
+    int i, s;
+
+    for (i = 0; i < 8; i++)
+	m[i] = GET_32BIT_LSB_FIRST(p + 4 * i);
+
+    for (s = 0; s < ctx->streams; s++) {
+	const word32 *k = ctx->l1key + chunkpos / 4 + 4 * s;
+	umac_u64 y = nh[s];
+
+	y += (umac_u64)(word32)(m[0] + k[0]) * (word32)(m[4] + k[4]);
+	y += (umac_u64)(word32)(m[1] + k[1]) * (word32)(m[5] + k[5]);
+	y += (umac_u64)(word32)(m[2] + k[2]) * (word32)(m[6] + k[6]);
+	y += (umac_u64)(word32)(m[3] + k[3]) * (word32)(m[7] + k[7]);
+	nh[s] = y;
+    }
+}
+
+/*
+ * One step of the polynomial hash modulo p64, y = y*k + m. The result
+ * is only reduced below 2^64; the key has its top seven bits in each
+ * half clear, which keeps the partial products in range.
+ */
+static umac_u64 umac_poly64_step(umac_u64 y, umac_u64 k, umac_u64 m)
+{
+    word32 kh = (word32)(k >> 32), kl = (word32)k;
+    word32 yh = (word32)(y >> 32), yl = (word32)y;
+    umac_u64 x, t, r;
+
+    x = (umac_u64)kh * yl + (umac_u64)yh * kl;
+    r = ((umac_u64)kh * yh + (word32)(x >> 32)) * UMAC_P64_OFFSET +
+	(umac_u64)kl * yl;
+
+    t = (umac_u64)(word32)x << 32;
+    r += t;
+    if (r < t)
+	r += UMAC_P64_OFFSET;
+
+    r += m;
+    if (r < m)
+	r += UMAC_P64_OFFSET;
+
+    return r;
+}
+
+static umac_u64 umac_poly64(umac_u64 y, umac_u64 k, umac_u64 m)
+{
+    /* Words from 2^64 - 2^32 up are split in two, after a marker */
+    if ((word32)(m >> 32) == 0xFFFFFFFF) {
+	y = umac_poly64_step(y, k, UMAC_P64 - 1);
+	return umac_poly64_step(y, k, m - UMAC_P64_OFFSET);
+    }
+    return umac_poly64_step(y, k, m);
+}
+
+/*
+ * Inner product hash of the (zero-extended to 128 bits) L2 output,
+ * with the result masked by the stream's last key.
+ */
+static word32 umac_l3(struct umac_ctx *ctx, int s, umac_u64 m)
+{
+    const umac_u64 *k = ctx->l3key1[s];
+    umac_u64 y;
+
+    /* The top half of the input is zero, so only k[4..7] matter */
+    y = (umac_u64)(m >> 48) * k[4] +
+	(umac_u64)((m >> 32) & 0xFFFF) * k[5] +
+	(umac_u64)((m >> 16) & 0xFFFF) * k[6] +
+	(umac_u64)(m & 0xFFFF) * k[7];
+
+    /* y < 2^54, so fold the bits above 36 down using 2^36 = 5 mod p36 */
+    y = (y & UMAC_MASK36) + 5 * (y >> 36);
+    y = (y & UMAC_MASK36) + 5 * (y >> 36);
+    if (y >= UMAC_P36)
+	y -= UMAC_P36;
+
+    return (word32)y ^ ctx->l3key2[s];
+}
+
+/*
+ * Finish the current chunk and start the next one. This is only done
+ * once the next chunk has some data, since the last chunk of the
+ * message is treated differently.
+ */
+static void umac_next_chunk(struct umac_ctx *ctx)
+{
+    int s;
+
+    for (s = 0; s < ctx->streams; s++) {
+	if (ctx->chunks)
+	    ctx->poly[s] = umac_poly64(ctx->poly[s], ctx->l2key[s],
+				       ctx->last[s]);
+	ctx->last[s] = ctx->nh[s] + UMAC_L1_KEY_LEN * 8;
+	ctx->nh[s] = 0;
+    }
+    ctx->chunks++;
+    ctx->chunkpos = 0;
+}
+
+static void umac_hash_bytes(struct umac_ctx *ctx, const unsigned char *p,
+			    int len)
+{
+    while (len > 0) {
+	int n;
+
+	if (ctx->chunkpos == UMAC_L1_KEY_LEN)
+	    umac_next_chunk(ctx);
+
+	if (ctx->buflen == 0 && len >= UMAC_NH_BLOCK) {
+	    /* Hash whole blocks straight from the caller's buffer */
+	    while (len >= UMAC_NH_BLOCK && ctx->chunkpos < UMAC_L1_KEY_LEN) {
+		umac_nh(ctx, ctx->nh, p, ctx->chunkpos);
+		ctx->chunkpos += UMAC_NH_BLOCK;
+		p += UMAC_NH_BLOCK;
+		len -= UMAC_NH_BLOCK;
+	    }
+	    continue;
+	}
+
+	n = UMAC_NH_BLOCK - ctx->buflen;
+	if (n > len)
+	    n = len;
+	memcpy(ctx->buf + ctx->buflen, p, n);
+	ctx->buflen += n;
+	p += n;
+	len -= n;
+	if (ctx->buflen == UMAC_NH_BLOCK) {
+	    umac_nh(ctx, ctx->nh, ctx->buf, ctx->chunkpos);
+	    ctx->chunkpos += UMAC_NH_BLOCK;
+	    ctx->buflen = 0;
+	}
+    }
+}
+
+/*
+ * Produce the tag for what has been hashed so far. The context is
+ * left alone, so that more data can follow.
+ */
+static void umac_result(struct umac_ctx *ctx, const unsigned char *nonce,
+			unsigned char *tag)
+{
+    umac_u64 nh[UMAC_MAX_STREAMS];
+    unsigned char pad[16];
+    int bits, s;
+
+    memcpy(nh, ctx->nh, sizeof(nh));
+    bits = (ctx->chunkpos + ctx->buflen) * 8;
+    if (ctx->buflen > 0 || bits == 0) {
+	/* Zero-pad the tail; an empty message hashes one zero block */
+	unsigned char block[UMAC_NH_BLOCK];
+	memset(block, 0, sizeof(block));
+	memcpy(block, ctx->buf, ctx->buflen);
+	umac_nh(ctx, nh, block, ctx->chunkpos);
+	smemclr(block, sizeof(block));
+    }
+
+    umac_pad(ctx, nonce, pad);
+
+    for (s = 0; s < ctx->streams; s++) {
+	umac_u64 y = nh[s] + bits;
+
+	if (ctx->chunks) {
+	    /* More than one chunk: run the L1 hashes through L2 */
+	    umac_u64 k = ctx->l2key[s];
+	    umac_u64 p = umac_poly64(ctx->poly[s], k, ctx->last[s]);
+	    y = umac_poly64(p, k, y);
+	    if (y >= UMAC_P64)
+		y -= UMAC_P64;
+	}
+
+	PUT_32BIT_MSB_FIRST(tag + 4 * s,
+			    umac_l3(ctx, s, y) ^ GET_32BIT_MSB_FIRST(pad + 4 * s));
+    }
+
+    smemclr(pad, sizeof(pad));
+    smemclr(nh, sizeof(nh));
+}
+
+/* ----------------------------------------------------------------------
+ * The ssh_mac interface.
+ */
+
+static void *umac_make_context(int streams)
+{
+    struct umac_ctx *ctx = snew(struct umac_ctx);
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->streams = streams;
+    ctx->pdf = aes_make_context();
+    return ctx;
+}
+
+static void *umac64_make_context(void *cipher_ctx)
+{
+    return umac_make_context(2);
+}
+
+static void *umac128_make_context(void *cipher_ctx)
+{
+    return umac_make_context(4);
+}
+
+static void umac_free_context(void *handle)
+{
+    struct umac_ctx *ctx = (struct umac_ctx *)handle;
+
+    aes_free_context(ctx->pdf);
+    smemclr(ctx, sizeof(*ctx));
+    sfree(ctx);
+}
+
+static void umac_key(void *handle, unsigned char *key)
+{
+    struct umac_ctx *ctx = (struct umac_ctx *)handle;
+    unsigned char buf[UMAC_L1_KEY_LEN + 16 * (UMAC_MAX_STREAMS - 1)];
+    int i, s;
+
+    aes128_key(ctx->pdf, key);
+
+    umac_kdf(ctx->pdf, 1, buf, UMAC_L1_KEY_LEN + 16 * (ctx->streams - 1));
+    for (i = 0; i < UMAC_L1_KEY_LEN / 4 + 4 * (ctx->streams - 1); i++)
+	ctx->l1key[i] = GET_32BIT_MSB_FIRST(buf + 4 * i);
+
+    umac_kdf(ctx->pdf, 2, buf, 24 * ctx->streams);
+    for (s = 0; s < ctx->streams; s++) {
+	/* Only the 64-bit key is needed, not the 128-bit one after it */
+	ctx->l2key[s] =
+	    UMAC_U64(GET_32BIT_MSB_FIRST(buf + 24 * s) & 0x01FFFFFF,
+		     GET_32BIT_MSB_FIRST(buf + 24 * s + 4) & 0x01FFFFFF);
+    }
+
+    umac_kdf(ctx->pdf, 3, buf, 64 * ctx->streams);
+    for (s = 0; s < ctx->streams; s++) {
+	for (i = 0; i < 8; i++) {
+	    const unsigned char *q = buf + 64 * s + 8 * i;
+	    ctx->l3key1[s][i] =
+		UMAC_U64(GET_32BIT_MSB_FIRST(q), GET_32BIT_MSB_FIRST(q + 4)) %
+		UMAC_P36;
+	}
+    }
+
+    umac_kdf(ctx->pdf, 4, buf, 4 * ctx->streams);
+    for (s = 0; s < ctx->streams; s++)
+	ctx->l3key2[s] = GET_32BIT_MSB_FIRST(buf + 4 * s);
+
+    umac_kdf(ctx->pdf, 0, buf, 16);
+    aes128_key(ctx->pdf, buf);
+    ctx->pdfvalid = FALSE;
+
+    smemclr(buf, sizeof(buf));
+}
+
+static void umac_start(void *handle)
+{
+    struct umac_ctx *ctx = (struct umac_ctx *)handle;
+    int s;
+
+    memset(ctx->nonce, 0, sizeof(ctx->nonce));
+    ctx->noncelen = 4;
+    ctx->buflen = 0;
+    ctx->chunkpos = 0;
+    ctx->chunks = 0;
+    for (s = 0; s < ctx->streams; s++) {
+	ctx->nh[s] = 0;
+	ctx->poly[s] = 1;
+    }
+}
+
+static void umac_bytes(void *handle, unsigned char const *blk, int len)
+{
+    struct umac_ctx *ctx = (struct umac_ctx *)handle;
+
+    /* The sequence number comes first, and goes into the nonce */
+    while (ctx->noncelen > 0 && len > 0) {
+	ctx->nonce[8 - ctx->noncelen] = *blk++;
+	ctx->noncelen--;
+	len--;
+    }
+
+    umac_hash_bytes(ctx, blk, len);
+}
+
+static void umac_genresult(void *handle, unsigned char *tag)
+{
+    struct umac_ctx *ctx = (struct umac_ctx *)handle;
+
+    umac_result(ctx, ctx->nonce, tag);
+}
+
+static int umac_verresult(void *handle, unsigned char const *tag)
+{
+    struct umac_ctx *ctx = (struct umac_ctx *)handle;
+    unsigned char correct[16];
+
+    umac_result(ctx, ctx->nonce, correct);
+    return smemeq(correct, tag, ctx->streams * 4);
+}
+
+static void umac_do_mac(void *handle, unsigned char *blk, int len,
+			unsigned long seq, unsigned char *tag)
+{
+    struct umac_ctx *ctx = (struct umac_ctx *)handle;
+
+    assert(len <= UMAC_MAX_MESSAGE);
+    umac_start(ctx);
+    PUT_32BIT_MSB_FIRST(ctx->nonce + 4, seq);
+    ctx->noncelen = 0;
+    umac_hash_bytes(ctx, blk, len);
+    umac_result(ctx, ctx->nonce, tag);
+}
+
+static void umac_generate(void *handle, unsigned char *blk, int len,
+			  unsigned long seq)
+{
+    umac_do_mac(handle, blk, len, seq, blk + len);
+}
+
+static int umac_verify(void *handle, unsigned char *blk, int len,
+		       unsigned long seq)
+{
+    struct umac_ctx *ctx = (struct umac_ctx *)handle;
+    unsigned char correct[16];
+
+    umac_do_mac(handle, blk, len, seq, correct);
+    return smemeq(correct, blk + len, ctx->streams * 4);
+}
+
+const struct ssh_mac ssh_umac64 = {
+    umac64_make_context, umac_free_context, umac_key,
+    umac_generate, umac_verify,
+    umac_start, umac_bytes, umac_genresult, umac_verresult,
+    "umac-64@openssh.com", "umac-64-etm@openssh.com",
+    8, 16,
+    "UMAC-64"
+};
+
+const struct ssh_mac ssh_umac128 = {
+    umac128_make_context, umac_free_context, umac_key,
+    umac_generate, umac_verify,
+    umac_start, umac_bytes, umac_genresult, umac_verresult,
+    "umac-128@openssh.com", "umac-128-etm@openssh.com",
+    16, 16,
+    "UMAC-128"
+};
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Test vectors from RFC 4418 appendix, with the key
+ * "abcdefghijklmnop" and the nonce "bcdefghi". The UMAC-128 values
+ * extend the UMAC-96 ones in the RFC by a fourth word.
+ */
+
+static int umac_test(const struct ssh_mac *alg, const char *msg,
+		     int reps, const char *expected)
+{
+    static const unsigned char key[16] = "abcdefghijklmnop";
+    static const unsigned char nonce[8] = "bcdefghi";
+    void *handle = alg->make_context(NULL);
+    unsigned char tag[16];
+    char hex[33];
+    int i, msglen = strlen(msg), ret;
+
+    alg->setkey(handle, (unsigned char *)key);
+
+    /* Use the partial-packet interface, with the nonce up front */
+    alg->start(handle);
+    alg->bytes(handle, nonce, 4);
+    {
+	struct umac_ctx *ctx = (struct umac_ctx *)handle;
+	memcpy(ctx->nonce, nonce, 8);
+    }
+    for (i = 0; i < reps; i++)
+	alg->bytes(handle, (const unsigned char *)msg, msglen);
+    alg->genresult(handle, tag);
+
+    for (i = 0; i < alg->len; i++)
+	sprintf(hex + 2 * i, "%02X", tag[i]);
+    ret = strcmp(hex, expected);
+    if (ret)
+	fprintf(stderr, "%s of \"%s\" * %d: expected %s, got %s\n",
+		alg->text_name, msg, reps, expected, hex);
+
+    alg->free_context(handle);
+    return ret != 0;
+}
+
+int main(void)
+{
+    int errors = 0;
+
+    errors += umac_test(&ssh_umac64, "", 0, "6E155FAD26900BE1");
+    errors += umac_test(&ssh_umac64, "a", 3, "44B5CB542F220104");
+    errors += umac_test(&ssh_umac64, "a", 1 << 10, "26BF2F5D60118BD9");
+    errors += umac_test(&ssh_umac64, "a", 1 << 15, "27F8EF643B0D118D");
+    errors += umac_test(&ssh_umac64, "a", 1 << 20, "A4477E87E9F55853");
+    errors += umac_test(&ssh_umac64, "abc", 1, "D4D7B9F6BD4FBFCF");
+    errors += umac_test(&ssh_umac64, "abc", 500, "D4CF26DDEFD5C01A");
+    errors += umac_test(&ssh_umac128, "", 0,
+			"32FEDB100C79AD58F07FF7643CC60465");
+    errors += umac_test(&ssh_umac128, "a", 3,
+			"185E4FE905CBA7BD85E4C2DC3D117D8D");
+    errors += umac_test(&ssh_umac128, "a", 1 << 10,
+			"7A54ABE04AF82D60FB298C3CBD195BCB");
+    errors += umac_test(&ssh_umac128, "a", 1 << 15,
+			"7B136BD911E4B734286EF2BE501F2C3C");
+    errors += umac_test(&ssh_umac128, "a", 1 << 20,
+			"F8ACFA3AC31CFEEA047F7B115B03BEF5");
+    errors += umac_test(&ssh_umac128, "abc", 1,
+			"883C3D4B97A61976FFCF232308CBA5A5");
+    errors += umac_test(&ssh_umac128, "abc", 500,
+			"8824A260C53C66A36C9260A62CB83AA1");
+
+    /*
+     * CPU time per gigabyte of 32 KB packets, compared with
+     * HMAC-SHA-256.
+     */
+    {
+	const struct ssh_mac *algs[] = {
+	    &ssh_umac64, &ssh_umac128, &ssh_hmac_sha256, &ssh_hmac_sha1
+	};
+	static unsigned char key[32], pkt[32768 + 32];
+	int a, i;
+
+	for (a = 0; a < sizeof(algs) / sizeof(*algs); a++) {
+	    void *handle = algs[a]->make_context(NULL);
+	    clock_t start;
+	    double secs;
+
+	    algs[a]->setkey(handle, key);
+	    start = clock();
+	    for (i = 0; i < 1 << 13; i++)
+		algs[a]->generate(handle, pkt, 32768, i);
+	    secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+	    printf("%s: %.2f CPU seconds per GB\n", algs[a]->text_name,
+		   secs * 4);
+	    algs[a]->free_context(handle);
+	}
+    }
+
+    printf("%d errors\n", errors);
+
+    return 0;
+}
+
+#endif
@@ -22,8 +22,8 @@
 #define SCRIPT_CHMOD_HELP2      18
 #define SCRIPT_LN_HELP          19
 #define SCRIPT_MKDIR_HELP       20
-#define SCRIPT_GET_HELP8        21
-#define SCRIPT_PUT_HELP8        22
+#define SCRIPT_GET_HELP9        21
+#define SCRIPT_PUT_HELP9        22
 #define SCRIPT_OPTION_HELP7     23
 #define SCRIPT_SYNCHRONIZE_HELP7 24
 #define SCRIPT_KEEPUPTODATE_HELP4 25
@@ -31,6 +31,7 @@
 #define SCRIPT_ECHO_HELP        27
 #define SCRIPT_STAT_HELP        28
 #define SCRIPT_CHECKSUM_HELP    29
+#define SCRIPT_STATS_HELP       30
 
 #define CORE_ERROR_STRINGS      100
 #define KEY_NOT_VERIFIED        101
@@ -453,6 +454,9 @@
 #define CODE_YOUR_CODE          552
 #define CODE_PS_ADD_TYPE        553
 #define COPY_INFO_PRESERVE_TIME_DIRS 554
+#define SCRIPT_PARALLEL_FAILED  555
+#define SCRIPT_STATS_DESC       556
+#define REMOTE_SPACE_INSUFFICIENT 557
 
 #define CORE_VARIABLE_STRINGS   600
 #define PUTTY_BASED_ON          601
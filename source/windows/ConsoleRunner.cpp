@@ -13,6 +13,8 @@
 
 #include <Consts.hpp>
 #include <StrUtils.hpp>
+#include <winsock2.h>
+#include <deque>
 
 #include "Console.h"
 #include "WinInterface.h"
@@ -56,6 +58,8 @@ public:
   virtual bool __fastcall CommandLineOnly() = 0;
   virtual bool __fastcall WantsProgress() = 0;
   virtual void __fastcall Progress(const TScriptProgress & Progress) = 0;
+  virtual bool __fastcall WantsActionLog() = 0;
+  virtual void __fastcall ActionLog(const UnicodeString & Data) = 0;
 };
 //---------------------------------------------------------------------------
 class TOwnConsole : public TConsole
@@ -76,6 +80,8 @@ public:
   virtual bool __fastcall CommandLineOnly();
   virtual bool __fastcall WantsProgress();
   virtual void __fastcall Progress(const TScriptProgress & Progress);
+  virtual bool __fastcall WantsActionLog();
+  virtual void __fastcall ActionLog(const UnicodeString & Data);
 
 protected:
   static TOwnConsole * FInstance;
@@ -522,6 +528,16 @@ void __fastcall TOwnConsole::Progress(const TScriptProgress & /*Progress*/)
   DebugFail();
 }
 //---------------------------------------------------------------------------
+bool __fastcall TOwnConsole::WantsActionLog()
+{
+  return false;
+}
+//---------------------------------------------------------------------------
+void __fastcall TOwnConsole::ActionLog(const UnicodeString & /*Data*/)
+{
+  DebugFail();
+}
+//---------------------------------------------------------------------------
 class TExternalConsole : public TConsole
 {
 public:
@@ -541,6 +557,8 @@ public:
   virtual bool __fastcall CommandLineOnly();
   virtual bool __fastcall WantsProgress();
   virtual void __fastcall Progress(const TScriptProgress & Progress);
+  virtual bool __fastcall WantsActionLog();
+  virtual void __fastcall ActionLog(const UnicodeString & Data);
 
 private:
   bool FPendingAbort;
@@ -553,17 +571,22 @@ private:
   bool FPipeOutput;
   bool FNoInteractiveInput;
   bool FWantsProgress;
+  bool FWantsActionLog;
+  std::unique_ptr<TCriticalSection> FActionLogSection;
+  UnicodeString FActionLogBuffer;
   static const int PrintTimeout = 30000;
 
   inline TConsoleCommStruct * __fastcall GetCommStruct();
   inline void __fastcall FreeCommStruct(TConsoleCommStruct * CommStruct);
   inline void __fastcall SendEvent(int Timeout);
   void __fastcall Init();
+  void __fastcall FlushActionLog();
   void __fastcall CheckHandle(HANDLE Handle, const UnicodeString & Desc);
 };
 //---------------------------------------------------------------------------
 __fastcall TExternalConsole::TExternalConsole(
-  const UnicodeString Instance, bool NoInteractiveInput)
+  const UnicodeString Instance, bool NoInteractiveInput) :
+  FActionLogSection(new TCriticalSection())
 {
   UnicodeString Name;
   Name = FORMAT(L"%s%s", (CONSOLE_EVENT_REQUEST, (Instance)));
@@ -612,6 +635,14 @@ __fastcall TExternalConsole::TExternalConsole(
 //---------------------------------------------------------------------------
 __fastcall TExternalConsole::~TExternalConsole()
 {
+  try
+  {
+    FlushActionLog();
+  }
+  catch (...)
+  {
+    // the other side is probably gone already
+  }
   CloseHandle(FRequestEvent);
   CloseHandle(FResponseEvent);
   CloseHandle(FCancelEvent);
@@ -661,6 +692,8 @@ void __fastcall TExternalConsole::SendEvent(int Timeout)
 //---------------------------------------------------------------------------
 void __fastcall TExternalConsole::Print(UnicodeString Str, bool FromBeginning)
 {
+  FlushActionLog();
+
   // need to do at least one iteration, even when Str is empty (new line)
   do
   {
@@ -695,6 +728,8 @@ void __fastcall TExternalConsole::Print(UnicodeString Str, bool FromBeginning)
 //---------------------------------------------------------------------------
 bool __fastcall TExternalConsole::Input(UnicodeString & Str, bool Echo, unsigned int Timer)
 {
+  FlushActionLog();
+
   TConsoleCommStruct * CommStruct = GetCommStruct();
   try
   {
@@ -730,6 +765,8 @@ bool __fastcall TExternalConsole::Input(UnicodeString & Str, bool Echo, unsigned
 int __fastcall TExternalConsole::Choice(UnicodeString Options, int Cancel, int Break,
   int Timeouted, bool Timeouting, unsigned int Timer)
 {
+  FlushActionLog();
+
   TConsoleCommStruct * CommStruct = GetCommStruct();
   try
   {
@@ -767,11 +804,17 @@ int __fastcall TExternalConsole::Choice(UnicodeString Options, int Cancel, int B
 //---------------------------------------------------------------------------
 bool __fastcall TExternalConsole::PendingAbort()
 {
+  // Polled regularly while a command is running,
+  // so this is where the records of the running command get sent.
+  FlushActionLog();
+
   return (WaitForSingleObject(FCancelEvent, 0) == WAIT_OBJECT_0);
 }
 //---------------------------------------------------------------------------
 void __fastcall TExternalConsole::SetTitle(UnicodeString Title)
 {
+  FlushActionLog();
+
   TConsoleCommStruct * CommStruct = GetCommStruct();
   try
   {
@@ -796,6 +839,7 @@ void __fastcall TExternalConsole::Init()
   {
     CommStruct->Event = TConsoleCommStruct::INIT;
     CommStruct->InitEvent.WantsProgress = false;
+    CommStruct->InitEvent.WantsActionLog = false;
   }
   __finally
   {
@@ -812,6 +856,7 @@ void __fastcall TExternalConsole::Init()
       (CommStruct->InitEvent.OutputType != FILE_TYPE_PIPE);
     FPipeOutput = (CommStruct->InitEvent.OutputType != FILE_TYPE_PIPE);
     FWantsProgress = CommStruct->InitEvent.WantsProgress;
+    FWantsActionLog = CommStruct->InitEvent.WantsActionLog;
   }
   __finally
   {
@@ -851,6 +896,8 @@ bool __fastcall TExternalConsole::WantsProgress()
 //---------------------------------------------------------------------------
 void __fastcall TExternalConsole::Progress(const TScriptProgress & Progress)
 {
+  FlushActionLog();
+
   TConsoleCommStruct * CommStruct = GetCommStruct();
   try
   {
@@ -904,6 +951,63 @@ void __fastcall TExternalConsole::Progress(const TScriptProgress & Progress)
   FreeCommStruct(GetCommStruct());
 }
 //---------------------------------------------------------------------------
+bool __fastcall TExternalConsole::WantsActionLog()
+{
+  return FWantsActionLog;
+}
+//---------------------------------------------------------------------------
+void __fastcall TExternalConsole::ActionLog(const UnicodeString & Data)
+{
+  // Called with the action log locked, possibly from a background transfer thread.
+  // So only buffer the records here, they are sent from the main thread
+  // before the next event or when polled for abort.
+  TGuard Guard(FActionLogSection.get());
+  FActionLogBuffer += Data;
+}
+//---------------------------------------------------------------------------
+void __fastcall TExternalConsole::FlushActionLog()
+{
+  // the comm struct is not shared between threads
+  if (GetCurrentThreadId() != MainThreadID)
+  {
+    return;
+  }
+
+  UnicodeString Data;
+  {
+    TGuard Guard(FActionLogSection.get());
+    Data = FActionLogBuffer;
+    FActionLogBuffer = L"";
+  }
+
+  while (!Data.IsEmpty())
+  {
+    TConsoleCommStruct * CommStruct = GetCommStruct();
+    try
+    {
+      int MaxLen = LENOF(CommStruct->ActionLogEvent.Data) - 1;
+      int Len = std::min(Data.Length(), MaxLen);
+      // do not split surrogate pair
+      if ((Len < Data.Length()) && (Data[Len] >= 0xD800) && (Data[Len] <= 0xDBFF))
+      {
+        Len--;
+      }
+
+      CommStruct->Event = TConsoleCommStruct::ACTIONLOG;
+      wcsncpy(CommStruct->ActionLogEvent.Data, Data.c_str(), Len);
+      CommStruct->ActionLogEvent.Data[Len] = L'\0';
+      Data.Delete(1, Len);
+    }
+    __finally
+    {
+      FreeCommStruct(CommStruct);
+    }
+
+    // the other side only queues the records, so it responds promptly
+    SendEvent(PrintTimeout);
+  }
+}
+//---------------------------------------------------------------------------
 class TNullConsole : public TConsole
 {
 public:
@@ -923,6 +1027,8 @@ public:
 
   virtual bool __fastcall WantsProgress();
   virtual void __fastcall Progress(const TScriptProgress & Progress);
+  virtual bool __fastcall WantsActionLog();
+  virtual void __fastcall ActionLog(const UnicodeString & Data);
 };
 //---------------------------------------------------------------------------
 __fastcall TNullConsole::TNullConsole()
@@ -1005,6 +1111,16 @@ void __fastcall TNullConsole::Progress(const TScriptProgress & /*Progress*/)
   DebugFail();
 }
 //---------------------------------------------------------------------------
+bool __fastcall TNullConsole::WantsActionLog()
+{
+  return false;
+}
+//---------------------------------------------------------------------------
+void __fastcall TNullConsole::ActionLog(const UnicodeString & /*Data*/)
+{
+  DebugFail();
+}
+//---------------------------------------------------------------------------
 static UnicodeString TimestampVarName(L"TIMESTAMP");
 //---------------------------------------------------------------------------
 class TConsoleRunner
@@ -1683,12 +1799,12 @@ void __fastcall TConsoleRunner::SynchronizeControllerSynchronize(
   TSynchronizeController * /*Sender*/, const UnicodeString LocalDirectory,
   const UnicodeString RemoteDirectory, const TCopyParamType & CopyParam,
   const TSynchronizeParamType & Params, TSynchronizeChecklist ** Checklist,
-  TSynchronizeOptions * /*Options*/, bool Full)
+  TSynchronizeOptions * Options, bool Full)
 {
   if (!Full)
   {
     FScript->Synchronize(LocalDirectory, RemoteDirectory, CopyParam,
-      Params.Params, Checklist);
+      Params.Params, Checklist, Options);
   }
 }
 //---------------------------------------------------------------------------
@@ -2194,6 +2310,8 @@ void __fastcall BatchSettings(TConsole * Console, TProgramParams * Params)
       int Matches = 0;
       int Changes = 0;
 
+      StoredSessions->LoadPending();
+
       for (int Index = 0; Index < StoredSessions->Count; Index++)
       {
         TSessionData * Data = StoredSessions->Sessions[Index];
@@ -2395,6 +2513,824 @@ int __fastcall KeyGen(TConsole * Console, TProgramParams * Params)
   return Result;
 }
 //---------------------------------------------------------------------------
+static bool __fastcall DelayProxyReceive(SOCKET Socket, void * Buffer, int Len)
+{
+  char * P = static_cast<char *>(Buffer);
+  bool Result = true;
+  while (Result && (Len > 0))
+  {
+    int Received = recv(Socket, P, Len, 0);
+    Result = (Received > 0);
+    if (Result)
+    {
+      P += Received;
+      Len -= Received;
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+static bool __fastcall DelayProxySend(SOCKET Socket, const void * Buffer, int Len)
+{
+  const char * P = static_cast<const char *>(Buffer);
+  bool Result = true;
+  while (Result && (Len > 0))
+  {
+    int Sent = send(Socket, P, Len, 0);
+    Result = (Sent > 0);
+    if (Result)
+    {
+      P += Sent;
+      Len -= Sent;
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+static void __fastcall DelayProxyNoDelay(SOCKET Socket)
+{
+  BOOL NoDelay = TRUE;
+  setsockopt(Socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char *>(&NoDelay), sizeof(NoDelay));
+}
+//---------------------------------------------------------------------------
+// Forwards data from Source to Target, delaying them by Latency (ms)
+// and throttling them to Bandwidth (B/s, 0 = unlimited).
+// The data are read as soon as they arrive and sent once they are due,
+// so that the latency does not limit the throughput.
+static void __fastcall DelayProxyForward(SOCKET Source, SOCKET Target, int Latency, int Bandwidth)
+{
+  struct TChunk
+  {
+    RawByteString Data;
+    unsigned int Due;
+  };
+  const int ChunkSize = 64 * 1024;
+  const unsigned int MaxChunks = 256;
+
+  std::deque<TChunk> Chunks;
+  bool Eof = false;
+  bool Failed = false;
+  // when the bandwidth allows sending the next chunk
+  unsigned int Next = GetTickCount();
+  while (!Failed && (!Eof || !Chunks.empty()))
+  {
+    // negative = infinite
+    int Wait = -1;
+    if (!Chunks.empty())
+    {
+      unsigned int Now = GetTickCount();
+      unsigned int Due = Chunks.front().Due;
+      if (static_cast<int>(Next - Due) > 0)
+      {
+        Due = Next;
+      }
+      Wait = std::max(static_cast<int>(Due - Now), 0);
+      if (Wait == 0)
+      {
+        const TChunk & Chunk = Chunks.front();
+        Failed = !DelayProxySend(Target, Chunk.Data.c_str(), Chunk.Data.Length());
+        if (Bandwidth > 0)
+        {
+          if (static_cast<int>(Now - Next) > 0)
+          {
+            Next = Now;
+          }
+          Next += static_cast<unsigned int>(static_cast<__int64>(Chunk.Data.Length()) * 1000 / Bandwidth);
+        }
+        Chunks.pop_front();
+      }
+    }
+
+    if (Failed || (Wait == 0))
+    {
+      // noop, sent a chunk, check for the next one
+    }
+    else if (!Eof && (Chunks.size() < MaxChunks))
+    {
+      fd_set ReadSet;
+      FD_ZERO(&ReadSet);
+      FD_SET(Source, &ReadSet);
+      timeval Timeout;
+      Timeout.tv_sec = Wait / 1000;
+      Timeout.tv_usec = (Wait % 1000) * 1000;
+      int Ready = select(0, &ReadSet, NULL, NULL, (Wait >= 0) ? &Timeout : NULL);
+      if (Ready < 0)
+      {
+        Eof = true;
+      }
+      else if (Ready > 0)
+      {
+        TChunk Chunk;
+        Chunk.Data.SetLength(ChunkSize);
+        int Received = recv(Source, Chunk.Data.c_str(), ChunkSize, 0);
+        if (Received <= 0)
+        {
+          Eof = true;
+        }
+        else
+        {
+          Chunk.Data.SetLength(Received);
+          Chunk.Due = GetTickCount() + Latency;
+          Chunks.push_back(Chunk);
+        }
+      }
+    }
+    else
+    {
+      // nothing more to read now, the queue is waiting for the first chunk to be due
+      Sleep(Wait);
+    }
+  }
+  shutdown(Target, SD_SEND);
+}
+//---------------------------------------------------------------------------
+class TDelayProxyPump : public TSimpleThread
+{
+public:
+  __fastcall TDelayProxyPump(SOCKET Source, SOCKET Target, int Latency, int Bandwidth) :
+    TSimpleThread()
+  {
+    FSource = Source;
+    FTarget = Target;
+    FLatency = Latency;
+    FBandwidth = Bandwidth;
+  }
+
+  virtual __fastcall ~TDelayProxyPump()
+  {
+    // close before the class's virtual functions (Terminate particularly) are lost
+    Close();
+  }
+
+  virtual void __fastcall Terminate()
+  {
+    shutdown(FSource, SD_BOTH);
+    shutdown(FTarget, SD_BOTH);
+  }
+
+protected:
+  virtual void __fastcall Execute()
+  {
+    DelayProxyForward(FSource, FTarget, FLatency, FBandwidth);
+  }
+
+private:
+  SOCKET FSource;
+  SOCKET FTarget;
+  int FLatency;
+  int FBandwidth;
+};
+//---------------------------------------------------------------------------
+// One connection of the delay proxy.
+// Forwards the client data itself and the server data with TDelayProxyPump.
+class TDelayProxyConnection : public TSimpleThread
+{
+public:
+  __fastcall TDelayProxyConnection(SOCKET Client, int Latency, int Bandwidth) :
+    TSimpleThread()
+  {
+    FClient = Client;
+    FTarget = INVALID_SOCKET;
+    FLatency = Latency;
+    FBandwidth = Bandwidth;
+  }
+
+  virtual __fastcall ~TDelayProxyConnection()
+  {
+    // close before the class's virtual functions (Terminate particularly) are lost
+    Close();
+    if (FTarget != INVALID_SOCKET)
+    {
+      closesocket(FTarget);
+    }
+    closesocket(FClient);
+  }
+
+  virtual void __fastcall Terminate()
+  {
+    shutdown(FClient, SD_BOTH);
+    if (FTarget != INVALID_SOCKET)
+    {
+      shutdown(FTarget, SD_BOTH);
+    }
+  }
+
+protected:
+  virtual void __fastcall Execute()
+  {
+    if (Handshake())
+    {
+      std::unique_ptr<TDelayProxyPump> Pump(new TDelayProxyPump(FTarget, FClient, FLatency, FBandwidth));
+      Pump->Start();
+      DelayProxyForward(FClient, FTarget, FLatency, FBandwidth);
+      Pump->WaitFor();
+    }
+  }
+
+private:
+  SOCKET FClient;
+  SOCKET FTarget;
+  int FLatency;
+  int FBandwidth;
+
+  // SOCKS5 (RFC 1928), CONNECT to an IPv4 address or a host name only,
+  // no authentication
+  bool __fastcall Handshake()
+  {
+    DelayProxyNoDelay(FClient);
+
+    unsigned char Buf[256];
+    bool Result =
+      DelayProxyReceive(FClient, Buf, 2) &&
+      (Buf[0] == 5) &&
+      DelayProxyReceive(FClient, Buf, Buf[1]);
+    if (Result)
+    {
+      static const unsigned char NoAuthentication[] = { 5, 0 };
+      Result =
+        DelayProxySend(FClient, NoAuthentication, sizeof(NoAuthentication)) &&
+        DelayProxyReceive(FClient, Buf, 4);
+    }
+
+    if (Result)
+    {
+      unsigned char Command = Buf[1];
+      unsigned char Reply = 0; // succeeded
+      sockaddr_in Address;
+      memset(&Address, 0, sizeof(Address));
+      Address.sin_family = AF_INET;
+      switch (Buf[3])
+      {
+        case 1: // IPv4 address
+          Result = DelayProxyReceive(FClient, &Address.sin_addr, 4);
+          break;
+
+        case 3: // host name
+          Result = DelayProxyReceive(FClient, Buf, 1);
+          if (Result)
+          {
+            int Len = Buf[0];
+            Result = DelayProxyReceive(FClient, Buf, Len);
+            if (Result)
+            {
+              Buf[Len] = '\0';
+              hostent * Host = gethostbyname(reinterpret_cast<char *>(Buf));
+              if ((Host != NULL) && (Host->h_addrtype == AF_INET))
+              {
+                memcpy(&Address.sin_addr, Host->h_addr_list[0], sizeof(Address.sin_addr));
+              }
+              else
+              {
+                Reply = 4; // host unreachable
+              }
+            }
+          }
+          break;
+
+        default:
+          // IPv6 is not needed for local servers, the request cannot be read further
+          Reply = 8; // address type not supported
+          break;
+      }
+
+      if (Result && (Reply != 8))
+      {
+        Result = DelayProxyReceive(FClient, &Address.sin_port, sizeof(Address.sin_port));
+      }
+
+      if (Result && (Reply == 0))
+      {
+        if (Command != 1)
+        {
+          Reply = 7; // command not supported
+        }
+        else
+        {
+          FTarget = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+          if ((FTarget == INVALID_SOCKET) ||
+              (connect(FTarget, reinterpret_cast<sockaddr *>(&Address), sizeof(Address)) != 0))
+          {
+            Reply = 5; // connection refused
+          }
+          else
+          {
+            DelayProxyNoDelay(FTarget);
+          }
+        }
+      }
+
+      if (Result)
+      {
+        // the bound address is not used by the clients
+        unsigned char Response[] = { 5, Reply, 0, 1, 0, 0, 0, 0, 0, 0 };
+        Result =
+          DelayProxySend(FClient, Response, sizeof(Response)) &&
+          (Reply == 0);
+      }
+    }
+    return Result;
+  }
+};
+//---------------------------------------------------------------------------
+// Local SOCKS5 proxy that delays and throttles all data it forwards.
+// Sessions of all protocols can connect through it, including FTP data
+// connections, so it stands in for a slow network link.
+// Latency and bandwidth apply to each connection and direction separately.
+class TDelayProxy : public TSimpleThread
+{
+public:
+  __fastcall TDelayProxy(int Latency, int Bandwidth) :
+    TSimpleThread()
+  {
+    FLatency = Latency;
+    FBandwidth = Bandwidth;
+
+    FListener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in Address;
+    memset(&Address, 0, sizeof(Address));
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int AddressLen = sizeof(Address);
+    if ((FListener == INVALID_SOCKET) ||
+        (bind(FListener, reinterpret_cast<sockaddr *>(&Address), sizeof(Address)) != 0) ||
+        (listen(FListener, SOMAXCONN) != 0) ||
+        (getsockname(FListener, reinterpret_cast<sockaddr *>(&Address), &AddressLen) != 0))
+    {
+      int Error = WSAGetLastError();
+      if (FListener != INVALID_SOCKET)
+      {
+        closesocket(FListener);
+      }
+      throw EOSExtException(L"Cannot start delay proxy.", Error);
+    }
+    FPort = ntohs(Address.sin_port);
+  }
+
+  virtual __fastcall ~TDelayProxy()
+  {
+    // close before the class's virtual functions (Terminate particularly) are lost
+    Close();
+  }
+
+  virtual void __fastcall Terminate()
+  {
+    // makes accept() fail
+    closesocket(FListener);
+  }
+
+  __property int Port = { read = FPort };
+
+protected:
+  virtual void __fastcall Execute()
+  {
+    std::vector<TDelayProxyConnection *> Connections;
+    SOCKET Client;
+    while ((Client = accept(FListener, NULL, NULL)) != INVALID_SOCKET)
+    {
+      // FTP opens a data connection for each transfer, do not let them pile up
+      std::vector<TDelayProxyConnection *>::iterator I = Connections.begin();
+      while (I != Connections.end())
+      {
+        if ((*I)->IsFinished())
+        {
+          delete *I;
+          I = Connections.erase(I);
+        }
+        else
+        {
+          ++I;
+        }
+      }
+
+      TDelayProxyConnection * Connection = new TDelayProxyConnection(Client, FLatency, FBandwidth);
+      Connections.push_back(Connection);
+      Connection->Start();
+    }
+
+    for (size_t Index = 0; Index < Connections.size(); Index++)
+    {
+      delete Connections[Index];
+    }
+  }
+
+private:
+  SOCKET FListener;
+  int FPort;
+  int FLatency;
+  int FBandwidth;
+};
+//---------------------------------------------------------------------------
+// Headless transfer benchmark. Runs canned workloads with TTerminal against
+// the servers given by URLs (typically local servers over SFTP, SCP and FTP)
+// and reports the timings and session metrics as JSON.
+class TBenchmark
+{
+public:
+  __fastcall TBenchmark(TConsole * Console, TProgramParams * Params);
+
+  void __fastcall Run(TStrings * Urls, TStrings * Workloads);
+  UnicodeString __fastcall ToJson();
+
+private:
+  TConsole * FConsole;
+  TProgramParams * FParams;
+  UnicodeString FLocalPath;
+  UnicodeString FRemotePath;
+  __int64 FHugeFileSize;
+  int FTinyFileCount;
+  int FLatency;
+  int FBandwidth;
+  std::unique_ptr<TDelayProxy> FProxy;
+  UnicodeString FResults;
+  int FFiles;
+  __int64 FBytes;
+
+  UnicodeString __fastcall PrepareData(const UnicodeString & Workload);
+  void __fastcall RunWorkload(const UnicodeString & Url, const UnicodeString & Workload);
+  void __fastcall DeleteRemoteFile(TTerminal * Terminal, const UnicodeString & FileName);
+  void __fastcall CountData(const UnicodeString & Path);
+  void __fastcall CountFile(const UnicodeString FileName, const TSearchRec Rec, void * Param);
+  void __fastcall ListFile(const UnicodeString FileName, const TSearchRec Rec, void * Param);
+  UnicodeString __fastcall StepToJson(
+    const UnicodeString & Operation, unsigned int Duration, int Files, __int64 Bytes);
+};
+//---------------------------------------------------------------------------
+static const UnicodeString BenchmarkHuge(L"huge");
+static const UnicodeString BenchmarkTiny(L"tiny");
+static const UnicodeString BenchmarkDeep(L"deep");
+static const UnicodeString BenchmarkSync(L"sync");
+static const int BenchmarkTreeDepth = 40;
+static const int BenchmarkTreeFilesPerLevel = 20;
+static const int BenchmarkSyncFileCount = 10000;
+// 1% of files changes before synchronization
+static const int BenchmarkSyncChangeEvery = 100;
+//---------------------------------------------------------------------------
+static void __fastcall BenchmarkWriteFile(const UnicodeString & FileName, __int64 Size)
+{
+  RawByteString Buffer;
+  Buffer.SetLength(static_cast<int>(std::min(Size, static_cast<__int64>(1024 * 1024))));
+  for (int Index = 1; Index <= Buffer.Length(); Index++)
+  {
+    Buffer[Index] = static_cast<char>(random(256));
+  }
+
+  std::unique_ptr<TFileStream> Stream(new TFileStream(ApiPath(FileName), fmCreate));
+  __int64 Left = Size;
+  while (Left > 0)
+  {
+    int Count = static_cast<int>(std::min(Left, static_cast<__int64>(Buffer.Length())));
+    Stream->WriteBuffer(Buffer.c_str(), Count);
+    Left -= Count;
+  }
+}
+//---------------------------------------------------------------------------
+__fastcall TBenchmark::TBenchmark(TConsole * Console, TProgramParams * Params)
+{
+  FConsole = Console;
+  FParams = Params;
+  FLocalPath =
+    ExcludeTrailingBackslash(
+      Params->SwitchValue(L"localpath", IncludeTrailingBackslash(SystemTemporaryDirectory()) + L"winscp-benchmark"));
+  FRemotePath = UnixExcludeTrailingBackslash(Params->SwitchValue(L"remotepath", L"/tmp/winscp-benchmark"));
+  FHugeFileSize = StrToInt64(Params->SwitchValue(L"hugefilesize", L"1024")) * 1024 * 1024;
+  FTinyFileCount = StrToInt(Params->SwitchValue(L"tinyfiles", L"100000"));
+  FLatency = StrToInt(Params->SwitchValue(L"latency", L"0"));
+  FBandwidth = StrToInt(Params->SwitchValue(L"bandwidth", L"0"));
+
+  if ((FLatency > 0) || (FBandwidth > 0))
+  {
+    FProxy.reset(new TDelayProxy(FLatency, FBandwidth * 1024));
+    FProxy->Start();
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TBenchmark::CountFile(const UnicodeString FileName, const TSearchRec Rec, void * Param)
+{
+  if (FLAGSET(Rec.Attr, faDirectory))
+  {
+    ProcessLocalDirectory(FileName, CountFile, Param);
+  }
+  else
+  {
+    FFiles++;
+    FBytes += Rec.Size;
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TBenchmark::CountData(const UnicodeString & Path)
+{
+  FFiles = 0;
+  FBytes = 0;
+  ProcessLocalDirectory(Path, CountFile);
+}
+//---------------------------------------------------------------------------
+void __fastcall TBenchmark::ListFile(const UnicodeString FileName, const TSearchRec Rec, void * Param)
+{
+  if (FLAGSET(Rec.Attr, faDirectory))
+  {
+    ProcessLocalDirectory(FileName, ListFile, Param);
+  }
+  else
+  {
+    static_cast<TStrings *>(Param)->Add(FileName);
+  }
+}
+//---------------------------------------------------------------------------
+UnicodeString __fastcall TBenchmark::PrepareData(const UnicodeString & Workload)
+{
+  UnicodeString Name;
+  if (Workload == BenchmarkHuge)
+  {
+    Name = FORMAT(L"%s-%s", (Workload, IntToStr(FHugeFileSize)));
+  }
+  else if (Workload == BenchmarkTiny)
+  {
+    Name = FORMAT(L"%s-%d", (Workload, FTinyFileCount));
+  }
+  else
+  {
+    Name = Workload;
+  }
+  UnicodeString Path = IncludeTrailingBackslash(FLocalPath) + Name;
+
+  // the data are generated once and reused by later runs
+  UnicodeString Marker = Path + L".complete";
+  if (!FileExists(ApiPath(Marker)))
+  {
+    ConsolePrintLine(FConsole, FORMAT(L"Generating %s data...", (Workload)));
+    if (DirectoryExists(ApiPath(Path)))
+    {
+      RecursiveDeleteFileChecked(Path, false);
+    }
+    THROWOSIFFALSE(ForceDirectories(ApiPath(Path)));
+
+    if (Workload == BenchmarkHuge)
+    {
+      BenchmarkWriteFile(IncludeTrailingBackslash(Path) + L"huge.bin", FHugeFileSize);
+    }
+    else if (Workload == BenchmarkTiny)
+    {
+      for (int Index = 0; Index < FTinyFileCount; Index++)
+      {
+        BenchmarkWriteFile(FORMAT(L"%s\\f%d.txt", (Path, Index)), 100);
+      }
+    }
+    else if (Workload == BenchmarkDeep)
+    {
+      UnicodeString Level = Path;
+      for (int Depth = 0; Depth < BenchmarkTreeDepth; Depth++)
+      {
+        Level = FORMAT(L"%s\\d%d", (Level, Depth));
+        THROWOSIFFALSE(ForceDirectories(ApiPath(Level)));
+        for (int Index = 0; Index < BenchmarkTreeFilesPerLevel; Index++)
+        {
+          BenchmarkWriteFile(FORMAT(L"%s\\f%d.bin", (Level, Index)), 4096 * (Index + 1));
+        }
+      }
+    }
+    else if (DebugAlwaysTrue(Workload == BenchmarkSync))
+    {
+      for (int Index = 0; Index < BenchmarkSyncFileCount; Index++)
+      {
+        // spread over subdirectories, as real trees are
+        UnicodeString Dir = FORMAT(L"%s\\s%d", (Path, Index / 1000));
+        THROWOSIFFALSE(ForceDirectories(ApiPath(Dir)));
+        BenchmarkWriteFile(FORMAT(L"%s\\f%d.bin", (Dir, Index)), 16 * 1024);
+      }
+    }
+
+    BenchmarkWriteFile(Marker, 0);
+  }
+  return Path;
+}
+//---------------------------------------------------------------------------
+void __fastcall TBenchmark::DeleteRemoteFile(TTerminal * Terminal, const UnicodeString & FileName)
+{
+  TRemoteFile * File = NULL;
+  if (Terminal->FileExists(FileName, &File))
+  {
+    std::unique_ptr<TStrings> FileList(new TStringList());
+    FileList->AddObject(FileName, File);
+    try
+    {
+      Terminal->DeleteFiles(FileList.get());
+    }
+    __finally
+    {
+      delete File;
+    }
+  }
+}
+//---------------------------------------------------------------------------
+UnicodeString __fastcall TBenchmark::StepToJson(
+  const UnicodeString & Operation, unsigned int Duration, int Files, __int64 Bytes)
+{
+  unsigned int Milliseconds = std::max(Duration, 1U);
+  return
+    FORMAT(L"{\"operation\":\"%s\",\"milliseconds\":%d,\"files\":%d,\"bytes\":%s,\"bytesPerSecond\":%s,\"filesPerSecond\":%s}",
+      (Operation, static_cast<int>(Duration), Files, IntToStr(Bytes),
+       IntToStr(Bytes * 1000 / Milliseconds), IntToStr(static_cast<__int64>(Files) * 1000 / Milliseconds)));
+}
+//---------------------------------------------------------------------------
+void __fastcall TBenchmark::RunWorkload(const UnicodeString & Url, const UnicodeString & Workload)
+{
+  UnicodeString LocalData = PrepareData(Workload);
+  CountData(LocalData);
+  int Files = FFiles;
+  __int64 Bytes = FBytes;
+
+  bool DefaultsOnly;
+  std::unique_ptr<TSessionData> Data(StoredSessions->ParseUrl(Url, FParams, DefaultsOnly));
+  if (FProxy.get() != NULL)
+  {
+    // even for the local servers
+    Data->ProxyMethod = pmSocks5;
+    Data->ProxyHost = L"127.0.0.1";
+    Data->ProxyPort = FProxy->Port;
+    Data->ProxyLocalhost = true;
+  }
+
+  ConsolePrintLine(FConsole, FORMAT(L"Running %s over %s...", (Workload, Data->FSProtocolStr)));
+
+  UnicodeString Steps;
+  std::unique_ptr<TTerminal> Terminal(new TTerminal(Data.get(), Configuration));
+  Terminal->AutoReadDirectory = false;
+  Terminal->Open();
+  try
+  {
+    UnicodeString Remote = UnixIncludeTrailingBackslash(FRemotePath) + ExtractFileName(LocalData);
+    DeleteRemoteFile(Terminal.get(), Remote);
+    if (!Terminal->FileExists(FRemotePath))
+    {
+      Terminal->CreateDirectory(FRemotePath);
+    }
+
+    TCopyParamType CopyParam;
+    std::unique_ptr<TStrings> FileList(new TStringList());
+
+    FileList->Add(LocalData);
+    unsigned int Start = GetTickCount();
+    Terminal->CopyToRemote(FileList.get(), UnixIncludeTrailingBackslash(FRemotePath), &CopyParam, cpNoConfirmation);
+    AddToList(Steps, StepToJson(L"upload", GetTickCount() - Start, Files, Bytes), L",");
+
+    if (Workload == BenchmarkSync)
+    {
+      std::unique_ptr<TStrings> LocalFiles(new TStringList());
+      ProcessLocalDirectory(LocalData, ListFile, LocalFiles.get());
+      int ChangedFiles = 0;
+      __int64 ChangedBytes = 0;
+      // newer than the uploaded files, even if the upload took less than the timestamp precision
+      int Age = DateTimeToFileDate(Now() + EncodeTime(0, 10, 0, 0));
+      for (int Index = 0; Index < LocalFiles->Count; Index += BenchmarkSyncChangeEvery)
+      {
+        UnicodeString FileName = LocalFiles->Strings[Index];
+        __int64 Size = 16 * 1024 + 1;
+        BenchmarkWriteFile(FileName, Size);
+        FileSetDate(ApiPath(FileName), Age);
+        ChangedFiles++;
+        ChangedBytes += Size;
+      }
+
+      Start = GetTickCount();
+      const int SynchronizeParams = TTerminal::spNoConfirmation;
+      std::unique_ptr<TSynchronizeChecklist> Checklist(
+        Terminal->SynchronizeCollect(LocalData, Remote, TTerminal::smRemote,
+          &CopyParam, SynchronizeParams, NULL, NULL));
+      Terminal->SynchronizeApply(Checklist.get(), LocalData, Remote,
+        &CopyParam, SynchronizeParams, NULL);
+      AddToList(Steps, StepToJson(L"synchronize", GetTickCount() - Start, ChangedFiles, ChangedBytes), L",");
+
+      // the changed files do not match the data of the next run
+      DeleteFile(ApiPath(LocalData + L".complete"));
+    }
+    else
+    {
+      UnicodeString Download = IncludeTrailingBackslash(FLocalPath) + L"download";
+      if (DirectoryExists(ApiPath(Download)))
+      {
+        RecursiveDeleteFileChecked(Download, false);
+      }
+      THROWOSIFFALSE(ForceDirectories(ApiPath(Download)));
+
+      TRemoteFile * File = Terminal->ReadFileListing(Remote);
+      try
+      {
+        FileList->Clear();
+        FileList->AddObject(Remote, File);
+        Start = GetTickCount();
+        Terminal->CopyToLocal(FileList.get(), IncludeTrailingBackslash(Download), &CopyParam, cpNoConfirmation);
+        AddToList(Steps, StepToJson(L"download", GetTickCount() - Start, Files, Bytes), L",");
+      }
+      __finally
+      {
+        delete File;
+      }
+
+      RecursiveDeleteFileChecked(Download, false);
+    }
+
+    DeleteRemoteFile(Terminal.get(), Remote);
+
+    AddToList(FResults,
+      FORMAT(L"{\"protocol\":\"%s\",\"workload\":\"%s\",\"steps\":[%s],\"metrics\":%s}",
+        (Data->FSProtocolStr, Workload, Steps, Terminal->Metrics->ToJson())),
+      L",");
+  }
+  __finally
+  {
+    if (Terminal->Active)
+    {
+      Terminal->Close();
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TBenchmark::Run(TStrings * Urls, TStrings * Workloads)
+{
+  for (int UrlIndex = 0; UrlIndex < Urls->Count; UrlIndex++)
+  {
+    for (int Index = 0; Index < Workloads->Count; Index++)
+    {
+      RunWorkload(Urls->Strings[UrlIndex], Workloads->Strings[Index]);
+    }
+  }
+}
+//---------------------------------------------------------------------------
+UnicodeString __fastcall TBenchmark::ToJson()
+{
+  return
+    FORMAT(L"{\"timestamp\":\"%s\",\"version\":\"%s\",\"latencyMs\":%d,\"bandwidthKBps\":%d,\"results\":[%s]}",
+      (FormatDateTime(L"yyyy'-'mm'-'dd'T'hh':'nn':'ss", Now()), Configuration->Version,
+       FLatency, FBandwidth, FResults));
+}
+//---------------------------------------------------------------------------
+int __fastcall Benchmark(TConsole * Console, TProgramParams * Params)
+{
+  int Result = RESULT_SUCCESS;
+  try
+  {
+    std::unique_ptr<TStrings> Urls(new TStringList());
+    if (!Params->FindSwitch(L"benchmark", Urls.get()) ||
+        (Urls->Count < 1))
+    {
+      throw Exception(L"Specify URLs of servers to run the benchmark against.");
+    }
+
+    std::unique_ptr<TStrings> Workloads(new TStringList());
+    Workloads->CommaText =
+      LowerCase(Params->SwitchValue(L"workload",
+        FORMAT(L"%s,%s,%s,%s", (BenchmarkHuge, BenchmarkTiny, BenchmarkDeep, BenchmarkSync))));
+    for (int Index = 0; Index < Workloads->Count; Index++)
+    {
+      UnicodeString Workload = Workloads->Strings[Index];
+      if ((Workload != BenchmarkHuge) && (Workload != BenchmarkTiny) &&
+          (Workload != BenchmarkDeep) && (Workload != BenchmarkSync))
+      {
+        throw Exception(FORMAT(L"Unknown workload \"%s\".", (Workload)));
+      }
+    }
+
+    UnicodeString LogFile;
+    if (Params->FindSwitch(LOG_SWITCH, LogFile))
+    {
+      Configuration->TemporaryLogging(LogFile);
+    }
+
+    TBenchmark Benchmark(Console, Params);
+    Benchmark.Run(Urls.get(), Workloads.get());
+
+    UnicodeString Json = Benchmark.ToJson();
+    UnicodeString OutputFileName;
+    if (Params->FindSwitch(L"output", OutputFileName) && !OutputFileName.IsEmpty())
+    {
+      UTF8String Utf8(Json);
+      std::unique_ptr<TFileStream> Stream(new TFileStream(ApiPath(OutputFileName), fmCreate));
+      Stream->WriteBuffer(Utf8.c_str(), Utf8.Length());
+    }
+    else
+    {
+      ConsolePrintLine(Console, Json);
+    }
+  }
+  catch (Exception & E)
+  {
+    UnicodeString Message;
+    if (ExceptionMessage(&E, Message))
+    {
+      ConsolePrintLine(Console, Message);
+      ExtException * EE = dynamic_cast<ExtException *>(&E);
+      if ((EE != NULL) && (EE->MoreMessages != NULL))
+      {
+        ConsolePrintLine(Console, EE->MoreMessages->Text);
+      }
+    }
+    Result = RESULT_ANY_ERROR;
+  }
+
+  Console->WaitBeforeExit();
+  return Result;
+}
+//---------------------------------------------------------------------------
 int __fastcall Console(TConsoleMode Mode)
 {
   DebugAssert(Mode != cmNone);
@@ -2447,6 +3383,14 @@ int __fastcall Console(TConsoleMode Mode)
         Result = KeyGen(Console, Params);
       }
     }
+    else if (Mode == cmBenchmark)
+    {
+      if (CheckSafe(Params))
+      {
+        Configuration->Usage->Inc(L"Benchmark");
+        Result = Benchmark(Console, Params);
+      }
+    }
     else
     {
       Runner = new TConsoleRunner(Console);
@@ -2493,6 +3437,16 @@ int __fastcall Console(TConsoleMode Mode)
           Configuration->TemporaryLogging(LogFile);
         }
         CheckXmlLogParam(Params);
+        if (Console->WantsActionLog())
+        {
+          // The log is streamed over the console connection,
+          // the /xmllog file is produced only if explicitly asked for.
+          if (!Configuration->LogActions)
+          {
+            Configuration->TemporaryActionsLogging(L"");
+          }
+          Configuration->OnActionsLog = Console->ActionLog;
+        }
 
         Result = Runner->Run(Session, Params,
           (ScriptCommands->Count > 0 ? ScriptCommands : NULL),
@@ -2508,6 +3462,7 @@ int __fastcall Console(TConsoleMode Mode)
   __finally
   {
     delete Runner;
+    Configuration->OnActionsLog = NULL;
     delete Console;
     delete ScriptCommands;
     delete ScriptParameters;
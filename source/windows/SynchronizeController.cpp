@@ -6,6 +6,7 @@
 #include <RemoteFiles.h>
 #include <Terminal.h>
 #include <DiscMon.hpp>
+#include <ExtCtrls.hpp>
 #include <Exceptions.h>
 #include "GUIConfiguration.h"
 #include "CoreMain.h"
@@ -25,11 +26,16 @@ __fastcall TSynchronizeController::TSynchronizeController(
   FSynchronizeAbort = NULL;
   FSynchronizeLog = NULL;
   FOptions = NULL;
+  FChangeTimer = NULL;
+  FPendingChanges = CreateSortedStringList();
+  FFirstPendingChange = 0;
 }
 //---------------------------------------------------------------------------
 __fastcall TSynchronizeController::~TSynchronizeController()
 {
   DebugAssert(FSynchronizeMonitor == NULL);
+  DebugAssert(FChangeTimer == NULL);
+  delete FPendingChanges;
 }
 //---------------------------------------------------------------------------
 void __fastcall TSynchronizeController::StartStop(TObject * Sender,
@@ -68,6 +74,11 @@ void __fastcall TSynchronizeController::StartStop(TObject * Sender,
           FMTLOAD(SYNCHRONIZE_SCAN, (FSynchronizeParams.LocalDirectory)));
       }
 
+      FChangeTimer = new TTimer(dynamic_cast<TComponent*>(Sender));
+      FChangeTimer->Enabled = false;
+      FChangeTimer->Interval = GUIConfiguration->KeepUpToDateChangeDelay;
+      FChangeTimer->OnTimer = SynchronizeChangeTimer;
+
       FSynchronizeMonitor = new TDiscMonitor(dynamic_cast<TComponent*>(Sender));
       FSynchronizeMonitor->SubTree = false;
       TMonitorFilters Filters;
@@ -96,6 +107,7 @@ void __fastcall TSynchronizeController::StartStop(TObject * Sender,
     catch(...)
     {
       SAFE_DESTROY(FSynchronizeMonitor);
+      SAFE_DESTROY(FChangeTimer);
       throw;
     }
   }
@@ -103,6 +115,9 @@ void __fastcall TSynchronizeController::StartStop(TObject * Sender,
   {
     FOptions = NULL;
     SAFE_DESTROY(FSynchronizeMonitor);
+    SAFE_DESTROY(FChangeTimer);
+    FPendingChanges->Clear();
+    FSnapshots.clear();
   }
 }
 //---------------------------------------------------------------------------
@@ -111,74 +126,261 @@ void __fastcall TSynchronizeController::SynchronizeChange(
 {
   try
   {
-    UnicodeString RemoteDirectory;
-    UnicodeString RootLocalDirectory;
-    RootLocalDirectory = IncludeTrailingBackslash(FSynchronizeParams.LocalDirectory);
-    RemoteDirectory = UnixIncludeTrailingBackslash(FSynchronizeParams.RemoteDirectory);
-
     UnicodeString LocalDirectory = IncludeTrailingBackslash(Directory);
 
-    DebugAssert(LocalDirectory.SubString(1, RootLocalDirectory.Length()) ==
-      RootLocalDirectory);
-    RemoteDirectory = RemoteDirectory +
-      ToUnixPath(LocalDirectory.SubString(RootLocalDirectory.Length() + 1,
-        LocalDirectory.Length() - RootLocalDirectory.Length()));
+    TSnapshots::iterator Previous = FSnapshots.find(LocalDirectory);
+    if (Previous == FSnapshots.end())
+    {
+      // First change in the directory, synchronize it as a whole.
+      // The snapshot is taken before the synchronization,
+      // so that changes made meanwhile are not missed.
+      TSnapshot Snapshot;
+      bool Exists = ReadSnapshot(LocalDirectory, Snapshot);
+      SynchronizeDirectory(LocalDirectory, NULL, &SubdirsChanged);
+      if (Exists)
+      {
+        FSnapshots[LocalDirectory] = Snapshot;
+      }
+    }
+    else
+    {
+      // Only tell the monitor, if it needs to rescan the subdirectories,
+      // the synchronization itself is postponed until the changes settle down
+      TSnapshot Current;
+      ReadSnapshot(LocalDirectory, Current);
+      std::unique_ptr<TStrings> ChangedFiles(new TStringList());
+      CompareSnapshots(Previous->second, Current, ChangedFiles.get(), SubdirsChanged);
+
+      if (FPendingChanges->Count == 0)
+      {
+        FFirstPendingChange = GetTickCount();
+      }
+      FPendingChanges->Add(LocalDirectory);
+
+      // Restart the timer with every change (debounce),
+      // but do not let a continuous writer postpone the synchronization forever
+      unsigned int MaxDelay = 10 * FChangeTimer->Interval;
+      if (GetTickCount() - FFirstPendingChange < MaxDelay)
+      {
+        FChangeTimer->Enabled = false;
+      }
+      FChangeTimer->Enabled = true;
+    }
+  }
+  catch(Exception & E)
+  {
+    SynchronizeAbort(dynamic_cast<EFatal*>(&E) != NULL);
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSynchronizeController::SynchronizeChangeTimer(TObject * /*Sender*/)
+{
+  FChangeTimer->Enabled = false;
+  try
+  {
+    SynchronizePendingChanges();
+  }
+  catch(Exception & E)
+  {
+    SynchronizeAbort(dynamic_cast<EFatal*>(&E) != NULL);
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSynchronizeController::SynchronizePendingChanges()
+{
+  // all changes coalesced since the last batch
+  std::unique_ptr<TStringList> Directories(new TStringList());
+  Directories->Assign(FPendingChanges);
+  FPendingChanges->Clear();
+
+  for (int Index = 0; Index < Directories->Count; Index++)
+  {
+    UnicodeString LocalDirectory = Directories->Strings[Index];
+    TSnapshots::iterator Previous = FSnapshots.find(LocalDirectory);
+    if (DebugAlwaysTrue(Previous != FSnapshots.end()))
+    {
+      TSnapshot Current;
+      if (!ReadSnapshot(LocalDirectory, Current))
+      {
+        // the directory was removed, the change is handled with its parent
+        FSnapshots.erase(Previous);
+      }
+      else
+      {
+        std::unique_ptr<TStrings> ChangedFiles(CreateSortedStringList());
+        bool SubdirsChanged;
+        CompareSnapshots(Previous->second, Current, ChangedFiles.get(), SubdirsChanged);
+        if (ChangedFiles->Count > 0)
+        {
+          // if the synchronization fails, do a full synchronization
+          // of the directory on the next change
+          FSnapshots.erase(Previous);
+          SynchronizeDirectory(LocalDirectory, ChangedFiles.get(), NULL);
+          FSnapshots[LocalDirectory] = Current;
+        }
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSynchronizeController::SynchronizeDirectory(
+  const UnicodeString & LocalDirectory, TStrings * ChangedFiles, bool * SubdirsChanged)
+{
+  UnicodeString RemoteDirectory;
+  UnicodeString RootLocalDirectory;
+  RootLocalDirectory = IncludeTrailingBackslash(FSynchronizeParams.LocalDirectory);
+  RemoteDirectory = UnixIncludeTrailingBackslash(FSynchronizeParams.RemoteDirectory);
+
+  DebugAssert(LocalDirectory.SubString(1, RootLocalDirectory.Length()) ==
+    RootLocalDirectory);
+  RemoteDirectory = RemoteDirectory +
+    ToUnixPath(LocalDirectory.SubString(RootLocalDirectory.Length() + 1,
+      LocalDirectory.Length() - RootLocalDirectory.Length()));
 
-    SynchronizeLog(slChange, FMTLOAD(SYNCHRONIZE_CHANGE,
-      (ExcludeTrailingBackslash(LocalDirectory))));
+  SynchronizeLog(slChange, FMTLOAD(SYNCHRONIZE_CHANGE,
+    (ExcludeTrailingBackslash(LocalDirectory))));
 
-    if (FOnSynchronize != NULL)
+  if (FOnSynchronize != NULL)
+  {
+    // this is completelly wrong as the options structure
+    // can contain non-root specific options in future
+    TSynchronizeOptions * Options =
+      ((LocalDirectory == RootLocalDirectory) ? FOptions : NULL);
+    // restrict the synchronization to the changed files only
+    TSynchronizeOptions ChangedOptions;
+    if (ChangedFiles != NULL)
+    {
+      ChangedOptions.Filter = CreateSortedStringList();
+      for (int Index = 0; Index < ChangedFiles->Count; Index++)
+      {
+        UnicodeString FileName = ChangedFiles->Strings[Index];
+        if ((Options == NULL) || Options->MatchesFilter(FileName))
+        {
+          ChangedOptions.Filter->Add(FileName);
+        }
+      }
+      Options = &ChangedOptions;
+    }
+
+    TSynchronizeChecklist * Checklist = NULL;
+    FOnSynchronize(this, LocalDirectory, RemoteDirectory, FCopyParam,
+      FSynchronizeParams, &Checklist, Options, false);
+    if (Checklist != NULL)
     {
-      // this is completelly wrong as the options structure
-      // can contain non-root specific options in future
-      TSynchronizeOptions * Options =
-        ((LocalDirectory == RootLocalDirectory) ? FOptions : NULL);
-      TSynchronizeChecklist * Checklist = NULL;
-      FOnSynchronize(this, LocalDirectory, RemoteDirectory, FCopyParam,
-        FSynchronizeParams, &Checklist, Options, false);
-      if (Checklist != NULL)
+      try
       {
-        try
+        if (SubdirsChanged == NULL)
+        {
+          // noop
+        }
+        else if (FLAGSET(FSynchronizeParams.Options, soRecurse))
         {
-          if (FLAGSET(FSynchronizeParams.Options, soRecurse))
+          *SubdirsChanged = false;
+          DebugAssert(Checklist != NULL);
+          for (int Index = 0; Index < Checklist->Count; Index++)
           {
-            SubdirsChanged = false;
-            DebugAssert(Checklist != NULL);
-            for (int Index = 0; Index < Checklist->Count; Index++)
+            const TSynchronizeChecklist::TItem * Item = Checklist->Item[Index];
+            // note that there may be action saDeleteRemote even if nothing has changed
+            // so this is sub-optimal
+            if (Item->IsDirectory)
             {
-              const TSynchronizeChecklist::TItem * Item = Checklist->Item[Index];
-              // note that there may be action saDeleteRemote even if nothing has changed
-              // so this is sub-optimal
-              if (Item->IsDirectory)
+              if ((Item->Action == TSynchronizeChecklist::saUploadNew) ||
+                  (Item->Action == TSynchronizeChecklist::saDeleteRemote))
+              {
+                *SubdirsChanged = true;
+                break;
+              }
+              else
               {
-                if ((Item->Action == TSynchronizeChecklist::saUploadNew) ||
-                    (Item->Action == TSynchronizeChecklist::saDeleteRemote))
-                {
-                  SubdirsChanged = true;
-                  break;
-                }
-                else
-                {
-                  DebugFail();
-                }
+                DebugFail();
               }
             }
           }
-          else
-          {
-            SubdirsChanged = false;
-          }
         }
-        __finally
+        else
         {
-          delete Checklist;
+          *SubdirsChanged = false;
         }
       }
+      __finally
+      {
+        delete Checklist;
+      }
     }
   }
-  catch(Exception & E)
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSynchronizeController::ReadSnapshot(
+  const UnicodeString & Directory, TSnapshot & Snapshot)
+{
+  TSearchRecChecked SearchRec;
+  int FindAttrs = faReadOnly | faHidden | faSysFile | faDirectory | faArchive;
+  bool Result = (FindFirstUnchecked(IncludeTrailingBackslash(Directory) + L"*.*", FindAttrs, SearchRec) == 0);
+  if (Result)
   {
-    SynchronizeAbort(dynamic_cast<EFatal*>(&E) != NULL);
+    try
+    {
+      do
+      {
+        if ((SearchRec.Name != L".") && (SearchRec.Name != L".."))
+        {
+          TSnapshotEntry Entry;
+          Entry.IsDirectory = FLAGSET(SearchRec.Attr, faDirectory);
+          Entry.Size =
+            (static_cast<__int64>(SearchRec.FindData.nFileSizeHigh) << 32) +
+            SearchRec.FindData.nFileSizeLow;
+          Entry.LastWriteTime =
+            (static_cast<__int64>(SearchRec.FindData.ftLastWriteTime.dwHighDateTime) << 32) +
+            SearchRec.FindData.ftLastWriteTime.dwLowDateTime;
+          Snapshot[SearchRec.Name] = Entry;
+        }
+      }
+      while (FindNextChecked(SearchRec) == 0);
+    }
+    __finally
+    {
+      FindClose(SearchRec);
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSynchronizeController::CompareSnapshots(
+  const TSnapshot & Previous, const TSnapshot & Current,
+  TStrings * ChangedFiles, bool & SubdirsChanged)
+{
+  SubdirsChanged = false;
+
+  // new and modified files
+  for (TSnapshot::const_iterator I = Current.begin(); I != Current.end(); I++)
+  {
+    TSnapshot::const_iterator P = Previous.find(I->first);
+    if (P == Previous.end())
+    {
+      ChangedFiles->Add(I->first);
+      SubdirsChanged = SubdirsChanged || I->second.IsDirectory;
+    }
+    else if (P->second.IsDirectory != I->second.IsDirectory)
+    {
+      ChangedFiles->Add(I->first);
+      SubdirsChanged = true;
+    }
+    else if (!I->second.IsDirectory &&
+             ((P->second.Size != I->second.Size) ||
+              (P->second.LastWriteTime != I->second.LastWriteTime)))
+    {
+      ChangedFiles->Add(I->first);
+    }
+  }
+
+  // deleted files
+  for (TSnapshot::const_iterator P = Previous.begin(); P != Previous.end(); P++)
+  {
+    if (Current.find(P->first) == Current.end())
+    {
+      ChangedFiles->Add(P->first);
+      SubdirsChanged = SubdirsChanged || P->second.IsDirectory;
+    }
   }
 }
 //---------------------------------------------------------------------------
@@ -3,6 +3,7 @@
 #define SynchronizeControllerH
 //---------------------------------------------------------------------------
 #include <CopyParam.h>
+#include <map>
 //---------------------------------------------------------------------------
 struct TSynchronizeParamType
 {
@@ -41,6 +42,10 @@ namespace Discmon
 {
 class TDiscMonitor;
 }
+namespace Extctrls
+{
+class TTimer;
+}
 //---------------------------------------------------------------------------
 enum TSynchronizeOperation { soUpload, soDelete };
 //---------------------------------------------------------------------------
@@ -71,8 +76,29 @@ private:
   TSynchronizeLog FSynchronizeLog;
   TCopyParamType FCopyParam;
 
+  struct TSnapshotEntry
+  {
+    bool IsDirectory;
+    __int64 Size;
+    __int64 LastWriteTime;
+  };
+  typedef std::map<UnicodeString, TSnapshotEntry> TSnapshot;
+  typedef std::map<UnicodeString, TSnapshot> TSnapshots;
+  // last synchronized state of local directories, to find changed files
+  TSnapshots FSnapshots;
+  TStringList * FPendingChanges;
+  unsigned int FFirstPendingChange;
+  Extctrls::TTimer * FChangeTimer;
+
   void __fastcall SynchronizeChange(TObject * Sender, const UnicodeString Directory,
     bool & SubdirsChanged);
+  void __fastcall SynchronizeChangeTimer(TObject * Sender);
+  void __fastcall SynchronizePendingChanges();
+  void __fastcall SynchronizeDirectory(const UnicodeString & LocalDirectory,
+    TStrings * ChangedFiles, bool * SubdirsChanged);
+  static bool __fastcall ReadSnapshot(const UnicodeString & Directory, TSnapshot & Snapshot);
+  static void __fastcall CompareSnapshots(const TSnapshot & Previous, const TSnapshot & Current,
+    TStrings * ChangedFiles, bool & SubdirsChanged);
   void __fastcall SynchronizeAbort(bool Close);
   void __fastcall SynchronizeLog(TSynchronizeLogEntry Entry, const UnicodeString Message);
   void __fastcall SynchronizeInvalid(TObject * Sender, const UnicodeString Directory,
@@ -600,6 +600,39 @@ int __fastcall Execute()
   CreateMutex(NULL, False, AppName.c_str());
   bool OnlyInstance = (GetLastError() == 0);
 
+  TConsoleMode Mode = cmNone;
+  if (Params->FindSwitch(L"help") || Params->FindSwitch(L"h") || Params->FindSwitch(L"?"))
+  {
+    Mode = cmHelp;
+  }
+  else if (Params->FindSwitch(L"batchsettings"))
+  {
+    Mode = cmBatchSettings;
+  }
+  else if (Params->FindSwitch(KEYGEN_SWITCH))
+  {
+    Mode = cmKeyGen;
+  }
+  else if (Params->FindSwitch(L"benchmark"))
+  {
+    Mode = cmBenchmark;
+  }
+  // We have to check for /console only after the other options,
+  // as the /console is always used when we are run by winscp.com
+  // (ambiguous use to pass console version)
+  else if (Params->FindSwitch(L"Console") || Params->FindSwitch(L"script") ||
+      Params->FindSwitch(COMMAND_SWITCH))
+  {
+    Mode = cmScripting;
+  }
+
+  if (Mode == cmNone)
+  {
+    // The console modes load only the stored sites they use (see CoreLoad),
+    // the GUI works with all of them
+    StoredSessions->LoadPending();
+  }
+
   UpdateStaticUsage();
 
   UnicodeString KeyFile;
@@ -648,28 +681,6 @@ int __fastcall Execute()
     }
   }
 
-  TConsoleMode Mode = cmNone;
-  if (Params->FindSwitch(L"help") || Params->FindSwitch(L"h") || Params->FindSwitch(L"?"))
-  {
-    Mode = cmHelp;
-  }
-  else if (Params->FindSwitch(L"batchsettings"))
-  {
-    Mode = cmBatchSettings;
-  }
-  else if (Params->FindSwitch(KEYGEN_SWITCH))
-  {
-    Mode = cmKeyGen;
-  }
-  // We have to check for /console only after the other options,
-  // as the /console is always used when we are run by winscp.com
-  // (ambiguous use to pass console version)
-  else if (Params->FindSwitch(L"Console") || Params->FindSwitch(L"script") ||
-      Params->FindSwitch(COMMAND_SWITCH))
-  {
-    Mode = cmScripting;
-  }
-
   if (Mode != cmNone)
   {
     return Console(Mode);